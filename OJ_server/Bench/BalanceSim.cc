@@ -0,0 +1,719 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <queue>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <getopt.h>
+
+#include <jsoncpp/json/json.h>
+
+#include "../OJ_Server/OJ_balance.hpp"
+#include "Submission.hpp"
+
+using namespace ns_OJ_balance;
+using ns_Submission::Percentile;
+
+// 负载均衡的离散事件模拟器
+// 线上的LoadBlance（选择策略、离线、重新上线）原样使用，只是主机换成模拟的主机，时钟换成模拟的时钟
+// 模拟的主机：
+//  有若干个核，正在处理的请求平分这些核（请求数不超过核数的时候每个请求独占一个核），和CompileServer上多个g++同时跑一样
+//  每个请求的工作量（单核上需要的毫秒数）来自服务时间的分布，或者录下来的到达记录
+//  可以安排故障（这段时间内连接失败，正在处理的请求全部失败）和变慢（这段时间内处理速度除以一个倍数）
+// 请求的处理和OJ_Server的Dispatch一样：选主机、增加负载，失败的话减少负载、离线这台主机、重新选择
+// 同样的参数和种子，每次的结果都一样；所有策略使用同一批请求
+// ./BalanceSim --hosts=4,4,8 --rate=30 --duration=600 --fail=1@120-180 --slow=2@300-360x4，--help查看所有参数
+
+struct Options
+{
+    std::string hosts = "4,4,4";
+    std::string service = "lognormal:400:0.6";
+    double rate = 20;       // 每秒到达的请求数
+    double duration = 600;  // 秒
+    std::string trace;
+    std::string fail;
+    std::string slow;
+    std::string policies;
+    int recoverMs = 5000;
+    double connectFailMs = 1;
+    uint32_t seed = 1;
+    bool verbose = false;
+    std::string out;
+};
+
+// 一个请求：到达的时间和工作量，毫秒
+struct SimRequest
+{
+    double arrivalMs;
+    double workMs;
+};
+
+// 一段故障或者变慢，factor为0表示故障
+struct Episode
+{
+    int host;
+    double startMs;
+    double endMs;
+    double factor;
+};
+
+static void Usage(const char *proc)
+{
+    std::cerr << "Usage: " << proc << " [options]\n"
+              << "  --hosts=4,4,8           每台模拟主机的核数，同时作为主机的权重，默认4,4,4\n"
+              << "  --service=DIST          单核上的服务时间，毫秒：const:X、exp:MEAN、uniform:A:B、lognormal:MEDIAN:SIGMA，默认lognormal:400:0.6\n"
+              << "  --rate=R                每秒到达的请求数，默认20\n"
+              << "  --duration=S            产生请求的秒数，默认600\n"
+              << "  --trace=FILE            使用录下来的请求，每行为：到达时间ms [服务时间ms]，没有服务时间的按--service产生\n"
+              << "  --fail=H@A-B,...        主机H在第A秒到第B秒故障\n"
+              << "  --slow=H@A-BxF,...      主机H在第A秒到第B秒的处理速度变为1/F\n"
+              << "  --policies=P1,P2        比较的策略，默认所有策略\n"
+              << "  --recover-ms=N          离线的主机多少毫秒之后重新尝试，默认5000，0表示不再上线\n"
+              << "  --connect-fail-ms=N     向故障的主机发请求，多久之后发现失败，默认1\n"
+              << "  --seed=N                随机数种子，默认1\n"
+              << "  --verbose               保留LoadBlance的日志\n"
+              << "  --out=FILE              把结果保存为json\n";
+}
+
+static bool ParseOptions(int argc, char *argv[], Options *options)
+{
+    static struct option longOptions[] = {
+        {"hosts", required_argument, nullptr, 'H'},
+        {"service", required_argument, nullptr, 's'},
+        {"rate", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"trace", required_argument, nullptr, 't'},
+        {"fail", required_argument, nullptr, 'f'},
+        {"slow", required_argument, nullptr, 'w'},
+        {"policies", required_argument, nullptr, 'p'},
+        {"recover-ms", required_argument, nullptr, 'R'},
+        {"connect-fail-ms", required_argument, nullptr, 'c'},
+        {"seed", required_argument, nullptr, 'S'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"out", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            options->hosts = optarg;
+            break;
+        case 's':
+            options->service = optarg;
+            break;
+        case 'r':
+            options->rate = atof(optarg);
+            break;
+        case 'd':
+            options->duration = atof(optarg);
+            break;
+        case 't':
+            options->trace = optarg;
+            break;
+        case 'f':
+            options->fail = optarg;
+            break;
+        case 'w':
+            options->slow = optarg;
+            break;
+        case 'p':
+            options->policies = optarg;
+            break;
+        case 'R':
+            options->recoverMs = atoi(optarg);
+            break;
+        case 'c':
+            options->connectFailMs = atof(optarg);
+            break;
+        case 'S':
+            options->seed = atoi(optarg);
+            break;
+        case 'v':
+            options->verbose = true;
+            break;
+        case 'o':
+            options->out = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+    return options->rate > 0 && options->duration > 0 && options->recoverMs >= 0 && options->connectFailMs >= 0;
+}
+
+// 服务时间的分布
+class ServiceTime
+{
+private:
+    std::string _kind;
+    double _a;
+    double _b;
+
+public:
+    bool Parse(const std::string &spec)
+    {
+        std::vector<std::string> items;
+        StringUtil::SplitString(spec, &items, ":");
+        if (items.size() < 2)
+            return false;
+        _kind = items[0];
+        _a = atof(items[1].c_str());
+        _b = items.size() > 2 ? atof(items[2].c_str()) : 0;
+        if (_kind == "const" || _kind == "exp")
+            return items.size() == 2 && _a > 0;
+        if (_kind == "uniform")
+            return items.size() == 3 && _a >= 0 && _b > _a;
+        if (_kind == "lognormal")
+            return items.size() == 3 && _a > 0 && _b >= 0;
+        return false;
+    }
+
+    double Next(std::mt19937 &engine) const
+    {
+        if (_kind == "exp")
+            return std::exponential_distribution<double>(1 / _a)(engine);
+        if (_kind == "uniform")
+            return std::uniform_real_distribution<double>(_a, _b)(engine);
+        if (_kind == "lognormal")
+            return std::lognormal_distribution<double>(std::log(_a), _b)(engine);
+        return _a;
+    }
+};
+
+static bool LoadRequests(const Options &options, const ServiceTime &service, std::vector<SimRequest> *requests)
+{
+    std::mt19937 engine(options.seed);
+    if (options.trace.empty())
+    {
+        // 泊松到达
+        std::exponential_distribution<double> gap(options.rate / 1000);
+        double now = 0;
+        while ((now += gap(engine)) < options.duration * 1000)
+            requests->push_back(SimRequest{now, service.Next(engine)});
+        return true;
+    }
+
+    std::ifstream in(options.trace);
+    if (!in.is_open())
+    {
+        std::cerr << "打开请求记录失败：" << options.trace << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        SimRequest request;
+        if (!(fields >> request.arrivalMs))
+            continue;
+        if (!(fields >> request.workMs))
+            request.workMs = service.Next(engine);
+        requests->push_back(request);
+    }
+    std::stable_sort(requests->begin(), requests->end(), [](const SimRequest &a, const SimRequest &b)
+                     { return a.arrivalMs < b.arrivalMs; });
+    return !requests->empty();
+}
+
+// H@A-B 或者 H@A-BxF，时间为秒
+static bool ParseEpisodes(const std::string &spec, bool isSlow, size_t hostCount, std::vector<Episode> *episodes)
+{
+    std::vector<std::string> items;
+    StringUtil::SplitString(spec, &items, ",");
+    for (const auto &item : items)
+    {
+        if (item.empty())
+            continue;
+        Episode episode;
+        double start = 0, end = 0;
+        episode.factor = 0;
+        int matched = isSlow ? sscanf(item.c_str(), "%d@%lf-%lfx%lf", &episode.host, &start, &end, &episode.factor)
+                             : sscanf(item.c_str(), "%d@%lf-%lf", &episode.host, &start, &end);
+        if (matched != (isSlow ? 4 : 3) || episode.host < 0 || static_cast<size_t>(episode.host) >= hostCount ||
+            end <= start || (isSlow && episode.factor <= 0))
+        {
+            std::cerr << "格式不正确：" << item << std::endl;
+            return false;
+        }
+        episode.startMs = start * 1000;
+        episode.endMs = end * 1000;
+        episodes->push_back(episode);
+    }
+    return true;
+}
+
+// 模拟的主机
+struct SimHost
+{
+    struct Job
+    {
+        int request;
+        double remaining; // 剩下的工作量，毫秒
+    };
+
+    int cores;
+    bool down;
+    double slow;
+    std::vector<Job> active;
+    double lastUpdate;
+    uint64_t version; // 每次重新安排完成事件加一，旧的完成事件作废
+
+    // 统计
+    double busyCoreMs;
+    double downMs;
+    double downSince;
+    double offlineMs; // LoadBlance认为它离线的时间
+    double offlineSince;
+    bool offline;
+    uint64_t chosen;
+    uint64_t completed;
+    uint64_t failed;
+    uint64_t offlines;
+
+    explicit SimHost(int cores)
+        : cores(cores), down(false), slow(1), lastUpdate(0), version(0), busyCoreMs(0), downMs(0), downSince(0),
+          offlineMs(0), offlineSince(0), offline(false), chosen(0), completed(0), failed(0), offlines(0)
+    {
+    }
+
+    // 每个请求的处理速度
+    double Share() const
+    {
+        return std::min(1.0, static_cast<double>(cores) / active.size()) / slow;
+    }
+
+    void Advance(double now)
+    {
+        double elapsed = now - lastUpdate;
+        lastUpdate = now;
+        if (active.empty() || elapsed <= 0)
+            return;
+        double share = Share();
+        for (auto &job : active)
+            job.remaining -= elapsed * share;
+        busyCoreMs += elapsed * std::min<double>(active.size(), cores);
+    }
+
+    // 下一个请求完成的时间，没有请求返回负数
+    double NextFinish(double now) const
+    {
+        if (active.empty())
+            return -1;
+        double minRemaining = active[0].remaining;
+        for (const auto &job : active)
+            minRemaining = std::min(minRemaining, job.remaining);
+        return now + std::max(0.0, minRemaining) / Share();
+    }
+};
+
+enum EventType
+{
+    EventArrival,
+    EventFinish,
+    EventFailure, // 发现请求失败
+    EventEpisodeStart,
+    EventEpisodeEnd
+};
+
+struct Event
+{
+    double time;
+    uint64_t seq; // 同一时刻的事件按产生的顺序处理，保证结果确定
+    EventType type;
+    int a;
+    int b;
+    uint64_t version;
+
+    bool operator>(const Event &other) const
+    {
+        return time != other.time ? time > other.time : seq > other.seq;
+    }
+};
+
+// 一次模拟，对应一个策略
+class Simulation
+{
+private:
+    const Options &_options;
+    const std::vector<SimRequest> &_requests;
+    const std::vector<Episode> &_episodes;
+
+    LoadBlance _balance;
+    std::vector<SimHost> _hosts;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> _events;
+    uint64_t _seq;
+    double _now;
+
+    std::vector<int> _attempts;      // 每个请求失败的次数
+    std::vector<double> _latencies;  // 完成的请求的延迟
+    std::vector<double> _affected;   // 经历过失败的请求的延迟
+    uint64_t _rejected;              // 没有在线的主机，请求直接失败
+    uint64_t _failovers;
+
+public:
+    Simulation(const Options &options, const std::vector<int> &cores, const std::vector<SimRequest> &requests,
+               const std::vector<Episode> &episodes, std::unique_ptr<BalancePolicy> policy)
+        : _options(options), _requests(requests), _episodes(episodes), _seq(0), _now(0),
+          _attempts(requests.size(), 0), _rejected(0), _failovers(0)
+    {
+        _balance.SetPolicy(std::move(policy));
+        _balance.SetRecoverAfter(options.recoverMs);
+        _balance.SetClock([this]()
+                          { return static_cast<uint64_t>(_now); });
+        for (size_t i = 0; i < cores.size(); i++)
+        {
+            _balance.AddMachine("sim" + std::to_string(i), 8081 + i, cores[i], nullptr);
+            _hosts.emplace_back(cores[i]);
+        }
+    }
+
+    void Run()
+    {
+        for (size_t i = 0; i < _requests.size(); i++)
+            Push(_requests[i].arrivalMs, EventArrival, i);
+        for (size_t i = 0; i < _episodes.size(); i++)
+        {
+            Push(_episodes[i].startMs, EventEpisodeStart, i);
+            Push(_episodes[i].endMs, EventEpisodeEnd, i);
+        }
+
+        while (!_events.empty())
+        {
+            Event event = _events.top();
+            _events.pop();
+            _now = event.time;
+            switch (event.type)
+            {
+            case EventArrival:
+                Dispatch(event.a);
+                break;
+            case EventFinish:
+                Finish(event.a, event.version);
+                break;
+            case EventFailure:
+                Failure(event.a, event.b);
+                break;
+            case EventEpisodeStart:
+                EpisodeStart(_episodes[event.a]);
+                break;
+            case EventEpisodeEnd:
+                EpisodeEnd(_episodes[event.a]);
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < _hosts.size(); i++)
+        {
+            _hosts[i].Advance(_now);
+            if (_hosts[i].down)
+                _hosts[i].downMs += _now - _hosts[i].downSince;
+            if (_hosts[i].offline)
+                _hosts[i].offlineMs += _now - _hosts[i].offlineSince;
+        }
+    }
+
+    Json::Value Report()
+    {
+        Json::Value result;
+        result["Policy"] = _balance.PolicyName();
+        result["Requests"] = static_cast<Json::UInt64>(_requests.size());
+        result["Completed"] = static_cast<Json::UInt64>(_latencies.size());
+        result["Rejected"] = static_cast<Json::UInt64>(_rejected);
+        result["Failovers"] = static_cast<Json::UInt64>(_failovers);
+        result["AffectedRequests"] = static_cast<Json::UInt64>(_affected.size());
+        result["MakespanSec"] = _now / 1000;
+
+        double sum = 0;
+        for (double latency : _latencies)
+            sum += latency;
+        result["MeanMs"] = _latencies.empty() ? 0.0 : sum / _latencies.size();
+        result["P50Ms"] = Percentile(_latencies, 0.5);
+        result["P90Ms"] = Percentile(_latencies, 0.9);
+        result["P99Ms"] = Percentile(_latencies, 0.99);
+        result["P999Ms"] = Percentile(_latencies, 0.999);
+        result["MaxMs"] = _latencies.empty() ? 0.0 : *std::max_element(_latencies.begin(), _latencies.end());
+        result["AffectedP99Ms"] = Percentile(_affected, 0.99);
+
+        for (size_t i = 0; i < _hosts.size(); i++)
+        {
+            const SimHost &host = _hosts[i];
+            Json::Value item;
+            item["Cores"] = host.cores;
+            item["Chosen"] = static_cast<Json::UInt64>(host.chosen);
+            item["Completed"] = static_cast<Json::UInt64>(host.completed);
+            item["Failed"] = static_cast<Json::UInt64>(host.failed);
+            item["Utilization"] = _now > 0 ? host.busyCoreMs / (host.cores * _now) : 0.0;
+            item["DownSec"] = host.downMs / 1000;
+            item["OfflineSec"] = host.offlineMs / 1000;
+            item["Offlines"] = static_cast<Json::UInt64>(host.offlines);
+            result["Hosts"].append(item);
+        }
+        return result;
+    }
+
+private:
+    void Push(double time, EventType type, int a, int b = 0, uint64_t version = 0)
+    {
+        _events.push(Event{time, _seq++, type, a, b, version});
+    }
+
+    // 和Control::Dispatch一样：选主机，增加负载，把请求交给主机
+    void Dispatch(int request)
+    {
+        int machineID = 0;
+        Machine *machine = nullptr;
+        bool isChosen = _balance.SmartChoice(&machineID, &machine);
+        SyncOnline();
+        if (!isChosen)
+        {
+            _rejected++;
+            return;
+        }
+
+        machine->IncreaseLoad();
+        SimHost &host = _hosts[machineID];
+        host.chosen++;
+        if (host.down)
+        {
+            // 连不上，过一会儿才发现
+            Push(_now + _options.connectFailMs, EventFailure, request, machineID);
+            return;
+        }
+
+        host.Advance(_now);
+        host.active.push_back(SimHost::Job{request, _requests[request].workMs});
+        Reschedule(machineID);
+    }
+
+    void Reschedule(int hostID)
+    {
+        SimHost &host = _hosts[hostID];
+        host.version++;
+        double finish = host.NextFinish(_now);
+        if (finish >= 0)
+            Push(finish, EventFinish, hostID, 0, host.version);
+    }
+
+    void Finish(int hostID, uint64_t version)
+    {
+        SimHost &host = _hosts[hostID];
+        if (version != host.version)
+            return;
+
+        host.Advance(_now);
+        Machine *machine = _balance.GetMachine(hostID);
+        for (auto iter = host.active.begin(); iter != host.active.end();)
+        {
+            // 浮点误差，剩下不到一微秒的也算完成
+            if (iter->remaining > 1e-3)
+            {
+                iter++;
+                continue;
+            }
+            machine->DecreaseLoad();
+            host.completed++;
+            double latency = _now - _requests[iter->request].arrivalMs;
+            _latencies.push_back(latency);
+            if (_attempts[iter->request] > 0)
+                _affected.push_back(latency);
+            iter = host.active.erase(iter);
+        }
+        Reschedule(hostID);
+    }
+
+    // 和Control::Dispatch一样：减少负载，离线这台主机，重新选择
+    void Failure(int request, int hostID)
+    {
+        _balance.GetMachine(hostID)->DecreaseLoad();
+        _hosts[hostID].failed++;
+        _failovers++;
+        _attempts[request]++;
+        _balance.OffLineMachine(hostID);
+        SyncOnline();
+        Dispatch(request);
+    }
+
+    void EpisodeStart(const Episode &episode)
+    {
+        SimHost &host = _hosts[episode.host];
+        host.Advance(_now);
+        if (episode.factor > 0)
+        {
+            host.slow = episode.factor;
+            Reschedule(episode.host);
+            return;
+        }
+
+        // 故障：正在处理的请求的连接都断开了
+        if (!host.down)
+        {
+            host.down = true;
+            host.downSince = _now;
+        }
+        for (const auto &job : host.active)
+            Push(_now, EventFailure, job.request, episode.host);
+        host.active.clear();
+        Reschedule(episode.host);
+    }
+
+    void EpisodeEnd(const Episode &episode)
+    {
+        SimHost &host = _hosts[episode.host];
+        host.Advance(_now);
+        if (episode.factor > 0)
+        {
+            host.slow = 1;
+            Reschedule(episode.host);
+            return;
+        }
+        if (host.down)
+        {
+            host.down = false;
+            host.downMs += _now - host.downSince;
+        }
+    }
+
+    // 记录LoadBlance眼中每台主机离线的时间
+    void SyncOnline()
+    {
+        for (size_t i = 0; i < _hosts.size(); i++)
+        {
+            SimHost &host = _hosts[i];
+            bool offline = !_balance.IsOnline(i);
+            if (offline == host.offline)
+                continue;
+            host.offline = offline;
+            if (offline)
+            {
+                host.offlines++;
+                host.offlineSince = _now;
+            }
+            else
+            {
+                host.offlineMs += _now - host.offlineSince;
+            }
+        }
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    ServiceTime service;
+    if (!ParseOptions(argc, argv, &options) || !service.Parse(options.service))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<int> cores;
+    std::vector<std::string> items;
+    StringUtil::SplitString(options.hosts, &items, ",");
+    for (const auto &item : items)
+    {
+        int core = atoi(item.c_str());
+        if (core <= 0)
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+        cores.push_back(core);
+    }
+
+    std::vector<std::string> policies;
+    if (options.policies.empty())
+        policies.assign(std::begin(PolicyNames), std::end(PolicyNames));
+    else
+        StringUtil::SplitString(options.policies, &policies, ",");
+
+    std::vector<SimRequest> requests;
+    std::vector<Episode> episodes;
+    if (cores.empty() || !LoadRequests(options, service, &requests) ||
+        !ParseEpisodes(options.fail, false, cores.size(), &episodes) ||
+        !ParseEpisodes(options.slow, true, cores.size(), &episodes))
+        return 1;
+
+    Json::Value result;
+    result["Hosts"] = options.hosts;
+    result["Service"] = options.service;
+    result["Trace"] = options.trace;
+    result["Rate"] = options.rate;
+    result["Requests"] = static_cast<Json::UInt64>(requests.size());
+    result["Fail"] = options.fail;
+    result["Slow"] = options.slow;
+    result["RecoverMs"] = options.recoverMs;
+    result["Seed"] = options.seed;
+
+    // 所有主机一直忙的时候，能处理的请求数和实际到达的请求数之比
+    double totalWork = 0;
+    int totalCores = 0;
+    for (const auto &request : requests)
+        totalWork += request.workMs;
+    for (int core : cores)
+        totalCores += core;
+    double span = requests.empty() ? 0 : requests.back().arrivalMs;
+    double offered = span > 0 ? totalWork / (totalCores * span) : 0;
+    result["OfferedLoad"] = offered;
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << requests.size() << "个请求，主机核数 " << options.hosts << "，平均负载 " << offered * 100 << "%" << std::endl;
+
+    for (const auto &name : policies)
+    {
+        std::unique_ptr<BalancePolicy> policy;
+        if (!MakePolicy(name, &policy))
+        {
+            std::cerr << "不认识的策略：" << name << std::endl;
+            return 1;
+        }
+
+        // LoadBlance在选主机、离线、上线的时候都会打日志
+        std::streambuf *logBuffer = std::cout.rdbuf();
+        std::ofstream devNull("/dev/null");
+        if (!options.verbose)
+            std::cout.rdbuf(devNull.rdbuf());
+        Simulation simulation(options, cores, requests, episodes, std::move(policy));
+        simulation.Run();
+        std::cout.rdbuf(logBuffer);
+
+        Json::Value report = simulation.Report();
+        std::cout << std::left << std::setw(20) << name << std::right
+                  << " p50 " << std::setw(8) << report["P50Ms"].asDouble()
+                  << "ms  p90 " << std::setw(8) << report["P90Ms"].asDouble()
+                  << "ms  p99 " << std::setw(8) << report["P99Ms"].asDouble()
+                  << "ms  p999 " << std::setw(8) << report["P999Ms"].asDouble()
+                  << "ms  完成 " << report["Completed"].asUInt64()
+                  << "  拒绝 " << report["Rejected"].asUInt64()
+                  << "  失败重试 " << report["Failovers"].asUInt64() << std::endl;
+        for (Json::ArrayIndex i = 0; i < report["Hosts"].size(); i++)
+        {
+            const Json::Value &host = report["Hosts"][i];
+            std::cout << "    主机" << i << "（" << host["Cores"].asInt() << "核）利用率 " << std::setw(5) << host["Utilization"].asDouble() * 100
+                      << "%  选中 " << host["Chosen"].asUInt64() << "  失败 " << host["Failed"].asUInt64()
+                      << "  故障 " << host["DownSec"].asDouble() << "s  离线 " << host["OfflineSec"].asDouble()
+                      << "s（" << host["Offlines"].asUInt64() << "次）" << std::endl;
+        }
+        result["Policies"].append(report);
+    }
+
+    if (!options.out.empty())
+    {
+        Json::StyledWriter writer;
+        std::ofstream out(options.out);
+        out << writer.write(result);
+        std::cout << "结果已保存到" << options.out << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+
+#include <jsoncpp/json/json.h>
+
+#include "../Compiler_Run/CompileAndRun.hpp"
+#include "Submission.hpp"
+
+using namespace ns_CompileAndRun;
+using namespace ns_Submission;
+
+// 编译运行流水线的进程内基准测试，不经过http，用来调优Compiler_Run本身
+// K个线程直接调用CompileAndRun::Start，提交和oj_bench一样来自题库（按比例混合正常、编译错误、超时、内存超限）
+// 每个提交的内容由它的序号决定，同样的参数跑两次，编译运行的是同样的代码，可以作为固定的基线
+// 报告：
+//  每类提交的端到端延迟
+//  每个阶段的时间：写源文件、编译、创建子进程、运行、读输出、清理临时文件（来自Compiler_Run中记录的指标）
+//  工作目录的文件读写速度
+// 可以切换：
+//  --launcher=fork|vfork  创建子进程的方式
+//  --workspace=DIR        临时文件目录，比如 /dev/shm/oj/ 和磁盘上的 ./temp/ 对比
+//  --cache=none|exe       编译缓存，配合--distinct让同样的代码重复出现
+// ./CompileAndRunBench --threads=4 --submissions=200 --out=baseline.json，--help查看所有参数
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    int threads = 4;
+    int submissions = 100;
+    std::string mix = "ok:70,compile_error:10,tle:10,memory:10";
+    std::string questions;
+    std::string questionPath = "../OJ_Server/questions/";
+    std::string workspace = TempPath;
+    std::string launcher = "fork";
+    std::string cache = "none";
+    int cacheMb = 256;
+    int distinct = 0;     // 不同提交的个数，0表示每个提交都不一样
+    int ioFiles = 1000;   // 测试工作目录读写速度的文件数
+    bool verbose = false; // 是否保留CompileAndRun的日志
+    std::string out;
+};
+
+struct Sample
+{
+    int kind;
+    int status;
+    double latencyMs;
+};
+
+static void Usage(const char *proc)
+{
+    std::cerr << "Usage: " << proc << " [options]\n"
+              << "  --threads=K             同时编译运行的线程数，默认4\n"
+              << "  --submissions=N         提交的总数，默认100\n"
+              << "  --mix=ok:70,compile_error:10,tle:10,memory:10  各类提交的比例\n"
+              << "  --questions=1,2,3       使用的题目，默认题库中所有的题目\n"
+              << "  --question-path=DIR     题目目录，默认../OJ_Server/questions/\n"
+              << "  --workspace=DIR         临时文件目录，默认./temp/\n"
+              << "  --launcher=fork|vfork   创建子进程的方式，默认fork\n"
+              << "  --cache=none|exe        编译缓存，默认none\n"
+              << "  --cache-mb=N            编译缓存的大小，默认256MB\n"
+              << "  --distinct=N            只有N个不同的提交，循环使用，默认0表示每个提交都不一样\n"
+              << "  --io-files=N            测试工作目录读写速度的文件数，默认1000，0表示不测\n"
+              << "  --verbose               保留编译运行的日志\n"
+              << "  --out=FILE              把结果保存为json\n";
+}
+
+static bool ParseOptions(int argc, char *argv[], Options *options)
+{
+    static struct option longOptions[] = {
+        {"threads", required_argument, nullptr, 't'},
+        {"submissions", required_argument, nullptr, 'n'},
+        {"mix", required_argument, nullptr, 'x'},
+        {"questions", required_argument, nullptr, 'q'},
+        {"question-path", required_argument, nullptr, 'Q'},
+        {"workspace", required_argument, nullptr, 'w'},
+        {"launcher", required_argument, nullptr, 'l'},
+        {"cache", required_argument, nullptr, 'c'},
+        {"cache-mb", required_argument, nullptr, 'm'},
+        {"distinct", required_argument, nullptr, 'd'},
+        {"io-files", required_argument, nullptr, 'i'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"out", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            options->threads = atoi(optarg);
+            break;
+        case 'n':
+            options->submissions = atoi(optarg);
+            break;
+        case 'x':
+            options->mix = optarg;
+            break;
+        case 'q':
+            options->questions = optarg;
+            break;
+        case 'Q':
+            options->questionPath = optarg;
+            break;
+        case 'w':
+            options->workspace = optarg;
+            break;
+        case 'l':
+            options->launcher = optarg;
+            break;
+        case 'c':
+            options->cache = optarg;
+            break;
+        case 'm':
+            options->cacheMb = atoi(optarg);
+            break;
+        case 'd':
+            options->distinct = atoi(optarg);
+            break;
+        case 'i':
+            options->ioFiles = atoi(optarg);
+            break;
+        case 'v':
+            options->verbose = true;
+            break;
+        case 'o':
+            options->out = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if (options->cache != "none" && options->cache != "exe")
+        return false;
+    if (options->workspace.empty() || options->workspace.back() != '/')
+        options->workspace += '/';
+    if (options->questionPath.empty() || options->questionPath.back() != '/')
+        options->questionPath += '/';
+    return options->threads > 0 && options->submissions > 0 && options->distinct >= 0;
+}
+
+// 工作目录所在的文件系统
+static std::string FileSystemName(const std::string &path)
+{
+    struct statfs st;
+    if (statfs(path.c_str(), &st) != 0)
+        return "unknown";
+    switch (st.f_type)
+    {
+    case 0x01021994:
+        return "tmpfs";
+    case 0xEF53:
+        return "ext4";
+    case 0x58465342:
+        return "xfs";
+    case 0x9123683E:
+        return "btrfs";
+    case 0x794c7630:
+        return "overlayfs";
+    default:
+        return "0x" + HashUtil::ToHex(st.f_type).substr(8);
+    }
+}
+
+// 工作目录的读写速度：和编译运行一样的方式写、读、删除一批小文件，平均每个文件每一步的微秒数
+static void MeasureTempIo(int files, Json::Value *result)
+{
+    std::string content(4096, 'x');
+    std::vector<std::string> names;
+    for (int i = 0; i < files; i++)
+        names.push_back(PathUtil::GetSrcName("iobench_" + std::to_string(i)));
+
+    Clock::time_point begin = Clock::now();
+    for (const auto &name : names)
+        FileUtil::WriteToFile(name, content);
+    Clock::time_point written = Clock::now();
+    std::string buffer;
+    for (const auto &name : names)
+        FileUtil::ReadFromFile(name, &buffer, true);
+    Clock::time_point read = Clock::now();
+    for (const auto &name : names)
+        unlink(name.c_str());
+    Clock::time_point removed = Clock::now();
+
+    auto perFile = [files](Clock::time_point from, Clock::time_point to)
+    {
+        return std::chrono::duration<double, std::micro>(to - from).count() / files;
+    };
+    (*result)["WriteUs"] = perFile(begin, written);
+    (*result)["ReadUs"] = perFile(written, read);
+    (*result)["RemoveUs"] = perFile(read, removed);
+}
+
+// 从Compiler_Run记录的指标中取出一个阶段的统计
+static Json::Value StageStats(const std::string &name, const std::string &labels)
+{
+    Histogram *histogram = Registry::Instance().GetHistogram(name, "", labels);
+    std::vector<uint64_t> counts;
+    uint64_t sum = 0, count = 0;
+    histogram->Snapshot(&counts, &sum, &count);
+
+    Json::Value stats;
+    stats["Count"] = static_cast<Json::UInt64>(count);
+    stats["MeanMs"] = count ? sum * histogram->Scale() * 1e3 / count : 0.0;
+    stats["P50Ms"] = histogram->Percentile(0.5) * 1e3;
+    stats["P99Ms"] = histogram->Percentile(0.99) * 1e3;
+    return stats;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    LauncherType launcher;
+    if (!ParseOptions(argc, argv, &options) || !Launcher::ParseType(options.launcher, &launcher))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    // 切换各个后端，需要在编译运行之前完成
+    PathUtil::SetWorkspace(options.workspace);
+    mkdir(options.workspace.c_str(), 0755);
+    Launcher::SetType(launcher);
+    if (options.cache == "exe" && !CompileCache::Instance().Enable(static_cast<size_t>(options.cacheMb) << 20))
+        return 1;
+
+    SubmissionSet submissions;
+    if (!submissions.Load(options.questionPath, options.questions, options.mix))
+        return 1;
+
+    Json::Value result;
+    result["Threads"] = options.threads;
+    result["Submissions"] = options.submissions;
+    result["Mix"] = options.mix;
+    result["Workspace"] = options.workspace;
+    result["FileSystem"] = FileSystemName(options.workspace);
+    result["Launcher"] = options.launcher;
+    result["Cache"] = options.cache;
+    result["Distinct"] = options.distinct;
+    if (options.ioFiles > 0)
+        MeasureTempIo(options.ioFiles, &result["TempIo"]);
+
+    // CompileAndRun的每一步都会打日志，跑的时候先关掉，不然输出全是日志
+    std::streambuf *logBuffer = std::cout.rdbuf();
+    std::ofstream devNull("/dev/null");
+    if (!options.verbose)
+        std::cout.rdbuf(devNull.rdbuf());
+
+    std::mutex lock;
+    std::vector<Sample> samples;
+    std::atomic<int> next(0);
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < options.threads; i++)
+    {
+        workers.emplace_back([&]()
+                             {
+            std::vector<Sample> local;
+            int seq;
+            while ((seq = next.fetch_add(1)) < options.submissions)
+            {
+                // 同一个序号总是生成同样的提交
+                int tag = options.distinct > 0 ? seq % options.distinct : seq;
+                std::mt19937 engine(tag + 1);
+                Sample sample;
+                QuestionPtr question;
+                std::string code;
+                submissions.Next(engine, &sample.kind, &question, &code);
+                code += "\n// CompileAndRunBench " + std::to_string(tag) + "\n";
+
+                Json::Value inValue;
+                inValue["Code"] = code + std::string(question->tail.data(), question->tail.size());
+                inValue["Input"] = "";
+                inValue["CpuLimit"] = question->cpuLimit;
+                inValue["MemoryLimit"] = question->memoryLimit;
+                Json::FastWriter writer;
+                std::string inJson = writer.write(inValue);
+
+                Clock::time_point begin = Clock::now();
+                std::string outJson;
+                sample.status = CompileAndRun::Start(inJson, &outJson);
+                sample.latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+                local.push_back(sample);
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            samples.insert(samples.end(), local.begin(), local.end()); });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    double elapsedSec = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout.rdbuf(logBuffer);
+
+    result["DurationSec"] = elapsedSec;
+    result["Throughput"] = samples.size() / elapsedSec;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "线程 " << options.threads << "，启动方式 " << options.launcher << "，工作目录 " << options.workspace
+              << "（" << result["FileSystem"].asString() << "），编译缓存 " << options.cache << std::endl;
+    std::cout << samples.size() << "个提交，" << elapsedSec << "秒，" << samples.size() / elapsedSec << "个/秒" << std::endl;
+
+    for (int kind = 0; kind < KindCount; kind++)
+    {
+        std::vector<double> latencies;
+        std::map<int, size_t> statuses;
+        for (const auto &sample : samples)
+        {
+            if (sample.kind != kind)
+                continue;
+            latencies.push_back(sample.latencyMs);
+            statuses[sample.status]++;
+        }
+        if (latencies.empty())
+            continue;
+
+        Json::Value item;
+        item["Count"] = static_cast<Json::UInt64>(latencies.size());
+        item["P50Ms"] = Percentile(latencies, 0.5);
+        item["P99Ms"] = Percentile(latencies, 0.99);
+        for (const auto &status : statuses)
+            item["Statuses"][std::to_string(status.first)] = static_cast<Json::UInt64>(status.second);
+        result["Kinds"][KindNames[kind]] = item;
+        std::cout << "  " << std::left << std::setw(14) << KindNames[kind] << std::right << std::setw(6) << latencies.size()
+                  << "  p50 " << std::setw(9) << item["P50Ms"].asDouble() << "ms  p99 " << std::setw(9) << item["P99Ms"].asDouble() << "ms" << std::endl;
+    }
+
+    // 每个阶段的时间
+    struct Stage
+    {
+        const char *name;
+        const char *metric;
+        std::string labels;
+    };
+    std::vector<Stage> stages = {
+        {"write_source", "oj_tempfile_io_duration_seconds", Label("op", "write")},
+        {"compile", "oj_compile_duration_seconds", ""},
+        {"spawn_compile", "oj_spawn_duration_seconds", Label("stage", "compile")},
+        {"run", "oj_run_duration_seconds", ""},
+        {"spawn_run", "oj_spawn_duration_seconds", Label("stage", "run")},
+        {"read_output", "oj_tempfile_io_duration_seconds", Label("op", "read")},
+        {"cleanup", "oj_tempfile_io_duration_seconds", Label("op", "remove")},
+    };
+    std::cout << "各阶段：" << std::endl;
+    for (const auto &stage : stages)
+    {
+        Json::Value stats = StageStats(stage.metric, stage.labels);
+        result["Stages"][stage.name] = stats;
+        std::cout << "  " << std::left << std::setw(14) << stage.name << std::right << std::setw(6) << stats["Count"].asUInt64()
+                  << "  mean " << std::setw(9) << stats["MeanMs"].asDouble() << "ms  p50 " << std::setw(9) << stats["P50Ms"].asDouble()
+                  << "ms  p99 " << std::setw(9) << stats["P99Ms"].asDouble() << "ms" << std::endl;
+    }
+
+    if (options.cache == "exe")
+    {
+        CacheStats stats = CompileCache::Instance().Stats();
+        result["CompileCache"]["Hits"] = static_cast<Json::UInt64>(stats.hits);
+        result["CompileCache"]["Misses"] = static_cast<Json::UInt64>(stats.misses);
+        result["CompileCache"]["Bytes"] = static_cast<Json::UInt64>(stats.bytes);
+        std::cout << "编译缓存：命中 " << stats.hits << "，未命中 " << stats.misses << "，占用 " << stats.bytes << " 字节" << std::endl;
+    }
+    if (options.ioFiles > 0)
+    {
+        std::cout << "工作目录读写（每个4KB文件）：写 " << result["TempIo"]["WriteUs"].asDouble() << "us，读 "
+                  << result["TempIo"]["ReadUs"].asDouble() << "us，删除 " << result["TempIo"]["RemoveUs"].asDouble() << "us" << std::endl;
+    }
+
+    if (!options.out.empty())
+    {
+        Json::StyledWriter writer;
+        std::ofstream out(options.out);
+        out << writer.write(result);
+        std::cout << "结果已保存到" << options.out << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "../Comm/Metrics.hpp"
+
+using namespace ns_Metrics;
+
+// 指标记录开销的基准测试：分片计数器 vs 所有线程共用一个原子变量，以及直方图记录一个值的开销
+// 多个线程同时不停地记录，统计平均每次记录花的时间
+// ./MetricsBench [线程数] [每个线程记录的次数]，默认为4个线程、每个线程10000000次
+
+typedef std::chrono::steady_clock Clock;
+
+template <class Fn>
+static double Measure(int threads, long iterations, Fn fn)
+{
+    std::vector<std::thread> workers;
+    Clock::time_point start = Clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([iterations, fn]()
+                             {
+                                 for (long i = 0; i < iterations; i++)
+                                     fn(i);
+                             });
+    }
+    for (auto &worker : workers)
+        worker.join();
+    // 每个线程平均每次记录的时间
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count() / static_cast<double>(iterations);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    long iterations = argc > 2 ? atol(argv[2]) : 10000000;
+
+    std::atomic<uint64_t> shared(0);
+    Counter counter;
+    Histogram histogram;
+
+    double sharedNs = Measure(threads, iterations, [&shared](long)
+                              { shared.fetch_add(1, std::memory_order_relaxed); });
+    double counterNs = Measure(threads, iterations, [&counter](long)
+                               { counter.Inc(); });
+    double histogramNs = Measure(threads, iterations, [&histogram](long i)
+                                 { histogram.Record(static_cast<uint64_t>(i & 0xFFFFF)); });
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "线程数 " << threads << "，每个线程记录 " << iterations << " 次" << std::endl;
+    std::cout << "共用一个原子变量  " << sharedNs << " ns/次" << std::endl;
+    std::cout << "分片计数器        " << counterNs << " ns/次，总数 " << counter.Value() << std::endl;
+    std::cout << "直方图            " << histogramNs << " ns/次，p99 " << histogram.Percentile(0.99) << " s" << std::endl;
+    return 0;
+}
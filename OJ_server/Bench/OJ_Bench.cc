@@ -0,0 +1,368 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <getopt.h>
+
+#include <jsoncpp/json/json.h>
+
+#include "../Comm/httplib.h"
+#include "Submission.hpp"
+
+using namespace ns_Submission;
+
+// 端到端的判题压测工具
+// 按比例混合几类提交（正常运行、编译错误、超时、内存超限），用题库中现有的题目拼出代码，
+// 发给OJ_Server的/Judge/N，或者直接发给CompileServer的/CompileAndRun
+// 两种模式：
+//  closed：concurrency个客户端，每个收到应答之后马上发下一个，测的是最大吞吐量
+//  open：按固定的速率发请求（开环），延迟从请求“应该发出”的时间开始算，服务跟不上的时候排队的时间也算在延迟里
+// 按提交的类型统计吞吐量和p50/p90/p99/p999延迟，结果可以保存为json，方便对比两次压测
+// ./oj_bench --target=oj --mode=open --rate=20 --duration=30 --out=result.json，--help查看所有参数
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    std::string target = "oj"; // oj或compile
+    std::string host = "127.0.0.1";
+    int port = 8888;
+    std::string mode = "closed"; // closed或open
+    int concurrency = 8;         // closed模式下的客户端数；open模式下最多同时在处理的请求数
+    double rate = 10;            // open模式下每秒发出的请求数
+    int duration = 30;           // 秒
+    std::string mix = "ok:70,compile_error:10,tle:10,memory:10";
+    std::string questions; // 逗号分隔的题目编号，空表示题库中所有的题目
+    std::string questionPath = "../OJ_Server/questions/";
+    bool allowCache = false; // 默认给每个提交加上不同的注释，避开判题结果缓存
+    std::string out;
+};
+
+// 一个请求的结果
+struct Sample
+{
+    int kind;
+    double latencyMs;
+    bool isOk;       // 收到了200的应答
+    int status;      // 判题结果中的Status
+    bool isCacheHit; // OJ_Server的判题结果缓存命中
+};
+
+static void Usage(const char *proc)
+{
+    std::cerr << "Usage: " << proc << " [options]\n"
+              << "  --target=oj|compile     压测OJ_Server的/Judge还是CompileServer的/CompileAndRun，默认oj\n"
+              << "  --host=HOST --port=PORT 服务地址，默认127.0.0.1:8888\n"
+              << "  --mode=closed|open      闭环或开环，默认closed\n"
+              << "  --concurrency=N         闭环的客户端数，开环最多同时在处理的请求数，默认8\n"
+              << "  --rate=R                开环每秒发出的请求数，默认10\n"
+              << "  --duration=SEC          压测时间，默认30秒\n"
+              << "  --mix=ok:70,compile_error:10,tle:10,memory:10  各类提交的比例\n"
+              << "  --questions=1,2,3       使用的题目，默认题库中所有的题目\n"
+              << "  --question-path=DIR     题目目录，默认../OJ_Server/questions/\n"
+              << "  --allow-cache           相同的提交不加区分，可以命中判题结果缓存\n"
+              << "  --out=FILE              把结果保存为json\n";
+}
+
+static bool ParseOptions(int argc, char *argv[], Options *options)
+{
+    static struct option longOptions[] = {
+        {"target", required_argument, nullptr, 't'},
+        {"host", required_argument, nullptr, 'H'},
+        {"port", required_argument, nullptr, 'p'},
+        {"mode", required_argument, nullptr, 'm'},
+        {"concurrency", required_argument, nullptr, 'c'},
+        {"rate", required_argument, nullptr, 'r'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"mix", required_argument, nullptr, 'x'},
+        {"questions", required_argument, nullptr, 'q'},
+        {"question-path", required_argument, nullptr, 'Q'},
+        {"allow-cache", no_argument, nullptr, 'a'},
+        {"out", required_argument, nullptr, 'o'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            options->target = optarg;
+            break;
+        case 'H':
+            options->host = optarg;
+            break;
+        case 'p':
+            options->port = atoi(optarg);
+            break;
+        case 'm':
+            options->mode = optarg;
+            break;
+        case 'c':
+            options->concurrency = atoi(optarg);
+            break;
+        case 'r':
+            options->rate = atof(optarg);
+            break;
+        case 'd':
+            options->duration = atoi(optarg);
+            break;
+        case 'x':
+            options->mix = optarg;
+            break;
+        case 'q':
+            options->questions = optarg;
+            break;
+        case 'Q':
+            options->questionPath = optarg;
+            break;
+        case 'a':
+            options->allowCache = true;
+            break;
+        case 'o':
+            options->out = optarg;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    if (options->target != "oj" && options->target != "compile")
+        return false;
+    if (options->mode != "closed" && options->mode != "open")
+        return false;
+    if (options->questionPath.empty() || options->questionPath.back() != '/')
+        options->questionPath += '/';
+    return options->concurrency > 0 && options->rate > 0 && options->duration > 0;
+}
+
+// 压测使用的题目，按比例随机生成每个请求
+class Workload
+{
+private:
+    SubmissionSet _submissions;
+    const Options &_options;
+
+public:
+    explicit Workload(const Options &options)
+        : _options(options)
+    {
+    }
+
+    bool Load()
+    {
+        return _submissions.Load(_options.questionPath, _options.questions, _options.mix);
+    }
+
+    // 随机选一道题和一类提交，生成请求的路径和请求体
+    void Next(std::mt19937 &engine, uint64_t sequence, int *kind, std::string *path, std::string *body) const
+    {
+        QuestionPtr question;
+        std::string code;
+        _submissions.Next(engine, kind, &question, &code);
+        if (!_options.allowCache)
+            code += "\n// oj_bench " + std::to_string(sequence) + "\n";
+
+        Json::Value value;
+        if (_options.target == "oj")
+        {
+            *path = "/Judge/" + question->id;
+            value["Code"] = code;
+            value["Input"] = "";
+        }
+        else
+        {
+            // 直接发给CompileServer，和OJ_Server一样把用户代码和tail拼起来
+            *path = "/CompileAndRun";
+            value["Code"] = code + "\n" + std::string(question->tail.data(), question->tail.size());
+            value["Input"] = "";
+            value["CpuLimit"] = question->cpuLimit;
+            value["MemoryLimit"] = question->memoryLimit;
+        }
+        Json::FastWriter writer;
+        *body = writer.write(value);
+    }
+};
+
+static void SendOne(httplib::Client &client, const std::string &path, const std::string &body, Sample *sample)
+{
+    auto response = client.Post(path.c_str(), body, "application/json;charset=utf-8");
+    sample->isOk = response && response->status == 200;
+    sample->status = 0;
+    sample->isCacheHit = false;
+    if (!sample->isOk)
+        return;
+
+    sample->isCacheHit = response->get_header_value("X-Judge-Cache") == "HIT";
+    Json::Value value;
+    Json::Reader reader;
+    if (reader.parse(response->body, value))
+        sample->status = value["Status"].asInt();
+    else
+        sample->isOk = false;
+}
+
+// 按类型汇总，打印并写进json
+static void Report(const Options &options, const std::vector<Sample> &samples, double elapsedSec, uint64_t scheduled)
+{
+    Json::Value result;
+    result["Target"] = options.target;
+    result["Host"] = options.host + ":" + std::to_string(options.port);
+    result["Mode"] = options.mode;
+    result["Concurrency"] = options.concurrency;
+    if (options.mode == "open")
+    {
+        result["Rate"] = options.rate;
+        result["Scheduled"] = static_cast<Json::UInt64>(scheduled);
+    }
+    result["Mix"] = options.mix;
+    result["DurationSec"] = elapsedSec;
+    result["Requests"] = static_cast<Json::UInt64>(samples.size());
+    result["Throughput"] = samples.size() / elapsedSec;
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << options.mode << " " << options.target << " " << samples.size() << "个请求，" << elapsedSec << "秒，"
+              << samples.size() / elapsedSec << "个/秒" << std::endl;
+    std::cout << std::left << std::setw(15) << "类型" << std::right << std::setw(8) << "请求" << std::setw(8) << "失败"
+              << std::setw(8) << "缓存" << std::setw(10) << "p50ms" << std::setw(10) << "p90ms" << std::setw(10) << "p99ms"
+              << std::setw(10) << "p999ms" << "  判题结果" << std::endl;
+
+    for (int kind = 0; kind <= KindCount; kind++)
+    {
+        // 最后一行为所有类型合在一起
+        bool isAll = kind == KindCount;
+        std::vector<double> latencies;
+        std::map<int, size_t> statuses;
+        size_t failed = 0, cacheHits = 0;
+        for (const auto &sample : samples)
+        {
+            if (!isAll && sample.kind != kind)
+                continue;
+            latencies.push_back(sample.latencyMs);
+            if (!sample.isOk)
+            {
+                failed++;
+                continue;
+            }
+            statuses[sample.status]++;
+            if (sample.isCacheHit)
+                cacheHits++;
+        }
+        if (latencies.empty())
+            continue;
+
+        Json::Value item;
+        item["Requests"] = static_cast<Json::UInt64>(latencies.size());
+        item["Failed"] = static_cast<Json::UInt64>(failed);
+        item["CacheHits"] = static_cast<Json::UInt64>(cacheHits);
+        item["Throughput"] = latencies.size() / elapsedSec;
+        item["P50Ms"] = Percentile(latencies, 0.5);
+        item["P90Ms"] = Percentile(latencies, 0.9);
+        item["P99Ms"] = Percentile(latencies, 0.99);
+        item["P999Ms"] = Percentile(latencies, 0.999);
+        item["MaxMs"] = *std::max_element(latencies.begin(), latencies.end());
+        std::string statusText;
+        for (const auto &status : statuses)
+        {
+            item["Statuses"][std::to_string(status.first)] = static_cast<Json::UInt64>(status.second);
+            statusText += " " + std::to_string(status.first) + "×" + std::to_string(status.second);
+        }
+        result["Kinds"][isAll ? "all" : KindNames[kind]] = item;
+
+        std::cout << std::left << std::setw(13) << (isAll ? "all" : KindNames[kind]) << std::right << std::setw(8) << latencies.size()
+                  << std::setw(8) << failed << std::setw(8) << cacheHits << std::setw(10) << item["P50Ms"].asDouble()
+                  << std::setw(10) << item["P90Ms"].asDouble() << std::setw(10) << item["P99Ms"].asDouble()
+                  << std::setw(10) << item["P999Ms"].asDouble() << " " << statusText << std::endl;
+    }
+
+    if (!options.out.empty())
+    {
+        Json::StyledWriter writer;
+        std::ofstream out(options.out);
+        out << writer.write(result);
+        std::cout << "结果已保存到" << options.out << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    Workload workload(options);
+    if (!workload.Load())
+        return 1;
+
+    std::mutex lock;
+    std::vector<Sample> samples;
+    std::atomic<uint64_t> sequence(0);
+    // 每次运行的提交都不一样，避免命中上一次压测留下的判题结果缓存
+    uint64_t runSalt = static_cast<uint64_t>(Clock::now().time_since_epoch().count()) << 20;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(options.duration);
+    std::chrono::duration<double> interval(1.0 / options.rate);
+
+    std::vector<std::thread> clients;
+    for (int i = 0; i < options.concurrency; i++)
+    {
+        clients.emplace_back([&, i]()
+                             {
+            httplib::Client client(options.host, options.port);
+            client.set_keep_alive(true);
+            // httplib的客户端分两次写请求头和请求体，不关掉Nagle的话每个请求都要多等一次延迟确认（40ms）
+            client.set_tcp_nodelay(true);
+            client.set_read_timeout(120);
+            std::mt19937 engine(i * 7919 + 1);
+            std::vector<Sample> local;
+
+            while (true)
+            {
+                uint64_t seq = sequence.fetch_add(1);
+                Clock::time_point sendTime = Clock::now();
+                if (options.mode == "open")
+                {
+                    // 开环：第seq个请求应该在start+seq*interval发出，延迟从这个时间开始算
+                    sendTime = start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<double>(seq));
+                    if (sendTime >= end)
+                        break;
+                    std::this_thread::sleep_until(sendTime);
+                }
+                else if (sendTime >= end)
+                {
+                    break;
+                }
+
+                Sample sample;
+                std::string path, body;
+                workload.Next(engine, runSalt + seq, &sample.kind, &path, &body);
+                SendOne(client, path, body, &sample);
+                sample.latencyMs = std::chrono::duration<double, std::milli>(Clock::now() - sendTime).count();
+                local.push_back(sample);
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+            samples.insert(samples.end(), local.begin(), local.end()); });
+    }
+    for (auto &client : clients)
+        client.join();
+
+    double elapsedSec = std::chrono::duration<double>(Clock::now() - start).count();
+    uint64_t scheduled = std::min<uint64_t>(sequence.load(), static_cast<uint64_t>(options.duration * options.rate));
+    Report(options, samples, elapsedSec, scheduled);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <sys/stat.h>
+
+#include "../OJ_Server/OJ_model.hpp"
+
+using namespace ns_OJ_model;
+
+// 题库启动时间的基准测试
+// 生成N道合成题目，分别测试：从题目目录加载、只加载题目列表、写打包文件、从打包文件加载 的耗时
+// ./QuestionBankBench [工作目录，默认为/tmp] [题目数量...]，题目数量默认为10000和100000
+
+static double NowMs()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::milli>>(steady_clock::now().time_since_epoch()).count();
+}
+
+// 生成合成题目，大小和真实题目差不多
+static bool MakeSyntheticQuestions(const std::string &questionPath, int count)
+{
+    mkdir(questionPath.c_str(), 0755);
+
+    std::string description(1024, 'd');
+    std::string header = "#include <iostream>\nclass Solution{\n    public:\n        int Max(int a,int b)\n        {\n            return 0;\n        }\n};\n";
+    std::string tail = "#ifndef COMPILER_ONLINE\n#include \"header.cpp\"\n#endif\n" + std::string(1024, 't') + "\nint main(){return 0;}\n";
+
+    std::string list;
+    for (int i = 1; i <= count; i++)
+    {
+        std::string id = std::to_string(i);
+        std::string dir = questionPath + id + "/";
+        mkdir(dir.c_str(), 0755);
+        if (!FileUtil::WriteToFile(dir + "desc.txt", description + id) ||
+            !FileUtil::WriteToFile(dir + "header.cpp", header) ||
+            !FileUtil::WriteToFile(dir + "tail.cpp", tail))
+            return false;
+        list += id + " 合成题目" + id + " 简单 1 30000\n";
+    }
+    return FileUtil::WriteToFile(questionPath + QuestionListName, list);
+}
+
+static void RunOnce(const std::string &workDir, int count)
+{
+    std::string questionPath = workDir + "/oj_bank_bench_" + std::to_string(count) + "/";
+    std::string packFile = questionPath + QuestionPackName;
+
+    if (!FileUtil::IsFileExist(questionPath + QuestionListName))
+    {
+        std::cout << "生成" << count << "道合成题目到" << questionPath << " ..." << std::endl;
+        if (!MakeSyntheticQuestions(questionPath, count))
+        {
+            std::cerr << "生成合成题目失败" << std::endl;
+            return;
+        }
+    }
+
+    // 按需加载：只读题目列表
+    std::shared_ptr<QuestionBank> lazy;
+    double begin = NowMs();
+    bool isLazy = Model::BuildLooseBank(questionPath, &lazy, true);
+    double lazyMs = NowMs() - begin;
+    lazy.reset();
+
+    std::shared_ptr<QuestionBank> loose;
+    begin = NowMs();
+    bool isLoose = Model::BuildLooseBank(questionPath, &loose);
+    double looseMs = NowMs() - begin;
+
+    begin = NowMs();
+    bool isWrite = isLoose && Model::WritePackedBank(*loose, packFile);
+    double writeMs = NowMs() - begin;
+    loose.reset();
+
+    std::shared_ptr<QuestionBank> packed;
+    begin = NowMs();
+    bool isPacked = isWrite && Model::BuildPackedBank(packFile, &packed);
+    double packedMs = NowMs() - begin;
+
+    if (!isPacked || !isLazy)
+    {
+        std::cerr << "题目数量" << count << "：加载失败" << std::endl;
+        return;
+    }
+
+    std::cout << "题目数量 " << count
+              << "\t目录加载 " << looseMs << " ms"
+              << "\t目录按需加载 " << lazyMs << " ms"
+              << "\t写打包文件 " << writeMs << " ms"
+              << "\t打包文件加载 " << packedMs << " ms"
+              << "\t加速比 " << looseMs / packedMs << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string workDir = argc >= 2 ? argv[1] : "/tmp";
+
+    std::vector<int> counts;
+    for (int i = 2; i < argc; i++)
+        counts.push_back(std::atoi(argv[i]));
+    if (counts.empty())
+    {
+        counts.push_back(10000);
+        counts.push_back(100000);
+    }
+
+    for (int count : counts)
+        RunOnce(workDir, count);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <random>
+
+#include "../OJ_Server/OJ_search.hpp"
+
+using namespace ns_OJ_search;
+
+// 全文搜索的基准测试
+// 在内存中生成N道合成题目，测试：建立索引、修改1%的题目之后增量重建、以及各种查询的耗时
+// ./SearchBench [题目数量...]，题目数量默认为10000和100000
+
+static double NowMs()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::milli>>(steady_clock::now().time_since_epoch()).count();
+}
+
+// 合成题目的词表：常见的中文二字词和英文单词，出现的频率大致符合齐夫分布
+static std::vector<std::string> MakeVocabulary(std::mt19937 &rng, int size)
+{
+    const char *english[] = {"sort", "array", "tree", "string", "path", "graph", "matrix", "sum", "node", "queue"};
+    std::vector<std::string> vocabulary;
+    for (int i = 0; i < size; i++)
+    {
+        if (i % 10 == 0)
+        {
+            vocabulary.push_back(std::string(english[(i / 10) % 10]) + std::to_string(i / 100));
+            continue;
+        }
+        // 在常用汉字区中随机取两个字
+        std::string word;
+        for (int k = 0; k < 2; k++)
+        {
+            uint32_t c = 0x4e00 + rng() % 3000;
+            word += static_cast<char>(0xe0 | (c >> 12));
+            word += static_cast<char>(0x80 | ((c >> 6) & 0x3f));
+            word += static_cast<char>(0x80 | (c & 0x3f));
+        }
+        vocabulary.push_back(word);
+    }
+    return vocabulary;
+}
+
+static std::string RandomText(std::mt19937 &rng, const std::vector<std::string> &vocabulary, int words)
+{
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::string text;
+    for (int i = 0; i < words; i++)
+    {
+        double u = uniform(rng);
+        text += vocabulary[static_cast<size_t>(vocabulary.size() * u * u * u)];
+        if (rng() % 3 == 0)
+            text += "，";
+    }
+    return text;
+}
+
+static void RunOnce(int count)
+{
+    std::mt19937 rng(count);
+    std::vector<std::string> vocabulary = MakeVocabulary(rng, 20000);
+    std::vector<std::string> descriptions(count);
+    std::vector<SearchDocument> documents(count);
+    for (int i = 0; i < count; i++)
+    {
+        descriptions[i] = RandomText(rng, vocabulary, 150);
+        documents[i].id = std::to_string(i + 1);
+        documents[i].title = RandomText(rng, vocabulary, 3) + std::to_string(i + 1);
+        documents[i].description = descriptions[i];
+    }
+
+    double begin = NowMs();
+    std::shared_ptr<SearchIndex> index = SearchIndex::Build(1, documents, nullptr);
+    double buildMs = NowMs() - begin;
+
+    // 修改1%的题目，再增量重建
+    for (int i = 0; i < count; i += 100)
+        descriptions[i] = RandomText(rng, vocabulary, 150);
+    size_t retokenized = 0;
+    begin = NowMs();
+    std::shared_ptr<SearchIndex> rebuilt = SearchIndex::Build(2, documents, index.get(), &retokenized);
+    double rebuildMs = NowMs() - begin;
+
+    std::cout << "题目数量: " << count << std::endl;
+    std::cout << "  建立索引:       " << buildMs << " ms" << std::endl;
+    std::cout << "  增量重建:       " << rebuildMs << " ms（重新分词" << retokenized << "道）" << std::endl;
+
+    // 高频词、中频词、低频词，以及它们的组合
+    std::vector<std::string> queries = {vocabulary[0], vocabulary[1], vocabulary[100], vocabulary[5000],
+                                        vocabulary[1] + vocabulary[2], vocabulary[100] + " " + vocabulary[300],
+                                        "zzz"};
+    for (const std::string &query : queries)
+    {
+        const int rounds = 200;
+        std::vector<double> costs;
+        SearchResult result;
+        for (int i = 0; i < rounds; i++)
+        {
+            begin = NowMs();
+            rebuilt->Search(query, 1, 20, &result);
+            costs.push_back(NowMs() - begin);
+        }
+        std::sort(costs.begin(), costs.end());
+        std::cout << "  查询 \"" << query << "\": 匹配" << result.total << "道, p50 " << costs[rounds / 2]
+                  << " ms, p99 " << costs[rounds * 99 / 100] << " ms" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> counts;
+    for (int i = 1; i < argc; i++)
+        counts.push_back(std::atoi(argv[i]));
+    if (counts.empty())
+        counts = {10000, 100000};
+
+    for (int count : counts)
+        RunOnce(count);
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <getopt.h>
+
+#include "../OJ_Server/OJ_store.hpp"
+#include "Submission.hpp"
+
+using namespace ns_OJ_store;
+using ns_Submission::Percentile;
+
+// 提交记录存储的基准测试
+//  写：K个线程同时Append，统计每秒写入的条数、攒成了多少批、每批写入和fdatasync的时间
+//  读：按用户、按题目、按时间范围查询，以及按序号取一条，每种查询的延迟
+//  恢复：重新打开存储的时间，第一次打开要读整个journal并压缩进快照，第二次只读快照
+// ./StoreBench --threads=8 --records=100000 --path=/tmp/oj_store/，--help查看所有参数
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options
+{
+    int threads = 8;
+    int records = 100000;
+    int codeBytes = 1024;
+    int users = 1000;
+    int questions = 20;
+    int queries = 10000;
+    std::string path = "./store_bench/";
+    bool sync = true;
+    int commitMs = 0;
+    bool verbose = false;
+};
+
+static void Usage(const char *proc)
+{
+    std::cerr << "Usage: " << proc << " [options]\n"
+              << "  --threads=K             同时写入的线程数，默认8\n"
+              << "  --records=N             写入的记录数，默认100000\n"
+              << "  --code-bytes=N          每条记录的代码长度，默认1024\n"
+              << "  --users=N               用户数，默认1000\n"
+              << "  --questions=N           题目数，默认20\n"
+              << "  --queries=N             每种查询的次数，默认10000\n"
+              << "  --path=DIR              存储的目录，会先被清空，默认./store_bench/\n"
+              << "  --sync=0|1              每批记录是否fdatasync，默认1\n"
+              << "  --commit-ms=N           攒多少毫秒的记录一起写，默认0\n"
+              << "  --verbose               保留存储的日志\n";
+}
+
+static bool ParseOptions(int argc, char *argv[], Options *options)
+{
+    static struct option longOptions[] = {
+        {"threads", required_argument, nullptr, 't'},
+        {"records", required_argument, nullptr, 'n'},
+        {"code-bytes", required_argument, nullptr, 'b'},
+        {"users", required_argument, nullptr, 'u'},
+        {"questions", required_argument, nullptr, 'q'},
+        {"queries", required_argument, nullptr, 'Q'},
+        {"path", required_argument, nullptr, 'p'},
+        {"sync", required_argument, nullptr, 's'},
+        {"commit-ms", required_argument, nullptr, 'c'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0}};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            options->threads = atoi(optarg);
+            break;
+        case 'n':
+            options->records = atoi(optarg);
+            break;
+        case 'b':
+            options->codeBytes = atoi(optarg);
+            break;
+        case 'u':
+            options->users = atoi(optarg);
+            break;
+        case 'q':
+            options->questions = atoi(optarg);
+            break;
+        case 'Q':
+            options->queries = atoi(optarg);
+            break;
+        case 'p':
+            options->path = optarg;
+            break;
+        case 's':
+            options->sync = atoi(optarg) != 0;
+            break;
+        case 'c':
+            options->commitMs = atoi(optarg);
+            break;
+        case 'v':
+            options->verbose = true;
+            break;
+        default:
+            return false;
+        }
+    }
+    if (options->path.empty() || options->path.back() != '/')
+        options->path += '/';
+    return options->threads > 0 && options->records > 0 && options->users > 0 && options->questions > 0 && options->queries > 0;
+}
+
+static void RemoveStore(const std::string &path)
+{
+    const char *files[] = {"journal", "journal.tmp", "snapshot", "snapshot.tmp", "lock", "users"};
+    for (const char *file : files)
+        unlink((path + file).c_str());
+}
+
+// 打开存储，返回用时毫秒
+static double OpenStore(SubmissionStore *store, const StoreOptions &options)
+{
+    Clock::time_point begin = Clock::now();
+    if (!store->Open(options))
+    {
+        std::cerr << "打开存储失败：" << options.path << std::endl;
+        exit(1);
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+template <class Function>
+static void MeasureQuery(const char *name, int queries, Function function)
+{
+    std::vector<double> latencies;
+    size_t found = 0;
+    for (int i = 0; i < queries; i++)
+    {
+        Clock::time_point begin = Clock::now();
+        found += function(i);
+        latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - begin).count());
+    }
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+              << "  p50 " << std::setw(8) << Percentile(latencies, 0.5) << "us  p99 " << std::setw(8) << Percentile(latencies, 0.99)
+              << "us  平均每次" << std::setw(6) << static_cast<double>(found) / queries << "条" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!ParseOptions(argc, argv, &options))
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    StoreOptions storeOptions;
+    storeOptions.path = options.path;
+    storeOptions.sync = options.sync;
+    storeOptions.commitIntervalMs = options.commitMs;
+    mkdir(options.path.c_str(), 0755);
+    RemoveStore(options.path);
+
+    // 存储在打开、压缩的时候会打日志
+    std::streambuf *logBuffer = std::cout.rdbuf();
+    std::ofstream devNull("/dev/null");
+    if (!options.verbose)
+        std::cout.rdbuf(devNull.rdbuf());
+
+    std::unique_ptr<SubmissionStore> store(new SubmissionStore());
+    OpenStore(store.get(), storeOptions);
+
+    // 写
+    std::string code(options.codeBytes, 'x');
+    std::string result = "{\"Reason\":\"ok\",\"Status\":0,\"Stderr\":\"\",\"Stdout\":\"通过用例1\"}";
+    uint64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    Clock::time_point begin = Clock::now();
+    std::vector<std::thread> writers;
+    for (int t = 0; t < options.threads; t++)
+    {
+        writers.emplace_back([&, t]()
+                             {
+            std::mt19937 engine(t + 1);
+            for (int i = t; i < options.records; i += options.threads)
+            {
+                Submission submission;
+                submission.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                submission.durationUs = 200000 + engine() % 100000;
+                submission.status = engine() % 4 == 0 ? -3 : 0;
+                submission.user = "user" + std::to_string(engine() % options.users);
+                submission.question = std::to_string(1 + engine() % options.questions);
+                submission.code = code;
+                submission.result = result;
+                store->Append(submission);
+            } });
+    }
+    for (auto &writer : writers)
+        writer.join();
+    double appendSec = std::chrono::duration<double>(Clock::now() - begin).count();
+    store->Flush();
+    double commitSec = std::chrono::duration<double>(Clock::now() - begin).count();
+    std::cout.rdbuf(logBuffer);
+
+    uint64_t commits = Registry::Instance().GetCounter("oj_store_commits_total", "")->Value();
+    Histogram *commitLatency = Registry::Instance().GetHistogram("oj_store_commit_duration_seconds", "");
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "写入" << options.records << "条，" << options.threads << "个线程，fdatasync " << (options.sync ? "开" : "关") << std::endl;
+    std::cout << "  Append " << options.records / appendSec << "条/秒，全部落盘 " << options.records / commitSec << "条/秒" << std::endl;
+    std::cout << "  " << commits << "批，平均每批" << static_cast<double>(options.records) / std::max<uint64_t>(commits, 1)
+              << "条，每批p50 " << commitLatency->Percentile(0.5) * 1e3 << "ms  p99 " << commitLatency->Percentile(0.99) * 1e3 << "ms" << std::endl;
+
+    // 读
+    std::cout << "查询（共" << store->Count() << "条）：" << std::endl;
+    std::vector<SubmissionPtr> out;
+    MeasureQuery("user", options.queries, [&](int i)
+                 {
+        SubmissionQuery query;
+        query.user = "user" + std::to_string(i % options.users);
+        store->Query(query, &out);
+        return out.size(); });
+    MeasureQuery("user+题目", options.queries, [&](int i)
+                 {
+        SubmissionQuery query;
+        query.user = "user" + std::to_string(i % options.users);
+        query.question = std::to_string(1 + i % options.questions);
+        store->Query(query, &out);
+        return out.size(); });
+    MeasureQuery("question", options.queries, [&](int i)
+                 {
+        SubmissionQuery query;
+        query.question = std::to_string(1 + i % options.questions);
+        query.beforeId = options.records - i % options.records;
+        store->Query(query, &out);
+        return out.size(); });
+    MeasureQuery("time", options.queries, [&](int i)
+                 {
+        SubmissionQuery query;
+        query.sinceMs = startMs + i % 1000;
+        query.untilMs = query.sinceMs + 10;
+        store->Query(query, &out);
+        return out.size(); });
+    MeasureQuery("get", options.queries, [&](int i)
+                 {
+        SubmissionPtr record;
+        return static_cast<size_t>(store->Get(1 + i % options.records, &record)); });
+
+    // 恢复
+    std::cout.rdbuf(devNull.rdbuf());
+    store.reset(new SubmissionStore());
+    double journalMs = OpenStore(store.get(), storeOptions);
+    store.reset(new SubmissionStore());
+    double snapshotMs = OpenStore(store.get(), storeOptions);
+    size_t recovered = store->Count();
+    store.reset();
+    std::cout.rdbuf(logBuffer);
+    std::cout << "恢复" << recovered << "条：从journal " << journalMs << "ms（包括压缩进快照），从快照 " << snapshotMs << "ms" << std::endl;
+
+    RemoveStore(options.path);
+    return 0;
+}
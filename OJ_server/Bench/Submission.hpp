@@ -0,0 +1,131 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+
+#include "../OJ_Server/OJ_model.hpp"
+
+// 压测用的提交：用题库中现有题目的预设代码，按比例混合几类提交
+// oj_bench（经过http）和CompileAndRunBench（进程内）用同一套提交，两边的结果可以对照
+namespace ns_Submission
+{
+    using namespace ns_OJ_model;
+
+    // 提交的类型
+    enum SubmissionKind
+    {
+        KindOk = 0,       // 题目的预设代码，能正常编译运行
+        KindCompileError, // 语法错误
+        KindTimeLimit,    // 死循环，超过CPU限制
+        KindMemoryLimit,  // 不停地申请内存，超过内存限制
+        KindCount
+    };
+
+    const char *const KindNames[KindCount] = {"ok", "compile_error", "tle", "memory"};
+
+    // 在用户代码后面追加的片段，全局对象的构造函数在main之前执行，不用关心题目的函数签名
+    const char *const KindSnippets[KindCount] = {
+        "",
+        "\nint oj_bench_broken = ;\n",
+        "\nstatic struct OjBenchSpin { OjBenchSpin() { volatile unsigned long n = 0; while (true) n++; } } ojBenchSpin;\n",
+        "\n#include <vector>\nstatic struct OjBenchHog { OjBenchHog() { std::vector<char *> blocks; while (true) { char *p = new char[1 << 20]; for (int i = 0; i < (1 << 20); i += 4096) p[i] = 1; blocks.push_back(p); } } } ojBenchHog;\n",
+    };
+
+    // 按比例随机选题目和提交类型
+    class SubmissionSet
+    {
+    private:
+        std::vector<QuestionPtr> _questions;
+        std::vector<int> _cumulative; // 各类提交的累计权重
+
+    public:
+        // questions为逗号分隔的题目编号，空表示题库中所有的题目；mix的格式为 ok:70,compile_error:10
+        bool Load(const std::string &questionPath, const std::string &questions, const std::string &mix)
+        {
+            if (!ParseMix(mix))
+            {
+                std::cerr << "提交比例的格式不正确：" << mix << std::endl;
+                return false;
+            }
+
+            std::shared_ptr<QuestionBank> bank;
+            if (!Model::BuildLooseBank(questionPath, &bank))
+            {
+                std::cerr << "加载题目失败：" << questionPath << std::endl;
+                return false;
+            }
+
+            if (questions.empty())
+            {
+                _questions = bank->questionList;
+                return !_questions.empty();
+            }
+
+            std::vector<std::string> ids;
+            StringUtil::SplitString(questions, &ids, ",");
+            for (const auto &id : ids)
+            {
+                auto iter = bank->questions.find(id);
+                if (iter == bank->questions.end())
+                {
+                    std::cerr << "题目" << id << "不存在" << std::endl;
+                    return false;
+                }
+                _questions.push_back(iter->second);
+            }
+            return !_questions.empty();
+        }
+
+        // 随机选一道题和一类提交，code为用户代码（还没有和tail拼接）
+        void Next(std::mt19937 &engine, int *kind, QuestionPtr *question, std::string *code) const
+        {
+            *question = _questions[engine() % _questions.size()];
+            int pick = engine() % _cumulative.back();
+            *kind = std::upper_bound(_cumulative.begin(), _cumulative.end(), pick) - _cumulative.begin();
+
+            code->assign((*question)->header.data(), (*question)->header.size());
+            *code += KindSnippets[*kind];
+        }
+
+    private:
+        bool ParseMix(const std::string &mix)
+        {
+            std::vector<int> weights(KindCount, 0);
+            std::vector<std::string> items;
+            StringUtil::SplitString(mix, &items, ",");
+            for (const auto &item : items)
+            {
+                size_t colon = item.find(':');
+                if (colon == std::string::npos)
+                    return false;
+                std::string name = item.substr(0, colon);
+                int kind = std::find(KindNames, KindNames + KindCount, name) - KindNames;
+                if (kind == KindCount)
+                    return false;
+                weights[kind] = atoi(item.substr(colon + 1).c_str());
+            }
+
+            _cumulative.clear();
+            int sum = 0;
+            for (int weight : weights)
+            {
+                sum += weight;
+                _cumulative.push_back(sum);
+            }
+            return sum > 0;
+        }
+    };
+
+    inline double Percentile(std::vector<double> &values, double p)
+    {
+        if (values.empty())
+            return 0;
+        size_t index = std::min(values.size() - 1, static_cast<size_t>(values.size() * p));
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+}
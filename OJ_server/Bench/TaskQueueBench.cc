@@ -0,0 +1,138 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+
+#include "../Comm/TaskQueue.hpp"
+
+using namespace ns_TaskQueue;
+
+// 任务队列的基准测试：httplib自带的线程池 vs 可以互相偷任务的队列
+// 模拟请求很多的时候：若干个线程（相当于接受连接的线程和IO线程）不停地提交很短的任务（相当于处理一个缓存命中的请求）
+// 一部分任务在执行完之后会再提交一个任务（相当于同一个连接上流水线发来的下一个请求）
+// 统计吞吐量，以及任务从提交到开始执行的等待时间的分位数
+// 生产者按固定的速率提交任务（开环），速率不超过处理能力的时候，等待时间反映的是队列本身的开销
+// ./TaskQueueBench [线程数] [每秒提交的任务数] [每个生产者的任务数]，默认为8个线程、每秒200000个、每个生产者100000个
+
+typedef std::chrono::steady_clock Clock;
+
+static const int Producers = 4;
+// 每个任务大约执行的时间
+static const int TaskWorkNs = 2000;
+// 每隔多少个任务有一个任务会再提交一个后续任务
+static const int FollowUpEvery = 4;
+
+static void BusyWork(int ns)
+{
+    Clock::time_point end = Clock::now() + std::chrono::nanoseconds(ns);
+    while (Clock::now() < end)
+    {
+    }
+}
+
+static double Percentile(std::vector<double> &values, double p)
+{
+    if (values.empty())
+        return 0;
+    size_t index = std::min(values.size() - 1, static_cast<size_t>(values.size() * p));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+struct Sample
+{
+    std::atomic<size_t> done;
+
+    Sample() : done(0)
+    {
+    }
+};
+
+static void SubmitOne(httplib::TaskQueue *queue, Sample *sample, std::vector<double> *waits, std::mutex *waitLock, bool withFollowUp)
+{
+    Clock::time_point submitted = Clock::now();
+    queue->enqueue([=]()
+                   {
+                       double waitUs = std::chrono::duration<double, std::micro>(Clock::now() - submitted).count();
+                       {
+                           std::unique_lock<std::mutex> guard(*waitLock);
+                           waits->push_back(waitUs);
+                       }
+                       BusyWork(TaskWorkNs);
+                       if (withFollowUp)
+                           SubmitOne(queue, sample, waits, waitLock, false);
+                       sample->done++; });
+}
+
+static void RunOnce(const std::string &name, httplib::TaskQueue *queue, double rate, int tasksPerProducer)
+{
+    Sample sample;
+    // 每个生产者一组，减少记录等待时间时的竞争
+    std::vector<std::vector<double>> waits(Producers);
+    std::vector<std::mutex> waitLocks(Producers);
+    // 每个生产者的任务数，加上后续任务
+    size_t expected = 0;
+    for (int i = 0; i < tasksPerProducer; i++)
+        expected += (i % FollowUpEvery == 0) ? 2 : 1;
+    expected *= Producers;
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> producers;
+    for (int p = 0; p < Producers; p++)
+    {
+        producers.emplace_back([&, p]()
+                               {
+                                   // 生产者提交的任务的间隔，后续任务也算在速率里
+                                   std::chrono::nanoseconds interval(static_cast<int64_t>(1e9 * expected / tasksPerProducer / rate));
+                                   Clock::time_point next = Clock::now();
+                                   for (int i = 0; i < tasksPerProducer; i++)
+                                   {
+                                       while (Clock::now() < next)
+                                       {
+                                       }
+                                       next += interval;
+                                       SubmitOne(queue, &sample, &waits[p], &waitLocks[p], i % FollowUpEvery == 0);
+                                   } });
+    }
+    for (auto &producer : producers)
+        producer.join();
+    while (sample.done < expected)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    queue->shutdown();
+
+    std::vector<double> all;
+    for (auto &w : waits)
+        all.insert(all.end(), w.begin(), w.end());
+
+    std::cout << std::left << std::setw(20) << name << std::right
+              << std::setw(12) << static_cast<size_t>(expected / seconds) << " 任务/秒"
+              << "  等待 p50 " << std::setw(8) << Percentile(all, 0.50) << "us"
+              << "  p99 " << std::setw(8) << Percentile(all, 0.99) << "us"
+              << "  p999 " << std::setw(8) << Percentile(all, 0.999) << "us" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t threads = argc > 1 ? std::atoi(argv[1]) : 8;
+    double rate = argc > 2 ? std::atof(argv[2]) : 200000;
+    int tasksPerProducer = argc > 3 ? std::atoi(argv[3]) : 100000;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "工作线程" << threads << "个，生产者" << Producers << "个，每秒提交" << rate
+              << "个任务，每个生产者提交" << tasksPerProducer << "个任务" << std::endl;
+
+    for (int round = 0; round < 2; round++)
+    {
+        httplib::ThreadPool pool(threads);
+        RunOnce("httplib::ThreadPool", &pool, rate, tasksPerProducer);
+
+        StealingTaskQueue stealing(threads);
+        RunOnce("StealingTaskQueue", &stealing, rate, tasksPerProducer);
+        TaskQueueCounters counters = stealing.Stats()->Snapshot();
+        std::cout << "  偷取的任务 " << counters.stolen << "/" << counters.completed
+                  << "，队列深度峰值 " << counters.maxDepth << std::endl;
+    }
+    return 0;
+}
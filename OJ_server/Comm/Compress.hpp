@@ -0,0 +1,245 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <zlib.h>
+#ifdef OJ_BROTLI_SUPPORT
+#include <brotli/encode.h>
+#endif
+
+#include <boost/algorithm/string.hpp>
+
+namespace ns_Compress
+{
+    // 响应体的编码方式
+    enum Encoding
+    {
+        EncodingIdentity = 0,
+        EncodingGzip,
+        EncodingBrotli,
+        EncodingCount
+    };
+
+    // Content-Encoding中使用的名字
+    inline const char *EncodingName(Encoding encoding)
+    {
+        static const char *names[EncodingCount] = {"identity", "gzip", "br"};
+        return names[encoding];
+    }
+
+    // 一种编码方式的统计数据
+    struct CompressStats
+    {
+        uint64_t count;       // 压缩次数
+        uint64_t inputBytes;  // 压缩前的字节数
+        uint64_t outputBytes; // 压缩后的字节数
+        uint64_t cpuNs;       // 压缩花费的CPU时间，纳秒
+    };
+
+    // 压缩器
+    // 没有使用httplib自带的压缩（CPPHTTPLIB_ZLIB_SUPPORT），因为它对每个响应都重新压缩一遍
+    // 我们希望缓存的页面和静态文件只压缩一次，压缩结果和原文一起缓存起来，只有动态的响应才现场压缩
+    class Compressor
+    {
+    private:
+        std::atomic<int> _levels[EncodingCount];
+        std::atomic<uint64_t> _count[EncodingCount];
+        std::atomic<uint64_t> _inputBytes[EncodingCount];
+        std::atomic<uint64_t> _outputBytes[EncodingCount];
+        std::atomic<uint64_t> _cpuNs[EncodingCount];
+
+        Compressor()
+        {
+            for (int i = 0; i < EncodingCount; i++)
+            {
+                _levels[i] = 0;
+                _count[i] = 0;
+                _inputBytes[i] = 0;
+                _outputBytes[i] = 0;
+                _cpuNs[i] = 0;
+            }
+            _levels[EncodingGzip] = 6;
+            _levels[EncodingBrotli] = 5;
+        }
+
+        Compressor(const Compressor &) = delete;
+        Compressor &operator=(const Compressor &) = delete;
+
+    public:
+        static Compressor &Instance()
+        {
+            static Compressor compressor;
+            return compressor;
+        }
+
+    public:
+        // 压缩等级，gzip为1-9，brotli为0-11
+        void SetLevel(Encoding encoding, int level)
+        {
+            _levels[encoding] = level;
+        }
+
+        int Level(Encoding encoding) const
+        {
+            return _levels[encoding];
+        }
+
+        // 编译时是否支持这种编码
+        static bool IsSupported(Encoding encoding)
+        {
+#ifdef OJ_BROTLI_SUPPORT
+            return encoding != EncodingIdentity;
+#else
+            return encoding == EncodingGzip;
+#endif
+        }
+
+        // 这种类型的内容是否值得压缩，图片之类本身已经压缩过的就不用了
+        static bool IsCompressible(const std::string &contentType)
+        {
+            return contentType.compare(0, 5, "text/") == 0 ||
+                   contentType.find("json") != std::string::npos ||
+                   contentType.find("javascript") != std::string::npos ||
+                   contentType.find("xml") != std::string::npos ||
+                   contentType.find("svg") != std::string::npos;
+        }
+
+        // 根据请求头Accept-Encoding选择编码方式
+        // 选择q值最大的、我们支持的编码；q值相同的时候，brotli压缩率更高，优先选择
+        Encoding Negotiate(const std::string &acceptEncoding) const
+        {
+            std::vector<std::string> items;
+            boost::split(items, acceptEncoding, boost::is_any_of(","));
+
+            double quality[EncodingCount] = {0};
+            double wildcard = -1;
+            bool isListed[EncodingCount] = {false};
+            for (auto &item : items)
+            {
+                std::vector<std::string> parts;
+                boost::split(parts, item, boost::is_any_of(";"));
+                std::string name = boost::trim_copy(parts[0]);
+                double q = 1.0;
+                for (size_t i = 1; i < parts.size(); i++)
+                {
+                    std::string param = boost::trim_copy(parts[i]);
+                    if (param.compare(0, 2, "q=") == 0)
+                        q = std::atof(param.c_str() + 2);
+                }
+
+                if (name == "*")
+                {
+                    wildcard = q;
+                    continue;
+                }
+                for (int i = EncodingGzip; i < EncodingCount; i++)
+                {
+                    if (boost::iequals(name, EncodingName(static_cast<Encoding>(i))))
+                    {
+                        quality[i] = q;
+                        isListed[i] = true;
+                    }
+                }
+            }
+
+            Encoding best = EncodingIdentity;
+            double bestQuality = 0;
+            for (int i = EncodingCount - 1; i > EncodingIdentity; i--)
+            {
+                Encoding encoding = static_cast<Encoding>(i);
+                double q = isListed[i] ? quality[i] : (wildcard > 0 ? wildcard : 0);
+                if (IsSupported(encoding) && q > bestQuality)
+                {
+                    best = encoding;
+                    bestQuality = q;
+                }
+            }
+            return best;
+        }
+
+        // 压缩，压缩失败或者压缩之后没有变小都返回false
+        bool Compress(Encoding encoding, const char *data, size_t size, std::string *out)
+        {
+            if (!IsSupported(encoding) || size == 0)
+                return false;
+
+            uint64_t begin = ThreadCpuNs();
+            bool isCompress = encoding == EncodingGzip ? Gzip(data, size, _levels[encoding], out)
+                                                       : Brotli(data, size, _levels[encoding], out);
+            _cpuNs[encoding] += ThreadCpuNs() - begin;
+            if (!isCompress)
+                return false;
+
+            _count[encoding]++;
+            _inputBytes[encoding] += size;
+            _outputBytes[encoding] += out->size();
+            return out->size() < size;
+        }
+
+        CompressStats Stats(Encoding encoding) const
+        {
+            CompressStats stats;
+            stats.count = _count[encoding];
+            stats.inputBytes = _inputBytes[encoding];
+            stats.outputBytes = _outputBytes[encoding];
+            stats.cpuNs = _cpuNs[encoding];
+            return stats;
+        }
+
+    private:
+        static uint64_t ThreadCpuNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+            return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        static bool Gzip(const char *data, size_t size, int level, std::string *out)
+        {
+            z_stream stream;
+            stream.zalloc = Z_NULL;
+            stream.zfree = Z_NULL;
+            stream.opaque = Z_NULL;
+            // windowBits加上16，输出gzip格式而不是zlib格式
+            if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+
+            out->resize(deflateBound(&stream, size) + 32);
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+            stream.avail_in = size;
+            stream.next_out = reinterpret_cast<Bytef *>(&(*out)[0]);
+            stream.avail_out = out->size();
+
+            int ret = deflate(&stream, Z_FINISH);
+            out->resize(stream.total_out);
+            deflateEnd(&stream);
+            return ret == Z_STREAM_END;
+        }
+
+        static bool Brotli(const char *data, size_t size, int level, std::string *out)
+        {
+#ifdef OJ_BROTLI_SUPPORT
+            size_t outSize = BrotliEncoderMaxCompressedSize(size);
+            if (outSize == 0)
+                return false;
+            out->resize(outSize);
+            if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                                       reinterpret_cast<const uint8_t *>(data), &outSize,
+                                       reinterpret_cast<uint8_t *>(&(*out)[0])))
+                return false;
+            out->resize(outSize);
+            return true;
+#else
+            (void)data;
+            (void)size;
+            (void)level;
+            (void)out;
+            return false;
+#endif
+        }
+    };
+}
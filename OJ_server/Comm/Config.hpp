@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <fstream>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <boost/algorithm/string.hpp>
+
+#include "Log.hpp"
+
+namespace ns_Config
+{
+    using namespace ns_Log;
+
+    // 服务的配置文件
+    // 每行一项，格式为：键=值
+    // 空行和以#开头的行会被忽略；没有配置的项使用调用者给出的默认值
+    class Config
+    {
+    private:
+        std::unordered_map<std::string, std::string> _values;
+
+    public:
+        bool Load(const std::string &fileName)
+        {
+            std::ifstream in(fileName);
+            if (!in.is_open())
+            {
+                Log(Warnning) << "没有找到配置文件" << fileName << "，使用默认配置" << '\n';
+                return false;
+            }
+
+            std::string line;
+            while (std::getline(in, line))
+            {
+                boost::trim(line);
+                if (line.empty() || line[0] == '#')
+                    continue;
+
+                size_t pos = line.find('=');
+                if (pos == std::string::npos)
+                {
+                    Log(Warnning) << "配置文件" << fileName << "中的这一行格式不正确：" << line << '\n';
+                    continue;
+                }
+                _values[boost::trim_copy(line.substr(0, pos))] = boost::trim_copy(line.substr(pos + 1));
+            }
+            return true;
+        }
+
+        std::string GetString(const std::string &key, const std::string &defaultValue) const
+        {
+            auto iter = _values.find(key);
+            return iter == _values.end() ? defaultValue : iter->second;
+        }
+
+        int GetInt(const std::string &key, int defaultValue) const
+        {
+            auto iter = _values.find(key);
+            return iter == _values.end() ? defaultValue : std::atoi(iter->second.c_str());
+        }
+    };
+}
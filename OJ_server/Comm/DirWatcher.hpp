@@ -0,0 +1,169 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <unistd.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "Log.hpp"
+
+namespace ns_DirWatcher
+{
+    using namespace ns_Log;
+
+    // 目录监视器
+    // 基于inotify，监视一个目录以及它下面所有的子目录，目录中的文件发生变化时调用回调
+    // 修改一个题目往往要改好几个文件，编辑器保存的时候也会产生好几个事件，
+    // 所以事件到来之后不会马上回调，而是等目录安静下来（debounceMs内没有新的事件）之后再统一回调一次
+    class DirWatcher
+    {
+    private:
+        std::string _root;
+        std::function<void()> _onChange;
+        int _debounceMs;
+
+        int _inotifyFd;
+        std::unordered_map<int, std::string> _watches; // watch描述符 -> 目录
+
+        std::atomic<bool> _stop;
+        std::thread _thread;
+
+    public:
+        DirWatcher(const std::string &root, std::function<void()> onChange, int debounceMs = 300)
+            : _root(root), _onChange(std::move(onChange)), _debounceMs(debounceMs), _inotifyFd(-1), _stop(false)
+        {
+        }
+
+        ~DirWatcher()
+        {
+            Stop();
+        }
+
+        DirWatcher(const DirWatcher &) = delete;
+        DirWatcher &operator=(const DirWatcher &) = delete;
+
+    public:
+        bool Start()
+        {
+            _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (_inotifyFd < 0)
+            {
+                Log(Warnning) << "inotify初始化失败，无法监视目录" << _root << '\n';
+                return false;
+            }
+
+            AddWatchRecursive(_root);
+            _thread = std::thread([this]()
+                                  { WatchRoutine(); });
+            Log(Normal) << "开始监视目录" << _root << '\n';
+            return true;
+        }
+
+        void Stop()
+        {
+            _stop = true;
+            if (_thread.joinable())
+                _thread.join();
+            if (_inotifyFd >= 0)
+            {
+                close(_inotifyFd);
+                _inotifyFd = -1;
+            }
+        }
+
+    private:
+        void AddWatchRecursive(const std::string &dir)
+        {
+            int wd = inotify_add_watch(_inotifyFd, dir.c_str(),
+                                       IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF);
+            if (wd < 0)
+            {
+                Log(Warnning) << "无法监视目录" << dir << '\n';
+                return;
+            }
+            _watches[wd] = dir;
+
+            DIR *dp = opendir(dir.c_str());
+            if (dp == nullptr)
+                return;
+
+            struct dirent *entry = nullptr;
+            while ((entry = readdir(dp)) != nullptr)
+            {
+                std::string name = entry->d_name;
+                if (name == "." || name == "..")
+                    continue;
+
+                std::string path = dir + "/" + name;
+                struct stat st;
+                if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+                    AddWatchRecursive(path);
+            }
+            closedir(dp);
+        }
+
+        // 读取所有已到达的事件，返回是否有事件
+        bool DrainEvents()
+        {
+            bool hasEvent = false;
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            while (true)
+            {
+                ssize_t n = read(_inotifyFd, buffer, sizeof(buffer));
+                if (n <= 0)
+                    break;
+
+                for (char *p = buffer; p < buffer + n;)
+                {
+                    struct inotify_event *event = reinterpret_cast<struct inotify_event *>(p);
+                    hasEvent = true;
+
+                    // 新建了子目录，比如新增了一个题目，需要把它也监视起来
+                    if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len > 0)
+                    {
+                        auto iter = _watches.find(event->wd);
+                        if (iter != _watches.end())
+                            AddWatchRecursive(iter->second + "/" + event->name);
+                    }
+                    if (event->mask & IN_IGNORED)
+                        _watches.erase(event->wd);
+
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            return hasEvent;
+        }
+
+        void WatchRoutine()
+        {
+            bool pending = false;
+            while (!_stop)
+            {
+                struct pollfd pfd;
+                pfd.fd = _inotifyFd;
+                pfd.events = POLLIN;
+
+                // 有未处理的变化时，按防抖时间等待；否则每200ms醒一次，检查是否需要退出
+                int ret = poll(&pfd, 1, pending ? _debounceMs : 200);
+                if (ret > 0 && DrainEvents())
+                {
+                    pending = true;
+                    continue;
+                }
+
+                // 在防抖时间内没有新的事件了，开始回调
+                if (ret == 0 && pending)
+                {
+                    pending = false;
+                    _onChange();
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+#include "httplib.h"
+#include "Metrics.hpp"
+
+namespace ns_HttpMetrics
+{
+    using namespace ns_Metrics;
+
+    // 给一个路由的处理函数加上统计：处理时间的直方图，以及返回4xx、5xx的次数
+    // 指标在注册路由的时候就获取好，处理请求的时候只需要记录
+    // 用法：svr.Get("/Question/(\\d+)", Metered("/Question", [](const Request &req, Response &resp) {...}));
+    inline httplib::Server::Handler Metered(const std::string &route, httplib::Server::Handler handler)
+    {
+        Histogram *latency = Registry::Instance().GetHistogram("oj_http_request_duration_seconds",
+                                                               "处理HTTP请求的时间，不包括读请求和写响应", Label("route", route));
+        Counter *errors = Registry::Instance().GetCounter("oj_http_request_errors_total",
+                                                          "返回4xx和5xx的请求数", Label("route", route));
+        return [handler, latency, errors](const httplib::Request &req, httplib::Response &resp)
+        {
+            ScopedTimer timer(latency);
+            handler(req, resp);
+            // 处理函数没有设置状态码的时候，httplib最后会设置为200或者404
+            if (resp.status >= 400)
+                errors->Inc();
+        };
+    }
+
+    // /metrics接口，按Prometheus的文本格式导出所有指标
+    inline void ServeMetrics(const httplib::Request &, httplib::Response &resp)
+    {
+        std::string text;
+        Registry::Instance().Expose(&text);
+        resp.set_content(text, "text/plain; version=0.0.4; charset=utf-8");
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+
+#include <boost/utility/string_view.hpp>
+
+namespace ns_JsonWriter
+{
+    // 流式的JSON写入器
+    // Json::Value要先把整棵树在内存中建出来，每个字符串都要拷贝一份，再整体序列化一遍
+    // 这里直接把数据追加到输出字符串的末尾，字符串可以是指向题库快照的string_view，不产生中间对象
+    // 用法：
+    //  JsonWriter writer(&out);
+    //  writer.BeginObject().Key("Id").String(id).Key("Questions").BeginArray()...EndArray().EndObject();
+    class JsonWriter
+    {
+    private:
+        std::string *_out;
+        std::vector<bool> _isFirst; // 每一层对象或数组中，是否还没有写过元素
+        bool _isAfterKey;           // 刚写完键，下一个值前面不需要逗号
+
+    public:
+        explicit JsonWriter(std::string *out)
+            : _out(out), _isAfterKey(false)
+        {
+        }
+
+    public:
+        JsonWriter &BeginObject()
+        {
+            Separator();
+            _out->push_back('{');
+            _isFirst.push_back(true);
+            return *this;
+        }
+
+        JsonWriter &EndObject()
+        {
+            _out->push_back('}');
+            _isFirst.pop_back();
+            return *this;
+        }
+
+        JsonWriter &BeginArray()
+        {
+            Separator();
+            _out->push_back('[');
+            _isFirst.push_back(true);
+            return *this;
+        }
+
+        JsonWriter &EndArray()
+        {
+            _out->push_back(']');
+            _isFirst.pop_back();
+            return *this;
+        }
+
+        JsonWriter &Key(boost::string_view key)
+        {
+            Separator();
+            Escape(key);
+            _out->push_back(':');
+            _isAfterKey = true;
+            return *this;
+        }
+
+        JsonWriter &String(boost::string_view value)
+        {
+            Separator();
+            Escape(value);
+            return *this;
+        }
+
+        JsonWriter &Int(int64_t value)
+        {
+            Separator();
+            _out->append(std::to_string(value));
+            return *this;
+        }
+
+        JsonWriter &UInt(uint64_t value)
+        {
+            Separator();
+            _out->append(std::to_string(value));
+            return *this;
+        }
+
+        JsonWriter &Double(double value)
+        {
+            Separator();
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.17g", value);
+            _out->append(buffer);
+            return *this;
+        }
+
+        JsonWriter &Bool(bool value)
+        {
+            Separator();
+            _out->append(value ? "true" : "false");
+            return *this;
+        }
+
+        // 已经是JSON的值原样写入，比如保存下来的判题结果，调用者保证内容是合法的JSON
+        JsonWriter &Raw(boost::string_view json)
+        {
+            Separator();
+            _out->append(json.data(), json.size());
+            return *this;
+        }
+
+    private:
+        void Separator()
+        {
+            if (_isAfterKey)
+            {
+                _isAfterKey = false;
+                return;
+            }
+            if (_isFirst.empty())
+                return;
+            if (!_isFirst.back())
+                _out->push_back(',');
+            _isFirst.back() = false;
+        }
+
+        // 写入带引号的字符串，UTF-8字符原样输出，只转义JSON要求转义的字符
+        void Escape(boost::string_view value)
+        {
+            static const char digits[] = "0123456789abcdef";
+            _out->push_back('"');
+
+            size_t begin = 0;
+            for (size_t i = 0; i < value.size(); i++)
+            {
+                unsigned char c = value[i];
+                if (c >= 0x20 && c != '"' && c != '\\')
+                    continue;
+
+                // 先把前面不需要转义的一段整体拷贝过去
+                _out->append(value.data() + begin, i - begin);
+                begin = i + 1;
+                switch (c)
+                {
+                case '"':
+                    _out->append("\\\"");
+                    break;
+                case '\\':
+                    _out->append("\\\\");
+                    break;
+                case '\n':
+                    _out->append("\\n");
+                    break;
+                case '\r':
+                    _out->append("\\r");
+                    break;
+                case '\t':
+                    _out->append("\\t");
+                    break;
+                default:
+                    _out->append("\\u00");
+                    _out->push_back(digits[c >> 4]);
+                    _out->push_back(digits[c & 0xf]);
+                    break;
+                }
+            }
+            _out->append(value.data() + begin, value.size() - begin);
+            _out->push_back('"');
+        }
+    };
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <functional>
+
+namespace ns_LruCache
+{
+    // 缓存的统计数据
+    struct CacheStats
+    {
+        uint64_t hits;    // 命中次数
+        uint64_t misses;  // 未命中次数
+        size_t bytes;     // 当前占用的字节数
+        size_t entries;   // 当前缓存的条目数
+        size_t capacity;  // 容量，按字节计算
+    };
+
+    // 按字节限制大小的LRU缓存，线程安全
+    // 每个值的大小由构造时传入的函数计算，总大小超过容量时，淘汰最久没有被用过的值
+    template <class V>
+    class LruCache
+    {
+    private:
+        typedef std::pair<std::string, V> Entry;
+        typedef std::list<Entry> EntryList;
+
+        // 链表头部是最近使用的，尾部是最久没被使用的
+        EntryList _entries;
+        std::unordered_map<std::string, typename EntryList::iterator> _index;
+
+        std::function<size_t(const V &)> _sizeOf;
+        size_t _capacity;
+        size_t _bytes;
+        uint64_t _hits;
+        uint64_t _misses;
+
+        std::mutex _lock;
+
+    public:
+        LruCache(size_t capacity, std::function<size_t(const V &)> sizeOf)
+            : _sizeOf(std::move(sizeOf)), _capacity(capacity), _bytes(0), _hits(0), _misses(0)
+        {
+        }
+
+        LruCache(const LruCache &) = delete;
+        LruCache &operator=(const LruCache &) = delete;
+
+    public:
+        bool Get(const std::string &key, V *value)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            auto iter = _index.find(key);
+            if (iter == _index.end())
+            {
+                _misses++;
+                return false;
+            }
+
+            _hits++;
+            _entries.splice(_entries.begin(), _entries, iter->second);
+            *value = iter->second->second;
+            return true;
+        }
+
+        void Put(const std::string &key, const V &value)
+        {
+            size_t size = _sizeOf(value) + key.size();
+            if (size > _capacity)
+                return;
+
+            std::unique_lock<std::mutex> guard(_lock);
+            auto iter = _index.find(key);
+            if (iter != _index.end())
+                Erase(iter->second);
+
+            _entries.emplace_front(key, value);
+            _index[key] = _entries.begin();
+            _bytes += size;
+
+            while (_bytes > _capacity && !_entries.empty())
+            {
+                auto last = _entries.end();
+                --last;
+                Erase(last);
+            }
+        }
+
+        void Clear()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _entries.clear();
+            _index.clear();
+            _bytes = 0;
+        }
+
+        CacheStats Stats()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            CacheStats stats;
+            stats.hits = _hits;
+            stats.misses = _misses;
+            stats.bytes = _bytes;
+            stats.entries = _entries.size();
+            stats.capacity = _capacity;
+            return stats;
+        }
+
+    private:
+        // 需要在锁内调用
+        void Erase(typename EntryList::iterator iter)
+        {
+            _bytes -= _sizeOf(iter->second) + iter->first.size();
+            _index.erase(iter->first);
+            _entries.erase(iter);
+        }
+    };
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ns_MappedFile
+{
+    // 只读的内存映射文件
+    // 文件被整个映射到进程的地址空间中，读取的时候直接访问内存，由操作系统按需从页缓存中调入
+    // 多个进程映射同一个文件，共享的是同一份页缓存
+    class MappedFile
+    {
+    private:
+        const char *_data;
+        size_t _size;
+
+    public:
+        MappedFile()
+            : _data(nullptr), _size(0)
+        {
+        }
+
+        ~MappedFile()
+        {
+            Close();
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+    public:
+        bool Open(const std::string &fileName)
+        {
+            Close();
+
+            int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (fstat(fd, &st) < 0 || st.st_size == 0)
+            {
+                close(fd);
+                return false;
+            }
+
+            // 映射完成之后，文件描述符就可以关闭了，映射依然有效
+            void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED)
+                return false;
+
+            _data = static_cast<const char *>(addr);
+            _size = st.st_size;
+            return true;
+        }
+
+        void Close()
+        {
+            if (_data != nullptr)
+            {
+                munmap(const_cast<char *>(_data), _size);
+                _data = nullptr;
+                _size = 0;
+            }
+        }
+
+        const char *Data() const
+        {
+            return _data;
+        }
+
+        size_t Size() const
+        {
+            return _size;
+        }
+    };
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+
+namespace ns_Metrics
+{
+    // 计数器和直方图分成多少份，每个线程固定写其中一份，读的时候把所有份加起来
+    // 所有线程都去加同一个原子变量的话，这个变量所在的缓存行会在CPU之间来回传递，线程越多越慢
+    const size_t MetricShards = 16;
+
+    // 当前线程写第几份，线程第一次记录的时候分配
+    inline size_t ShardIndex()
+    {
+        static std::atomic<size_t> next(0);
+        static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % MetricShards;
+        return index;
+    }
+
+    // 独占一个缓存行的原子变量
+    struct PaddedCounter
+    {
+        std::atomic<uint64_t> value;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+
+        PaddedCounter() : value(0)
+        {
+        }
+    };
+
+    // 只增不减的计数器
+    class Counter
+    {
+    private:
+        PaddedCounter _shards[MetricShards];
+
+    public:
+        void Inc(uint64_t n = 1)
+        {
+            _shards[ShardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t Value() const
+        {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < MetricShards; i++)
+                sum += _shards[i].value.load(std::memory_order_relaxed);
+            return sum;
+        }
+    };
+
+    // 可增可减的当前值，比如正在处理的请求数
+    class Gauge
+    {
+    private:
+        std::atomic<int64_t> _value;
+
+    public:
+        Gauge() : _value(0)
+        {
+        }
+
+        void Set(int64_t value)
+        {
+            _value.store(value, std::memory_order_relaxed);
+        }
+
+        void Add(int64_t delta)
+        {
+            _value.fetch_add(delta, std::memory_order_relaxed);
+        }
+
+        int64_t Value() const
+        {
+            return _value.load(std::memory_order_relaxed);
+        }
+    };
+
+    // 固定分桶的直方图，分桶的方式和HDR直方图一样：按2的幂分成若干段，每段再平均分成4个桶
+    // 这样任何一个值所在的桶，上下界相差不超过25%，从1微秒到几天都能用同一套桶表示
+    // 记录一个值只需要算一次前导零、加两个原子变量
+    class Histogram
+    {
+    public:
+        static const size_t SubBucketBits = 2;
+        static const size_t SubBuckets = 1 << SubBucketBits;
+        static const size_t MaxExponent = 42; // 2^42微秒大约是50天，再大的值都放进最后一个桶
+        static const size_t BucketCount = SubBuckets + (MaxExponent - SubBucketBits + 1) * SubBuckets;
+
+    private:
+        struct Shard
+        {
+            std::atomic<uint64_t> counts[BucketCount];
+            PaddedCounter sum;
+
+            Shard()
+            {
+                for (size_t i = 0; i < BucketCount; i++)
+                    counts[i].store(0, std::memory_order_relaxed);
+            }
+        };
+
+        Shard _shards[MetricShards];
+        double _scale; // 导出的时候，把记录的整数值乘以这个系数，比如微秒转换为秒
+
+    public:
+        explicit Histogram(double scale = 1e-6)
+            : _scale(scale)
+        {
+        }
+
+    public:
+        void Record(uint64_t value)
+        {
+            Shard &shard = _shards[ShardIndex()];
+            shard.counts[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+            shard.sum.value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        double Scale() const
+        {
+            return _scale;
+        }
+
+        // 值所在的桶
+        static size_t Bucket(uint64_t value)
+        {
+            if (value < SubBuckets)
+                return value;
+            size_t exponent = 63 - __builtin_clzll(value);
+            if (exponent > MaxExponent)
+                return BucketCount - 1;
+            size_t sub = (value >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+            return SubBuckets + (exponent - SubBucketBits) * SubBuckets + sub;
+        }
+
+        // 桶中最大的值（包含）
+        static uint64_t UpperBound(size_t bucket)
+        {
+            if (bucket < SubBuckets)
+                return bucket;
+            size_t exponent = (bucket - SubBuckets) / SubBuckets + SubBucketBits;
+            uint64_t sub = (bucket - SubBuckets) % SubBuckets;
+            return ((SubBuckets + sub + 1) << (exponent - SubBucketBits)) - 1;
+        }
+
+        // 所有份加起来的每个桶的计数、总和以及总数
+        void Snapshot(std::vector<uint64_t> *counts, uint64_t *sum, uint64_t *count) const
+        {
+            counts->assign(BucketCount, 0);
+            *sum = 0;
+            *count = 0;
+            for (size_t s = 0; s < MetricShards; s++)
+            {
+                for (size_t b = 0; b < BucketCount; b++)
+                {
+                    uint64_t n = _shards[s].counts[b].load(std::memory_order_relaxed);
+                    (*counts)[b] += n;
+                    *count += n;
+                }
+                *sum += _shards[s].sum.value.load(std::memory_order_relaxed);
+            }
+        }
+
+        // 估算分位数，q在0到1之间，返回桶的上界（已经乘以系数）
+        double Percentile(double q) const
+        {
+            std::vector<uint64_t> counts;
+            uint64_t sum = 0, count = 0;
+            Snapshot(&counts, &sum, &count);
+            if (count == 0)
+                return 0;
+
+            uint64_t rank = static_cast<uint64_t>(q * count);
+            uint64_t seen = 0;
+            for (size_t b = 0; b < BucketCount; b++)
+            {
+                seen += counts[b];
+                if (seen > rank)
+                    return UpperBound(b) * _scale;
+            }
+            return UpperBound(BucketCount - 1) * _scale;
+        }
+    };
+
+    // 记录一段代码执行的时间（微秒），离开作用域的时候写进直方图
+    // histogram为空的时候只计时，可以用ElapsedUs()自己决定记不记录（比如fork之后只在父进程记录）
+    class ScopedTimer
+    {
+    private:
+        Histogram *_histogram;
+        std::chrono::steady_clock::time_point _start;
+
+    public:
+        explicit ScopedTimer(Histogram *histogram)
+            : _histogram(histogram), _start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~ScopedTimer()
+        {
+            if (_histogram)
+                _histogram->Record(ElapsedUs());
+        }
+
+        uint64_t ElapsedUs() const
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+    };
+
+    // 生成一个标签，值中的特殊字符会被转义，比如 Label("route", "/Judge") 为 route="/Judge"
+    inline std::string Label(const std::string &key, const std::string &value)
+    {
+        std::string label = key + "=\"";
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+                label += '\\';
+            if (c == '\n')
+            {
+                label += "\\n";
+                continue;
+            }
+            label += c;
+        }
+        label += '"';
+        return label;
+    }
+
+    // 所有指标的注册表，/metrics接口按Prometheus的文本格式导出
+    // 获取指标需要加锁查表，热点路径上应该只获取一次，把返回的指针保存下来（指标不会被删除，指针一直有效）
+    class Registry
+    {
+    public:
+        enum MetricType
+        {
+            CounterType,
+            GaugeType,
+            HistogramType
+        };
+
+    private:
+        // 同一个名字、不同标签的一组指标
+        struct Series
+        {
+            std::string labels;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+            std::function<double()> callback; // 导出的时候才去读取的指标，比如缓存的统计数据、队列的长度
+        };
+
+        struct Family
+        {
+            std::string help;
+            MetricType type;
+            std::vector<std::unique_ptr<Series>> series;
+        };
+
+        std::mutex _lock;
+        std::map<std::string, Family> _families;
+        std::string _constLabels; // 导出的时候加在每个指标前面的标签
+
+    public:
+        static Registry &Instance()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+    public:
+        Counter *GetCounter(const std::string &name, const std::string &help, const std::string &labels = "")
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            Series *series = FindOrCreate(name, help, CounterType, labels);
+            if (!series->counter)
+                series->counter.reset(new Counter());
+            return series->counter.get();
+        }
+
+        Gauge *GetGauge(const std::string &name, const std::string &help, const std::string &labels = "")
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            Series *series = FindOrCreate(name, help, GaugeType, labels);
+            if (!series->gauge)
+                series->gauge.reset(new Gauge());
+            return series->gauge.get();
+        }
+
+        // 记录的值的单位为微秒，导出的时候转换为秒，名字应该以_seconds结尾
+        Histogram *GetHistogram(const std::string &name, const std::string &help, const std::string &labels = "")
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            Series *series = FindOrCreate(name, help, HistogramType, labels);
+            if (!series->histogram)
+                series->histogram.reset(new Histogram());
+            return series->histogram.get();
+        }
+
+        // 导出的时候调用callback获取当前值，type为CounterType或GaugeType
+        // 同一个名字和标签再次注册会替换掉原来的callback
+        void SetCallback(const std::string &name, const std::string &help, MetricType type, const std::string &labels,
+                         std::function<double()> callback)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            FindOrCreate(name, help, type, labels)->callback = callback;
+        }
+
+        // 加在所有指标上的标签，比如多进程模式下的 worker="0"
+        // 注册表是每个进程一份，不加标签的话，抓取落在哪个进程上就是哪个进程的计数，同一个指标会忽大忽小
+        void SetConstLabels(const std::string &labels)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _constLabels = labels;
+        }
+
+        // Prometheus文本格式
+        void Expose(std::string *out)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            out->clear();
+            for (auto &item : _families)
+            {
+                const std::string &name = item.first;
+                const Family &family = item.second;
+                out->append("# HELP ").append(name).append(" ").append(family.help).append("\n");
+                out->append("# TYPE ").append(name).append(" ").append(TypeName(family.type)).append("\n");
+
+                for (const auto &series : family.series)
+                {
+                    std::string labels = _constLabels.empty() || series->labels.empty() ? _constLabels + series->labels
+                                                                                        : _constLabels + ',' + series->labels;
+                    if (family.type == HistogramType && series->histogram)
+                    {
+                        ExposeHistogram(name, labels, *series->histogram, out);
+                        continue;
+                    }
+
+                    double value = 0;
+                    if (series->callback)
+                        value = series->callback();
+                    else if (series->counter)
+                        value = series->counter->Value();
+                    else if (series->gauge)
+                        value = series->gauge->Value();
+                    AppendSample(name, labels, value, out);
+                }
+            }
+        }
+
+    private:
+        Series *FindOrCreate(const std::string &name, const std::string &help, MetricType type, const std::string &labels)
+        {
+            Family &family = _families[name];
+            if (family.series.empty())
+            {
+                family.help = help;
+                family.type = type;
+            }
+            for (auto &series : family.series)
+            {
+                if (series->labels == labels)
+                    return series.get();
+            }
+            family.series.emplace_back(new Series());
+            family.series.back()->labels = labels;
+            return family.series.back().get();
+        }
+
+        static const char *TypeName(MetricType type)
+        {
+            switch (type)
+            {
+            case CounterType:
+                return "counter";
+            case GaugeType:
+                return "gauge";
+            default:
+                return "histogram";
+            }
+        }
+
+        static std::string FormatNumber(double value)
+        {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%.9g", value);
+            return buffer;
+        }
+
+        static void AppendSample(const std::string &name, const std::string &labels, double value, std::string *out)
+        {
+            out->append(name);
+            if (!labels.empty())
+                out->append("{").append(labels).append("}");
+            out->append(" ").append(FormatNumber(value)).append("\n");
+        }
+
+        // 直方图的桶是累计的：le="x"表示小于等于x的值的个数
+        // 每次抓取、每个工作进程导出的le都必须是同一组，否则按le把多个进程加起来的时候累计值会变小，histogram_quantile算出来的也不对
+        // 全部168个桶太多，只在每个2的幂的段末导出一次，le为2^k-1，相邻的边界差一倍；更细的分位数在进程内用Percentile估算
+        static void ExposeHistogram(const std::string &name, const std::string &labels, const Histogram &histogram, std::string *out)
+        {
+            std::vector<uint64_t> counts;
+            uint64_t sum = 0, count = 0;
+            histogram.Snapshot(&counts, &sum, &count);
+
+            std::string prefix = labels.empty() ? "" : labels + ",";
+            uint64_t cumulative = 0;
+            for (size_t b = 0; b < counts.size(); b++)
+            {
+                cumulative += counts[b];
+                if ((b + 1) % Histogram::SubBuckets != 0)
+                    continue;
+                AppendSample(name + "_bucket", prefix + "le=\"" + FormatNumber(Histogram::UpperBound(b) * histogram.Scale()) + "\"",
+                             cumulative, out);
+            }
+            AppendSample(name + "_bucket", prefix + "le=\"+Inf\"", count, out);
+            AppendSample(name + "_sum", labels, sum * histogram.Scale(), out);
+            AppendSample(name + "_count", labels, count, out);
+        }
+    };
+}
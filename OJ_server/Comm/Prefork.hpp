@@ -0,0 +1,312 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <ctime>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "Log.hpp"
+
+namespace ns_Prefork
+{
+    using namespace ns_Log;
+
+    // 工作进程的入口，slot为工作进程的编号（同一时刻不会有两个活着的进程使用同一个编号）
+    // 工作进程准备好接受连接之后，调用NotifyReady(readyFd)通知主进程，返回值为进程的退出码
+    typedef std::function<int(size_t slot, int readyFd)> WorkerMain;
+
+    // 等待新的工作进程准备好的最长时间
+    const int ReadyTimeoutSec = 60;
+    // 让旧的工作进程退出之后，最多等它多久，超时就强制杀掉
+    const int RetireTimeoutSec = 40;
+
+    // 工作进程准备好了
+    inline void NotifyReady(int readyFd)
+    {
+        if (readyFd < 0)
+            return;
+        char c = 1;
+        ssize_t n = write(readyFd, &c, 1);
+        (void)n;
+        close(readyFd);
+    }
+
+    // 多进程模式的主进程
+    // 主进程只负责创建和管理工作进程，自己不处理请求，也不创建任何线程（fork之后只有调用fork的线程还在，带着线程fork是不安全的）
+    // 每个工作进程各自监听同一个端口（SO_REUSEPORT），由内核把新连接分给它们，一个进程崩溃不影响其他进程
+    // 信号：
+    //  SIGHUP：滚动重启，一个一个地替换工作进程，先启动新的，新的准备好之后再让旧的退出，服务不中断
+    //          新的工作进程从主进程fork出来，运行的还是主进程启动时的程序，要读新的配置需要WorkerMain自己在fork之后读
+    //          升级程序不能靠SIGHUP：另外启动一个新的主进程，两边的工作进程用SO_REUSEPORT同时监听，新的准备好之后再让旧的主进程退出
+    //  SIGTERM、SIGINT：让所有工作进程处理完手上的请求之后退出，然后主进程退出
+    // 工作进程意外退出的时候，会被马上重新启动
+    class Master
+    {
+    private:
+        struct Worker
+        {
+            pid_t pid;
+            size_t slot;
+            int readyFd;     // 工作进程准备好之后会写这个管道
+            bool isReady;
+            bool isRetiring; // 主进程让它退出的，退出之后不用重启
+            time_t startTime;
+        };
+
+        size_t _workerCount;
+        WorkerMain _main;
+        std::function<void(size_t slot)> _onExit;
+        std::vector<Worker> _workers;
+        std::vector<bool> _isSlotUsed;
+        bool _isStopping;
+        sigset_t _oldMask;
+
+    public:
+        // 滚动重启的时候，新旧两个进程会同时存在，所以编号的数量是工作进程数的两倍
+        Master(size_t workerCount, WorkerMain main)
+            : _workerCount(workerCount == 0 ? 1 : workerCount), _main(main),
+              _isSlotUsed(SlotCount(workerCount == 0 ? 1 : workerCount), false), _isStopping(false)
+        {
+        }
+
+        static size_t SlotCount(size_t workerCount)
+        {
+            return workerCount * 2;
+        }
+
+        // 工作进程退出之后调用，可以用来清理这个编号在共享内存中的数据
+        void SetExitHandler(std::function<void(size_t slot)> onExit)
+        {
+            _onExit = onExit;
+        }
+
+        int Run()
+        {
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigaddset(&mask, SIGCHLD);
+            sigaddset(&mask, SIGHUP);
+            sigaddset(&mask, SIGTERM);
+            sigaddset(&mask, SIGINT);
+            sigprocmask(SIG_BLOCK, &mask, &_oldMask);
+
+            Log(Normal) << "主进程" << getpid() << "启动" << _workerCount << "个工作进程" << '\n';
+            for (size_t i = 0; i < _workerCount; i++)
+                Spawn();
+
+            while (!_isStopping || !_workers.empty())
+            {
+                struct timespec timeout = {1, 0};
+                int sig = sigtimedwait(&mask, nullptr, &timeout);
+                if (sig == SIGHUP && !_isStopping)
+                {
+                    RollingRestart();
+                }
+                else if ((sig == SIGTERM || sig == SIGINT) && !_isStopping)
+                {
+                    Log(Normal) << "主进程收到退出信号，等待所有工作进程退出" << '\n';
+                    _isStopping = true;
+                    for (auto &worker : _workers)
+                        kill(worker.pid, SIGTERM);
+                }
+                Reap();
+                CheckReady();
+            }
+
+            Log(Normal) << "所有工作进程已经退出，主进程退出" << '\n';
+            return 0;
+        }
+
+    private:
+        bool Spawn()
+        {
+            size_t slot = 0;
+            while (slot < _isSlotUsed.size() && _isSlotUsed[slot])
+                slot++;
+            if (slot == _isSlotUsed.size())
+            {
+                Log(Error) << "没有空闲的工作进程编号" << '\n';
+                return false;
+            }
+
+            int pipeFd[2];
+            if (pipe2(pipeFd, O_CLOEXEC) < 0)
+            {
+                Log(Error) << "创建管道失败" << '\n';
+                return false;
+            }
+
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                Log(Error) << "创建工作进程失败" << '\n';
+                close(pipeFd[0]);
+                close(pipeFd[1]);
+                return false;
+            }
+            if (pid == 0)
+            {
+                close(pipeFd[0]);
+                sigprocmask(SIG_SETMASK, &_oldMask, nullptr);
+                _exit(_main(slot, pipeFd[1]));
+            }
+
+            close(pipeFd[1]);
+            Worker worker;
+            worker.pid = pid;
+            worker.slot = slot;
+            worker.readyFd = pipeFd[0];
+            worker.isReady = false;
+            worker.isRetiring = false;
+            worker.startTime = time(nullptr);
+            _workers.push_back(worker);
+            _isSlotUsed[slot] = true;
+            Log(Normal) << "工作进程" << pid << "已启动，编号" << slot << '\n';
+            return true;
+        }
+
+        // 回收已经退出的工作进程，意外退出的马上重启
+        void Reap()
+        {
+            int status = 0;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                for (auto iter = _workers.begin(); iter != _workers.end(); iter++)
+                {
+                    if (iter->pid != pid)
+                        continue;
+
+                    Worker worker = *iter;
+                    _workers.erase(iter);
+                    if (worker.readyFd >= 0)
+                        close(worker.readyFd);
+                    _isSlotUsed[worker.slot] = false;
+                    if (_onExit)
+                        _onExit(worker.slot);
+
+                    if (worker.isRetiring || _isStopping)
+                    {
+                        Log(Normal) << "工作进程" << pid << "已退出" << '\n';
+                        break;
+                    }
+
+                    Log(Error) << "工作进程" << pid << "意外退出，状态" << status << "，重新启动" << '\n';
+                    // 刚启动就退出的进程，很可能一启动就会崩溃，稍等一下再重启，避免不停地fork
+                    if (time(nullptr) - worker.startTime < 1)
+                        sleep(1);
+                    Spawn();
+                    break;
+                }
+            }
+        }
+
+        // 看看哪些工作进程已经准备好了
+        void CheckReady()
+        {
+            for (auto &worker : _workers)
+            {
+                if (worker.isReady || worker.readyFd < 0)
+                    continue;
+
+                struct pollfd pfd;
+                pfd.fd = worker.readyFd;
+                pfd.events = POLLIN;
+                if (poll(&pfd, 1, 0) <= 0)
+                    continue;
+
+                char c = 0;
+                worker.isReady = read(worker.readyFd, &c, 1) == 1;
+                close(worker.readyFd);
+                worker.readyFd = -1;
+            }
+        }
+
+        Worker *FindWorker(pid_t pid)
+        {
+            for (auto &worker : _workers)
+            {
+                if (worker.pid == pid)
+                    return &worker;
+            }
+            return nullptr;
+        }
+
+        // 滚动重启，每次只替换一个工作进程，任何时候都至少有workerCount个进程在接受连接
+        void RollingRestart()
+        {
+            Log(Normal) << "开始滚动重启工作进程" << '\n';
+            std::vector<pid_t> olds;
+            for (auto &worker : _workers)
+            {
+                if (!worker.isRetiring)
+                    olds.push_back(worker.pid);
+            }
+
+            for (pid_t old : olds)
+            {
+                if (FindWorker(old) == nullptr)
+                    continue;
+                if (!Spawn())
+                    return;
+
+                pid_t young = _workers.back().pid;
+                if (!WaitReady(young))
+                {
+                    Log(Error) << "新的工作进程" << young << "没有准备好，停止滚动重启" << '\n';
+                    return;
+                }
+
+                Worker *worker = FindWorker(old);
+                if (worker == nullptr)
+                    continue;
+                worker->isRetiring = true;
+                kill(old, SIGTERM);
+                WaitExit(old);
+            }
+            Log(Normal) << "滚动重启完成" << '\n';
+        }
+
+        bool WaitReady(pid_t pid)
+        {
+            time_t deadline = time(nullptr) + ReadyTimeoutSec;
+            while (time(nullptr) < deadline)
+            {
+                Reap();
+                CheckReady();
+                Worker *worker = FindWorker(pid);
+                if (worker == nullptr)
+                    return false;
+                if (worker->isReady)
+                    return true;
+                if (worker->readyFd < 0)
+                    return false;
+                usleep(100 * 1000);
+            }
+            return false;
+        }
+
+        void WaitExit(pid_t pid)
+        {
+            time_t deadline = time(nullptr) + RetireTimeoutSec;
+            while (FindWorker(pid) != nullptr)
+            {
+                if (time(nullptr) >= deadline)
+                {
+                    Log(Warnning) << "工作进程" << pid << "没有按时退出，强制结束" << '\n';
+                    kill(pid, SIGKILL);
+                    deadline = time(nullptr) + RetireTimeoutSec;
+                }
+                usleep(100 * 1000);
+                Reap();
+            }
+        }
+    };
+}
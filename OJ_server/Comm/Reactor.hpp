@@ -0,0 +1,711 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "httplib.h"
+#include "Log.hpp"
+
+namespace ns_Reactor
+{
+    using namespace ns_Log;
+
+    // 请求头的最大长度，超过这个长度还没有收到完整的请求头，就认为是恶意的连接
+    const size_t MaxHeaderSize = 64 * 1024;
+    // 每次从socket读取的大小
+    const size_t ReadChunkSize = 16 * 1024;
+    // 停止的时候，最多等待多久让正在处理的请求完成
+    const time_t DrainTimeoutSec = 30;
+    // 停止的时候，刚接受的连接还没有发来请求，最多等待多久
+    const time_t DrainGraceSec = 2;
+
+    // 把一个完整的请求交给httplib处理的流
+    // 读：只读这个请求的字节，读完之后返回0，保证httplib不会多读，把后面流水线发来的请求吃掉
+    // 写：socket是非阻塞的，写满了就用poll等待可写，直到写完或者超时
+    // 设置了文件来源之后，下一次写不看传进来的数据，而是用sendfile从文件直接写到socket
+    class BufferedStream : public httplib::Stream
+    {
+    private:
+        int _fd;
+        const std::string &_request;
+        size_t _pos;
+        std::string _ip;
+        int _port;
+        int _writeTimeoutMs;
+        int _fileFd;
+        off_t _fileOffset;
+
+    public:
+        BufferedStream(int fd, const std::string &request, const std::string &ip, int port, int writeTimeoutMs)
+            : _fd(fd), _request(request), _pos(0), _ip(ip), _port(port), _writeTimeoutMs(writeTimeoutMs), _fileFd(-1), _fileOffset(0)
+        {
+        }
+
+        // 当前工作线程正在回复的流，只在ReactorServer处理请求期间有效
+        static BufferedStream *&Current()
+        {
+            static thread_local BufferedStream *stream = nullptr;
+            return stream;
+        }
+
+        void SetFileSource(int fileFd, size_t offset)
+        {
+            _fileFd = fileFd;
+            _fileOffset = static_cast<off_t>(offset);
+        }
+
+        bool is_readable() const override
+        {
+            return _pos < _request.size();
+        }
+
+        bool is_writable() const override
+        {
+            struct pollfd pfd;
+            pfd.fd = _fd;
+            pfd.events = POLLOUT;
+            return poll(&pfd, 1, _writeTimeoutMs) > 0 && (pfd.revents & POLLOUT);
+        }
+
+        ssize_t read(char *ptr, size_t size) override
+        {
+            size_t n = std::min(size, _request.size() - _pos);
+            memcpy(ptr, _request.data() + _pos, n);
+            _pos += n;
+            return n;
+        }
+
+        ssize_t write(const char *ptr, size_t size) override
+        {
+            if (_fileFd >= 0)
+                return WriteFile(size);
+
+            size_t written = 0;
+            while (written < size)
+            {
+                ssize_t n = send(_fd, ptr + written, size - written, MSG_NOSIGNAL);
+                if (n > 0)
+                {
+                    written += n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && is_writable())
+                    continue;
+                return -1;
+            }
+            return written;
+        }
+
+        void get_remote_ip_and_port(std::string &ip, int &port) const override
+        {
+            ip = _ip;
+            port = _port;
+        }
+
+        socket_t socket() const override
+        {
+            return _fd;
+        }
+
+    private:
+        // 文件被截断、sendfile读不到数据的时候返回-1，这个响应失败
+        ssize_t WriteFile(size_t size)
+        {
+            int fileFd = _fileFd;
+            _fileFd = -1;
+            size_t written = 0;
+            while (written < size)
+            {
+                ssize_t n = sendfile(_fd, fileFd, &_fileOffset, size - written);
+                if (n > 0)
+                {
+                    written += n;
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && is_writable())
+                    continue;
+                return -1;
+            }
+            return written;
+        }
+    };
+
+    // 基于epoll的HTTP服务
+    // httplib::Server每个连接占用一个工作线程，keep-alive的连接即使什么都不发，也会一直阻塞在读上
+    // 几百个空闲的浏览器就能把线程池占满，判题请求只能排队
+    // 这里由少数几个IO线程用epoll同时管理所有的连接，只有收到一个完整的请求之后，才交给工作线程处理
+    // 工作线程用httplib原来的路由和处理函数处理请求，写完响应之后，再把连接交还给IO线程
+    class ReactorServer : public httplib::Server
+    {
+    private:
+        struct Connection
+        {
+            int fd;
+            std::string ip;
+            int port;
+            std::string buffer;     // 已经收到、还没有处理的数据
+            bool isBusy;            // 正在被工作线程处理
+            bool isContinueSent;    // 已经回复过100 Continue
+            bool isCloseAfterReply; // 回复完当前的请求就关闭连接，请求体太大、没有读完的时候后面的数据已经对不上了
+            size_t requestCount;    // 这个连接上处理过的请求数
+            time_t lastActive;      // 最后一次活动的时间，用来关闭空闲的连接
+        };
+
+        // 一个IO线程，有自己的epoll和自己管理的连接
+        struct Loop
+        {
+            int epollFd;
+            std::thread thread;
+            bool isDetached; // 停止的时候，已经不再接受新的连接
+            std::mutex lock; // 保护connections，以及连接的isBusy和lastActive
+            std::unordered_map<int, Connection *> connections;
+        };
+
+        int _listenFd;
+        size_t _ioThreads;
+        std::vector<std::unique_ptr<Loop>> _loops;
+        std::unique_ptr<httplib::TaskQueue> _workers;
+        std::atomic<bool> _isRunning;
+        std::atomic<size_t> _detachedLoops;
+        std::atomic<size_t> _connectionCount;
+
+    public:
+        explicit ReactorServer(size_t ioThreads = 2)
+            : _listenFd(-1), _ioThreads(ioThreads == 0 ? 1 : ioThreads), _isRunning(false), _detachedLoops(0), _connectionCount(0)
+        {
+        }
+
+        ~ReactorServer()
+        {
+            Stop();
+        }
+
+    public:
+        // 开始服务，阻塞直到Stop被调用
+        bool Listen(const std::string &host, int port)
+        {
+            return Bind(host, port) && ListenAfterBind();
+        }
+
+        // 只创建监听的socket，不开始服务
+        // 多进程模式下，新的工作进程绑定好端口之后就可以通知主进程，让旧的进程退出了
+        bool Bind(const std::string &host, int port)
+        {
+            RaiseFileLimit();
+            if (!CreateListenSocket(host, port))
+                return false;
+            Log(Normal) << "服务开始监听" << host << ":" << port << "，IO线程" << _ioThreads << "个" << '\n';
+            return true;
+        }
+
+        // 在Bind之后开始服务，阻塞直到Stop被调用，并且处理完已经收到的请求
+        bool ListenAfterBind()
+        {
+            if (_listenFd < 0)
+                return false;
+
+            _workers.reset(new_task_queue());
+            _isRunning = true;
+            _detachedLoops = 0;
+            // httplib用svr_sock_判断服务是否正在关闭，无效的时候内容提供者不会写出任何数据
+            svr_sock_ = _listenFd;
+            for (size_t i = 0; i < _ioThreads; i++)
+            {
+                std::unique_ptr<Loop> loop(new Loop());
+                loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+                loop->isDetached = false;
+                // 每个IO线程都监听同一个socket，EPOLLEXCLUSIVE保证一个新连接只唤醒一个线程
+                struct epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                event.data.ptr = nullptr;
+                epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, _listenFd, &event);
+                _loops.push_back(std::move(loop));
+            }
+            for (auto &loop : _loops)
+            {
+                Loop *raw = loop.get();
+                loop->thread = std::thread([this, raw]()
+                                           { LoopRoutine(raw); });
+            }
+
+            for (auto &loop : _loops)
+                loop->thread.join();
+            // 等工作线程把手上的请求处理完，它们看到服务已经停止，会自己关闭连接
+            svr_sock_ = INVALID_SOCKET;
+            _workers->shutdown();
+            for (auto &loop : _loops)
+            {
+                for (auto &item : loop->connections)
+                {
+                    close(item.first);
+                    delete item.second;
+                }
+                close(loop->epollFd);
+            }
+            _loops.clear();
+            if (_listenFd >= 0)
+                close(_listenFd);
+            _listenFd = -1;
+            Log(Normal) << "服务已经停止" << '\n';
+            return true;
+        }
+
+        // 停止服务：不再接受新的连接，已经收到的请求处理完之后，关闭所有的连接
+        // 只修改一个原子变量，可以在信号处理函数中调用
+        void Stop()
+        {
+            _isRunning = false;
+        }
+
+        size_t ConnectionCount() const
+        {
+            return _connectionCount;
+        }
+
+        // 在内容提供函数中调用，把文件的[offset, offset+length)写进响应
+        // 由ReactorServer处理的请求，数据用sendfile从文件直接写到socket，不经过用户态
+        // httplib只有通过sink写出的数据才算数，所以仍然调用一次sink.write，数据指针不会被读，由流换成sendfile
+        // 当前线程没有在ReactorServer中处理请求的时候返回false，调用者自己读出来再写
+        static bool SendFile(int fileFd, size_t offset, size_t length, httplib::DataSink &sink)
+        {
+            BufferedStream *stream = BufferedStream::Current();
+            if (stream == nullptr)
+                return false;
+            if (length == 0)
+                return true;
+            stream->SetFileSource(fileFd, offset);
+            sink.write(nullptr, length);
+            return true;
+        }
+
+    private:
+        // 一万个连接需要一万个文件描述符，默认的软限制通常只有1024
+        static void RaiseFileLimit()
+        {
+            struct rlimit limit;
+            if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+            {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+        }
+
+        bool CreateListenSocket(const std::string &host, int port)
+        {
+            _listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (_listenFd < 0)
+                return false;
+
+            int yes = 1;
+            setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            setsockopt(_listenFd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1 ||
+                bind(_listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+                ::listen(_listenFd, SOMAXCONN) < 0)
+            {
+                Log(Error) << "监听" << host << ":" << port << "失败：" << strerror(errno) << '\n';
+                close(_listenFd);
+                _listenFd = -1;
+                return false;
+            }
+            return true;
+        }
+
+        void LoopRoutine(Loop *loop)
+        {
+            const int maxEvents = 256;
+            struct epoll_event events[maxEvents];
+            time_t lastSweep = time(nullptr);
+            time_t drainDeadline = 0;
+
+            while (true)
+            {
+                if (!_isRunning)
+                {
+                    if (!loop->isDetached)
+                    {
+                        drainDeadline = time(nullptr) + DrainTimeoutSec;
+                        Detach(loop);
+                    }
+                    // 停止的时候，空闲的连接马上关闭，正在处理和收了一半的请求等它们完成
+                    CloseIdle(loop, time(nullptr), true);
+                    if (IsEmpty(loop) || time(nullptr) >= drainDeadline)
+                        break;
+                }
+
+                int n = epoll_wait(loop->epollFd, events, maxEvents, _isRunning ? 1000 : 100);
+                for (int i = 0; i < n; i++)
+                {
+                    if (events[i].data.ptr == nullptr)
+                        Accept(loop);
+                    else
+                        OnReadable(loop, static_cast<Connection *>(events[i].data.ptr));
+                }
+
+                time_t now = time(nullptr);
+                if (now != lastSweep)
+                {
+                    lastSweep = now;
+                    CloseIdle(loop, now, false);
+                }
+            }
+
+            // 超过了等待的时间，关闭剩下的空闲连接，正在处理的连接由工作线程处理完之后关闭
+            std::unique_lock<std::mutex> guard(loop->lock);
+            for (auto iter = loop->connections.begin(); iter != loop->connections.end();)
+            {
+                Connection *conn = (iter++)->second;
+                if (!conn->isBusy)
+                    CloseLocked(loop, conn);
+            }
+        }
+
+        // 不再接受新的连接
+        // 已经在监听socket的队列中的连接，内核已经完成了握手，关闭监听socket会把它们重置，所以先把它们全部接受下来
+        // 最后一个离开的IO线程关闭监听socket，之后新的连接由其他进程（SO_REUSEPORT）接受
+        void Detach(Loop *loop)
+        {
+            epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, _listenFd, nullptr);
+            Accept(loop);
+            loop->isDetached = true;
+            if (++_detachedLoops == _loops.size())
+            {
+                Accept(loop);
+                close(_listenFd);
+                _listenFd = -1;
+            }
+        }
+
+        bool IsEmpty(Loop *loop)
+        {
+            std::unique_lock<std::mutex> guard(loop->lock);
+            return loop->connections.empty();
+        }
+
+        void Accept(Loop *loop)
+        {
+            while (true)
+            {
+                struct sockaddr_storage addr;
+                socklen_t len = sizeof(addr);
+                int fd = accept4(_listenFd, reinterpret_cast<struct sockaddr *>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                    return;
+
+                int yes = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+                Connection *conn = new Connection();
+                conn->fd = fd;
+                conn->port = 0;
+                conn->isBusy = false;
+                conn->isContinueSent = false;
+                conn->isCloseAfterReply = false;
+                conn->requestCount = 0;
+                conn->lastActive = time(nullptr);
+                char ip[INET6_ADDRSTRLEN] = {0};
+                if (getnameinfo(reinterpret_cast<struct sockaddr *>(&addr), len, ip, sizeof(ip), nullptr, 0, NI_NUMERICHOST) == 0)
+                    conn->ip = ip;
+                if (addr.ss_family == AF_INET)
+                    conn->port = ntohs(reinterpret_cast<struct sockaddr_in *>(&addr)->sin_port);
+                else if (addr.ss_family == AF_INET6)
+                    conn->port = ntohs(reinterpret_cast<struct sockaddr_in6 *>(&addr)->sin6_port);
+
+                {
+                    std::unique_lock<std::mutex> guard(loop->lock);
+                    loop->connections[fd] = conn;
+                }
+                _connectionCount++;
+                Arm(loop, conn, EPOLL_CTL_ADD);
+            }
+        }
+
+        // 连接只在一个地方被处理：EPOLLONESHOT保证一次事件之后就不再通知，处理完再重新注册
+        static void Arm(Loop *loop, Connection *conn, int op)
+        {
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            event.data.ptr = conn;
+            epoll_ctl(loop->epollFd, op, conn->fd, &event);
+        }
+
+        void OnReadable(Loop *loop, Connection *conn)
+        {
+            bool isClosed = false;
+            char buffer[ReadChunkSize];
+            while (true)
+            {
+                ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+                if (n > 0)
+                {
+                    conn->buffer.append(buffer, n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                    isClosed = true;
+                break;
+            }
+
+            {
+                std::unique_lock<std::mutex> guard(loop->lock);
+                conn->lastActive = time(nullptr);
+            }
+            // 对方已经关闭了连接，已经收到的请求也没法回复了
+            if (isClosed)
+            {
+                Close(loop, conn);
+                return;
+            }
+            TryDispatch(loop, conn);
+        }
+
+        // 缓冲区中有完整的请求，就交给工作线程；否则继续等待数据
+        void TryDispatch(Loop *loop, Connection *conn)
+        {
+            size_t length = 0;
+            int framing = FrameRequest(conn, &length);
+            if (framing < 0)
+            {
+                Close(loop, conn);
+                return;
+            }
+            if (framing == 0)
+            {
+                // 在锁内清除isBusy并重新注册，避免清理空闲连接的时候把它关掉
+                std::unique_lock<std::mutex> guard(loop->lock);
+                conn->isBusy = false;
+                Arm(loop, conn, EPOLL_CTL_MOD);
+                return;
+            }
+
+            {
+                std::unique_lock<std::mutex> guard(loop->lock);
+                conn->isBusy = true;
+            }
+            std::shared_ptr<std::string> request = std::make_shared<std::string>(conn->buffer, 0, length);
+            conn->buffer.erase(0, length);
+            if (conn->isCloseAfterReply)
+                conn->buffer.clear();
+            // 100 Continue已经由IO线程回复过了，去掉Expect，避免httplib再回复一次
+            if (conn->isContinueSent)
+                RemoveHeader(request.get(), "Expect");
+            conn->isContinueSent = false;
+            _workers->enqueue([this, loop, conn, request]()
+                              { Process(loop, conn, *request); });
+        }
+
+        // 在工作线程中处理一个请求
+        void Process(Loop *loop, Connection *conn, const std::string &request)
+        {
+            conn->requestCount++;
+            bool closeConnection = !_isRunning || conn->requestCount >= keep_alive_max_count_ || conn->isCloseAfterReply;
+            bool connectionClosed = false;
+
+            BufferedStream stream(conn->fd, request, conn->ip, conn->port,
+                                  static_cast<int>(write_timeout_sec_ * 1000 + write_timeout_usec_ / 1000));
+            BufferedStream::Current() = &stream;
+            bool isOk = process_request(stream, closeConnection, connectionClosed, nullptr);
+            BufferedStream::Current() = nullptr;
+
+            if (!isOk || closeConnection || connectionClosed)
+            {
+                Close(loop, conn);
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> guard(loop->lock);
+                conn->lastActive = time(nullptr);
+            }
+
+            // 流水线：客户端可能已经把下一个请求发过来了，没有的话重新交给IO线程等待
+            TryDispatch(loop, conn);
+        }
+
+        // 判断缓冲区开头是不是一个完整的请求
+        // 返回1表示完整，length为请求的长度；返回0表示还需要更多数据；返回-1表示请求有问题，需要关闭连接
+        int FrameRequest(Connection *conn, size_t *length)
+        {
+            const std::string &buffer = conn->buffer;
+            size_t headerEnd = buffer.find("\r\n\r\n");
+            if (headerEnd == std::string::npos)
+                return buffer.size() > MaxHeaderSize ? -1 : 0;
+            headerEnd += 4;
+
+            std::string contentLength = HeaderValue(buffer, headerEnd, "Content-Length");
+            std::string transferEncoding = HeaderValue(buffer, headerEnd, "Transfer-Encoding");
+
+            // 客户端要求先确认再发送请求体
+            if (!conn->isContinueSent && strcasecmp(HeaderValue(buffer, headerEnd, "Expect").c_str(), "100-continue") == 0 &&
+                buffer.size() == headerEnd)
+            {
+                const char *reply = "HTTP/1.1 100 Continue\r\n\r\n";
+                send(conn->fd, reply, strlen(reply), MSG_NOSIGNAL);
+                conn->isContinueSent = true;
+            }
+
+            if (strcasecmp(transferEncoding.c_str(), "chunked") == 0)
+                return FrameChunked(buffer, headerEnd, length);
+
+            size_t bodyLength = contentLength.empty() ? 0 : std::strtoull(contentLength.c_str(), nullptr, 10);
+            // 请求体超过限制，只把请求头交给httplib去回复413
+            // 请求体不会再读了，缓冲区中剩下的数据不能当成下一个请求，回复之后关闭连接
+            if (bodyLength > payload_max_length_)
+            {
+                *length = headerEnd;
+                conn->isCloseAfterReply = true;
+                return 1;
+            }
+            if (buffer.size() < headerEnd + bodyLength)
+                return 0;
+            *length = headerEnd + bodyLength;
+            return 1;
+        }
+
+        // 分块传输的请求体：若干个 长度\r\n数据\r\n，最后是 0\r\n，然后是可选的尾部和\r\n
+        int FrameChunked(const std::string &buffer, size_t pos, size_t *length)
+        {
+            size_t total = 0;
+            while (true)
+            {
+                size_t lineEnd = buffer.find("\r\n", pos);
+                if (lineEnd == std::string::npos)
+                    return 0;
+                char *end = nullptr;
+                unsigned long long size = std::strtoull(buffer.c_str() + pos, &end, 16);
+                if (end == buffer.c_str() + pos)
+                    return -1;
+                pos = lineEnd + 2;
+
+                if (size == 0)
+                {
+                    size_t trailerEnd = buffer.find("\r\n", pos);
+                    while (trailerEnd != std::string::npos && trailerEnd != pos)
+                    {
+                        pos = trailerEnd + 2;
+                        trailerEnd = buffer.find("\r\n", pos);
+                    }
+                    if (trailerEnd == std::string::npos)
+                        return 0;
+                    *length = trailerEnd + 2;
+                    return 1;
+                }
+
+                total += size;
+                if (total > payload_max_length_)
+                    return -1;
+                if (buffer.size() < pos + size + 2)
+                    return 0;
+                pos += size + 2;
+            }
+        }
+
+        // 在请求头中查找一个字段的值，字段名不区分大小写
+        static std::string HeaderValue(const std::string &buffer, size_t headerEnd, const char *name)
+        {
+            size_t nameLength = strlen(name);
+            size_t pos = buffer.find("\r\n");
+            while (pos != std::string::npos && pos + 2 < headerEnd)
+            {
+                pos += 2;
+                size_t lineEnd = buffer.find("\r\n", pos);
+                if (lineEnd == std::string::npos || lineEnd >= headerEnd)
+                    break;
+                if (lineEnd - pos > nameLength && buffer[pos + nameLength] == ':' &&
+                    strncasecmp(buffer.c_str() + pos, name, nameLength) == 0)
+                {
+                    size_t begin = pos + nameLength + 1;
+                    while (begin < lineEnd && (buffer[begin] == ' ' || buffer[begin] == '\t'))
+                        begin++;
+                    size_t end = lineEnd;
+                    while (end > begin && (buffer[end - 1] == ' ' || buffer[end - 1] == '\t'))
+                        end--;
+                    return buffer.substr(begin, end - begin);
+                }
+                pos = lineEnd;
+            }
+            return std::string();
+        }
+
+        // 从请求头中删除一个字段
+        static void RemoveHeader(std::string *request, const char *name)
+        {
+            size_t nameLength = strlen(name);
+            size_t headerEnd = request->find("\r\n\r\n");
+            size_t pos = request->find("\r\n");
+            while (pos != std::string::npos && pos < headerEnd)
+            {
+                size_t lineEnd = request->find("\r\n", pos + 2);
+                if (lineEnd - pos - 2 > nameLength && (*request)[pos + 2 + nameLength] == ':' &&
+                    strncasecmp(request->c_str() + pos + 2, name, nameLength) == 0)
+                {
+                    request->erase(pos, lineEnd - pos);
+                    return;
+                }
+                pos = lineEnd;
+            }
+        }
+
+        // 关闭超过keep-alive超时时间没有活动的空闲连接
+        // isDraining为true时，关闭所有没有未完成请求的连接；刚接受、还没有发来请求的连接，给它一点时间把请求发过来
+        void CloseIdle(Loop *loop, time_t now, bool isDraining)
+        {
+            std::unique_lock<std::mutex> guard(loop->lock);
+            for (auto iter = loop->connections.begin(); iter != loop->connections.end();)
+            {
+                Connection *conn = (iter++)->second;
+                if (conn->isBusy)
+                    continue;
+                bool isIdle = isDraining ? conn->buffer.empty() && (conn->requestCount > 0 || now - conn->lastActive > DrainGraceSec)
+                                         : now - conn->lastActive > keep_alive_timeout_sec_;
+                if (isIdle)
+                    CloseLocked(loop, conn);
+            }
+        }
+
+        void Close(Loop *loop, Connection *conn)
+        {
+            std::unique_lock<std::mutex> guard(loop->lock);
+            CloseLocked(loop, conn);
+        }
+
+        void CloseLocked(Loop *loop, Connection *conn)
+        {
+            epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+            close(conn->fd);
+            loop->connections.erase(conn->fd);
+            delete conn;
+            _connectionCount--;
+        }
+    };
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace ns_SharedCounter
+{
+    // 放在共享内存中、多个进程都能读写的计数器表
+    // 表有若干行，每个进程只修改自己的那一行，读的时候把所有行加起来
+    // 这样一个进程崩溃了，主进程把它的那一行清零，它没来得及减掉的计数也就一起清掉了，不会永远留在表里
+    // 必须在fork之前创建，子进程继承同一块共享内存
+    class SharedCounterTable
+    {
+    private:
+        size_t _rows;
+        size_t _columns;
+        std::atomic<uint64_t> *_cells;
+
+    public:
+        SharedCounterTable(size_t rows, size_t columns)
+            : _rows(rows), _columns(columns), _cells(nullptr)
+        {
+            void *memory = mmap(nullptr, Bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory != MAP_FAILED)
+            {
+                // 匿名映射的内容全是0，对于无锁的64位原子变量，全0就是值为0的对象
+                _cells = static_cast<std::atomic<uint64_t> *>(memory);
+            }
+        }
+
+        ~SharedCounterTable()
+        {
+            if (_cells)
+                munmap(_cells, Bytes());
+        }
+
+        SharedCounterTable(const SharedCounterTable &) = delete;
+        SharedCounterTable &operator=(const SharedCounterTable &) = delete;
+
+    public:
+        bool IsValid() const
+        {
+            return _cells != nullptr;
+        }
+
+        size_t Rows() const
+        {
+            return _rows;
+        }
+
+        size_t Columns() const
+        {
+            return _columns;
+        }
+
+        void Add(size_t row, size_t column, int64_t delta)
+        {
+            _cells[row * _columns + column].fetch_add(static_cast<uint64_t>(delta), std::memory_order_relaxed);
+        }
+
+        uint64_t Get(size_t row, size_t column) const
+        {
+            return _cells[row * _columns + column].load(std::memory_order_relaxed);
+        }
+
+        void Set(size_t row, size_t column, uint64_t value)
+        {
+            _cells[row * _columns + column].store(value, std::memory_order_relaxed);
+        }
+
+        // 所有进程的计数之和
+        uint64_t Sum(size_t column) const
+        {
+            uint64_t sum = 0;
+            for (size_t row = 0; row < _rows; row++)
+                sum += _cells[row * _columns + column].load(std::memory_order_relaxed);
+            return sum;
+        }
+
+        // 清空一个进程的所有计数
+        void ClearRow(size_t row)
+        {
+            for (size_t column = 0; column < _columns; column++)
+                _cells[row * _columns + column].store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        size_t Bytes() const
+        {
+            return _rows * _columns * sizeof(std::atomic<uint64_t>);
+        }
+    };
+}
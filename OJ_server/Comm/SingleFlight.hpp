@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+
+namespace ns_SingleFlight
+{
+    // 合并相同的并发请求
+    // 同一时间，有多个线程要做同一件事情（键相同），那么只让第一个线程真正去做，其余的线程等着，做完之后所有线程拿到同一个结果
+    // 和缓存不同，SingleFlight只管正在进行中的请求，请求一结束，键就被删除了
+    template <class T>
+    class SingleFlight
+    {
+    private:
+        // 一次正在进行中的调用
+        struct Call
+        {
+            std::mutex lock;
+            std::condition_variable cond;
+            bool done;
+            T value;
+
+            Call()
+                : done(false)
+            {
+            }
+        };
+
+        std::unordered_map<std::string, std::shared_ptr<Call>> _calls;
+        std::mutex _lock;
+
+    public:
+        SingleFlight()
+        {
+        }
+        ~SingleFlight()
+        {
+        }
+
+        SingleFlight(const SingleFlight &) = delete;
+        SingleFlight &operator=(const SingleFlight &) = delete;
+
+    public:
+        // 执行键为key的任务，结果写入out
+        // 返回true表示是当前线程执行的task，返回false表示结果来自于其他线程的执行
+        bool Do(const std::string &key, const std::function<T()> &task, T *out)
+        {
+            std::shared_ptr<Call> call;
+            bool isLeader = false;
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                auto iter = _calls.find(key);
+                if (iter == _calls.end())
+                {
+                    call = std::make_shared<Call>();
+                    _calls[key] = call;
+                    isLeader = true;
+                }
+                else
+                {
+                    call = iter->second;
+                }
+            }
+
+            // 跟随者：等待领头的线程做完
+            if (!isLeader)
+            {
+                std::unique_lock<std::mutex> guard(call->lock);
+                call->cond.wait(guard, [&call]()
+                                { return call->done; });
+                *out = call->value;
+                return false;
+            }
+
+            // 领头者：执行任务，然后唤醒所有等待的线程
+            // 任务抛出异常的时候同样要删掉键、唤醒等待的线程，它们拿到空的结果；否则它们和之后相同的请求会永远等下去
+            T value;
+            try
+            {
+                value = task();
+            }
+            catch (...)
+            {
+                Finish(key, call, T());
+                throw;
+            }
+            Finish(key, call, value);
+
+            *out = std::move(value);
+            return true;
+        }
+
+        // 当前正在进行中的调用数量
+        size_t InFlight()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            return _calls.size();
+        }
+
+    private:
+        // 一次调用结束：之后到达的请求重新执行，正在等待的线程拿到value
+        void Finish(const std::string &key, const std::shared_ptr<Call> &call, const T &value)
+        {
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _calls.erase(key);
+            }
+            {
+                std::unique_lock<std::mutex> guard(call->lock);
+                call->value = value;
+                call->done = true;
+            }
+            call->cond.notify_all();
+        }
+    };
+}
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <jsoncpp/json/json.h>
+
+#include "httplib.h"
+#include "Metrics.hpp"
+
+namespace ns_TaskQueue
+{
+    using namespace ns_Metrics;
+
+    // 任务队列的统计数据
+    struct TaskQueueCounters
+    {
+        size_t threads = 0;
+        size_t depth = 0;     // 当前排队的任务数
+        size_t maxDepth = 0;  // 排队任务数的峰值
+        size_t enqueued = 0;  // 提交的任务总数
+        size_t completed = 0; // 完成的任务总数
+        size_t stolen = 0;    // 从其他线程的队列偷来的任务数
+        uint64_t waitNs = 0;  // 任务从提交到开始执行的总时间
+        uint64_t maxWaitNs = 0;
+        uint64_t runNs = 0; // 任务执行的总时间
+    };
+
+    // 统计数据单独放在一个对象里
+    // 队列归httplib所有，服务停止的时候就会被销毁，管理接口通过这个对象读取统计数据
+    class TaskQueueStats
+    {
+    private:
+        std::atomic<size_t> _threads;
+        std::atomic<size_t> _depth;
+        std::atomic<size_t> _maxDepth;
+        std::atomic<size_t> _enqueued;
+        std::atomic<size_t> _completed;
+        std::atomic<size_t> _stolen;
+        std::atomic<uint64_t> _waitNs;
+        std::atomic<uint64_t> _maxWaitNs;
+        std::atomic<uint64_t> _runNs;
+        Histogram *_waitHistogram; // 注册到/metrics之后，记录每个任务的等待时间
+
+    public:
+        TaskQueueStats()
+            : _threads(0), _depth(0), _maxDepth(0), _enqueued(0), _completed(0), _stolen(0),
+              _waitNs(0), _maxWaitNs(0), _runNs(0), _waitHistogram(nullptr)
+        {
+        }
+
+    public:
+        void SetThreads(size_t threads)
+        {
+            _threads = threads;
+        }
+
+        void OnEnqueue()
+        {
+            _enqueued.fetch_add(1, std::memory_order_relaxed);
+            UpdateMax(_maxDepth, _depth.fetch_add(1, std::memory_order_relaxed) + 1);
+        }
+
+        void OnStart(uint64_t waitNs, bool isStolen)
+        {
+            _depth.fetch_sub(1, std::memory_order_relaxed);
+            _waitNs.fetch_add(waitNs, std::memory_order_relaxed);
+            UpdateMax(_maxWaitNs, waitNs);
+            if (_waitHistogram)
+                _waitHistogram->Record(waitNs / 1000);
+            if (isStolen)
+                _stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void OnFinish(uint64_t runNs)
+        {
+            _completed.fetch_add(1, std::memory_order_relaxed);
+            _runNs.fetch_add(runNs, std::memory_order_relaxed);
+        }
+
+        TaskQueueCounters Snapshot() const
+        {
+            TaskQueueCounters counters;
+            counters.threads = _threads;
+            counters.depth = _depth;
+            counters.maxDepth = _maxDepth;
+            counters.enqueued = _enqueued;
+            counters.completed = _completed;
+            counters.stolen = _stolen;
+            counters.waitNs = _waitNs;
+            counters.maxWaitNs = _maxWaitNs;
+            counters.runNs = _runNs;
+            return counters;
+        }
+
+        // 统计数据的json，用于管理接口
+        void ToJson(std::string *outJson) const
+        {
+            TaskQueueCounters counters = Snapshot();
+            size_t started = counters.enqueued - counters.depth;
+
+            Json::Value outValue;
+            outValue["Threads"] = static_cast<Json::UInt64>(counters.threads);
+            outValue["Depth"] = static_cast<Json::UInt64>(counters.depth);
+            outValue["MaxDepth"] = static_cast<Json::UInt64>(counters.maxDepth);
+            outValue["Enqueued"] = static_cast<Json::UInt64>(counters.enqueued);
+            outValue["Completed"] = static_cast<Json::UInt64>(counters.completed);
+            outValue["Stolen"] = static_cast<Json::UInt64>(counters.stolen);
+            outValue["AvgWaitUs"] = started ? counters.waitNs / 1e3 / started : 0.0;
+            outValue["MaxWaitUs"] = counters.maxWaitNs / 1e3;
+            outValue["AvgRunUs"] = counters.completed ? counters.runNs / 1e3 / counters.completed : 0.0;
+
+            Json::StyledWriter writer;
+            *outJson = writer.write(outValue);
+        }
+
+        // 把统计数据注册为/metrics中的指标，需要在队列开始工作之前调用
+        void RegisterMetrics()
+        {
+            Registry &registry = Registry::Instance();
+            _waitHistogram = registry.GetHistogram("oj_taskqueue_wait_seconds", "任务从提交到开始执行等待的时间");
+            registry.SetCallback("oj_taskqueue_threads", "工作线程数", Registry::GaugeType, "", [this]()
+                                 { return static_cast<double>(_threads.load()); });
+            registry.SetCallback("oj_taskqueue_depth", "正在排队的任务数", Registry::GaugeType, "", [this]()
+                                 { return static_cast<double>(_depth.load()); });
+            registry.SetCallback("oj_taskqueue_tasks_total", "完成的任务数", Registry::CounterType, "", [this]()
+                                 { return static_cast<double>(_completed.load()); });
+            registry.SetCallback("oj_taskqueue_stolen_total", "从其他线程的队列偷来的任务数", Registry::CounterType, "", [this]()
+                                 { return static_cast<double>(_stolen.load()); });
+        }
+
+    private:
+        template <class T>
+        static void UpdateMax(std::atomic<T> &target, T value)
+        {
+            T current = target.load(std::memory_order_relaxed);
+            while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+    };
+
+    // 每个线程一个队列、可以互相偷任务的任务队列，用来替换httplib自带的线程池
+    // httplib的线程池所有线程共用一个链表、一把锁和一个条件变量，请求多的时候线程都在抢这把锁
+    // 这里每个工作线程有自己的队列和锁：
+    //  外部线程（接受连接的线程、IO线程）提交的任务轮流放到各个线程的队列中
+    //  工作线程自己提交的任务（比如处理完一个请求之后，接着处理同一个连接上的下一个请求）放到自己的队列中
+    //  自己的队列空了，就去其他线程的队列里偷一个任务，保证不会有线程闲着而其他队列还在排队
+    // 线程数在运行时指定，可以来自配置文件
+    class StealingTaskQueue : public httplib::TaskQueue
+    {
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Task
+        {
+            std::function<void()> fn;
+            Clock::time_point enqueueTime;
+        };
+
+        struct Worker
+        {
+            std::mutex lock;
+            std::deque<Task> tasks;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::atomic<size_t> _next;    // 外部提交的任务轮流放到各个队列中
+        std::atomic<size_t> _pending; // 所有队列中的任务总数
+
+        // 没有任务的线程在这里睡眠
+        std::mutex _sleepLock;
+        std::condition_variable _sleepCond;
+        std::atomic<size_t> _sleepers;
+        bool _stop;
+
+        std::shared_ptr<TaskQueueStats> _stats;
+
+    public:
+        StealingTaskQueue(size_t threadNum, std::shared_ptr<TaskQueueStats> stats = nullptr)
+            : _next(0), _pending(0), _sleepers(0), _stop(false),
+              _stats(stats ? stats : std::make_shared<TaskQueueStats>())
+        {
+            if (threadNum == 0)
+                threadNum = DefaultThreads();
+            _stats->SetThreads(threadNum);
+
+            for (size_t i = 0; i < threadNum; i++)
+                _workers.emplace_back(new Worker());
+            for (size_t i = 0; i < threadNum; i++)
+            {
+                _workers[i]->thread = std::thread([this, i]()
+                                                  { WorkerRoutine(i); });
+            }
+        }
+
+        ~StealingTaskQueue()
+        {
+            shutdown();
+        }
+
+        StealingTaskQueue(const StealingTaskQueue &) = delete;
+        StealingTaskQueue &operator=(const StealingTaskQueue &) = delete;
+
+    public:
+        // 默认的线程数，和httplib一样取CPU核数，但至少8个，判题请求会阻塞在等待编译运行的结果上
+        static size_t DefaultThreads()
+        {
+            size_t cores = std::thread::hardware_concurrency();
+            return cores > 8 ? cores : 8;
+        }
+
+        size_t Size() const
+        {
+            return _workers.size();
+        }
+
+        const std::shared_ptr<TaskQueueStats> &Stats() const
+        {
+            return _stats;
+        }
+
+        void enqueue(std::function<void()> fn) override
+        {
+            Task task;
+            task.fn = std::move(fn);
+            task.enqueueTime = Clock::now();
+
+            size_t index = CurrentQueue() == this ? CurrentIndex() : _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+            {
+                std::unique_lock<std::mutex> guard(_workers[index]->lock);
+                _workers[index]->tasks.push_back(std::move(task));
+            }
+            _stats->OnEnqueue();
+            _pending.fetch_add(1);
+
+            // 有线程在睡眠才需要唤醒，忙的时候不用碰睡眠的锁
+            if (_sleepers.load() > 0)
+            {
+                std::unique_lock<std::mutex> guard(_sleepLock);
+                _sleepCond.notify_one();
+            }
+        }
+
+        // 停止的时候，把队列中剩下的任务做完再退出
+        void shutdown() override
+        {
+            {
+                std::unique_lock<std::mutex> guard(_sleepLock);
+                if (_stop)
+                    return;
+                _stop = true;
+            }
+            _sleepCond.notify_all();
+
+            for (auto &worker : _workers)
+            {
+                if (worker->thread.joinable())
+                    worker->thread.join();
+            }
+        }
+
+    private:
+        // 当前线程所属的队列和它在队列中的编号，不是工作线程的话为空
+        static StealingTaskQueue *&CurrentQueue()
+        {
+            static thread_local StealingTaskQueue *queue = nullptr;
+            return queue;
+        }
+
+        static size_t &CurrentIndex()
+        {
+            static thread_local size_t index = 0;
+            return index;
+        }
+
+        void WorkerRoutine(size_t index)
+        {
+            CurrentQueue() = this;
+            CurrentIndex() = index;
+
+            while (true)
+            {
+                Task task;
+                bool isStolen = false;
+                if (Pop(index, &task) || (isStolen = Steal(index, &task)))
+                {
+                    Run(task, isStolen);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> guard(_sleepLock);
+                _sleepers.fetch_add(1);
+                _sleepCond.wait(guard, [this]()
+                                { return _stop || _pending.load() > 0; });
+                _sleepers.fetch_sub(1);
+                if (_stop && _pending.load() == 0)
+                    return;
+            }
+        }
+
+        // 从自己的队列头部取出最早提交的任务，请求按到达的顺序处理
+        bool Pop(size_t index, Task *task)
+        {
+            Worker &worker = *_workers[index];
+            std::unique_lock<std::mutex> guard(worker.lock);
+            if (worker.tasks.empty())
+                return false;
+
+            *task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            _pending.fetch_sub(1);
+            return true;
+        }
+
+        // 从其他线程的队列中偷一个任务，从自己的下一个开始找，避免所有线程都去偷同一个队列
+        // 先用try_lock转一圈，不在别人持有的锁上排队；一个都没偷到的时候，再阻塞地锁一遍刚才没锁上的队列
+        // 否则任务恰好在一个正被持有的队列里，_pending大于0，睡眠的条件不成立，线程会一直空转
+        bool Steal(size_t index, Task *task)
+        {
+            std::vector<Worker *> contended;
+            for (size_t i = 1; i < _workers.size(); i++)
+            {
+                Worker &victim = *_workers[(index + i) % _workers.size()];
+                std::unique_lock<std::mutex> guard(victim.lock, std::try_to_lock);
+                if (!guard.owns_lock())
+                {
+                    contended.push_back(&victim);
+                    continue;
+                }
+                if (TakeFront(victim, task))
+                    return true;
+            }
+
+            for (Worker *victim : contended)
+            {
+                std::unique_lock<std::mutex> guard(victim->lock);
+                if (TakeFront(*victim, task))
+                    return true;
+            }
+            return false;
+        }
+
+        // 需要持有worker的锁
+        bool TakeFront(Worker &worker, Task *task)
+        {
+            if (worker.tasks.empty())
+                return false;
+            *task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            _pending.fetch_sub(1);
+            return true;
+        }
+
+        void Run(Task &task, bool isStolen)
+        {
+            Clock::time_point start = Clock::now();
+            _stats->OnStart(std::chrono::duration_cast<std::chrono::nanoseconds>(start - task.enqueueTime).count(), isStolen);
+            task.fn();
+            _stats->OnFinish(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+    };
+}
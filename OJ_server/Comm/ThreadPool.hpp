@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace ns_ThreadPool
+{
+    // 固定线程数的线程池
+    // 和httplib自带的线程池不同，这里的线程池是给我们自己的任务用的，比如嵌入模式下的编译运行
+    // 编译运行都是很重的任务，不能放在httplib处理连接的线程上无限制地跑，所以单独用一个池子来限制并发
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> _workers;
+        std::queue<std::function<void()>> _tasks;
+
+        std::mutex _lock;
+        std::condition_variable _cond;
+        bool _stop;
+
+    public:
+        explicit ThreadPool(size_t threadNum)
+            : _stop(false)
+        {
+            if (threadNum == 0)
+                threadNum = 1;
+
+            for (size_t i = 0; i < threadNum; i++)
+            {
+                _workers.emplace_back([this]()
+                                      { WorkerRoutine(); });
+            }
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _stop = true;
+            }
+            _cond.notify_all();
+
+            for (auto &worker : _workers)
+            {
+                worker.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+    public:
+        size_t Size() const
+        {
+            return _workers.size();
+        }
+
+        // 提交一个任务，返回的future可以用来等待任务的结果
+        template <class F>
+        std::future<typename std::result_of<F()>::type> Submit(F task)
+        {
+            typedef typename std::result_of<F()>::type ReturnType;
+
+            auto packaged = std::make_shared<std::packaged_task<ReturnType()>>(std::move(task));
+            std::future<ReturnType> result = packaged->get_future();
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _tasks.emplace([packaged]()
+                               { (*packaged)(); });
+            }
+            _cond.notify_one();
+
+            return result;
+        }
+
+    private:
+        void WorkerRoutine()
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> guard(_lock);
+                    _cond.wait(guard, [this]()
+                               { return _stop || !_tasks.empty(); });
+
+                    // 停止的时候，把队列中剩下的任务做完再退出
+                    if (_stop && _tasks.empty())
+                        return;
+
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+
+                task();
+            }
+        }
+    };
+}
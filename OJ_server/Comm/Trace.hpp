@@ -0,0 +1,357 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstdio>
+#include <cctype>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "JsonWriter.hpp"
+
+namespace ns_Trace
+{
+    using namespace ns_JsonWriter;
+
+    // 在服务之间传递追踪编号的请求头
+    // OJ_Server把请求发给CompileServer的时候带上这个头，CompileServer记录的阶段就和OJ_Server的属于同一次追踪
+    // 请求带上这个头，也会强制记录这一次请求，方便排查某一次很慢的判题
+    // 对外的服务要自己过滤：只有内部的地址带来的编号才交给RootSpan，CompileServer只接受OJ_Server的请求，直接沿用
+    const char *const TraceHeader = "X-Trace-Id";
+    // 一次追踪最多记录的阶段数，防止一个请求把内存占满
+    const size_t MaxSpansPerTrace = 256;
+
+    // 一个阶段：名字、开始的时间（墙上时间的微秒，不同进程导出的追踪可以放在一起看）、持续的时间、在哪个线程上
+    struct SpanRecord
+    {
+        const char *name; // 必须是字符串常量
+        std::string detail;
+        uint64_t startUs;
+        uint64_t durationUs;
+        long tid;
+    };
+
+    // 一次被采样的请求的追踪，可能有多个线程往里面加阶段（比如嵌入执行器的线程池）
+    class Trace
+    {
+    private:
+        std::string _id;
+        std::mutex _lock;
+        std::vector<SpanRecord> _spans;
+        size_t _dropped; // 超过上限没有记录的阶段数
+
+    public:
+        explicit Trace(const std::string &id)
+            : _id(id), _dropped(0)
+        {
+        }
+
+    public:
+        const std::string &Id() const
+        {
+            return _id;
+        }
+
+        void Add(SpanRecord &&span)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            if (_spans.size() >= MaxSpansPerTrace)
+            {
+                _dropped++;
+                return;
+            }
+            _spans.push_back(std::move(span));
+        }
+
+        // 把所有阶段写成Chrome trace-event格式的事件
+        void WriteEvents(JsonWriter *writer, long pid)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            for (const auto &span : _spans)
+            {
+                writer->BeginObject()
+                    .Key("name").String(span.name)
+                    .Key("cat").String("oj")
+                    .Key("ph").String("X")
+                    .Key("ts").UInt(span.startUs)
+                    .Key("dur").UInt(span.durationUs)
+                    .Key("pid").Int(pid)
+                    .Key("tid").Int(span.tid)
+                    .Key("args").BeginObject().Key("trace_id").String(_id);
+                if (!span.detail.empty())
+                    writer->Key("detail").String(span.detail);
+                if (_dropped)
+                    writer->Key("dropped_spans").UInt(_dropped);
+                writer->EndObject().EndObject();
+            }
+        }
+    };
+
+    typedef std::shared_ptr<Trace> TracePtr;
+
+    inline uint64_t NowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    inline long CurrentTid()
+    {
+        static thread_local long tid = syscall(SYS_gettid);
+        return tid;
+    }
+
+    // 当前线程正在处理的请求的追踪，没有被采样的请求为空
+    inline TracePtr &CurrentSlot()
+    {
+        static thread_local TracePtr trace;
+        return trace;
+    }
+
+    inline const TracePtr &CurrentTrace()
+    {
+        return CurrentSlot();
+    }
+
+    // 追踪的采样和保存
+    // 每sampleEvery个请求采样一个，采样的追踪放进一个固定大小的环形缓冲区，满了就覆盖最早的
+    // 导出为Chrome trace-event格式的json，可以直接用chrome://tracing或者Perfetto打开
+    class Tracer
+    {
+    private:
+        std::atomic<size_t> _sampleEvery; // 0表示不主动采样，只记录带着追踪编号的请求
+        std::atomic<size_t> _requests;
+        std::string _processName;
+
+        std::mutex _lock;
+        std::vector<TracePtr> _ring;
+        size_t _capacity;
+        size_t _next; // 环形缓冲区满了之后，下一个要覆盖的位置
+
+    public:
+        static Tracer &Instance()
+        {
+            static Tracer tracer;
+            return tracer;
+        }
+
+    private:
+        Tracer()
+            : _sampleEvery(0), _requests(0), _processName("oj"), _capacity(256), _next(0)
+        {
+        }
+
+    public:
+        // 需要在开始处理请求之前调用
+        void Configure(const std::string &processName, size_t sampleEvery, size_t capacity)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _processName = processName;
+            _sampleEvery = sampleEvery;
+            _capacity = capacity == 0 ? 1 : capacity;
+            _ring.clear();
+            _next = 0;
+        }
+
+        // 决定一个请求要不要追踪，要的话返回新的追踪
+        // 上游传来了追踪编号，说明上游已经决定采样这个请求，沿用上游的编号
+        TracePtr Sample(const std::string &upstreamId)
+        {
+            if (IsValidId(upstreamId))
+                return std::make_shared<Trace>(upstreamId);
+
+            size_t every = _sampleEvery.load(std::memory_order_relaxed);
+            if (every == 0 || _requests.fetch_add(1, std::memory_order_relaxed) % every != 0)
+                return nullptr;
+            return std::make_shared<Trace>(NewId());
+        }
+
+        // 请求处理完了，把追踪存进环形缓冲区
+        void Store(const TracePtr &trace)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            if (_ring.size() < _capacity)
+            {
+                _ring.push_back(trace);
+                return;
+            }
+            _ring[_next] = trace;
+            _next = (_next + 1) % _capacity;
+        }
+
+        // 导出追踪，traceId为空表示导出缓冲区中所有的追踪
+        void ExportChrome(const std::string &traceId, std::string *out)
+        {
+            std::vector<TracePtr> traces;
+            std::string processName;
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                traces = _ring;
+                processName = _processName;
+            }
+
+            long pid = getpid();
+            out->clear();
+            JsonWriter writer(out);
+            writer.BeginObject().Key("traceEvents").BeginArray();
+            writer.BeginObject()
+                .Key("name").String("process_name")
+                .Key("ph").String("M")
+                .Key("pid").Int(pid)
+                .Key("args").BeginObject().Key("name").String(processName).EndObject()
+                .EndObject();
+            for (const auto &trace : traces)
+            {
+                if (traceId.empty() || trace->Id() == traceId)
+                    trace->WriteEvents(&writer, pid);
+            }
+            writer.EndArray().Key("displayTimeUnit").String("ms").EndObject();
+        }
+
+    private:
+        // 追踪编号会原样写进导出的json和发给其他服务的请求头，只接受十六进制
+        static bool IsValidId(const std::string &id)
+        {
+            if (id.empty() || id.size() > 32)
+                return false;
+            for (char c : id)
+            {
+                if (!isxdigit(static_cast<unsigned char>(c)))
+                    return false;
+            }
+            return true;
+        }
+
+        static std::string NewId()
+        {
+            static thread_local std::mt19937_64 engine(std::random_device{}() ^ (static_cast<uint64_t>(CurrentTid()) << 32));
+            char buffer[17];
+            snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(engine()));
+            return buffer;
+        }
+    };
+
+    // 记录一个阶段，离开作用域或者调用End()的时候结束
+    // 当前线程没有在追踪的时候什么都不做，只多了一次读线程局部变量
+    class Span
+    {
+    private:
+        Trace *_trace; // 由外层的RootSpan或TraceScope保证追踪一直有效
+        const char *_name;
+        std::string _detail;
+        uint64_t _startUs;
+
+    public:
+        explicit Span(const char *name)
+            : _trace(CurrentSlot().get()), _name(name), _startUs(_trace ? NowUs() : 0)
+        {
+        }
+
+        ~Span()
+        {
+            End();
+        }
+
+        Span(const Span &) = delete;
+        Span &operator=(const Span &) = delete;
+
+    public:
+        bool IsRecording() const
+        {
+            return _trace != nullptr;
+        }
+
+        // 附加的信息，比如选中了哪台主机
+        void SetDetail(const std::string &detail)
+        {
+            if (_trace)
+                _detail = detail;
+        }
+
+        // 提前结束，比如fork之后只在父进程结束
+        void End()
+        {
+            if (!_trace)
+                return;
+            SpanRecord span;
+            span.name = _name;
+            span.detail.swap(_detail);
+            span.startUs = _startUs;
+            span.durationUs = NowUs() - _startUs;
+            span.tid = CurrentTid();
+            _trace->Add(std::move(span));
+            _trace = nullptr;
+        }
+    };
+
+    // 一个请求的根阶段：决定要不要追踪这个请求，在作用域内把追踪设为当前线程的追踪
+    // 离开作用域的时候，把追踪存进环形缓冲区
+    class RootSpan
+    {
+    private:
+        TracePtr _previous;
+        TracePtr _trace;
+        const char *_name;
+        uint64_t _startUs;
+
+    public:
+        RootSpan(const char *name, const std::string &upstreamId)
+            : _previous(CurrentSlot()), _trace(Tracer::Instance().Sample(upstreamId)), _name(name),
+              _startUs(_trace ? NowUs() : 0)
+        {
+            CurrentSlot() = _trace;
+        }
+
+        ~RootSpan()
+        {
+            if (_trace)
+            {
+                SpanRecord span;
+                span.name = _name;
+                span.startUs = _startUs;
+                span.durationUs = NowUs() - _startUs;
+                span.tid = CurrentTid();
+                _trace->Add(std::move(span));
+                Tracer::Instance().Store(_trace);
+            }
+            CurrentSlot() = _previous;
+        }
+
+        RootSpan(const RootSpan &) = delete;
+        RootSpan &operator=(const RootSpan &) = delete;
+
+    public:
+        // 没有被采样的时候为空
+        std::string TraceId() const
+        {
+            return _trace ? _trace->Id() : std::string();
+        }
+    };
+
+    // 把一个追踪带到另一个线程上，比如交给线程池执行的任务
+    class TraceScope
+    {
+    private:
+        TracePtr _previous;
+
+    public:
+        explicit TraceScope(const TracePtr &trace)
+            : _previous(CurrentSlot())
+        {
+            CurrentSlot() = trace;
+        }
+
+        ~TraceScope()
+        {
+            CurrentSlot() = _previous;
+        }
+
+        TraceScope(const TraceScope &) = delete;
+        TraceScope &operator=(const TraceScope &) = delete;
+    };
+}
@@ -6,8 +6,10 @@
 #include <vector>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <mutex>
 #include <atomic>
+#include <cstdint>
 
 #include <boost/algorithm/string.hpp>
 
@@ -73,45 +75,64 @@ namespace ns_Util
         }
     };
 
+    // 默认的临时文件目录
     const std::string TempPath = "./temp/";
 
     //生成路径工具
     class PathUtil
     {
     private:
-        static std::string AddSuffix(const std::string& fileName,const std::string& suffix,const std::string& filePath = TempPath)
+        static std::string AddSuffix(const std::string& fileName,const std::string& suffix,const std::string& filePath)
         {
             return filePath + fileName + suffix;
         }
+
+        static std::string& CurrentWorkspace()
+        {
+            static std::string workspace = TempPath;
+            return workspace;
+        }
     public:
-        static std::string GetSrcName(const std::string& fileName,const std::string& filePath = TempPath)
+        // 临时文件所在的目录，默认为TempPath，可以换成tmpfs上的目录，省掉编译运行过程中的磁盘读写
+        // 需要在开始编译运行之前设置，path以'/'结尾
+        static void SetWorkspace(const std::string& path)
+        {
+            CurrentWorkspace() = path;
+        }
+
+        static const std::string& Workspace()
         {
-            return AddSuffix(fileName,".cpp");
+            return CurrentWorkspace();
         }
 
-        static std::string GetExeName(const std::string& fileName,const std::string& filePath = TempPath)
+        static std::string GetSrcName(const std::string& fileName,const std::string& filePath = Workspace())
         {
-            return AddSuffix(fileName,".exe");
+            return AddSuffix(fileName,".cpp",filePath);
         }
 
-        static std::string GetStdinName(const std::string& fileName,const std::string& filePath = TempPath)
+        static std::string GetExeName(const std::string& fileName,const std::string& filePath = Workspace())
         {
-            return AddSuffix(fileName,".stdin");        
+            return AddSuffix(fileName,".exe",filePath);
         }
 
-        static std::string GetStdoutName(const std::string& fileName,const std::string& filePath = TempPath)
+        static std::string GetStdinName(const std::string& fileName,const std::string& filePath = Workspace())
         {
-            return AddSuffix(fileName,".stdout");       
+            return AddSuffix(fileName,".stdin",filePath);        
         }
 
-        static std::string GetStderrName(const std::string& fileName,const std::string& filePath = TempPath)
+        static std::string GetStdoutName(const std::string& fileName,const std::string& filePath = Workspace())
         {
-            return AddSuffix(fileName,".stderr");   
+            return AddSuffix(fileName,".stdout",filePath);       
         }
 
-        static std::string GetCompileErrorName(const std::string& fileName,const std::string& filePath = TempPath)
+        static std::string GetStderrName(const std::string& fileName,const std::string& filePath = Workspace())
         {
-            return AddSuffix(fileName,".compileError");
+            return AddSuffix(fileName,".stderr",filePath);   
+        }
+
+        static std::string GetCompileErrorName(const std::string& fileName,const std::string& filePath = Workspace())
+        {
+            return AddSuffix(fileName,".compileError",filePath);
         }
     };
 
@@ -139,19 +160,18 @@ namespace ns_Util
             
             //采用原子库的方法
             static std::atomic_uint id(0);
-            id++;
+            unsigned int uniqueId = ++id;
 
-            //用毫秒级的时间戳+原子库，确保每个名字是唯一的
+            //用进程号+时间戳+原子库，确保每个名字是唯一的
             //可不可以只用时间戳或者只用原子库？不行。
-            //因为，时间戳在同一毫秒中，也可能会有多个数据传来，这几个文件就是同名的。
+            //因为，时间戳在同一微秒中，也可能会有多个数据传来，这几个文件就是同名的。
             //而只用原子库，uint类型数据是有上限的，当数据溢出的时候也会导致重复
-            //所以，时间戳+原子库，是为了保证，在一个毫秒内只有接收超过2^32的数据，才会导致重名
-            std::string ms;
-            TimeUtil::GetCurTimeMs(&ms);
+            //原子库是每个进程一份，多进程模式下fork出来的工作进程都从0开始数，几个嵌入执行器同时在同一个temp目录下编译，
+            //所以还要带上进程号；时间戳带上秒，不同秒里的同一微秒也区分开
+            timeval now;
+            gettimeofday(&now,nullptr);
 
-            std::string uniqueId = std::to_string(id);
-
-            return ms+'_'+uniqueId;
+            return std::to_string(getpid())+'_'+std::to_string(now.tv_sec)+'_'+std::to_string(now.tv_usec)+'_'+std::to_string(uniqueId);
         }
 
         static bool WriteToFile(const std::string& fileName,const std::string& content)
@@ -190,6 +210,42 @@ namespace ns_Util
         }
     };
 
+    class HashUtil
+    {
+    public:
+        // FNV-1a 64位哈希
+        // 为什么不用std::hash？std::hash的结果依赖于标准库的实现，不同的编译器、不同的版本可能算出来不一样
+        // 我们的哈希值会被当成版本号、缓存的键来用，需要一个稳定的算法
+        static uint64_t Hash(const char *data, size_t size, uint64_t seed = 14695981039346656037ULL)
+        {
+            uint64_t hash = seed;
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= static_cast<unsigned char>(data[i]);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        static uint64_t Hash(const std::string &data, uint64_t seed = 14695981039346656037ULL)
+        {
+            return Hash(data.c_str(), data.size(), seed);
+        }
+
+        // 把哈希值转换为16进制字符串
+        static std::string ToHex(uint64_t hash)
+        {
+            static const char digits[] = "0123456789abcdef";
+            std::string hex(16, '0');
+            for (int i = 15; i >= 0; i--)
+            {
+                hex[i] = digits[hash & 0xf];
+                hash >>= 4;
+            }
+            return hex;
+        }
+    };
+
     class StringUtil
     {
     public:
@@ -204,5 +260,51 @@ namespace ns_Util
             // 如果不启用压缩，那么就会切为("1","","","","2")
             boost::split(*output,input,boost::is_any_of(sep),boost::algorithm::token_compress_on);
         }
+
+        // URL编码，用于把中文等字符放到链接的参数里
+        static std::string UrlEncode(const std::string& input)
+        {
+            static const char digits[] = "0123456789ABCDEF";
+            std::string output;
+            for (unsigned char c : input)
+            {
+                if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+                {
+                    output += c;
+                }
+                else
+                {
+                    output += '%';
+                    output += digits[c >> 4];
+                    output += digits[c & 0xf];
+                }
+            }
+            return output;
+        }
+    };
+
+    class HttpUtil
+    {
+    public:
+        // 判断请求头If-None-Match是否和资源的ETag匹配
+        // If-None-Match可以是"*"，也可以是用逗号分隔的多个ETag，比较的时候忽略弱ETag的W/前缀
+        static bool IsETagMatch(const std::string& ifNoneMatch,const std::string& etag)
+        {
+            if (ifNoneMatch.empty() || etag.empty())
+                return false;
+
+            std::vector<std::string> tags;
+            StringUtil::SplitString(ifNoneMatch,&tags,", ");
+            for (auto& tag : tags)
+            {
+                if (tag == "*")
+                    return true;
+                if (tag.compare(0,2,"W/") == 0)
+                    tag.erase(0,2);
+                if (tag == etag)
+                    return true;
+            }
+            return false;
+        }
     };
 };
\ No newline at end of file
@@ -4,13 +4,19 @@
 
 #include <jsoncpp/json/json.h>
 
+#include "../Comm/Metrics.hpp"
+#include "../Comm/Trace.hpp"
 #include "Compiler.hpp"
 #include "Runner.hpp"
+#include "CompileCache.hpp"
 
 namespace ns_CompileAndRun
 {
     using namespace ns_Compiler;
     using namespace ns_Runner;
+    using namespace ns_CompileCache;
+    using namespace ns_Metrics;
+    using namespace ns_Trace;
 
     enum CompileAndRunState
     {
@@ -19,6 +25,66 @@ namespace ns_CompileAndRun
         CompileError = -3
     };
 
+    // 一次编译运行的请求，字段和inJson一一对应
+    struct RunRequest
+    {
+        std::string code;  // 用户提交的代码
+        std::string input; // 用户输入
+        int cpuLimit;      // cpu限制
+        int memoryLimit;   // 内存限制
+        bool syntaxOnly;   // 只检查语法，不链接也不运行
+
+        RunRequest()
+            : cpuLimit(0), memoryLimit(0), syntaxOnly(false)
+        {
+        }
+    };
+
+    // 一次编译运行的结果，字段和outJson一一对应
+    struct RunResult
+    {
+        int status;         // 状态码
+        std::string reason; // 原因
+        std::string stdOut; // 标准输出
+        std::string stdErr; // 标准错误
+
+        RunResult()
+            : status(0)
+        {
+        }
+    };
+
+    // 编译运行各个阶段的指标，第一次使用的时候注册
+    struct CompileAndRunMetrics
+    {
+        Histogram *compile;     // g++编译的时间
+        Histogram *check;       // g++只检查语法的时间
+        Histogram *run;         // 运行用户程序的时间
+        Histogram *writeSource; // 写源文件的时间
+        Histogram *readOutput;  // 读取运行结果的时间
+        Histogram *removeTemp;  // 删除临时文件的时间
+        Counter *compileErrors;
+
+        static CompileAndRunMetrics &Instance()
+        {
+            static CompileAndRunMetrics metrics;
+            return metrics;
+        }
+
+    private:
+        CompileAndRunMetrics()
+        {
+            Registry &registry = Registry::Instance();
+            compile = registry.GetHistogram("oj_compile_duration_seconds", "编译用户代码的时间");
+            check = registry.GetHistogram("oj_syntax_check_duration_seconds", "只检查用户代码语法的时间");
+            run = registry.GetHistogram("oj_run_duration_seconds", "运行用户程序的时间");
+            writeSource = registry.GetHistogram("oj_tempfile_io_duration_seconds", "读写临时文件的时间", Label("op", "write"));
+            readOutput = registry.GetHistogram("oj_tempfile_io_duration_seconds", "读写临时文件的时间", Label("op", "read"));
+            removeTemp = registry.GetHistogram("oj_tempfile_io_duration_seconds", "读写临时文件的时间", Label("op", "remove"));
+            compileErrors = registry.GetCounter("oj_compile_errors_total", "编译失败的次数");
+        }
+    };
+
     class CompileAndRun
     {
     public:
@@ -45,10 +111,8 @@ namespace ns_CompileAndRun
         // 6. 把输出结果打包成json串，返回给用户
         static int Start(const std::string &inJson, std::string *outJson)
         {
-            // 返回值的状态码
-            int statusCode = 0;
-
             // 1. 解析用户传入的json串
+            Span parseSpan("ParseJson");
             Json::Value inValue;
             Json::Reader reader;
             reader.parse(inJson, inValue);
@@ -60,11 +124,33 @@ namespace ns_CompileAndRun
              * Input : 用户输入
              * CpuLimit : Cpu限制
              * MemoryLimit : 内存限制
+             * SyntaxOnly : 只检查语法，可以没有
              *****/
-            std::string code = inValue["Code"].asString();
-            std::string input = inValue["Input"].asString();
-            int cpuLimit = inValue["CpuLimit"].asInt();
-            int memoryLimit = inValue["MemoryLimit"].asInt();
+            RunRequest request;
+            request.code = inValue["Code"].asString();
+            request.input = inValue["Input"].asString();
+            request.cpuLimit = inValue["CpuLimit"].asInt();
+            request.memoryLimit = inValue["MemoryLimit"].asInt();
+            request.syntaxOnly = inValue["SyntaxOnly"].asBool();
+            parseSpan.End();
+
+            RunResult result;
+            int statusCode = Execute(request, &result);
+
+            // 6. 把输出结果打包成json串
+            Span resultSpan("ResultToJson");
+            ResultToJson(result, outJson);
+
+            return statusCode;
+        }
+
+        // Start中去掉json解析和打包之后剩下的部分，就是Execute
+        // 为什么要单独拆出来？OJ_Server在嵌入模式下会直接在本进程内调用编译运行，
+        // 此时请求和结果本来就是结构体，没必要先打包成json再解析回来
+        static int Execute(const RunRequest &request, RunResult *result)
+        {
+            // 返回值的状态码
+            int statusCode = 0;
 
             // 2.提取code来生成.cpp文件
             // 用户在传入的时候，是不会传入他的代码文件名的。或者说，文件名其实并不重要，也只有我们服务器内部才需要知道。
@@ -74,25 +160,51 @@ namespace ns_CompileAndRun
             bool compileStatus = true;
             int RunStatusCode = 0;
 
+            CompileAndRunMetrics &metrics = CompileAndRunMetrics::Instance();
             std::string src = PathUtil::GetSrcName(fileName);
-            FileUtil::WriteToFile(src, code);
+            std::string exe = PathUtil::GetExeName(fileName);
+            {
+                Span span("WriteToFile");
+                ScopedTimer timer(metrics.writeSource);
+                FileUtil::WriteToFile(src, request.code);
+            }
 
-            if (code.empty())
+            if (request.code.empty())
             {
                 statusCode = CodeEmpty;
                 goto END;
             }
 
-            // 3. 交给compiler去编译
-            compileStatus = Compiler::Compile(fileName);
+            if (request.syntaxOnly)
+            {
+                statusCode = CheckSyntax(fileName, result);
+                goto CLEAN;
+            }
+
+            // 3. 交给compiler去编译，同样的代码编译过的话，直接用编译缓存中的程序
+            if (!CompileCache::Instance().Fetch(request.code, exe))
+            {
+                {
+                    Span span("Compile");
+                    ScopedTimer timer(metrics.compile);
+                    compileStatus = Compiler::Compile(fileName);
+                }
+                if (compileStatus)
+                    CompileCache::Instance().Store(request.code, exe);
+            }
             if (!compileStatus)
             {
+                metrics.compileErrors->Inc();
                 statusCode = CompileError;
                 goto END;
             }
 
             // 4. 交给runner去运行
-            RunStatusCode = Runner::Run(fileName, cpuLimit, memoryLimit);
+            {
+                Span span("Run");
+                ScopedTimer timer(metrics.run);
+                RunStatusCode = Runner::Run(fileName, request.cpuLimit, request.memoryLimit);
+            }
             if (RunStatusCode < 0)
             {
                 // 运行前崩溃
@@ -111,12 +223,28 @@ namespace ns_CompileAndRun
         END:
 
             // 5. 获取运行结果
-            std::string stdout;
-            FileUtil::ReadFromFile(PathUtil::GetStdoutName(fileName), &stdout, true);
+            result->status = statusCode;
+            result->reason = StatusReason(statusCode, fileName);
+            {
+                Span span("ReadFromFile");
+                ScopedTimer timer(metrics.readOutput);
+                FileUtil::ReadFromFile(PathUtil::GetStdoutName(fileName), &result->stdOut, true);
+                FileUtil::ReadFromFile(PathUtil::GetStderrName(fileName), &result->stdErr, true);
+            }
 
-            std::string stderr;
-            FileUtil::ReadFromFile(PathUtil::GetStderrName(fileName), &stderr, true);
+        CLEAN:
+            {
+                Span span("RemoveTempFile");
+                ScopedTimer timer(metrics.removeTemp);
+                RemoveTempFile(fileName);
+            }
 
+            return statusCode;
+        }
+
+        // 把运行结果打包成返回给用户的json串
+        static void ResultToJson(const RunResult &result, std::string *outJson)
+        {
             Json::Value outValue;
             /****
              * outValue:
@@ -125,20 +253,45 @@ namespace ns_CompileAndRun
              * Stdout : 标准输出
              * Stderr : 标准错误
              **** */
-            outValue["Status"] = statusCode;
-            outValue["Reason"] = StatusReason(statusCode, fileName);
-            outValue["Stdout"] = stdout;
-            outValue["Stderr"] = stderr;
+            outValue["Status"] = result.status;
+            outValue["Reason"] = result.reason;
+            outValue["Stdout"] = result.stdOut;
+            outValue["Stderr"] = result.stdErr;
 
             Json::StyledWriter writer;
             *outJson = writer.write(outValue);
+        }
 
-            RemoveTempFile(fileName);
+    private:
+        // 只检查语法：没有程序可以运行，诊断信息原样放在Stderr中，由调用者解析
+        // 诊断信息中的临时文件名换成main.cpp，不把服务器上的路径交给用户
+        static int CheckSyntax(const std::string &fileName, RunResult *result)
+        {
+            CompileAndRunMetrics &metrics = CompileAndRunMetrics::Instance();
+            bool isPassed = false;
+            {
+                Span span("CheckSyntax");
+                ScopedTimer timer(metrics.check);
+                isPassed = Compiler::CheckSyntax(fileName);
+            }
 
-            return statusCode;
+            std::string diagnostics;
+            FileUtil::ReadFromFile(PathUtil::GetCompileErrorName(fileName), &diagnostics, true);
+            std::string src = PathUtil::GetSrcName(fileName);
+            for (size_t pos = diagnostics.find(src); pos != std::string::npos; pos = diagnostics.find(src, pos))
+            {
+                diagnostics.replace(pos, src.size(), "main.cpp");
+                pos += strlen("main.cpp");
+            }
+
+            result->status = isPassed ? 0 : CompileError;
+            result->reason = isPassed ? "语法检查通过" : "编译错误";
+            result->stdErr = std::move(diagnostics);
+            if (!isPassed)
+                metrics.compileErrors->Inc();
+            return result->status;
         }
 
-    private:
         static std::string StatusReason(int code, const std::string &fileName)
         {
             std::string reason;
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../Comm/Utility.hpp"
+#include "../Comm/LruCache.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/Log.hpp"
+
+namespace ns_CompileCache
+{
+    using namespace ns_Util;
+    using namespace ns_LruCache;
+    using namespace ns_Metrics;
+    using namespace ns_Log;
+
+    // 缓存中的一个可执行文件，最后一个引用释放的时候（被淘汰、被替换）删除文件
+    // 正在运行这个文件的进程不受影响，文件的内容要等进程退出之后才会被释放
+    struct CachedExecutable
+    {
+        std::string source; // 完整的源代码，命中的时候逐字节比较，哈希相同而代码不同的提交不会拿到别人的程序
+        std::string path;
+        size_t bytes;
+
+        ~CachedExecutable()
+        {
+            unlink(path.c_str());
+        }
+    };
+
+    typedef std::shared_ptr<const CachedExecutable> CachedExecutablePtr;
+
+    // 编译缓存：同样的代码只编译一次
+    // 编译是判题中最慢的一步（g++要几百毫秒），同一份代码会被运行很多次：不同的输入、多个OJ_Server进程各自的判题结果缓存没有命中、重新判题
+    // 编译成功之后，把可执行文件硬链接到工作目录下的cache目录，下次同样的代码直接链接回来
+    // 默认不开启，需要在开始编译运行之前调用Enable
+    class CompileCache
+    {
+    private:
+        std::unique_ptr<LruCache<CachedExecutablePtr>> _cache;
+        std::string _cachePath;
+        std::atomic<uint64_t> _stores;
+
+    public:
+        static CompileCache &Instance()
+        {
+            static CompileCache cache;
+            return cache;
+        }
+
+    private:
+        CompileCache()
+            : _stores(0)
+        {
+        }
+
+    public:
+        // capacity为缓存的可执行文件和源代码的总字节数
+        // 缓存目录放在工作目录下，保证和临时文件在同一个文件系统上，才能硬链接
+        bool Enable(size_t capacity)
+        {
+            _cachePath = PathUtil::Workspace() + "cache/";
+            mkdir(PathUtil::Workspace().c_str(), 0755);
+            mkdir(_cachePath.c_str(), 0755);
+            if (!FileUtil::IsFileExist(_cachePath))
+            {
+                Log(Error) << "创建编译缓存目录失败：" << _cachePath << '\n';
+                return false;
+            }
+            RemoveStaleFiles();
+
+            _cache.reset(new LruCache<CachedExecutablePtr>(capacity, [](const CachedExecutablePtr &entry)
+                                                           { return entry->bytes + entry->source.size(); }));
+
+            Registry &registry = Registry::Instance();
+            registry.SetCallback("oj_compile_cache_hits_total", "编译缓存命中的次数", Registry::CounterType, "", [this]()
+                                 { return static_cast<double>(_cache->Stats().hits); });
+            registry.SetCallback("oj_compile_cache_misses_total", "编译缓存没有命中的次数", Registry::CounterType, "", [this]()
+                                 { return static_cast<double>(_cache->Stats().misses); });
+            registry.SetCallback("oj_compile_cache_bytes", "编译缓存占用的字节数", Registry::GaugeType, "", [this]()
+                                 { return static_cast<double>(_cache->Stats().bytes); });
+            return true;
+        }
+
+        bool IsEnabled() const
+        {
+            return _cache != nullptr;
+        }
+
+        // 同样的代码编译过的话，把可执行文件链接到exe，不需要再编译
+        bool Fetch(const std::string &source, const std::string &exe)
+        {
+            if (!_cache)
+                return false;
+
+            CachedExecutablePtr entry;
+            if (!_cache->Get(Key(source), &entry) || entry->source != source)
+                return false;
+            return link(entry->path.c_str(), exe.c_str()) == 0;
+        }
+
+        // 编译成功之后，把可执行文件放进缓存
+        void Store(const std::string &source, const std::string &exe)
+        {
+            if (!_cache)
+                return;
+
+            struct stat st;
+            if (stat(exe.c_str(), &st) != 0)
+                return;
+
+            // 文件名带上序号，哈希相同的新文件替换旧文件的时候，旧文件的析构不会删掉新文件
+            std::string key = Key(source);
+            std::shared_ptr<CachedExecutable> entry = std::make_shared<CachedExecutable>();
+            entry->source = source;
+            entry->path = _cachePath + key + "_" + std::to_string(_stores.fetch_add(1)) + ".exe";
+            entry->bytes = st.st_size;
+            if (link(exe.c_str(), entry->path.c_str()) != 0)
+            {
+                // 链接失败，析构的时候unlink一个不存在的文件，没有影响
+                return;
+            }
+            _cache->Put(key, entry);
+        }
+
+        CacheStats Stats()
+        {
+            return _cache ? _cache->Stats() : CacheStats();
+        }
+
+    private:
+        static std::string Key(const std::string &source)
+        {
+            return HashUtil::ToHex(HashUtil::Hash(source));
+        }
+
+        // 上次运行留下的文件不在缓存的索引里，不会再被用到
+        void RemoveStaleFiles()
+        {
+            DIR *dir = opendir(_cachePath.c_str());
+            if (dir == nullptr)
+                return;
+            struct dirent *item;
+            while ((item = readdir(dir)) != nullptr)
+            {
+                std::string name = item->d_name;
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".exe") == 0)
+                    unlink((_cachePath + name).c_str());
+            }
+            closedir(dir);
+        }
+    };
+}
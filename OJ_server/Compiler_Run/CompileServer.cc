@@ -1,31 +1,49 @@
 #include "CompileAndRun.hpp"
 #include "../Comm/httplib.h"
+#include "../Comm/TaskQueue.hpp"
+#include "../Comm/HttpMetrics.hpp"
+#include "../Comm/Trace.hpp"
 
 using namespace ns_CompileAndRun;
 using namespace httplib;
+using namespace ns_TaskQueue;
+using namespace ns_HttpMetrics;
+using namespace ns_Trace;
 
 void Usage(const std::string proc)
 {
-    std::cerr<<"Uasge:"<<"\n\t"<<proc<<std::endl;
+    std::cerr<<"Uasge:"<<"\n\t"<<proc<<" port [threads]"<<std::endl;
 }
 
-// ./CompileServer 端口号port
+// ./CompileServer 端口号port [工作线程数threads]
 int main(int argc,char*argv[])
 {
-    if(argc!=2)
+    if(argc!=2 && argc!=3)
     {
         Usage(argv[0]);
         return 1;
     }
 
     Server svr;
+    // 只追踪OJ_Server采样过的请求
+    Tracer::Instance().Configure("CompileServer",0,256);
+    // 线程数没有指定的话按CPU核数
+    size_t workerThreads = argc==3?atoi(argv[2]):0;
+    std::shared_ptr<TaskQueueStats> queueStats = std::make_shared<TaskQueueStats>();
+    queueStats->RegisterMetrics();
+    svr.new_task_queue = [workerThreads,queueStats]()
+    {
+        return new StealingTaskQueue(workerThreads,queueStats);
+    };
 
     // svr.Get("/Hello",[](const Request &req, Response &resp){
     //     // 用来进行基本测试
     //     resp.set_content("hello httplib,你好 httplib!", "text/plain;charset=utf-8");
     // });
 
-    svr.Post("/CompileAndRun", [](const Request &req, Response &resp){
+    svr.Post("/CompileAndRun", Metered("/CompileAndRun", [](const Request &req, Response &resp){
+        // OJ_Server采样了这个判题的话，请求头中带着追踪编号，这里记录的阶段属于同一次追踪
+        RootSpan trace("CompileAndRun",req.get_header_value(TraceHeader));
         // 用户请求的服务正文是我们想要的json string
         std::string in_json = req.body;
         std::string out_json;
@@ -33,6 +51,37 @@ int main(int argc,char*argv[])
             CompileAndRun::Start(in_json, &out_json);
             resp.set_content(out_json, "application/json;charset=utf-8");
         }
+    }));
+
+    // Prometheus拉取指标的接口
+    svr.Get("/metrics",ServeMetrics);
+
+    // 管理接口，只允许本机访问
+    svr.Get("/Admin/QueueStats",[queueStats](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        queueStats->ToJson(&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    });
+
+    // OJ_Server追踪过的请求，Chrome trace-event格式，?id=只导出一次追踪
+    svr.Get("/Admin/Traces",[](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        Tracer::Instance().ExportChrome(req.get_param_value("id"),&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
     });
 
     svr.listen("0.0.0.0",atoi(argv[1]));
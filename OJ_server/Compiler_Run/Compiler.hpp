@@ -1,20 +1,38 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <cstring>
+#include <cctype>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 #include "../Comm/Utility.hpp"
 #include "../Comm/Log.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/Trace.hpp"
+#include "Launcher.hpp"
 
 namespace ns_Compiler
 {
     using namespace ns_Util;
     using namespace ns_Log;
+    using namespace ns_Metrics;
+    using namespace ns_Trace;
+    using namespace ns_Launcher;
+
+    // 编译器给出的一条诊断信息
+    struct Diagnostic
+    {
+        std::string file;
+        int line = 0;
+        int column = 0;
+        std::string severity; // fatal error、error、warning、note
+        std::string message;
+    };
 
     // 编译模块，主要负责代码的编译，不管运行
     class Compiler
@@ -42,49 +60,130 @@ namespace ns_Compiler
             std::string exe = PathUtil::GetExeName(FileName);
 
             // 开始进行编译
-            // 首先创建子进程，让子进程做程序替换来编译
-            pid_t pid = fork();
-            // 首先子进程应该做的事情——进程替换，替换为g++来编译
-            if (pid == 0)
+            static Histogram *spawnLatency = Registry::Instance().GetHistogram("oj_spawn_duration_seconds", "创建子进程的时间", Label("stage", "compile"));
+            if (!RunCompiler({"g++", "-o", exe, src, "-D", "COMPILER_ONLINE", "-std=c++11"}, stderr, spawnLatency, nullptr))
+                return false;
+
+            // 如何检查是否成功编译？最简单的方法——看是否存在exe文件
+            if(!FileUtil::IsFileExist(exe))
             {
-                // 我们希望，stderr输出到文件里，所以我们应该干什么？
-                // 1. 创建stderr文件
-                umask(0);
-                int _stderr = open(stderr.c_str(), O_CREAT | O_WRONLY, 0644);
-                if (_stderr < 0)
-                {
-                    Log(Error) << "没有成功生成stderr文件" << "\n";
-                    exit(1);
-                }
+                Log(Normal)<<"生成可执行程序失败"<<'\n';
+                return false;
+            }
+
+            Log(Normal)<<"编译成功，可执行程序： "<<exe<<'\n';
+            return true;
+        }
 
-                // 2. 输出重定向,让标准错误输出到stderr文件中
-                dup2(_stderr,2);
+        // 只检查语法和语义，不生成目标文件，也不链接，诊断信息同样写到compileError里
+        // 没有可执行文件可以看，是否通过由g++的退出码决定
+        static bool CheckSyntax(const std::string &FileName)
+        {
+            std::string src = PathUtil::GetSrcName(FileName);
+            std::string stderr = PathUtil::GetCompileErrorName(FileName);
 
-                // 3. 通过进程替换，开始编译
-                execlp("g++", "g++", "-o", exe.c_str(), src.c_str(),"-D", "COMPILER_ONLINE","-std=c++11",nullptr);
+            static Histogram *spawnLatency = Registry::Instance().GetHistogram("oj_spawn_duration_seconds", "创建子进程的时间", Label("stage", "check"));
+            int status = 0;
+            if (!RunCompiler({"g++", "-fsyntax-only", src, "-D", "COMPILER_ONLINE", "-std=c++11"}, stderr, spawnLatency, &status))
+                return false;
+            return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
 
-                // 如果运行到了这里，说明进程替换失败了
-                Log(Error) << "进程替换失败，编译器没有成功启动" << '\n';
-                exit(2);
+        // 解析g++的诊断信息，只取“文件:行:列: 级别: 内容”这样的行
+        // 其余的行，比如“In function ...”和指出错误位置的代码行，都跳过
+        static void ParseDiagnostics(const std::string &text, std::vector<Diagnostic> *out)
+        {
+            out->clear();
+            size_t begin = 0;
+            while (begin < text.size())
+            {
+                size_t end = text.find('\n', begin);
+                if (end == std::string::npos)
+                    end = text.size();
+                Diagnostic diagnostic;
+                if (ParseDiagnosticLine(text.substr(begin, end - begin), &diagnostic))
+                    out->push_back(std::move(diagnostic));
+                begin = end + 1;
             }
-            // 再来看父进程，父进程要干什么？
-            // 父进程只需要等待子进程跑完，然后检查是否成功编译就可以了
-            // 但是如何检查是否成功编译？最简单的方法——看是否存在exe文件
-            else
+        }
+
+    private:
+        // 创建子进程执行g++，标准错误写到stderrFile，等它结束；status不为空的时候带回子进程的退出状态
+        static bool RunCompiler(const std::vector<std::string> &argv, const std::string &stderrFile, Histogram *spawnLatency, int *status)
+        {
+            // 我们希望，stderr输出到文件里，所以先创建stderr文件，再让子进程把标准错误重定向过去
+            int _stderr = open(stderrFile.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+            if (_stderr < 0)
             {
-                //等待子进程编译完全
-                waitpid(pid, nullptr, 0);
+                Log(Error) << "没有成功生成stderr文件" << "\n";
+                return false;
+            }
 
-                //等待完之后，检查是否生成了可执行文件
-                if(!FileUtil::IsFileExist(exe))
-                {
-                    Log(Normal)<<"生成可执行程序失败"<<'\n';
-                    return false;
-                }
+            // 创建子进程，让子进程做程序替换，替换为g++来编译
+            LaunchRequest request;
+            request.argv = argv;
+            request.stderrFd = _stderr;
+
+            // 记录创建子进程本身花的时间，用fork的话，进程占用的内存越多越慢
+            pid_t pid;
+            {
+                Span spawnSpan("spawn");
+                ScopedTimer spawnTimer(spawnLatency);
+                pid = Launcher::Spawn(request);
+            }
+            close(_stderr);
+            if (pid < 0)
+            {
+                Log(Error) << "创建子进程失败，编译器没有成功启动" << '\n';
+                return false;
             }
 
-            Log(Normal)<<"编译成功，可执行程序： "<<exe<<'\n';
+            // 父进程只需要等待子进程跑完
+            {
+                Span waitSpan("g++");
+                waitpid(pid, status, 0);
+            }
             return true;
         }
+
+        static bool ParseNumber(const std::string &line, size_t *pos, int *value)
+        {
+            size_t begin = *pos;
+            *value = 0;
+            while (*pos < line.size() && isdigit(static_cast<unsigned char>(line[*pos])))
+                *value = *value * 10 + (line[(*pos)++] - '0');
+            return *pos > begin;
+        }
+
+        static bool ParseDiagnosticLine(const std::string &line, Diagnostic *diagnostic)
+        {
+            static const char *const severities[] = {"fatal error", "error", "warning", "note"};
+
+            // 文件名里也可能有冒号，从左往右找第一个后面跟着“行:列: ”的冒号
+            for (size_t colon = line.find(':'); colon != std::string::npos; colon = line.find(':', colon + 1))
+            {
+                size_t pos = colon + 1;
+                if (!ParseNumber(line, &pos, &diagnostic->line) || pos >= line.size() || line[pos] != ':')
+                    continue;
+                pos++;
+                if (!ParseNumber(line, &pos, &diagnostic->column) || line.compare(pos, 2, ": ") != 0)
+                    continue;
+                pos += 2;
+
+                for (const char *severity : severities)
+                {
+                    size_t length = strlen(severity);
+                    if (line.compare(pos, length, severity) == 0 && line.compare(pos + length, 2, ": ") == 0)
+                    {
+                        diagnostic->file = line.substr(0, colon);
+                        diagnostic->severity = severity;
+                        diagnostic->message = line.substr(pos + length + 2);
+                        return true;
+                    }
+                }
+                return false;
+            }
+            return false;
+        }
     };
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+namespace ns_Launcher
+{
+    // 创建子进程的方式
+    //  fork：复制父进程的页表，父进程占用的内存越多越慢，嵌入模式下的OJ_Server带着题库和缓存，fork要几毫秒
+    //  vfork：子进程和父进程共用内存，父进程暂停到子进程exec为止，不复制页表，和进程的大小无关
+    // 子进程在exec之前只做dup2、setrlimit这样的系统调用，不修改内存，两种方式都是安全的
+    enum LauncherType
+    {
+        LauncherFork,
+        LauncherVfork
+    };
+
+    // 要启动的程序
+    struct LaunchRequest
+    {
+        std::vector<std::string> argv;
+        int stdinFd;       // 重定向到子进程标准输入的文件，-1表示不重定向
+        int stdoutFd;
+        int stderrFd;
+        int cpuLimit;      // CPU时间限制，秒，0表示不限制
+        int memoryLimitKb; // 地址空间限制，KB，0表示不限制
+
+        LaunchRequest()
+            : stdinFd(-1), stdoutFd(-1), stderrFd(-1), cpuLimit(0), memoryLimitKb(0)
+        {
+        }
+    };
+
+    class Launcher
+    {
+    public:
+        // 需要在开始编译运行之前设置
+        static void SetType(LauncherType type)
+        {
+            Current() = type;
+        }
+
+        static LauncherType Type()
+        {
+            return Current();
+        }
+
+        static bool ParseType(const std::string &name, LauncherType *type)
+        {
+            if (name == "fork")
+                *type = LauncherFork;
+            else if (name == "vfork")
+                *type = LauncherVfork;
+            else
+                return false;
+            return true;
+        }
+
+        static const char *TypeName(LauncherType type)
+        {
+            return type == LauncherVfork ? "vfork" : "fork";
+        }
+
+        // 启动程序，返回子进程的pid，失败返回-1
+        // 程序不存在等exec失败的情况，子进程以127退出
+        static pid_t Spawn(const LaunchRequest &request)
+        {
+            // 子进程中不能再申请内存（vfork的子进程和父进程共用堆），参数在这里准备好
+            std::vector<char *> argv;
+            for (const auto &arg : request.argv)
+                argv.push_back(const_cast<char *>(arg.c_str()));
+            argv.push_back(nullptr);
+
+            pid_t pid = Current() == LauncherVfork ? vfork() : fork();
+            if (pid == 0)
+            {
+                if (request.stdinFd >= 0)
+                    dup2(request.stdinFd, 0);
+                if (request.stdoutFd >= 0)
+                    dup2(request.stdoutFd, 1);
+                if (request.stderrFd >= 0)
+                    dup2(request.stderrFd, 2);
+                SetLimit(RLIMIT_CPU, request.cpuLimit);
+                SetLimit(RLIMIT_AS, static_cast<rlim_t>(request.memoryLimitKb) * 1024);
+
+                execvp(argv[0], argv.data());
+                _exit(127);
+            }
+            return pid;
+        }
+
+    private:
+        static LauncherType &Current()
+        {
+            static LauncherType type = LauncherFork;
+            return type;
+        }
+
+        static void SetLimit(int resource, rlim_t value)
+        {
+            if (value == 0)
+                return;
+            struct rlimit limit;
+            limit.rlim_max = RLIM_INFINITY;
+            limit.rlim_cur = value;
+            setrlimit(resource, &limit);
+        }
+    };
+}
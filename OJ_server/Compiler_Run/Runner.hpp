@@ -11,11 +11,17 @@
 
 #include "../Comm/Utility.hpp"
 #include "../Comm/Log.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/Trace.hpp"
+#include "Launcher.hpp"
 
 namespace ns_Runner
 {
     using namespace ns_Util;
     using namespace ns_Log;
+    using namespace ns_Metrics;
+    using namespace ns_Trace;
+    using namespace ns_Launcher;
 
     enum RunState
     {
@@ -58,80 +64,64 @@ namespace ns_Runner
 
             //2.生成临时文件
             umask(0);
-            int _stdin = open(stdin.c_str(),O_CREAT|O_WRONLY,0644);
+            int _stdin = open(stdin.c_str(),O_CREAT|O_WRONLY|O_CLOEXEC,0644);
             if(_stdin<0)
             {
                 Log(Warnning)<<"生成stdin文件失败"<<'\n';
                 return MakeFileError;
             }
 
-            int _stdout = open(stdout.c_str(),O_CREAT|O_WRONLY,0644);
+            int _stdout = open(stdout.c_str(),O_CREAT|O_WRONLY|O_CLOEXEC,0644);
             if(_stdout<0)
             {
                 Log(Warnning)<<"生成stdout文件失败"<<'\n';
                 return MakeFileError;
             }
 
-            int _stderr = open(stderr.c_str(),O_CREAT|O_WRONLY,0644);
+            int _stderr = open(stderr.c_str(),O_CREAT|O_WRONLY|O_CLOEXEC,0644);
             if(_stderr<0)
             {
                 Log(Warnning)<<"生成stdin文件失败"<<'\n';
                 return MakeFileError;
             }
 
-            //3.创建子进程
-            pid_t pid = fork();
-            //对子进程，执行可执行文件
-            if(pid==0)
+            //3.创建子进程，子进程把输入输出重定向到文件里，设置系统资源，然后执行传入的exe文件
+            LaunchRequest request;
+            request.argv = {exe};
+            request.stdinFd = _stdin;
+            request.stdoutFd = _stdout;
+            request.stderrFd = _stderr;
+            request.cpuLimit = CpuLimit;
+            request.memoryLimitKb = MemoryLimit;
+
+            static Histogram *spawnLatency = Registry::Instance().GetHistogram("oj_spawn_duration_seconds", "创建子进程的时间", Label("stage", "run"));
+            pid_t pid;
             {
-                //1. 把输入输出重定向到文件里
-                dup2(_stdin,0);
-                dup2(_stdout,1);
-                dup2(_stderr,2);
-
-                //2. 设置系统资源
-                SetProcLimit(CpuLimit,MemoryLimit);
-
-                //3. 开始程序替换，执行传入的exe文件
-                execlp(exe.c_str(),exe.c_str(),nullptr);
+                Span spawnSpan("spawn");
+                ScopedTimer spawnTimer(spawnLatency);
+                pid = Launcher::Spawn(request);
+            }
 
-                //如果运行到这里，说明进程替换失败了
-                Log(Error)<<"进程替换失败，未能成功运行"<<'\n';
-                exit(2);
+            //等待之前，要记得关闭文件描述符！
+            close(_stdin);
+            close(_stdout);
+            close(_stderr);
+            if(pid<0)
+            {
+                Log(Error)<<"创建子进程失败，未能成功运行"<<'\n';
+                return MakeFileError;
             }
+
             //对于父进程，父进程只需要等待子进程运行完成，就可以了
-            else
+            int status = 0;
             {
-                //但是，等待之前，要记得关闭文件描述符！
-                close(_stdin);
-                close(_stdout);
-                close(_stderr);
-
-                int status = 0;
+                Span waitSpan("wait");
                 waitpid(pid,&status,0);
-                
-                //不需要管status是什么状态，只需要把返回码完完整整打印出来就可以
-                Log(Normal)<<"运行完毕，运行结果为："<<(status&0x7f)<<'\n';
-                return status&0x7f;
             }
-        }
-
-    private:
-        // 设置程序的资源
-        // 因为只在Run中会用到，而且大部分为系统调用，所以直接封装为类中函数
-        static void SetProcLimit(int CpuLimit,int MemoryLimit)
-        {
-            // 设置CPU时长
-            struct rlimit cpu_rlimit;
-            cpu_rlimit.rlim_max = RLIM_INFINITY;
-            cpu_rlimit.rlim_cur = CpuLimit;
-            setrlimit(RLIMIT_CPU, &cpu_rlimit);
 
-            // 设置内存大小
-            struct rlimit mem_rlimit;
-            mem_rlimit.rlim_max = RLIM_INFINITY;
-            mem_rlimit.rlim_cur = MemoryLimit * 1024; //转化成为KB
-            setrlimit(RLIMIT_AS, &mem_rlimit);
+            //不需要管status是什么状态，只需要把返回码完完整整打印出来就可以
+            Log(Normal)<<"运行完毕，运行结果为："<<(status&0x7f)<<'\n';
+            return status&0x7f;
         }
     };
-}
\ No newline at end of file
+}
@@ -1,42 +1,541 @@
 #include <iostream>
+// 连接由epoll管理，文件描述符会超过select的上限FD_SETSIZE，httplib要改用poll
+#define CPPHTTPLIB_USE_POLL
 #include "../Comm/httplib.h"
+#include "../Comm/Reactor.hpp"
+#include "../Comm/TaskQueue.hpp"
+#include "../Comm/Prefork.hpp"
+#include "../Comm/SharedCounter.hpp"
+#include "../Comm/HttpMetrics.hpp"
+#include "../Comm/Trace.hpp"
 #include "OJ_control.hpp"
+#include "OJ_asset.hpp"
 
 using namespace httplib;
 using namespace ns_OJ_control;
+using namespace ns_OJ_asset;
+using namespace ns_Reactor;
+using namespace ns_TaskQueue;
+using namespace ns_Prefork;
+using namespace ns_SharedCounter;
+using namespace ns_HttpMetrics;
+using namespace ns_Trace;
 
-int main()
+// 服务的配置文件
+const std::string ServerConfName = "./conf/Server.conf";
+// 多进程模式下，共享负载表最多记录多少台主机
+const size_t MaxSharedMachines = 64;
+// 提交历史每页最多返回多少条
+const int MaxSubmissionsPerPage = 100;
+
+// 当前进程中的服务，收到退出信号的时候停止它
+static ReactorServer* CurrentServer = nullptr;
+
+static void StopServer(int)
+{
+    if(CurrentServer)
+        CurrentServer->Stop();
+}
+
+// 压缩过的响应，ETag要和原文的区分开，否则缓存可能把压缩过的内容交给不支持压缩的客户端
+static std::string EncodedETag(const std::string& etag,Encoding encoding)
+{
+    if(encoding==EncodingIdentity || etag.size()<2)
+        return etag;
+    return etag.substr(0,etag.size()-1)+'-'+EncodingName(encoding)+'"';
+}
+
+// 请求带来的追踪编号，只有本机和配置的内部地址带来的才沿用
+// 外部的客户端随便带一个编号就能强制追踪，用它自己的请求把环形缓冲区挤满，采样到的追踪都被覆盖掉
+static std::string UpstreamTraceId(const Request& req,const std::vector<std::string>& tracePeers)
 {
-    Server svr;
+    if(req.remote_addr=="127.0.0.1" || std::find(tracePeers.begin(),tracePeers.end(),req.remote_addr)!=tracePeers.end())
+        return req.get_header_value(TraceHeader);
+    return std::string();
+}
 
-    Control control;
+// 返回缓存好的页面或静态文件
+// 按Accept-Encoding挑选一个已经压缩好的版本；浏览器带来的ETag和页面的一致，说明它缓存的页面还是最新的，直接返回304
+static void SetPage(const Request& req,Response& resp,const RenderedPage& page,const std::string& contentType,
+                    const std::string& cacheControl = RevalidateCacheControl)
+{
+    Encoding encoding = Compressor::Instance().Negotiate(req.get_header_value("Accept-Encoding"));
+    if(page.encoded[encoding].empty())
+        encoding = EncodingIdentity;
 
-    svr.Get("/AllQuestions",[&control](const Request& req,Response& resp)
+    std::string etag = EncodedETag(page.etag,encoding);
+    resp.set_header("ETag",etag);
+    resp.set_header("Cache-Control",cacheControl);
+    resp.set_header("Vary","Accept-Encoding");
+    if(HttpUtil::IsETagMatch(req.get_header_value("If-None-Match"),etag))
     {
-        std::string html;
-        control.AllQuestion(&html);
-        resp.set_content(html,"text/html;charset=utf-8");
+        resp.status = 304;
+        resp.body.clear();
+        return;
+    }
+
+    if(encoding==EncodingIdentity)
+    {
+        resp.set_content(page.html,contentType.c_str());
+    }
+    else
+    {
+        resp.set_content(page.encoded[encoding],contentType.c_str());
+        resp.set_header("Content-Encoding",EncodingName(encoding));
+    }
+}
+
+// 一个提供服务的进程：加载题库、注册路由、开始监听
+// 单进程模式下直接在main中调用；多进程模式下每个工作进程fork之后调用，题库、线程、缓存都在fork之后创建
+// 打包好的题库文件是mmap的，多个进程映射同一个文件，共用内核中的同一份页面
+static int ServeWorker(const Config& config,SharedCounterTable* sharedLoad,size_t slot,int readyFd)
+{
+    Compressor::Instance().SetLevel(EncodingGzip,config.GetInt("compress.gzip_level",6));
+    Compressor::Instance().SetLevel(EncodingBrotli,config.GetInt("compress.brotli_level",5));
+
+    // 判题结果超过这个大小才压缩，太小的结果压缩省不了多少流量，反而白白花CPU
+    size_t judgeCompressThreshold = config.GetInt("compress.judge_threshold",1024);
+
+    // 少数几个IO线程管理所有的连接，空闲的keep-alive连接不再占用工作线程
+    ReactorServer svr(config.GetInt("reactor.io_threads",2));
+    // 请求由可以互相偷任务的线程池处理，线程数可以在配置文件中指定，0表示按CPU核数
+    size_t workerThreads = config.GetInt("taskqueue.threads",0);
+    std::shared_ptr<TaskQueueStats> queueStats = std::make_shared<TaskQueueStats>();
+    queueStats->RegisterMetrics();
+    Registry::Instance().SetCallback("oj_http_connections","当前打开的连接数",Registry::GaugeType,"",[&svr]()
+    {
+        return static_cast<double>(svr.ConnectionCount());
     });
+    svr.new_task_queue = [workerThreads,queueStats]()
+    {
+        return new StealingTaskQueue(workerThreads,queueStats);
+    };
+
+    // 多进程模式下每个工作进程的指标各自独立，加上worker标签区分开，每个进程的计数在各自的时间序列上单调增长
+    // metrics.worker_port_base大于0时，工作进程还在 base+编号 的端口上单独提供/metrics，Prometheus逐个抓取所有的端口
+    std::unique_ptr<Server> metricsSvr;
+    std::thread metricsThread;
+    if(sharedLoad)
+    {
+        Registry::Instance().SetConstLabels(Label("worker",std::to_string(slot)));
+        int metricsPortBase = config.GetInt("metrics.worker_port_base",0);
+        if(metricsPortBase>0)
+        {
+            metricsSvr.reset(new Server());
+            metricsSvr->Get("/metrics",ServeMetrics);
+            if(metricsSvr->bind_to_port("0.0.0.0",metricsPortBase+static_cast<int>(slot)))
+            {
+                Server* raw = metricsSvr.get();
+                metricsThread = std::thread([raw]()
+                {
+                    raw->listen_after_bind();
+                });
+            }
+            else
+            {
+                Log(Warnning)<<"工作进程的指标端口"<<metricsPortBase+slot<<"绑定失败"<<'\n';
+            }
+        }
+    }
+
+    // 每trace.sample_every个判题采样一个，最近的trace.capacity个放在内存中
+    Tracer::Instance().Configure("OJ_Server",config.GetInt("trace.sample_every",100),config.GetInt("trace.capacity",256));
+    std::vector<std::string> tracePeers;
+    StringUtil::SplitString(config.GetString("trace.trusted_peers",""),&tracePeers,", ");
+
+    Control control(sharedLoad,slot);
+    control.ConfigureBalance(config.GetString("balance.policy","least_load"),config.GetInt("balance.recover_after_ms",5000));
+
+    // 判题的调度，每个工作进程各自限制自己交给主机的判题数
+    SchedulerOptions schedulerOptions;
+    schedulerOptions.slots = config.GetInt("scheduler.slots",schedulerOptions.slots);
+    for(int i = 0;i<ClassCount;i++)
+        schedulerOptions.weights[i] = config.GetInt(std::string("scheduler.weight.")+JudgeClassNames[i],schedulerOptions.weights[i]);
+    schedulerOptions.quantum = config.GetInt("scheduler.user_quantum",schedulerOptions.quantum);
+    control.ConfigureScheduler(schedulerOptions);
 
-    svr.Get(R"(/Question/(\d+))",[&control](const Request& req,Response& resp)
+    // 比赛的时间为unix时间戳（秒），排行榜只统计这段时间内的提交
+    ContestOptions contestOptions;
+    contestOptions.startMs = std::strtoull(config.GetString("contest.start","0").c_str(),nullptr,10)*1000;
+    contestOptions.endMs = std::strtoull(config.GetString("contest.end","0").c_str(),nullptr,10)*1000;
+    contestOptions.penaltyMinutes = config.GetInt("contest.penalty_minutes",20);
+    contestOptions.refreshMs = config.GetInt("scoreboard.refresh_ms",1000);
+    control.ConfigureContest(contestOptions);
+
+    // 提交记录，多个工作进程共用同一个目录
+    StoreOptions storeOptions;
+    storeOptions.path = config.GetString("store.path","./submissions/");
+    storeOptions.sync = config.GetInt("store.sync",1)!=0;
+    storeOptions.commitIntervalMs = config.GetInt("store.commit_interval_ms",0);
+    storeOptions.snapshotBytes = static_cast<size_t>(config.GetInt("store.snapshot_mb",64))<<20;
+    if(!control.OpenStore(storeOptions))
+        Log(Warnning)<<"打开提交记录失败，判题结果不会被保存"<<'\n';
+
+    svr.Get("/AllQuestions",Metered("/AllQuestions",[&control](const Request& req,Response& resp)
+    {
+        // /AllQuestions?page=&size=&sort=&star=
+        PageQuery query;
+        if(req.has_param("page"))
+            query.page = std::atoi(req.get_param_value("page").c_str());
+        if(req.has_param("size"))
+            query.size = std::atoi(req.get_param_value("size").c_str());
+        query.sort = ParseSort(req.get_param_value("sort"));
+        query.star = req.get_param_value("star");
+
+        RenderedPagePtr page;
+        if(control.AllQuestion(query,&page))
+            SetPage(req,resp,*page,"text/html;charset=utf-8");
+    }));
+
+    // JSON接口，供在浏览器中渲染的页面使用
+    svr.Get("/api/questions",Metered("/api/questions",[&control](const Request& req,Response& resp)
+    {
+        // /api/questions?page=&size=&sort=&star=
+        PageQuery query;
+        if(req.has_param("page"))
+            query.page = std::atoi(req.get_param_value("page").c_str());
+        if(req.has_param("size"))
+            query.size = std::atoi(req.get_param_value("size").c_str());
+        query.sort = ParseSort(req.get_param_value("sort"));
+        query.star = req.get_param_value("star");
+
+        RenderedPagePtr page;
+        if(control.ApiQuestions(query,&page))
+            SetPage(req,resp,*page,"application/json;charset=utf-8");
+        else
+            resp.status = 500;
+    }));
+
+    svr.Get(R"(/api/question/(\d+))",Metered("/api/question",[&control](const Request& req,Response& resp)
     {
         std::string number = req.matches[1];
-        std::string html;
-        control.GetOneQuestion(number,&html);
-        resp.set_content(html,"text/html;charset=utf-8");
-    });
+        RenderedPagePtr page;
+        if(control.ApiQuestion(number,&page))
+            SetPage(req,resp,*page,"application/json;charset=utf-8");
+        else
+            resp.status = 404;
+    }));
+
+    // 提交记录没有登录来区分是谁的，和管理接口一样只允许本机访问
+    svr.Get("/api/submissions",Metered("/api/submissions",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        // /api/submissions?user=&question=&since=&until=&before=&limit=，时间为毫秒时间戳
+        SubmissionQuery query;
+        query.user = req.get_param_value("user");
+        query.question = req.get_param_value("question");
+        if(req.has_param("since"))
+            query.sinceMs = std::strtoull(req.get_param_value("since").c_str(),nullptr,10);
+        if(req.has_param("until"))
+            query.untilMs = std::strtoull(req.get_param_value("until").c_str(),nullptr,10);
+        if(req.has_param("before"))
+            query.beforeId = std::strtoull(req.get_param_value("before").c_str(),nullptr,10);
+        if(req.has_param("limit"))
+            query.limit = std::min(std::max(std::atoi(req.get_param_value("limit").c_str()),1),MaxSubmissionsPerPage);
+
+        std::string respJson;
+        control.SubmissionHistory(query,&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    }));
+
+    // 公开的只有题目的统计，用户名是客户端自己填的，谁都可以用别人的名字提交，用户的排名在/Admin/Scoreboard
+    svr.Get("/Scoreboard",Metered("/Scoreboard",[&control](const Request& req,Response& resp)
+    {
+        RenderedPagePtr page = control.Scoreboard(false);
+        SetPage(req,resp,*page,"application/json;charset=utf-8");
+    }));
+
+    // 包括提交的代码和完整的判题结果，序号是连续的，对外开放就等于公开所有人的代码
+    svr.Get(R"(/api/submission/(\d+))",Metered("/api/submission",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        if(control.SubmissionDetail(std::strtoull(req.matches[1].str().c_str(),nullptr,10),&respJson))
+            resp.set_content(respJson,"application/json;charset=utf-8");
+        else
+            resp.status = 404;
+    }));
 
-    svr.Post(R"(/Judge/(\d+))",[&control](const Request& req,Response& resp)
+    svr.Get("/Search",Metered("/Search",[&control](const Request& req,Response& resp)
+    {
+        // /Search?q=&page=&size=
+        int page = 1;
+        int size = DefaultPageSize;
+        if(req.has_param("page"))
+            page = std::atoi(req.get_param_value("page").c_str());
+        if(req.has_param("size"))
+            size = std::atoi(req.get_param_value("size").c_str());
+
+        std::string respJson;
+        control.Search(req.get_param_value("q"),page,size,&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    }));
+
+    svr.Get(R"(/Question/(\d+))",Metered("/Question",[&control](const Request& req,Response& resp)
+    {
+        std::string number = req.matches[1];
+        RenderedPagePtr page;
+        if(control.GetOneQuestion(number,&page))
+            SetPage(req,resp,*page,"text/html;charset=utf-8");
+    }));
+
+    svr.Post(R"(/Judge/(\d+))",Metered("/Judge",[&control,&tracePeers,judgeCompressThreshold](const Request& req,Response& resp)
     {
         std::string number = req.matches[1];
         std::string respJson;
+        bool isCacheHit = false;
+
+        // 被采样的判题记录每个阶段的时间，追踪编号放在应答头中，可以用它去/Admin/Traces查
+        RootSpan trace("Judge",UpstreamTraceId(req,tracePeers));
+        control.Judge(number,req.body,req.remote_addr,&respJson,&isCacheHit);
+        resp.set_header("X-Judge-Cache",isCacheHit?"HIT":"MISS");
+        std::string traceId = trace.TraceId();
+        if(!traceId.empty())
+            resp.set_header(TraceHeader,traceId);
 
-        control.Judge(number,req.body,&respJson);
+        // 判题结果中带着程序完整的输出，可能很大，超过阈值就现场压缩
+        if(respJson.size()>=judgeCompressThreshold)
+        {
+            Encoding encoding = Compressor::Instance().Negotiate(req.get_header_value("Accept-Encoding"));
+            std::string compressed;
+            if(encoding!=EncodingIdentity && Compressor::Instance().Compress(encoding,respJson.data(),respJson.size(),&compressed))
+            {
+                resp.set_header("Content-Encoding",EncodingName(encoding));
+                resp.set_header("Vary","Accept-Encoding");
+                respJson.swap(compressed);
+            }
+        }
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    }));
+
+    // 用自定义输入运行代码，只返回程序的输出，不算一次提交
+    svr.Post(R"(/Run/(\d+))",Metered("/Run",[&control,&tracePeers](const Request& req,Response& resp)
+    {
+        std::string number = req.matches[1];
+        std::string respJson;
+        RootSpan trace("Run",UpstreamTraceId(req,tracePeers));
+        DispatchStatus status = control.Run(number,req.body,req.remote_addr,&respJson);
+        if(status==DispatchOk)
+            resp.set_content(respJson,"application/json;charset=utf-8");
+        else
+            resp.status = status==DispatchInvalid?400:status==DispatchNotFound?404:503;
+    }));
+
+    // 只检查代码能不能通过编译，返回结构化的诊断信息
+    svr.Post(R"(/Check/(\d+))",Metered("/Check",[&control,&tracePeers](const Request& req,Response& resp)
+    {
+        std::string number = req.matches[1];
+        std::string respJson;
+        RootSpan trace("Check",UpstreamTraceId(req,tracePeers));
+        DispatchStatus status = control.Check(number,req.body,req.remote_addr,&respJson);
+        if(status==DispatchOk)
+            resp.set_content(respJson,"application/json;charset=utf-8");
+        else
+            resp.status = status==DispatchNotFound?404:503;
+    }));
+
+    // 管理接口，只允许本机访问
+    svr.Post("/Admin/Reload",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        control.ReloadQuestions(&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    });
+
+    // 重判一次保存下来的提交，排在所有判题的后面
+    svr.Post(R"(/Admin/Rejudge/(\d+))",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        DispatchStatus status = control.Rejudge(std::strtoull(req.matches[1].str().c_str(),nullptr,10),req.remote_addr,&respJson);
+        if(status==DispatchOk)
+            resp.set_content(respJson,"application/json;charset=utf-8");
+        else
+            resp.status = status==DispatchNotFound?404:503;
+    });
+
+    // 带用户排名的排行榜
+    svr.Get("/Admin/Scoreboard",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        RenderedPagePtr page = control.Scoreboard(true);
+        SetPage(req,resp,*page,"application/json;charset=utf-8");
+    });
+
+    svr.Get("/Admin/CacheStats",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        control.CacheStatistics(&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    });
+
+    svr.Get("/Admin/CompressStats",[&control](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        control.CompressStatistics(&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    });
+
+    svr.Get("/Admin/QueueStats",[queueStats](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        queueStats->ToJson(&respJson);
         resp.set_content(respJson,"application/json;charset=utf-8");
     });
 
-    svr.set_base_dir("./wwwroot");
-    svr.listen("0.0.0.0",8888);
+    // 最近采样的判题追踪，Chrome trace-event格式，?id=只导出一次追踪
+    svr.Get("/Admin/Traces",[](const Request& req,Response& resp)
+    {
+        if(req.remote_addr!="127.0.0.1")
+        {
+            resp.status = 403;
+            return;
+        }
+
+        std::string respJson;
+        Tracer::Instance().ExportChrome(req.get_param_value("id"),&respJson);
+        resp.set_content(respJson,"application/json;charset=utf-8");
+    });
+
+    // Prometheus抓取指标的接口
+    svr.Get("/metrics",ServeMetrics);
+
+    // 静态文件，启动的时候全部加载到内存中，之后目录有变化就重新加载
+    // 这个路由匹配所有的路径，必须最后注册
+    AssetTable assets;
+    assets.Load();
+    assets.StartWatch();
+    svr.Get("/.*",Metered("static",[&assets](const Request& req,Response& resp)
+    {
+        AssetPtr asset;
+        if(!assets.Find(req.path,&asset))
+        {
+            resp.status = 404;
+            return;
+        }
+
+        if(asset->page)
+        {
+            SetPage(req,resp,*asset->page,asset->contentType,asset->cacheControl);
+            return;
+        }
+
+        // 大文件用sendfile从文件直接写到socket，文件在发送的中途被截断，只有这个响应失败
+        resp.set_header("ETag",asset->etag);
+        resp.set_header("Cache-Control",asset->cacheControl);
+        if(HttpUtil::IsETagMatch(req.get_header_value("If-None-Match"),asset->etag))
+        {
+            resp.status = 304;
+            return;
+        }
+        std::shared_ptr<AssetFile> file = asset->file;
+        std::shared_ptr<std::string> buffer = std::make_shared<std::string>();
+        resp.set_content_provider(file->Size(),asset->contentType.c_str(),[file,buffer](size_t offset,size_t length,DataSink& sink)
+        {
+            if(ReactorServer::SendFile(file->Fd(),offset,length,sink))
+                return true;
+            // 不是由ReactorServer处理的请求，一块一块读出来再写，整个响应用同一块缓冲区
+            if(!file->Read(offset,std::min(length,AssetChunkSize),buffer.get()))
+                return false;
+            sink.write(buffer->data(),buffer->size());
+            return true;
+        });
+    }));
+    // 收到退出信号的时候，不再接受新的连接，处理完已经收到的请求之后再退出
+    CurrentServer = &svr;
+    signal(SIGTERM,StopServer);
+    signal(SIGINT,StopServer);
+    if(!svr.Bind("0.0.0.0",8888))
+        return 1;
+    // 题库已经加载好、端口已经绑定好，可以接受请求了
+    NotifyReady(readyFd);
+    svr.ListenAfterBind();
+    CurrentServer = nullptr;
+    if(metricsThread.joinable())
+    {
+        metricsSvr->stop();
+        metricsThread.join();
+    }
 
     return 0;
+}
+
+int main()
+{
+    Config config;
+    config.Load(ServerConfName);
+
+    // 工作进程数，0表示单进程模式
+    int workers = config.GetInt("server.workers",0);
+    if(workers<=0)
+        return ServeWorker(config,nullptr,0,-1);
+
+    // 多进程模式：主进程只管理工作进程，每个工作进程用SO_REUSEPORT监听同一个端口
+    // 主机的负载放在共享内存中，所有工作进程看到的是同一份负载
+    SharedCounterTable sharedLoad(Master::SlotCount(workers),MaxSharedMachines);
+    if(!sharedLoad.IsValid())
+    {
+        Log(Error)<<"创建共享负载表失败"<<'\n';
+        return 1;
+    }
+    // 工作进程fork之后重新读一遍配置文件，SIGHUP滚动重启的时候，改过的配置随着新的工作进程生效
+    // server.workers和共享负载表的大小是主进程启动时定下的，改了要重启主进程
+    // 新的工作进程还是从主进程fork出来的，运行的是主进程启动时的程序；升级程序要在旁边再启动一个新的主进程，
+    // 两边的工作进程用SO_REUSEPORT一起监听同一个端口，新的都准备好之后再给旧的主进程发SIGTERM
+    Master master(workers,[&sharedLoad](size_t slot,int readyFd)
+    {
+        Config workerConfig;
+        workerConfig.Load(ServerConfName);
+        return ServeWorker(workerConfig,&sharedLoad,slot,readyFd);
+    });
+    // 工作进程退出之后，它没来得及减掉的负载一起清掉
+    master.SetExitHandler([&sharedLoad](size_t slot)
+    {
+        sharedLoad.ClearRow(slot);
+    });
+    return master.Run();
 }
\ No newline at end of file
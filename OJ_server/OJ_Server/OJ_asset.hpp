@@ -0,0 +1,343 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <fstream>
+#include <iterator>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../Comm/Utility.hpp"
+#include "../Comm/Log.hpp"
+#include "../Comm/DirWatcher.hpp"
+#include "../Comm/Compress.hpp"
+#include "OJ_cache.hpp"
+
+namespace ns_OJ_asset
+{
+    using namespace ns_Util;
+    using namespace ns_Log;
+    using namespace ns_DirWatcher;
+    using namespace ns_Compress;
+    using namespace ns_OJ_cache;
+
+    // 静态文件的根目录
+    const std::string AssetRoot = "./wwwroot";
+    // 超过这个大小的文件不读进内存，发送的时候从文件中一块一块地读
+    const size_t LargeAssetSize = 1024 * 1024;
+    // 不能用sendfile的时候，发送大文件每次读多少
+    const size_t AssetChunkSize = 64 * 1024;
+
+    // 文件名中带有内容哈希的文件（比如app.3f2a9c1d.js），内容变了文件名就会变，浏览器可以放心地长期缓存
+    const std::string ImmutableCacheControl = "public, max-age=31536000, immutable";
+    // 其他文件每次都要向服务器确认，没有变化的话返回304
+    const std::string RevalidateCacheControl = "no-cache";
+
+    // 大文件：保持打开的文件描述符，发送的时候用sendfile从文件直接写到socket，不能用的时候按块pread
+    // 不用mmap：部署的时候直接覆盖写文件（比如cp），映射的页面被截断，下一次访问就是SIGBUS，整个服务都会崩溃
+    // pread读到的比预期的少，只会让这一个响应失败；文件变了之后目录监视会重新加载，换成新的ETag
+    // 用改名替换的文件，打开的描述符还指向旧的文件，正在发送的响应不受影响
+    class AssetFile
+    {
+    private:
+        int _fd;
+        size_t _size;
+
+    public:
+        AssetFile()
+            : _fd(-1), _size(0)
+        {
+        }
+
+        ~AssetFile()
+        {
+            if (_fd >= 0)
+                close(_fd);
+        }
+
+        AssetFile(const AssetFile &) = delete;
+        AssetFile &operator=(const AssetFile &) = delete;
+
+    public:
+        bool Open(const std::string &path, size_t size)
+        {
+            _fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            _size = size;
+            return _fd >= 0;
+        }
+
+        int Fd() const
+        {
+            return _fd;
+        }
+
+        // 读[offset, offset+length)，文件被截断、读不够的时候返回false
+        // out的容量够的时候不重新分配，同一个响应的每一块可以用同一块缓冲区
+        bool Read(size_t offset, size_t length, std::string *out) const
+        {
+            out->resize(length);
+            size_t done = 0;
+            while (done < length)
+            {
+                ssize_t n = pread(_fd, &(*out)[done], length - done, offset + done);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    return false;
+                done += n;
+            }
+            return true;
+        }
+
+        size_t Size() const
+        {
+            return _size;
+        }
+    };
+
+    // 一个静态文件
+    struct Asset
+    {
+        std::string contentType;
+        std::string cacheControl;
+        std::string etag;
+        std::string stamp; // 文件的inode、大小和修改时间，重新加载的时候用来判断文件有没有变化
+        size_t size;
+
+        RenderedPagePtr page;               // 小文件：内容以及压缩好的版本都在内存中
+        std::shared_ptr<AssetFile> file;    // 大文件：发送的时候从文件中按块读出来
+    };
+    typedef std::shared_ptr<const Asset> AssetPtr;
+    typedef std::unordered_map<std::string, AssetPtr> AssetMap;
+    typedef std::shared_ptr<const AssetMap> AssetMapPtr;
+
+    // 静态文件表
+    // 启动的时候把wwwroot下的所有文件读进内存，算好ETag、Content-Type和压缩好的版本，形成一张不可变的表
+    // 请求静态文件只需要查一次表，不再打开和读取文件
+    // 目录中的文件有变化的时候，重新生成一张表，原子地替换旧的表
+    class AssetTable
+    {
+    private:
+        std::string _root;
+        AssetMapPtr _assets;
+        std::mutex _loadLock;
+        std::unique_ptr<DirWatcher> _watcher;
+
+    public:
+        explicit AssetTable(const std::string &root = AssetRoot)
+            : _root(root), _assets(std::make_shared<AssetMap>())
+        {
+        }
+
+        AssetTable(const AssetTable &) = delete;
+        AssetTable &operator=(const AssetTable &) = delete;
+
+    public:
+        // 加载所有的静态文件，成功之后替换当前的表
+        bool Load()
+        {
+            std::unique_lock<std::mutex> guard(_loadLock);
+
+            std::shared_ptr<AssetMap> assets = std::make_shared<AssetMap>();
+            AssetMapPtr old = std::atomic_load(&_assets);
+            if (!LoadDir(_root, "/", *old, assets.get()))
+            {
+                Log(Warnning) << "加载静态文件失败，继续使用旧的静态文件" << '\n';
+                return false;
+            }
+
+            std::atomic_store(&_assets, AssetMapPtr(assets));
+            Log(Normal) << "加载静态文件成功！共" << assets->size() << "个文件" << '\n';
+            return true;
+        }
+
+        // 开始监视静态文件目录，有变化就重新加载
+        void StartWatch()
+        {
+            _watcher.reset(new DirWatcher(_root, [this]()
+                                          { Load(); }));
+            if (!_watcher->Start())
+                _watcher.reset();
+        }
+
+        // 按请求的路径查找静态文件，以/结尾的路径查找目录下的index.html
+        bool Find(const std::string &path, AssetPtr *asset)
+        {
+            if (path.empty() || path[0] != '/')
+                return false;
+
+            AssetMapPtr assets = std::atomic_load(&_assets);
+            auto iter = assets->find(path.back() == '/' ? path + "index.html" : path);
+            if (iter == assets->end())
+                return false;
+
+            *asset = iter->second;
+            return true;
+        }
+
+    private:
+        // 递归地加载一个目录，urlPrefix为这个目录对应的请求路径
+        // 内容没有变化的文件（大小和修改时间都相同）直接复用旧表中的项，不再读取和压缩
+        bool LoadDir(const std::string &dir, const std::string &urlPrefix, const AssetMap &old, AssetMap *assets)
+        {
+            DIR *dp = opendir(dir.c_str());
+            if (dp == nullptr)
+            {
+                Log(Error) << "无法打开静态文件目录" << dir << '\n';
+                return false;
+            }
+
+            bool isLoad = true;
+            struct dirent *entry = nullptr;
+            while (isLoad && (entry = readdir(dp)) != nullptr)
+            {
+                std::string name = entry->d_name;
+                // 跳过隐藏文件，包括编辑器的临时文件
+                if (name.empty() || name[0] == '.')
+                    continue;
+
+                std::string path = dir + "/" + name;
+                std::string url = urlPrefix + name;
+                struct stat st;
+                if (stat(path.c_str(), &st) != 0)
+                    continue;
+
+                if (S_ISDIR(st.st_mode))
+                {
+                    isLoad = LoadDir(path, url + "/", old, assets);
+                    continue;
+                }
+                if (!S_ISREG(st.st_mode))
+                    continue;
+
+                std::string stamp = FileStamp(st);
+                auto iter = old.find(url);
+                if (iter != old.end() && iter->second->stamp == stamp)
+                {
+                    (*assets)[url] = iter->second;
+                    continue;
+                }
+
+                AssetPtr asset;
+                if (!LoadFile(path, name, st, stamp, &asset))
+                {
+                    isLoad = false;
+                    continue;
+                }
+                (*assets)[url] = asset;
+            }
+            closedir(dp);
+            return isLoad;
+        }
+
+        static bool LoadFile(const std::string &path, const std::string &name, const struct stat &st,
+                             const std::string &stamp, AssetPtr *out)
+        {
+            std::shared_ptr<Asset> asset = std::make_shared<Asset>();
+            asset->contentType = ContentType(name);
+            asset->cacheControl = IsHashedName(name) ? ImmutableCacheControl : RevalidateCacheControl;
+            asset->stamp = stamp;
+            asset->size = st.st_size;
+
+            if (static_cast<size_t>(st.st_size) >= LargeAssetSize)
+            {
+                asset->file = std::make_shared<AssetFile>();
+                if (!asset->file->Open(path, st.st_size))
+                {
+                    Log(Error) << "无法打开静态文件" << path << '\n';
+                    return false;
+                }
+                // 大文件不计算内容哈希，用文件的元数据作为ETag
+                asset->etag = '"' + HashUtil::ToHex(HashUtil::Hash(stamp)) + '"';
+            }
+            else
+            {
+                // 按原始字节读取，FileUtil::ReadFromFile按行读取，不适合图片之类的二进制文件
+                std::string content;
+                if (!ReadRaw(path, &content))
+                {
+                    Log(Error) << "无法读取静态文件" << path << '\n';
+                    return false;
+                }
+                asset->page = PageCache::MakePage(std::move(content), Compressor::IsCompressible(asset->contentType));
+                asset->etag = asset->page->etag;
+            }
+
+            *out = asset;
+            return true;
+        }
+
+        static bool ReadRaw(const std::string &path, std::string *content)
+        {
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open())
+                return false;
+            content->assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            return true;
+        }
+
+        static std::string FileStamp(const struct stat &st)
+        {
+            return std::to_string(st.st_ino) + ':' + std::to_string(st.st_size) + ':' +
+                   std::to_string(st.st_mtim.tv_sec) + '.' + std::to_string(st.st_mtim.tv_nsec);
+        }
+
+        // 文件名形如 名字.哈希.扩展名，哈希至少8位十六进制数字
+        static bool IsHashedName(const std::string &name)
+        {
+            size_t last = name.rfind('.');
+            if (last == std::string::npos || last == 0)
+                return false;
+            size_t prev = name.rfind('.', last - 1);
+            if (prev == std::string::npos || last - prev - 1 < 8)
+                return false;
+
+            for (size_t i = prev + 1; i < last; i++)
+            {
+                if (!isxdigit(static_cast<unsigned char>(name[i])))
+                    return false;
+            }
+            return true;
+        }
+
+        static std::string ContentType(const std::string &name)
+        {
+            static const std::unordered_map<std::string, std::string> types = {
+                {"html", "text/html;charset=utf-8"},
+                {"htm", "text/html;charset=utf-8"},
+                {"css", "text/css;charset=utf-8"},
+                {"js", "application/javascript;charset=utf-8"},
+                {"mjs", "application/javascript;charset=utf-8"},
+                {"json", "application/json;charset=utf-8"},
+                {"txt", "text/plain;charset=utf-8"},
+                {"xml", "application/xml"},
+                {"svg", "image/svg+xml"},
+                {"png", "image/png"},
+                {"jpg", "image/jpeg"},
+                {"jpeg", "image/jpeg"},
+                {"gif", "image/gif"},
+                {"ico", "image/x-icon"},
+                {"webp", "image/webp"},
+                {"woff", "font/woff"},
+                {"woff2", "font/woff2"},
+                {"ttf", "font/ttf"},
+                {"pdf", "application/pdf"},
+                {"wasm", "application/wasm"},
+            };
+
+            size_t pos = name.rfind('.');
+            if (pos != std::string::npos)
+            {
+                auto iter = types.find(boost::algorithm::to_lower_copy(name.substr(pos + 1)));
+                if (iter != types.end())
+                    return iter->second;
+            }
+            return "application/octet-stream";
+        }
+    };
+}
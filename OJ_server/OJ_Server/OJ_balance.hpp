@@ -0,0 +1,573 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+
+#include "../Comm/Log.hpp"
+#include "../Comm/Utility.hpp"
+#include "../Comm/SharedCounter.hpp"
+#include "../Comm/Metrics.hpp"
+
+namespace ns_CompileAndRun
+{
+    struct RunRequest;
+}
+
+// 负载均衡：主机、选择主机的策略、主机的上下线
+// 这里不依赖编译运行和http，负载均衡模拟器（Bench/BalanceSim）直接使用这里的LoadBlance，和线上是同一份代码
+namespace ns_OJ_balance
+{
+    using namespace ns_SharedCounter;
+    using namespace ns_Metrics;
+    using namespace ns_Log;
+    using namespace ns_Util;
+    using ns_CompileAndRun::RunRequest;
+
+    // 执行编译运行的执行器
+    // 对LoadBlance来说，它并不关心编译运行到底是在哪里完成的，它只关心把请求交出去，然后拿到结果
+    // 所以我们把“交出去”这件事抽象成执行器，远端主机和本进程内的执行器都实现同一个接口
+    class Executor
+    {
+    public:
+        virtual ~Executor()
+        {
+        }
+
+        // 执行一次编译运行，outJson为返回给用户的结果
+        // 返回false表示执行器不可用（比如远端主机离线），需要换一个执行器重试
+        virtual bool Execute(const RunRequest &request, std::string *outJson) = 0;
+    };
+
+    // 根据主机的配置创建执行器，由使用LoadBlance的一方提供
+    typedef std::function<std::shared_ptr<Executor>(const std::string &ip, int port)> ExecutorFactory;
+
+    // 当前时间，毫秒；模拟器换成虚拟的时钟
+    typedef std::function<uint64_t()> BalanceClock;
+
+    inline uint64_t SteadyMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 进行服务的主机
+    class Machine
+    {
+    public:
+        std::string ip;   // 主机ip，嵌入执行器为"embedded"
+        int port;         // 主机服务端口，嵌入执行器为线程数
+        int weight;       // 主机的权重，按权重分配的策略使用，一般为主机的核数
+        uint64_t load;    // 主机负载
+        std::mutex *lock; // 主机锁
+        std::shared_ptr<Executor> executor; // 主机的执行器
+        uint64_t offlineAt; // 主机离线的时间，毫秒
+
+        // 多进程模式下，主机的负载记在共享内存中，每个工作进程一行，主机在第column列
+        // 所有进程看到的负载是一样的，不会出现每个进程都以为某台主机很空闲，一起把请求发过去的情况
+        SharedCounterTable *sharedLoad;
+        size_t sharedRow;
+        size_t sharedColumn;
+
+        // 主机的统计：被负载均衡选中的次数、执行失败（离线）的次数、每次执行的时间
+        Counter *choices;
+        Counter *errors;
+        Histogram *latency;
+    public:
+        Machine()
+            : ip(""), port(0), weight(1), load(0), lock(nullptr), offlineAt(0), sharedLoad(nullptr), sharedRow(0), sharedColumn(0),
+              choices(nullptr), errors(nullptr), latency(nullptr)
+        {
+        }
+        ~Machine()
+        {
+        }
+
+    public:
+        // 增加主机负载
+        void IncreaseLoad()
+        {
+            if (sharedLoad)
+            {
+                sharedLoad->Add(sharedRow, sharedColumn, 1);
+                return;
+            }
+            if (lock)
+                lock->lock();
+            load++;
+            if (lock)
+                lock->unlock();
+        }
+
+        // 减少主机负载
+        void DecreaseLoad()
+        {
+            if (sharedLoad)
+            {
+                sharedLoad->Add(sharedRow, sharedColumn, -1);
+                return;
+            }
+            if (lock)
+                lock->lock();
+            load--;
+            if (lock)
+                lock->unlock();
+        }
+
+        // 获取主机负载
+        uint64_t Load()
+        {
+            if (sharedLoad)
+                return sharedLoad->Sum(sharedColumn);
+            if (lock)
+                lock->lock();
+            uint64_t ans = load;
+            if (lock)
+                lock->unlock();
+
+            return ans;
+        }
+    };
+
+    // 选择主机的策略
+    // 在LoadBlance的锁里调用，策略自己的状态不需要再加锁
+    class BalancePolicy
+    {
+    public:
+        virtual ~BalancePolicy()
+        {
+        }
+
+        virtual const char *Name() const = 0;
+
+        // online为在线的主机，至少有一台，返回选中的主机在online中的下标
+        virtual size_t Choose(const std::vector<Machine *> &online) = 0;
+    };
+
+    // 遍历所有在线主机，找到负载最小的那一个，负载相同的时候选靠前的
+    class LeastLoadPolicy : public BalancePolicy
+    {
+    public:
+        const char *Name() const override
+        {
+            return "least_load";
+        }
+
+        size_t Choose(const std::vector<Machine *> &online) override
+        {
+            size_t chosen = 0;
+            uint64_t minLoad = online[0]->Load();
+            for (size_t i = 1; i < online.size(); i++)
+            {
+                uint64_t load = online[i]->Load();
+                if (load < minLoad)
+                {
+                    chosen = i;
+                    minLoad = load;
+                }
+            }
+            return chosen;
+        }
+    };
+
+    // 按负载和权重之比选择，核数多的主机分到更多的请求
+    // 负载为0的主机之间，选权重大的
+    class WeightedLeastLoadPolicy : public BalancePolicy
+    {
+    public:
+        const char *Name() const override
+        {
+            return "weighted_least_load";
+        }
+
+        size_t Choose(const std::vector<Machine *> &online) override
+        {
+            size_t chosen = 0;
+            uint64_t chosenLoad = online[0]->Load() + 1;
+            for (size_t i = 1; i < online.size(); i++)
+            {
+                uint64_t load = online[i]->Load() + 1;
+                // load/weight < chosenLoad/chosenWeight，交叉相乘避免除法
+                if (load * online[chosen]->weight < chosenLoad * online[i]->weight)
+                {
+                    chosen = i;
+                    chosenLoad = load;
+                }
+            }
+            return chosen;
+        }
+    };
+
+    // 轮流选择，不看负载
+    class RoundRobinPolicy : public BalancePolicy
+    {
+    private:
+        size_t _next;
+
+    public:
+        RoundRobinPolicy()
+            : _next(0)
+        {
+        }
+
+        const char *Name() const override
+        {
+            return "round_robin";
+        }
+
+        size_t Choose(const std::vector<Machine *> &online) override
+        {
+            return _next++ % online.size();
+        }
+    };
+
+    // 随机挑两台，选负载小的那一台
+    // 多进程模式下各进程看到的负载有延迟的时候，不会所有进程都选中同一台最空闲的主机
+    class TwoChoicesPolicy : public BalancePolicy
+    {
+    private:
+        std::mt19937 _engine;
+
+    public:
+        explicit TwoChoicesPolicy(uint32_t seed = 1)
+            : _engine(seed)
+        {
+        }
+
+        const char *Name() const override
+        {
+            return "power_of_two";
+        }
+
+        size_t Choose(const std::vector<Machine *> &online) override
+        {
+            if (online.size() == 1)
+                return 0;
+            size_t first = _engine() % online.size();
+            size_t second = _engine() % (online.size() - 1);
+            if (second >= first)
+                second++;
+            return online[second]->Load() < online[first]->Load() ? second : first;
+        }
+    };
+
+    const char *const PolicyNames[] = {"least_load", "weighted_least_load", "round_robin", "power_of_two"};
+
+    inline bool MakePolicy(const std::string &name, std::unique_ptr<BalancePolicy> *policy)
+    {
+        if (name == "least_load")
+            policy->reset(new LeastLoadPolicy());
+        else if (name == "weighted_least_load")
+            policy->reset(new WeightedLeastLoadPolicy());
+        else if (name == "round_robin")
+            policy->reset(new RoundRobinPolicy());
+        else if (name == "power_of_two")
+            policy->reset(new TwoChoicesPolicy());
+        else
+            return false;
+        return true;
+    }
+
+    const std::string ServerMachineConfigure = "./conf/ServerMachine.conf";
+    const std::string EmbeddedMachine = "embedded";
+
+    // 负责管理所有的主机，让主机的负载均衡
+    class LoadBlance
+    {
+    private:
+        // 在MachinesContainer里面，存储着所有要被用于OJ服务的主机，每个主机都有着自己的下标
+        // 为什么不用哈希表？因为主机是固定的，一般来说，一个服务器一个主机，一旦被用于了OJ服务，那么就不会再发生变化了
+        // 这个时候，我们采用数组的方式，效率要比哈希表容器要高，但是本质还是哈希的思想，仅此而已
+        std::vector<Machine> MachinesContainer;
+        // 用数组的下标，来表示主机
+        std::vector<int> onlineMachine;  // 在线的主机
+        std::vector<int> offlineMachine; // 离线的主机
+        std::vector<Machine *> candidates; // 交给策略选择的在线主机，避免每次选择都申请内存
+
+        std::mutex *lock;
+
+        // 多进程模式下共享的负载表，以及本进程在表中的行
+        SharedCounterTable *sharedLoad;
+        size_t sharedRow;
+
+        std::unique_ptr<BalancePolicy> policy;
+        // 主机离线多久之后重新尝试，毫秒，0表示离线之后不再自动上线
+        uint64_t recoverAfterMs;
+        BalanceClock clock;
+        Counter *recoveries;
+
+    public:
+        LoadBlance(SharedCounterTable *sharedLoad = nullptr, size_t sharedRow = 0)
+            : sharedLoad(sharedLoad), sharedRow(sharedRow), policy(new LeastLoadPolicy()), recoverAfterMs(0), clock(SteadyMs)
+        {
+            lock = new std::mutex();
+            recoveries = Registry::Instance().GetCounter("oj_machine_recoveries_total", "离线的主机重新上线的次数");
+        }
+        ~LoadBlance()
+        {
+        }
+
+    public:
+        // 需要在开始选择主机之前设置
+        void SetPolicy(std::unique_ptr<BalancePolicy> newPolicy)
+        {
+            std::unique_lock<std::mutex> guard(*lock);
+            policy = std::move(newPolicy);
+        }
+
+        void SetRecoverAfter(uint64_t ms)
+        {
+            std::unique_lock<std::mutex> guard(*lock);
+            recoverAfterMs = ms;
+        }
+
+        void SetClock(const BalanceClock &newClock)
+        {
+            std::unique_lock<std::mutex> guard(*lock);
+            clock = newClock;
+        }
+
+        const char *PolicyName()
+        {
+            std::unique_lock<std::mutex> guard(*lock);
+            return policy->Name();
+        }
+
+        size_t MachineCount() const
+        {
+            return MachinesContainer.size();
+        }
+
+        // 主机都在开始选择之前添加好，之后不会再增删，指向主机的指针一直有效
+        Machine *GetMachine(int machineID)
+        {
+            return &MachinesContainer[machineID];
+        }
+
+        // 读取所有主机列表
+        // 和题目列表的读取一样，我们也是一行一行读取，题目的数据格式为：
+        //  IP:Port
+        // 如果想在OJ_Server进程内直接编译运行，可以写成：
+        //  embedded:线程数
+        // 两种写法可以混在一起，嵌入执行器和远端主机一起参与负载均衡
+        // 后面还可以再跟一个权重，比如 IP:Port:8，给weighted_least_load策略使用，不写默认为1
+        bool LoadConfigure(const std::string &configurePath, const ExecutorFactory &factory)
+        {
+            std::ifstream machineConfigure(configurePath);
+            if (!machineConfigure.is_open())
+            {
+                Log(Normal) << "打开服务主机目录失败！" << '\n';
+                return false;
+            }
+
+            // 打开成功之后，和题目列表的读取一样，读取所有主机的数据，然后添加到container中
+            // 主机的数据格式为： IP:Port
+            std::string buffer;
+            while (std::getline(machineConfigure, buffer))
+            {
+                // 空行和#开头的注释行直接跳过
+                if (buffer.empty() || buffer[0] == '#')
+                    continue;
+
+                std::vector<std::string> data;
+                // 切分字符串，提取到IP和Port
+                StringUtil::SplitString(buffer, &data, ":");
+
+                // 正常来说，切分出来的数据只有两个元素：IP和port，带权重的时候是三个
+                if (data.size() != 2 && data.size() != 3)
+                {
+                    Log(Warnning) << "读取主机数据失败，已跳过该主机" << '\n';
+                    continue;
+                }
+
+                int port = std::atoi(data[1].c_str());
+                int weight = data.size() == 3 ? std::atoi(data[2].c_str()) : 1;
+                AddMachine(data[0], port, weight, factory(data[0], port));
+            }
+
+            machineConfigure.close();
+            Log(Normal) << "所有主机已加载完毕！" << '\n';
+            return true;
+        }
+
+        // 添加一台主机，返回主机的下标，主机默认在线
+        int AddMachine(const std::string &machineIP, int machinePort, int weight, const std::shared_ptr<Executor> &executor)
+        {
+            Machine machine;
+            machine.ip = machineIP;
+            machine.port = machinePort;
+            machine.weight = weight > 0 ? weight : 1;
+            machine.load = 0;
+            machine.lock = new std::mutex();
+            machine.executor = executor;
+            // 嵌入执行器在每个工作进程中各有一个，负载只属于本进程，不放进共享的负载表
+            if (sharedLoad && machineIP != EmbeddedMachine)
+            {
+                if (MachinesContainer.size() < sharedLoad->Columns())
+                {
+                    machine.sharedLoad = sharedLoad;
+                    machine.sharedRow = sharedRow;
+                    machine.sharedColumn = MachinesContainer.size();
+                }
+                else
+                {
+                    Log(Warnning) << "主机太多，共享负载表放不下，主机" << machineIP << ":" << machinePort << "的负载只在本进程内统计" << '\n';
+                }
+            }
+
+            std::string label = Label("machine", machineIP + ":" + std::to_string(machinePort));
+            machine.choices = Registry::Instance().GetCounter("oj_machine_choices_total", "负载均衡选中主机的次数", label);
+            machine.errors = Registry::Instance().GetCounter("oj_machine_errors_total", "主机没有应答的次数", label);
+            machine.latency = Registry::Instance().GetHistogram("oj_machine_execute_duration_seconds", "主机执行一次编译运行的时间", label);
+
+            // 当主机被加入时，默认添加到在线主机中
+            std::unique_lock<std::mutex> guard(*lock);
+            onlineMachine.push_back(MachinesContainer.size());
+            MachinesContainer.push_back(machine);
+            return MachinesContainer.size() - 1;
+        }
+
+        // 采用负载均衡的原则，选择最佳的主机
+        // 为什么要用二重指针？因为一个指针表示的是，这是一个输出参数，而另一个指针，表示我们想返回的是一个机器的指针参数
+        bool SmartChoice(int *ID, Machine **machine)
+        {
+            lock->lock();
+
+            // 离线够久的主机重新上线，给它一次机会，如果还是没有应答，会再次离线
+            RecoverMachines();
+
+            // 1. 首先判断是否有在线的主机
+            if (onlineMachine.size() == 0)
+            {
+                Log(Normal) << "所有主机都已下线 请维护服务器" << '\n';
+                lock->unlock();
+                return false;
+            }
+
+            // 2. 由策略从在线的主机中选出一台
+            candidates.clear();
+            for (int id : onlineMachine)
+                candidates.push_back(&MachinesContainer[id]);
+            int chosenID = onlineMachine[policy->Choose(candidates)];
+
+            // 3. 找到了合适的机器，赋值给输出型参数
+            *ID = chosenID;
+            *machine = &MachinesContainer[chosenID];
+
+            lock->unlock();
+
+            return true;
+        }
+
+        // 主机的负载和在线主机数，在导出的时候读取
+        void RegisterMetrics()
+        {
+            for (auto &machine : MachinesContainer)
+            {
+                Machine *target = &machine;
+                Registry::Instance().SetCallback("oj_machine_load", "主机正在处理的请求数", Registry::GaugeType,
+                                                 Label("machine", machine.ip + ":" + std::to_string(machine.port)),
+                                                 [target]()
+                                                 { return static_cast<double>(target->Load()); });
+            }
+            Registry::Instance().SetCallback("oj_machines_online", "在线的主机数", Registry::GaugeType, "", [this]()
+                                             {
+                std::unique_lock<std::mutex> guard(*lock);
+                return static_cast<double>(onlineMachine.size()); });
+        }
+
+        //离线一个主机
+        // 主机的负载不清零：发到这台主机上、还没有返回的请求，返回的时候会自己减掉，主机重新上线的时候负载是准确的
+        void OffLineMachine(int MachineID)
+        {
+            lock->lock();
+
+            // 通过遍历所有数组的方式，找到需要被找到的主机
+            for (auto iter = onlineMachine.begin(); iter < onlineMachine.end(); iter++)
+            {
+                if (*iter == MachineID)
+                {
+                    MachinesContainer[MachineID].offlineAt = clock();
+                    onlineMachine.erase(iter);
+                    offlineMachine.push_back(MachineID);
+                    break;
+                }
+            }
+
+            lock->unlock();
+        }
+
+        // 所有离线的主机统一上线
+        void OnlineMachine()
+        {
+            lock->lock();
+            recoveries->Inc(offlineMachine.size());
+            onlineMachine.insert(onlineMachine.end(), offlineMachine.begin(), offlineMachine.end());
+            offlineMachine.clear();
+            lock->unlock();
+        }
+
+        bool IsOnline(int machineID)
+        {
+            std::unique_lock<std::mutex> guard(*lock);
+            for (int id : onlineMachine)
+            {
+                if (id == machineID)
+                    return true;
+            }
+            return false;
+        }
+
+        //显示所有主机，为了做测试才用的函数
+        void ShowMachines()
+        {
+            lock->lock();
+
+            std::cout<<"当前在线主机的列表："<<std::endl;
+            for(auto& id : onlineMachine)
+            {
+                std::cout<<id<<" ";
+            }
+            std::cout<<std::endl;
+
+            std::cout<<"当前离线主机的列表："<<std::endl;
+            for(auto& id : offlineMachine)
+            {
+                std::cout<<id<<" ";
+            }
+            std::cout<<std::endl;
+
+            lock->unlock();
+        }
+
+    private:
+        // 在锁里调用
+        void RecoverMachines()
+        {
+            if (recoverAfterMs == 0 || offlineMachine.empty())
+                return;
+
+            uint64_t now = clock();
+            for (auto iter = offlineMachine.begin(); iter != offlineMachine.end();)
+            {
+                if (now - MachinesContainer[*iter].offlineAt >= recoverAfterMs)
+                {
+                    Log(Normal) << "主机" << *iter << "离线已经超过" << recoverAfterMs << "毫秒，重新上线" << '\n';
+                    recoveries->Inc();
+                    onlineMachine.push_back(*iter);
+                    iter = offlineMachine.erase(iter);
+                }
+                else
+                {
+                    iter++;
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+#include "../Comm/Utility.hpp"
+#include "../Comm/Log.hpp"
+#include "../Comm/LruCache.hpp"
+#include "../Comm/Compress.hpp"
+
+namespace ns_OJ_cache
+{
+    using namespace ns_Util;
+    using namespace ns_Log;
+    using namespace ns_LruCache;
+    using namespace ns_Compress;
+
+    // 判题结果缓存的默认容量，按字节计算
+    const size_t ResultCacheCapacity = 64 * 1024 * 1024;
+
+    // 判题结果缓存
+    // 同一份代码，对同一个版本的题目，判出来的结果是一样的。用户因为网络问题重复提交的时候，没必要再编译运行一遍
+    // 缓存的键为：题目ID + 题目版本 + 代码哈希，值为最终返回给用户的json串
+    // 采用LRU的淘汰策略，总大小超过容量时，淘汰最久没有被用过的结果
+    // 题目的版本变了，旧版本的键不会再被查到，不主动清除，由LRU慢慢淘汰
+    // 重新加载的时候新旧快照上的请求会交替到达，按版本清除的话，两个版本会互相把对方的结果清掉
+    class ResultCache
+    {
+    private:
+        struct Entry
+        {
+            std::string source; // 提交的代码和输入。哈希可能冲突，命中的时候需要比对原文
+            std::string result; // 判题结果
+        };
+        typedef std::shared_ptr<const Entry> EntryPtr;
+
+        LruCache<EntryPtr> _results;
+
+    public:
+        explicit ResultCache(size_t capacity = ResultCacheCapacity)
+            : _results(capacity, [](const EntryPtr &entry)
+                       { return sizeof(Entry) + entry->source.size() + entry->result.size(); })
+        {
+        }
+
+    public:
+        // 查找缓存，命中返回true，并把结果写入result
+        bool Get(const std::string &questionId, uint64_t version, const std::string &source, std::string *result)
+        {
+            EntryPtr entry;
+            if (!_results.Get(MakeKey(questionId, version, source), &entry) || entry->source != source)
+                return false;
+
+            *result = entry->result;
+            return true;
+        }
+
+        // 添加缓存
+        void Put(const std::string &questionId, uint64_t version, const std::string &source, const std::string &result)
+        {
+            std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+            entry->source = source;
+            entry->result = result;
+            _results.Put(MakeKey(questionId, version, source), entry);
+        }
+
+        size_t Bytes()
+        {
+            return _results.Stats().bytes;
+        }
+
+    private:
+        static std::string MakeKey(const std::string &questionId, uint64_t version, const std::string &source)
+        {
+            return questionId + ':' + HashUtil::ToHex(version) + ':' + HashUtil::ToHex(HashUtil::Hash(source));
+        }
+    };
+
+    // 页面缓存的默认容量，按字节计算
+    const size_t PageCacheCapacity = 32 * 1024 * 1024;
+
+    // 渲染好的页面
+    // 页面在放进缓存的时候就压缩好，之后每次请求按Accept-Encoding挑一个现成的版本
+    struct RenderedPage
+    {
+        std::string html;
+        std::string etag;                   // 强ETag，由页面内容的哈希得到，内容不变ETag就不变
+        std::string encoded[EncodingCount]; // 各种编码压缩后的页面，为空表示没有这个版本
+
+        size_t Bytes() const
+        {
+            size_t bytes = sizeof(RenderedPage) + html.size() + etag.size();
+            for (const auto &body : encoded)
+                bytes += body.size();
+            return bytes;
+        }
+    };
+    typedef std::shared_ptr<const RenderedPage> RenderedPagePtr;
+
+    // 页面缓存
+    // 题目页面和题目列表页面只有在题库变化的时候才会变，没必要每次请求都重新查找、填字典、展开模板
+    // 缓存的键由调用者决定，需要带上题库快照的代数，题库重新加载之后旧页面自然不会再被命中
+    class PageCache
+    {
+    private:
+        LruCache<RenderedPagePtr> _pages;
+
+    public:
+        explicit PageCache(size_t capacity = PageCacheCapacity)
+            : _pages(capacity, [](const RenderedPagePtr &page)
+                     { return page->Bytes(); })
+        {
+        }
+
+    public:
+        bool Get(const std::string &key, RenderedPagePtr *page)
+        {
+            return _pages.Get(key, page);
+        }
+
+        // 缓存一个渲染好的页面，返回带有ETag的页面
+        // compress为true时，同时缓存页面压缩后的各个版本
+        RenderedPagePtr Put(const std::string &key, std::string html, bool compress = true)
+        {
+            RenderedPagePtr page = MakePage(std::move(html), compress);
+            _pages.Put(key, page);
+            return page;
+        }
+
+        // 生成一个带有ETag的页面，compress为true时同时生成压缩后的各个版本
+        static RenderedPagePtr MakePage(std::string html, bool compress)
+        {
+            std::shared_ptr<RenderedPage> page = std::make_shared<RenderedPage>();
+            page->etag = MakeETag(html);
+            page->html.swap(html);
+            if (compress)
+            {
+                for (int i = EncodingGzip; i < EncodingCount; i++)
+                {
+                    Encoding encoding = static_cast<Encoding>(i);
+                    if (!Compressor::Instance().Compress(encoding, page->html.data(), page->html.size(), &page->encoded[i]))
+                        page->encoded[i].clear();
+                }
+            }
+            return page;
+        }
+
+        static std::string MakeETag(const std::string &body)
+        {
+            return '"' + HashUtil::ToHex(HashUtil::Hash(body)) + '"';
+        }
+
+        // 题库重新加载之后调用，旧快照的页面不会再被用到，尽早释放内存
+        void Clear()
+        {
+            _pages.Clear();
+        }
+
+        CacheStats Stats()
+        {
+            return _pages.Stats();
+        }
+    };
+}
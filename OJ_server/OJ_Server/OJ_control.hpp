@@ -5,279 +5,500 @@
 #include <fstream>
 #include <mutex>
 #include <vector>
+#include <algorithm>
+#include <memory>
 #include <cassert>
+#include <csignal>
+#include <sys/stat.h>
 
 #include <jsoncpp/json/json.h>
 
 #include "../Comm/httplib.h"
 #include "../Comm/Log.hpp"
 #include "../Comm/Utility.hpp"
+#include "../Comm/ThreadPool.hpp"
+#include "../Comm/SingleFlight.hpp"
+#include "../Comm/Compress.hpp"
+#include "../Comm/Config.hpp"
+#include "../Comm/JsonWriter.hpp"
+#include "../Comm/SharedCounter.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/Trace.hpp"
+#include "../Compiler_Run/CompileAndRun.hpp"
 #include "OJ_model.hpp"
 #include "OJ_view.hpp"
+#include "OJ_cache.hpp"
+#include "OJ_balance.hpp"
+#include "OJ_store.hpp"
+#include "OJ_stats.hpp"
+#include "OJ_scheduler.hpp"
 
 namespace ns_OJ_control
 {
     using namespace ns_OJ_model;
     using namespace ns_OJ_view;
+    using namespace ns_OJ_cache;
+    using namespace ns_OJ_balance;
+    using namespace ns_OJ_store;
+    using namespace ns_OJ_stats;
+    using namespace ns_OJ_scheduler;
+    using namespace ns_SingleFlight;
+    using namespace ns_Compress;
+    using namespace ns_Config;
+    using namespace ns_JsonWriter;
+    using namespace ns_SharedCounter;
+    using namespace ns_Metrics;
+    using namespace ns_Trace;
     using namespace ns_Log;
     using namespace ns_Util;
     using namespace httplib;
+    using namespace ns_CompileAndRun;
 
-    // 进行服务的主机
-    class Machine
+    // 远端执行器：把请求打包成json，通过http发给CompileServer
+    class RemoteExecutor : public Executor
     {
+    private:
+        std::string _ip;
+        int _port;
+
     public:
-        std::string ip;   // 主机ip
-        int port;         // 主机服务端口
-        uint64_t load;    // 主机负载
-        std::mutex *lock; // 主机锁
-    public:
-        Machine()
-            : ip(""), port(0), load(0), lock(nullptr)
-        {
-        }
-        ~Machine()
+        RemoteExecutor(const std::string &ip, int port)
+            : _ip(ip), _port(port)
         {
         }
 
     public:
-        // 增加主机负载
-        void IncreaseLoad()
+        bool Execute(const RunRequest &request, std::string *outJson) override
         {
-            if (lock)
-                lock->lock();
-            load++;
-            if (lock)
-                lock->unlock();
-        }
+            // 形成compileJson串
+            /*****
+             * CompileJson:
+             * Code : 用户提交的代码
+             * Input : 用户输入
+             * CpuLimit : Cpu限制
+             * MemoryLimit : 内存限制
+             * SyntaxOnly : 只检查语法
+             *****/
+            Json::Value compileValue;
+            compileValue["Code"] = request.code;
+            compileValue["Input"] = request.input;
+            compileValue["CpuLimit"] = request.cpuLimit;
+            compileValue["MemoryLimit"] = request.memoryLimit;
+            if (request.syntaxOnly)
+                compileValue["SyntaxOnly"] = true;
 
-        // 减少主机负载
-        void DecreaseLoad()
-        {
-            if (lock)
-                lock->lock();
-            load--;
-            if (lock)
-                lock->unlock();
+            Json::FastWriter writer;
+            std::string compileJson = writer.write(compileValue);
+
+            // 这个请求正在被追踪的话，把追踪编号带给CompileServer
+            Headers headers;
+            const TracePtr &trace = CurrentTrace();
+            if (trace)
+                headers.emplace(TraceHeader, trace->Id());
+
+            Client client(_ip, _port);
+            auto response = client.Post("/CompileAndRun", headers, compileJson, "application/json;charset=utf-8");
+
+            // 没有应答，说明主机已经离线
+            if (!response)
+                return false;
+
+            // 应答的状态码不是200，结果为空，交给上层判断
+            if (response->status == 200)
+                *outJson = response->body;
+            return true;
         }
+    };
 
-        // 获取主机负载
-        uint64_t Load()
-        {
-            if (lock)
-                lock->lock();
-            int ans = load;
-            if (lock)
-                lock->unlock();
+    // 嵌入执行器：直接在OJ_Server进程内调用CompileAndRun
+    // 单机部署的时候，OJ_Server和CompileServer在同一台机器上，再走一次http和两次json完全是浪费
+    // 编译运行放在单独的线程池里跑，线程数就是这台“主机”能同时处理的请求数
+    class EmbeddedExecutor : public Executor
+    {
+    private:
+        ns_ThreadPool::ThreadPool _pool;
 
-            return ans;
+    public:
+        explicit EmbeddedExecutor(size_t threadNum)
+            : _pool(threadNum)
+        {
+            // CompileAndRun的临时文件默认放在当前目录的temp下，嵌入模式下当前目录是OJ_Server，需要确保目录存在
+            mkdir(PathUtil::Workspace().c_str(), 0755);
         }
 
-        // 重置主机负载
-        void ResetLoad()
+    public:
+        bool Execute(const RunRequest &request, std::string *outJson) override
         {
-            if (lock)
-                lock->lock();
-            load = 0;
-            if (lock)
-                lock->unlock();
+            // 编译运行在线程池的线程上执行，把当前的追踪带过去
+            TracePtr trace = CurrentTrace();
+            std::future<RunResult> future = _pool.Submit([&request, trace]()
+                                                         {
+                TraceScope scope(trace);
+                RunResult result;
+                CompileAndRun::Execute(request, &result);
+                return result; });
+
+            // 本进程内的结果只需要打包一次，直接返回给用户
+            CompileAndRun::ResultToJson(future.get(), outJson);
+            return true;
         }
     };
 
-    const std::string ServerMachineConfigure = "./conf/ServerMachine.conf";
+    // 检查、运行和重判的结果：请求不完整，题目或记录不存在，还是所有主机都离线
+    enum DispatchStatus
+    {
+        DispatchOk = 0,
+        DispatchInvalid,
+        DispatchNotFound,
+        DispatchUnavailable
+    };
 
-    // 负责管理所有的主机，让主机的负载均衡
-    class LoadBlance
+    class Control
     {
     private:
-        // 在MachinesContainer里面，存储着所有要被用于OJ服务的主机，每个主机都有着自己的下标
-        // 为什么不用哈希表？因为主机是固定的，一般来说，一个服务器一个主机，一旦被用于了OJ服务，那么就不会再发生变化了
-        // 这个时候，我们采用数组的方式，效率要比哈希表容器要高，但是本质还是哈希的思想，仅此而已
-        std::vector<Machine> MachinesContainer;
-        // 用数组的下标，来表示主机
-        std::vector<int> onlineMachine;  // 在线的主机
-        std::vector<int> offlineMachine; // 离线的主机
-
-        std::mutex *lock;
-
+        Model _model;
+        View _view;
+        LoadBlance _loadBlance;
+        ResultCache _resultCache;
+        PageCache _pageCache;
+        SingleFlight<std::string> _singleFlight;
+        SubmissionStore _store;
+        Statistics _statistics;
+        ContestOptions _contest;
+        JudgeScheduler _scheduler;
+
+        // 判题的统计
+        Histogram* _judgeLatency;
+        Counter* _judgeCacheHits;    // 结果缓存命中
+        Counter* _judgeCoalesced;    // 和正在判的相同提交合并
+        Counter* _judgeDispatched;   // 交给主机执行
+        Counter* _judgeFailed;       // 题目不存在或者没有可用的主机
     public:
-        LoadBlance()
+        // 多进程模式下，sharedLoad为所有工作进程共享的主机负载表，sharedRow为本进程在表中的行
+        explicit Control(SharedCounterTable* sharedLoad = nullptr,size_t sharedRow = 0)
+            : _loadBlance(sharedLoad,sharedRow)
         {
-            lock = new std::mutex();
-            assert(LoadConfigure(ServerMachineConfigure));
+            assert(_loadBlance.LoadConfigure(ServerMachineConfigure,MakeExecutor));
             Log(Normal) << "加载" << ServerMachineConfigure << "成功！" << '\n';
-        }
-        ~LoadBlance()
-        {
-        }
+            _loadBlance.RegisterMetrics();
+            RegisterMetrics();
+
+            // 存储中的每条记录都按序号交给统计，包括重启时恢复出来的和其他工作进程写入的
+            // 旧版本的记录没有结论，从保存的判题结果中重新得出
+            _store.SetListener([this](const Submission& submission)
+                               {
+                Verdict verdict = static_cast<Verdict>(submission.verdict);
+                if(verdict==VerdictUnknown)
+                {
+                    Json::Value resultValue;
+                    Json::Reader reader;
+                    verdict = reader.parse(submission.result,resultValue)?JudgeVerdict(resultValue):VerdictSystemError;
+                }
+                _statistics.Add(submission,verdict); });
+
+            // 题库重新加载之后，旧的页面都不会再被命中了
+            _model.AddReloadListener([this]()
+                                     { _pageCache.Clear(); });
 
+            // 题目目录有改动时，在后台重新加载题库
+            _model.StartWatch();
+        }
+        ~Control()
+        {}
     public:
-        // 读取所有主机列表
-        // 和题目列表的读取一样，我们也是一行一行读取，题目的数据格式为：
-        //  IP:Port
-        bool LoadConfigure(const std::string &configurePath)
+        // 选择主机的策略，以及离线的主机多久之后重新尝试
+        bool ConfigureBalance(const std::string& policyName,int recoverAfterMs)
         {
-            std::ifstream machineConfigure(configurePath);
-            if (!machineConfigure.is_open())
+            std::unique_ptr<BalancePolicy> policy;
+            if(!MakePolicy(policyName,&policy))
             {
-                Log(Normal) << "打开服务主机目录失败！" << '\n';
+                Log(Warnning)<<"不认识的负载均衡策略"<<policyName<<"，继续使用"<<_loadBlance.PolicyName()<<'\n';
                 return false;
             }
+            _loadBlance.SetPolicy(std::move(policy));
+            _loadBlance.SetRecoverAfter(recoverAfterMs>0?recoverAfterMs:0);
+            Log(Normal)<<"负载均衡策略为"<<policyName<<"，离线的主机"<<recoverAfterMs<<"毫秒后重新尝试"<<'\n';
+            return true;
+        }
 
-            // 打开成功之后，和题目列表的读取一样，读取所有主机的数据，然后添加到container中
-            // 主机的数据格式为： IP:Port
-            std::string buffer;
-            while (std::getline(machineConfigure, buffer))
-            {
-                std::vector<std::string> data;
-                // 切分字符串，提取到IP和Port
-                StringUtil::SplitString(buffer, &data, ":");
+        // 比赛的时间和罚时规则，需要在OpenStore之前设置，恢复出来的记录按这个规则计入排行榜
+        void ConfigureContest(const ContestOptions& options)
+        {
+            _contest = options;
+            _statistics.Configure(options);
+        }
 
-                // 正常来说，切分出来的数据只有两个元素：IP和port
-                if (data.size() != 2)
-                {
-                    Log(Warnning) << "读取主机数据失败，已跳过该主机" << '\n';
-                    continue;
-                }
+        // 同时交给主机的判题数，以及排队时各个类别的权重
+        void ConfigureScheduler(const SchedulerOptions& options)
+        {
+            _scheduler.Configure(options);
+            Log(Normal)<<"同时判题数上限为"<<options.slots<<"，类别的权重为check:"<<options.weights[ClassCheck]<<" run:"<<options.weights[ClassRun]<<" contest:"<<options.weights[ClassContest]
+                       <<" practice:"<<options.weights[ClassPractice]<<" rejudge:"<<options.weights[ClassRejudge]<<'\n';
+        }
 
-                std::string machineIP = data[0];
-                std::string machinePort = data[1];
+        // 打开提交记录的存储，打开失败的时候照常判题，只是不保存记录
+        bool OpenStore(const StoreOptions& options)
+        {
+            return _store.Open(options);
+        }
 
-                // 读取完毕后，生成结构体，添加到Container中
-                Machine machine;
-                machine.ip = machineIP;
-                machine.port = std::atoi(machinePort.c_str());
-                machine.load = 0;
-                machine.lock = new std::mutex();
+        // 提交历史，不包括代码和结果，结果中的Status足够列出每次提交的对错，只在索引中查，不读磁盘
+        void SubmissionHistory(const SubmissionQuery& query,std::string* outJson)
+        {
+            std::vector<SubmissionPtr> records;
+            if(_store.IsOpen())
+                _store.Query(query,&records);
 
-                // 当主机被加入时，默认添加到在线主机中
-                onlineMachine.push_back(MachinesContainer.size());
-                MachinesContainer.push_back(machine);
+            JsonWriter writer(outJson);
+            writer.BeginObject().Key("Submissions").BeginArray();
+            for(const auto& record : records)
+            {
+                writer.BeginObject()
+                      .Key("Id").UInt(record->id)
+                      .Key("Time").UInt(record->timeMs)
+                      .Key("User").String(record->user)
+                      .Key("Question").String(record->question)
+                      .Key("Status").Int(record->status)
+                      .Key("Verdict").String(VerdictName(record->verdict))
+                      .Key("DurationUs").UInt(record->durationUs)
+                      .EndObject();
             }
-
-            machineConfigure.close();
-            Log(Normal) << "所有主机已加载完毕！" << '\n';
-            return true;
+            writer.EndArray();
+            // 下一页从最后一条的序号往前查
+            if(records.size()==query.limit)
+                writer.Key("Before").UInt(records.back()->id);
+            writer.EndObject();
         }
 
-        // 采用负载均衡的原则，选择最佳的主机
-        // 为什么要用二重指针？因为一个指针表示的是，这是一个输出参数，而另一个指针，表示我们想返回的是一个机器的指针参数
-        bool SmartChoice(int *ID, Machine **machine)
+        // 一次提交的详细内容，包括代码和当时返回的判题结果，从存储的文件中读出来
+        bool SubmissionDetail(uint64_t id,std::string* outJson)
         {
-            lock->lock();
-
-            // 负载均衡的算法——遍历所有主机，找到负载最小的那一个
-            // 1. 首先判断是否有在线的主机
-            if (onlineMachine.size() == 0)
-            {
-                Log(Normal) << "所有主机都已下线 请维护服务器" << '\n';
-                lock->unlock();
+            SubmissionPtr record;
+            if(!_store.IsOpen() || !_store.Get(id,&record))
                 return false;
-            }
 
-            // 2. 从在线主机数组下标0开始，依次往后遍历所有在线的主机
-            Machine* minLoadMachine = &MachinesContainer[onlineMachine[0]];
-            int minLoadMachineID = onlineMachine[0];
+            JsonWriter writer(outJson);
+            writer.BeginObject()
+                  .Key("Id").UInt(record->id)
+                  .Key("Time").UInt(record->timeMs)
+                  .Key("User").String(record->user)
+                  .Key("Question").String(record->question)
+                  .Key("Status").Int(record->status)
+                  .Key("Verdict").String(VerdictName(record->verdict))
+                  .Key("DurationUs").UInt(record->durationUs)
+                  .Key("Code").String(record->code)
+                  .Key("Result").Raw(record->result)
+                  .EndObject();
+            return true;
+        }
 
-            for (int i = 1; i < onlineMachine.size(); i++)
-            {
-                Machine* curMachine = &MachinesContainer[onlineMachine[i]];
-                if (minLoadMachine->load > curMachine->load)
-                {
-                    minLoadMachineID = i;
-                    minLoadMachine = curMachine;
-                }
-            }
+        // 题目统计和排行榜，两次重建之间返回同一份页面
+        // 先把其他工作进程写入journal的记录读进来，所有工作进程的排行榜最多差refreshMs
+        // 用户名没有经过验证，withUsers为true的页面带着每个用户的排名，只用于管理接口
+        RenderedPagePtr Scoreboard(bool withUsers)
+        {
+            if(_store.IsOpen())
+                _store.Refresh();
+            return _statistics.Scoreboard(withUsers);
+        }
 
-            // 3. 遍历完所有之后，找到了最小负载的机器，赋值给输出型参数
-            *ID = minLoadMachineID;
-            *machine = minLoadMachine;
+        // 手动重新加载题库，用于管理接口
+        bool ReloadQuestions(std::string* outJson)
+        {
+            bool isReload = _model.Reload();
 
-            lock->unlock();
+            Json::Value outValue;
+            outValue["Status"] = isReload?0:-1;
+            outValue["Reason"] = isReload?"重新加载题库成功":"重新加载题库失败，继续使用旧的题库";
+            QuestionBankPtr bank = _model.Snapshot();
+            outValue["Questions"] = static_cast<Json::UInt64>(bank?bank->questionList.size():0);
 
-            return true;
+            Json::FastWriter writer;
+            *outJson = writer.write(outValue);
+            return isReload;
         }
 
-        //离线一个主机
-        void OffLineMachine(int MachineID)
+        // 缓存的统计数据，用于管理接口
+        void CacheStatistics(std::string* outJson)
         {
-            lock->lock();
+            CacheStats bodyStats = _model.BodyCacheStats();
+
+            Json::Value outValue;
+            outValue["QuestionBody"]["Hits"] = static_cast<Json::UInt64>(bodyStats.hits);
+            outValue["QuestionBody"]["Misses"] = static_cast<Json::UInt64>(bodyStats.misses);
+            outValue["QuestionBody"]["Bytes"] = static_cast<Json::UInt64>(bodyStats.bytes);
+            outValue["QuestionBody"]["Entries"] = static_cast<Json::UInt64>(bodyStats.entries);
+            outValue["QuestionBody"]["Capacity"] = static_cast<Json::UInt64>(bodyStats.capacity);
+            outValue["JudgeResult"]["Bytes"] = static_cast<Json::UInt64>(_resultCache.Bytes());
+
+            CacheStats pageStats = _pageCache.Stats();
+            outValue["Page"]["Hits"] = static_cast<Json::UInt64>(pageStats.hits);
+            outValue["Page"]["Misses"] = static_cast<Json::UInt64>(pageStats.misses);
+            outValue["Page"]["Bytes"] = static_cast<Json::UInt64>(pageStats.bytes);
+            outValue["Page"]["Entries"] = static_cast<Json::UInt64>(pageStats.entries);
+            outValue["Page"]["Capacity"] = static_cast<Json::UInt64>(pageStats.capacity);
+
+            Json::StyledWriter writer;
+            *outJson = writer.write(outValue);
+        }
 
-            // 通过遍历所有数组的方式，找到需要被找到的主机
-            for (auto iter = onlineMachine.begin(); iter < onlineMachine.end(); iter++)
+        // 压缩的统计数据，用于管理接口
+        void CompressStatistics(std::string* outJson)
+        {
+            Json::Value outValue;
+            for(int i=EncodingGzip;i<EncodingCount;i++)
             {
-                if (*iter == MachineID)
-                {
-                    MachinesContainer[MachineID].ResetLoad();
-                    onlineMachine.erase(iter);
-                    offlineMachine.push_back(MachineID);
-                    break;
-                }
+                Encoding encoding = static_cast<Encoding>(i);
+                if(!Compressor::IsSupported(encoding))
+                    continue;
+
+                CompressStats stats = Compressor::Instance().Stats(encoding);
+                Json::Value& item = outValue[EncodingName(encoding)];
+                item["Level"] = Compressor::Instance().Level(encoding);
+                item["Count"] = static_cast<Json::UInt64>(stats.count);
+                item["InputBytes"] = static_cast<Json::UInt64>(stats.inputBytes);
+                item["OutputBytes"] = static_cast<Json::UInt64>(stats.outputBytes);
+                item["Ratio"] = stats.inputBytes?static_cast<double>(stats.outputBytes)/stats.inputBytes:0.0;
+                item["CpuMs"] = stats.cpuNs/1e6;
+                item["MBPerCpuSecond"] = stats.cpuNs?stats.inputBytes*1e3/stats.cpuNs:0.0;
             }
 
-            lock->unlock();
+            Json::StyledWriter writer;
+            *outJson = writer.write(outValue);
         }
 
-        void OnlineMachine()
+        //获取题目列表的页面，只渲染请求的那一页
+        //渲染好的页面按修正之后的参数缓存，题库没有变化的时候，再次请求只需要查一次缓存
+        //先查出本页再查缓存：查页只是在索引上算一下位置，超出范围的页码、不存在的难度都落到同一个缓存项上
+        bool AllQuestion(const PageQuery& query,RenderedPagePtr* out)
         {
-            // 我们统⼀上线，后⾯统⼀解决
-            // TODO
+            QuestionPage page;
+            bool isGetPage = _model.GetQuestionPage(query,&page);
+            if(!isGetPage)
+            {
+                Log(Error)<<"获取题目列表失败！"<<'\n';
+                return false;
+            }
+
+            std::string key = PageKey("list",page);
+            if(_pageCache.Get(key,out))
+                return true;
+
+            std::string html;
+            _view.AllExpandHtml(page,&html);
+            *out = _pageCache.Put(key,std::move(html));
+            return true;
         }
 
-        //显示所有主机，为了做测试才用的函数
-        void ShowMachines()
+        // 题目列表的JSON接口，和页面一样分页，结果同样放进页面缓存
+        // 直接从快照的索引写出JSON，不经过模板
+        bool ApiQuestions(const PageQuery& query,RenderedPagePtr* out)
         {
-            lock->lock();
-
-            std::cout<<"当前在线主机的列表："<<std::endl;
-            for(auto& id : onlineMachine)
+            QuestionPage page;
+            if(!_model.GetQuestionPage(query,&page))
             {
-                std::cout<<id<<" ";
+                Log(Error)<<"获取题目列表失败！"<<'\n';
+                return false;
             }
-            std::cout<<std::endl;
 
-            std::cout<<"当前离线主机的列表："<<std::endl;
-            for(auto& id : offlineMachine)
+            std::string key = PageKey("api-list",page);
+            if(_pageCache.Get(key,out))
+                return true;
+
+            std::string json;
+            JsonWriter writer(&json);
+            writer.BeginObject()
+                  .Key("Page").Int(page.query.page)
+                  .Key("Size").Int(page.query.size)
+                  .Key("Pages").Int(page.pages)
+                  .Key("Total").UInt(page.total)
+                  .Key("Sort").String(SortName(page.query.sort))
+                  .Key("Star").String(page.query.star)
+                  .Key("Stars").BeginArray();
+            for(const auto& star : page.bank->stars)
+                writer.String(star);
+            writer.EndArray().Key("Questions").BeginArray();
+            for(size_t i=0;i<page.count;i++)
             {
-                std::cout<<id<<" ";
+                const Question& question = *page.questions[i];
+                writer.BeginObject()
+                      .Key("Id").String(question.id)
+                      .Key("Title").String(question.title)
+                      .Key("Star").String(question.star)
+                      .EndObject();
             }
-            std::cout<<std::endl;
+            writer.EndArray().EndObject();
 
-            lock->unlock();
+            *out = _pageCache.Put(key,std::move(json));
+            return true;
         }
-    };
 
-    class Control
-    {
-    private:
-        Model _model;
-        View _view;
-        LoadBlance _loadBlance;
-    public:
-        Control()
-        {}
-        ~Control()
-        {}
-    public:
-        //获取所有题目的页面
-        bool AllQuestion(std::string* html)
+        // 单个题目的JSON接口，包括描述、预设代码和限制
+        bool ApiQuestion(const std::string& questionNumber,RenderedPagePtr* out)
         {
-            std::vector<Question> questions;
-            bool isGetAllQuestions = _model.GetAllQuestions(&questions);
-            if(!isGetAllQuestions)
+            std::string key = PageKey("api-question",_model.Snapshot(),questionNumber);
+            if(_pageCache.Get(key,out))
+                return true;
+
+            QuestionPtr question;
+            if(!_model.GetOneQuestion(questionNumber,&question))
             {
-                Log(Error)<<"获取题目列表失败！"<<'\n';
+                Log(Error)<<"题目： "<<questionNumber<<" 不存在！"<<'\n';
                 return false;
             }
 
-            _view.AllExpandHtml(questions,html);
+            std::string json;
+            JsonWriter writer(&json);
+            writer.BeginObject()
+                  .Key("Id").String(question->id)
+                  .Key("Title").String(question->title)
+                  .Key("Star").String(question->star)
+                  .Key("CpuLimit").Int(question->cpuLimit)
+                  .Key("MemoryLimit").Int(question->memoryLimit)
+                  .Key("Description").String(question->description)
+                  .Key("Header").String(question->header)
+                  .EndObject();
+
+            *out = _pageCache.Put(key,std::move(json));
             return true;
         }
 
-        //获取单个题目的页面
-        bool GetOneQuestion(const std::string& questionNumber,std::string* html)
+        // 搜索题目，结果为JSON
+        void Search(const std::string& query,int page,int size,std::string* outJson)
+        {
+            SearchResult result;
+            std::vector<QuestionPtr> questions;
+            _model.Search(query,page,size,&result,&questions);
+
+            Json::Value outValue;
+            outValue["Query"] = query;
+            outValue["Total"] = static_cast<Json::UInt64>(result.total);
+            outValue["Page"] = result.page;
+            outValue["Size"] = result.size;
+            outValue["Results"] = Json::Value(Json::arrayValue);
+            for(size_t i=0;i<questions.size();i++)
+            {
+                Json::Value item;
+                item["Id"] = questions[i]->id;
+                item["Title"] = questions[i]->title;
+                item["Star"] = questions[i]->star;
+                item["Score"] = result.hits[i].score;
+                outValue["Results"].append(item);
+            }
+
+            Json::FastWriter writer;
+            *outJson = writer.write(outValue);
+        }
+
+        //获取单个题目的页面，和题目列表一样缓存渲染好的页面
+        //题目不存在的时候不放进缓存，所以可以直接用请求的编号查
+        bool GetOneQuestion(const std::string& questionNumber,RenderedPagePtr* out)
         {
-            Question question;
+            std::string key = PageKey("question",_model.Snapshot(),questionNumber);
+            if(_pageCache.Get(key,out))
+                return true;
+
+            QuestionPtr question;
             bool isGetOneQuestion = _model.GetOneQuestion(questionNumber,&question);
             if(!isGetOneQuestion)
             {
@@ -285,7 +506,9 @@ namespace ns_OJ_control
                 return false;
             }
 
-            _view.OneExpandHtml(question,html);
+            std::string html;
+            _view.OneExpandHtml(*question,&html);
+            *out = _pageCache.Put(key,std::move(html));
             return true;
         }
 
@@ -307,81 +530,408 @@ namespace ns_OJ_control
              *****/
         // 3.找到负载最低的主机
         // 4.向主机发送请求，得到结果
-        void Judge(const std::string& questionNumber,const std::string& inJson,std::string* outJson)
+        // 在第2步之后，会先去判题结果缓存里找一找，同样的代码已经判过了就直接返回，isCacheHit表示结果是否来自缓存
+        // client为请求的来源地址，排队时按它轮转
+        void Judge(const std::string& questionNumber,const std::string& inJson,const std::string& client,
+                   std::string* outJson,bool* isCacheHit = nullptr)
         {
+            ScopedTimer timer(_judgeLatency);
+            if(isCacheHit)
+                *isCacheHit = false;
+
             // 1.根据题目编号，找到题目
-            Question question;
-            if(!_model.GetOneQuestion(questionNumber,&question))
+            QuestionPtr question;
+            Span questionSpan("GetQuestion");
+            bool isFound = _model.GetOneQuestion(questionNumber,&question);
+            questionSpan.End();
+            if(!isFound)
             {
                 Log(Error)<<"需要被判题的题目不存在！"<<"题目ID： "<<questionNumber<<'\n';
+                _judgeFailed->Inc();
                 return;
             }
 
-            // 2.根据inJson的数据，形式编译所需要的compileJson串
+            // 2.根据inJson的数据，形成编译运行的请求
             // 2.1. 读取inJson中的数据
+            Span parseSpan("ParseJson");
             Json::Value inValue;
             Json::Reader reader;
             reader.parse(inJson,inValue);
 
             std::string code = inValue["Code"].asString();
             std::string input = inValue["Input"].asString();
+            // 提交的用户，用于保存提交记录，没有登录的提交为空
+            std::string user = inValue["User"].asString();
+
+            // 2.2. 形成请求，是否需要打包成compileJson串由执行器决定
+            RunRequest request;
+            MakeRunRequest(*question,code,input,&request);
+            parseSpan.End();
+
+            // 2.3. 查找判题结果缓存，代码和输入一起决定了结果
+            std::string source = code+'\0'+input;
+            Span cacheSpan("ResultCache");
+            bool isCached = _resultCache.Get(question->id,question->version,source,outJson);
+            cacheSpan.End();
+            if(isCached)
+            {
+                if(isCacheHit)
+                    *isCacheHit = true;
+                _judgeCacheHits->Inc();
+                Log(Normal)<<"判题结果缓存命中，题目ID： "<<questionNumber<<'\n';
+                RecordSubmission(question->id,user,code,input,*outJson,timer.ElapsedUs(),FlagCached);
+                return;
+            }
 
-            // 2.2. 形成compileJson串
-            Json::Value compileValue;
+            // 3.合并相同的并发提交
+            // 双击提交、比赛中大家用同一份模板，同一份代码会在很短的时间内到达好几次
+            // 正在判的提交和新来的提交完全一样，就不再分发了，等第一份判完，大家拿同一个结果
+            std::string flightKey = question->id+':'+HashUtil::ToHex(question->version)+':'+source;
+            std::string result;
+            Span flightSpan("SingleFlight");
+            // 只有真正要交给主机的提交才排队，缓存命中和合并的提交不占位置
+            JudgeClass judgeClass = ClassifyJudge();
+            bool isLeader = _singleFlight.Do(flightKey,[this,&request,&client,judgeClass]()
+            {
+                std::unique_ptr<JudgeScheduler::Ticket> ticket;
+                Span scheduleSpan("Schedule");
+                scheduleSpan.SetDetail(JudgeClassNames[judgeClass]);
+                _scheduler.Acquire(judgeClass,client,request.cpuLimit,&ticket);
+                scheduleSpan.End();
+
+                std::string dispatchResult;
+                Dispatch(request,&dispatchResult);
+                return dispatchResult;
+            },&result);
+            flightSpan.SetDetail(isLeader?"leader":"coalesced");
+            flightSpan.End();
+
+            if(result.empty())
+            {
+                _judgeFailed->Inc();
+                return;
+            }
+
+            *outJson = result;
+            (isLeader?_judgeDispatched:_judgeCoalesced)->Inc();
+            RecordSubmission(question->id,user,code,input,result,timer.ElapsedUs());
+            if(!isLeader)
+            {
+                Log(Normal)<<"相同的提交正在判题，已合并，题目ID： "<<questionNumber<<'\n';
+                return;
+            }
 
-            compileValue["Code"] = code+"\n"+question.tail;//编译所需要的代码，由用户写的代码和包含测试用例与主函数的tail拼接而成
-            compileValue["Input"] = input;
-            compileValue["CpuLimit"] = question.cpuLimit;
-            compileValue["MemoryLimit"] = question.memoryLimit;
+            Span storeSpan("StoreResult");
+            if(IsCacheable(result))
+                _resultCache.Put(question->id,question->version,source,result);
+        }
 
-            Json::FastWriter writer;
-            std::string compileJson = writer.write(compileValue);
+        // 只检查代码能不能通过编译：和题目的tail拼在一起做g++ -fsyntax-only，不链接也不运行
+        // 排在检查的类别中，花费固定为1，诊断信息解析成结构化的列表，行号换算到用户代码或者tail中
+        DispatchStatus Check(const std::string& questionNumber,const std::string& inJson,const std::string& client,std::string* outJson)
+        {
+            QuestionPtr question;
+            if(!_model.GetOneQuestion(questionNumber,&question))
+                return DispatchNotFound;
+
+            Json::Value inValue;
+            Json::Reader reader;
+            reader.parse(inJson,inValue);
+            std::string code = inValue["Code"].asString();
 
-            // 3.找到负载最小的主机
-            // 这里会产生一个问题——当我们找到了负载最小的主机，然后这个主机突然下线了，怎么办？
-            // 如果我们不去管，只去发请求而不检查回复的可靠性，那么有可能会因为这个问题导致无法正确判题
-            // 所以在这里，我们采取的方式是——循环。不断找到负载最小的主机，向其发送请求，一直到收到了正确的回复为止
+            RunRequest request;
+            MakeRunRequest(*question,code,"",&request);
+            request.syntaxOnly = true;
+            std::string result;
+            {
+                std::unique_ptr<JudgeScheduler::Ticket> ticket;
+                Span scheduleSpan("Schedule");
+                scheduleSpan.SetDetail(JudgeClassNames[ClassCheck]);
+                _scheduler.Acquire(ClassCheck,client,1,&ticket);
+                scheduleSpan.End();
+                if(!Dispatch(request,&result))
+                    return DispatchUnavailable;
+            }
+
+            Json::Value resultValue;
+            reader.parse(result,resultValue);
+            std::vector<Diagnostic> diagnostics;
+            Compiler::ParseDiagnostics(resultValue["Stderr"].asString(),&diagnostics);
+
+            // 用户代码后面接一个换行再接tail，main.cpp中超过用户代码行数的行属于tail
+            int codeLines = static_cast<int>(std::count(code.begin(),code.end(),'\n'))+1;
+            JsonWriter writer(outJson);
+            writer.BeginObject()
+                  .Key("Status").Int(resultValue["Status"].asInt())
+                  .Key("Reason").String(resultValue["Reason"].asString())
+                  .Key("Diagnostics").BeginArray();
+            for(const Diagnostic& diagnostic : diagnostics)
+            {
+                std::string file = diagnostic.file;
+                int line = diagnostic.line;
+                if(file=="main.cpp")
+                {
+                    file = line<=codeLines?"solution.cpp":"tail.cpp";
+                    if(line>codeLines)
+                        line -= codeLines;
+                }
+                writer.BeginObject()
+                      .Key("File").String(file)
+                      .Key("Line").Int(line)
+                      .Key("Column").Int(diagnostic.column)
+                      .Key("Severity").String(diagnostic.severity)
+                      .Key("Message").String(diagnostic.message)
+                      .EndObject();
+            }
+            writer.EndArray().EndObject();
+            return DispatchOk;
+        }
+
+        // 用自定义输入运行用户的代码，排在运行的类别中，用户在等着看输出
+        // 运行不是判题：不拼tail，用户的代码自己带main从标准输入读Input；不保存提交，不计入统计和排行榜，只返回程序的输出
+        // 没有Input的请求不是运行，否则任何提交都可以改走这个接口插到比赛和平时提交的前面
+        DispatchStatus Run(const std::string& questionNumber,const std::string& inJson,const std::string& client,std::string* outJson)
+        {
+            QuestionPtr question;
+            if(!_model.GetOneQuestion(questionNumber,&question))
+                return DispatchNotFound;
+
+            Json::Value inValue;
+            Json::Reader reader;
+            reader.parse(inJson,inValue);
+            RunRequest request;
+            request.code = inValue["Code"].asString();
+            request.input = inValue["Input"].asString();
+            request.cpuLimit = question->cpuLimit;
+            request.memoryLimit = question->memoryLimit;
+            if(request.input.empty())
+                return DispatchInvalid;
+
+            std::unique_ptr<JudgeScheduler::Ticket> ticket;
+            Span scheduleSpan("Schedule");
+            scheduleSpan.SetDetail(JudgeClassNames[ClassRun]);
+            _scheduler.Acquire(ClassRun,client,request.cpuLimit,&ticket);
+            scheduleSpan.End();
+            return Dispatch(request,outJson)?DispatchOk:DispatchUnavailable;
+        }
+
+        // 重判一次保存下来的提交，用题库中现在的题目和当时的输入，排在重判的类别中
+        // 不经过结果缓存，也不保存成新的提交，返回原来的结论和重判的结果
+        // 和判题一样按请求的来源地址轮转，提交记录中的用户名是客户端自己填的
+        DispatchStatus Rejudge(uint64_t id,const std::string& client,std::string* outJson)
+        {
+            SubmissionPtr record;
+            QuestionPtr question;
+            if(!_store.IsOpen() || !_store.Get(id,&record) || !_model.GetOneQuestion(record->question,&question))
+                return DispatchNotFound;
+
+            RunRequest request;
+            MakeRunRequest(*question,record->code,record->input,&request);
+            std::string result;
+            {
+                std::unique_ptr<JudgeScheduler::Ticket> ticket;
+                _scheduler.Acquire(ClassRejudge,client,request.cpuLimit,&ticket);
+                if(!Dispatch(request,&result))
+                    return DispatchUnavailable;
+            }
+
+            Json::Value resultValue;
+            Json::Reader reader;
+            reader.parse(result,resultValue);
+            JsonWriter writer(outJson);
+            writer.BeginObject()
+                  .Key("Id").UInt(record->id)
+                  .Key("Verdict").String(VerdictName(record->verdict))
+                  .Key("NewVerdict").String(VerdictName(JudgeVerdict(resultValue)))
+                  .Key("Result").Raw(result)
+                  .EndObject();
+            return DispatchOk;
+        }
+
+    private:
+        // 页面缓存的键：题库的代号、页面的种类、页面的参数，题库重新加载之后旧的键自然不会再被命中
+        static std::string PageKey(const char* kind,const QuestionBankPtr& bank,const std::string& detail)
+        {
+            return std::to_string(bank?bank->generation:0)+':'+kind+':'+detail;
+        }
+
+        // 题目列表的键只能用修正之后的查询条件，否则一个客户端换着页码请求，就能用同一页的副本把缓存挤满
+        static std::string PageKey(const char* kind,const QuestionPage& page)
+        {
+            const PageQuery& query = page.query;
+            return PageKey(kind,page.bank,std::to_string(query.page)+':'+std::to_string(query.size)+':'+SortName(query.sort)+':'+query.star);
+        }
+
+        // 编译所需要的代码，由用户写的代码和包含测试用例与主函数的tail拼接而成
+        static void MakeRunRequest(const Question& question,const std::string& code,const std::string& input,RunRequest* request)
+        {
+            request->code.reserve(code.size()+1+question.tail.size());
+            request->code += code;
+            request->code += '\n';
+            request->code.append(question.tail.data(),question.tail.size());
+            request->input = input;
+            request->cpuLimit = question.cpuLimit;
+            request->memoryLimit = question.memoryLimit;
+        }
+
+        // 类别不看请求体，客户端选不了：比赛期间的提交是比赛提交，其余是平时的提交
+        JudgeClass ClassifyJudge() const
+        {
+            uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            if(_contest.startMs!=0 && nowMs>=_contest.startMs && (_contest.endMs==0 || nowMs<_contest.endMs))
+                return ClassContest;
+            return ClassPractice;
+        }
+
+        // 判题结果的结论：Status为0时看测试用例的输出中有没有没通过的用例，大于0时是程序收到的信号
+        static Verdict JudgeVerdict(const Json::Value& resultValue)
+        {
+            int status = resultValue["Status"].asInt();
+            if(status==0)
+                return resultValue["Stdout"].asString().find("没有通过")==std::string::npos?VerdictAccepted:VerdictWrongAnswer;
+            if(status==CodeEmpty || status==CompileError)
+                return VerdictCompileError;
+            if(status==SIGXCPU)
+                return VerdictTimeLimit;
+            if(status==SIGABRT)
+                return VerdictMemoryLimit;
+            if(status>0)
+                return VerdictRuntimeError;
+            return VerdictSystemError;
+        }
+
+        // 保存一次提交，合并的提交和缓存命中的提交也是用户的一次提交，同样保存
+        // 统计由存储读到记录的时候更新；存储没有打开的时候直接更新
+        void RecordSubmission(const std::string& questionId,const std::string& user,const std::string& code,const std::string& input,
+                              const std::string& result,uint64_t durationUs,uint8_t flags = 0)
+        {
+            Json::Value resultValue;
+            Json::Reader reader;
+            reader.parse(result,resultValue);
+
+            Submission submission;
+            submission.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            submission.durationUs = durationUs;
+            submission.status = resultValue["Status"].asInt();
+            submission.verdict = JudgeVerdict(resultValue);
+            submission.flags = flags;
+            submission.user = user;
+            submission.question = questionId;
+            if(!_store.IsOpen())
+            {
+                _statistics.Add(submission,static_cast<Verdict>(submission.verdict));
+                return;
+            }
+            submission.code = code;
+            submission.input = input;
+            submission.result = result;
+            _store.Append(submission);
+        }
+
+        // 判题的指标在构造的时候获取好；缓存的统计数据在导出的时候才读取
+        void RegisterMetrics()
+        {
+            Registry& registry = Registry::Instance();
+            _judgeLatency = registry.GetHistogram("oj_judge_duration_seconds","一次判题的总时间，包括缓存命中的");
+            _judgeCacheHits = registry.GetCounter("oj_judge_total","判题请求数",Label("result","cache_hit"));
+            _judgeCoalesced = registry.GetCounter("oj_judge_total","判题请求数",Label("result","coalesced"));
+            _judgeDispatched = registry.GetCounter("oj_judge_total","判题请求数",Label("result","dispatched"));
+            _judgeFailed = registry.GetCounter("oj_judge_total","判题请求数",Label("result","failed"));
+
+            registry.SetCallback("oj_cache_hits_total","缓存命中次数",Registry::CounterType,Label("cache","page"),[this]()
+                                 { return static_cast<double>(_pageCache.Stats().hits); });
+            registry.SetCallback("oj_cache_misses_total","缓存未命中次数",Registry::CounterType,Label("cache","page"),[this]()
+                                 { return static_cast<double>(_pageCache.Stats().misses); });
+            registry.SetCallback("oj_cache_bytes","缓存占用的字节数",Registry::GaugeType,Label("cache","page"),[this]()
+                                 { return static_cast<double>(_pageCache.Stats().bytes); });
+            registry.SetCallback("oj_cache_hits_total","缓存命中次数",Registry::CounterType,Label("cache","question_body"),[this]()
+                                 { return static_cast<double>(_model.BodyCacheStats().hits); });
+            registry.SetCallback("oj_cache_misses_total","缓存未命中次数",Registry::CounterType,Label("cache","question_body"),[this]()
+                                 { return static_cast<double>(_model.BodyCacheStats().misses); });
+            registry.SetCallback("oj_cache_bytes","缓存占用的字节数",Registry::GaugeType,Label("cache","question_body"),[this]()
+                                 { return static_cast<double>(_model.BodyCacheStats().bytes); });
+            registry.SetCallback("oj_cache_bytes","缓存占用的字节数",Registry::GaugeType,Label("cache","judge_result"),[this]()
+                                 { return static_cast<double>(_resultCache.Bytes()); });
+        }
+
+        // 主机配置中的IP为embedded时，在本进程内编译运行，否则通过http交给CompileServer
+        static std::shared_ptr<Executor> MakeExecutor(const std::string& ip,int port)
+        {
+            if(ip==EmbeddedMachine)
+                return std::make_shared<EmbeddedExecutor>(port);
+            return std::make_shared<RemoteExecutor>(ip,port);
+        }
+
+        // 4.由负载均衡的策略选出主机，把请求交给主机的执行器
+        // 这里会产生一个问题——当我们找到了负载最小的主机，然后这个主机突然下线了，怎么办？
+        // 如果我们不去管，只去发请求而不检查回复的可靠性，那么有可能会因为这个问题导致无法正确判题
+        // 所以在这里，我们采取的方式是——循环。不断找到负载最小的主机，向其发送请求，一直到收到了正确的回复为止
+        bool Dispatch(const RunRequest& request,std::string* outJson)
+        {
             while(true)
             {
                 int machineID = 0;
                 Machine* machine = nullptr;
-                if(!_loadBlance.SmartChoice(&machineID,&machine))
+                Span choiceSpan("SmartChoice");
+                bool isChosen = _loadBlance.SmartChoice(&machineID,&machine);
+                choiceSpan.End();
+                if(!isChosen)
                 {
                     //如果没有找到合适的主机，那么说明服务器挂了，服务也没必要进行了
                     Log(Normal)<<"所有主机都已经离线"<<'\n';
-                    return;
+                    return false;
                 }
 
-                // 4. 找到主机后，向主机发送请求
-                Client client(machine->ip,machine->port);
+                // 找到主机后，把请求交给主机的执行器
                 machine->IncreaseLoad();
+                machine->choices->Inc();
                 Log(Normal)<<"选择主机成功，主机号为： "<<machineID<<'\n';
-                auto response = client.Post("/CompileAndRun",compileJson,"application/json;charset=utf-8");
+                std::string result;
+                bool isOnline = false;
+                {
+                    Span executeSpan("Execute");
+                    if(executeSpan.IsRecording())
+                        executeSpan.SetDetail(machine->ip+':'+std::to_string(machine->port));
+                    ScopedTimer timer(machine->latency);
+                    isOnline = machine->executor->Execute(request,&result);
+                }
+                machine->DecreaseLoad();
 
                 // 如果有应答
-                if(response)
-                {   
-                    // 如果应答的状态码为200，则表示正常，从response中获取outJson
-                    if(response->status==200)
+                if(isOnline)
+                {
+                    // 结果不为空，则表示正常
+                    if(!result.empty())
                     {
-                        *outJson = response->body;
-                        machine->DecreaseLoad();
+                        *outJson = result;
                         Log(Normal)<<"编译和运行服务成功！"<<'\n';
-                        break;
+                        return true;
                     }
-                    
-                    machine->DecreaseLoad();
                 }
                 // 如果没有应答，则表示主机已经离线，重新找其他主机
                 else
                 {
+                    machine->errors->Inc();
                     Log(Warnning)<<"请求的主机"<<machineID<<"已经离线，尝试请求其他主机"<<'\n';
                     _loadBlance.OffLineMachine(machineID);
                     //为了测试
                     _loadBlance.ShowMachines();
                 }
-
             }
         }
+
+        // 判断一个判题结果是否可以缓存
+        // 编译错误、代码为空、正常运行，这些结果对同一份代码来说是确定的
+        // 而超时、内存超限、未知错误等，可能和主机当时的负载有关，下次提交不一定还是这个结果，所以不缓存
+        static bool IsCacheable(const std::string& result)
+        {
+            Json::Value resultValue;
+            Json::Reader reader;
+            if(!reader.parse(result,resultValue))
+                return false;
+
+            int status = resultValue["Status"].asInt();
+            return status==0 || status==CompileError || status==CodeEmpty;
+        }
     };
 }
\ No newline at end of file
@@ -2,57 +2,281 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <mutex>
 #include <assert.h>
 #include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <jsoncpp/json/json.h>
+#include <boost/utility/string_view.hpp>
 
 #include "../Comm/Utility.hpp"
 #include "../Comm/Log.hpp"
+#include "../Comm/DirWatcher.hpp"
+#include "../Comm/MappedFile.hpp"
+#include "../Comm/LruCache.hpp"
+#include "../Comm/SingleFlight.hpp"
+#include "OJ_pack.hpp"
+#include "OJ_search.hpp"
 
 namespace ns_OJ_model
 {
     using namespace ns_Log;
     using namespace ns_Util;
+    using namespace ns_DirWatcher;
+    using namespace ns_MappedFile;
+    using namespace ns_LruCache;
+    using namespace ns_SingleFlight;
+    using namespace ns_OJ_pack;
+    using namespace ns_OJ_search;
 
     struct Question
     {
-        std::string id;          // 题目id
-        std::string title;       // 题目标题
-        std::string star;        // 题目难度
-        int cpuLimit;            // cpu限制
-        int memoryLimit;         // 内存限制
-        std::string description; // 题目描述
-        std::string header;      // 题目头，需要给用户的初始代码
-        std::string tail;        // 题目尾，包含测试用例，用于和用户传入的代码拼接
+        std::string id;                 // 题目id
+        std::string title;              // 题目标题
+        std::string star;               // 题目难度
+        int cpuLimit;                   // cpu限制
+        int memoryLimit;                // 内存限制
+        boost::string_view description; // 题目描述
+        boost::string_view header;      // 题目头，需要给用户的初始代码
+        boost::string_view tail;        // 题目尾，包含测试用例，用于和用户传入的代码拼接
+        uint64_t version;               // 题目版本，由tail和限制计算得出，判题结果只在同一个版本内有效
+
+        // 是否已经加载了描述、题目头、题目尾
+        // 从题目目录加载时，快照中只有题目列表中的信息，这三部分在第一次被访问的时候才会去读文件
+        bool hasBody;
+        // 描述、题目头、题目尾指向的内存
+        // 从目录加载时是一块属于这个题目的字符串，从打包文件加载时是整个映射的文件
+        std::shared_ptr<const void> storage;
+
+        Question()
+            : cpuLimit(0), memoryLimit(0), version(0), hasBody(false)
+        {
+        }
+    };
+
+    // 题目一旦加载完成就不会再被修改，所有人拿到的都是同一份题目的引用计数句柄
+    // 读取题目的时候只需要拷贝一个智能指针，不再深拷贝描述、预设代码和tail
+    typedef std::shared_ptr<const Question> QuestionPtr;
+    typedef std::shared_ptr<const std::vector<QuestionPtr>> QuestionListPtr;
+
+    // 题目列表的排序方式
+    enum QuestionSort
+    {
+        SortById = 0, // 按题目编号
+        SortByStar,   // 按难度，同难度按编号
+        SortByTitle   // 按标题，同标题按编号
+    };
+
+    // 排序方式和链接参数之间的转换
+    inline QuestionSort ParseSort(const std::string &sort)
+    {
+        if (sort == "star")
+            return SortByStar;
+        if (sort == "title")
+            return SortByTitle;
+        return SortById;
+    }
+
+    inline const char *SortName(QuestionSort sort)
+    {
+        if (sort == SortByStar)
+            return "star";
+        if (sort == SortByTitle)
+            return "title";
+        return "id";
+    }
+
+    // 同一难度的题目的索引
+    struct StarIndex
+    {
+        std::vector<QuestionPtr> byId;
+        std::vector<QuestionPtr> byTitle;
+    };
+
+    // 题库快照
+    // 一次加载形成一个快照，快照形成之后是只读的
+    struct QuestionBank
+    {
+        std::unordered_map<std::string, QuestionPtr> questions; // 题目ID -> 题目
+        std::vector<QuestionPtr> questionList;                  // 按题目列表文件中的顺序排列的所有题目
+        std::string questionPath;                               // 题目目录，按需加载题目内容的时候使用
+        uint64_t generation;                                    // 快照的代数，每加载一次加一
+
+        // 题目列表的有序索引，形成快照的时候排好序，分页的时候直接按下标取一段
+        std::vector<QuestionPtr> byId;
+        std::vector<QuestionPtr> byStar;
+        std::vector<QuestionPtr> byTitle;
+        std::unordered_map<std::string, StarIndex> starIndexes; // 难度 -> 该难度的题目
+        std::vector<std::string> stars;                         // 题库中出现的所有难度，按难度从低到高排列
+
+        QuestionBank()
+            : generation(0)
+        {
+        }
+    };
+    typedef std::shared_ptr<const QuestionBank> QuestionBankPtr;
+
+    const int DefaultPageSize = 50;
+    const int MaxPageSize = 200;
+
+    // 分页查询的条件
+    struct PageQuery
+    {
+        int page;         // 页码，从1开始
+        int size;         // 每页的题目数量
+        QuestionSort sort; // 排序方式
+        std::string star; // 只看某个难度，为空表示不筛选
+
+        PageQuery()
+            : page(1), size(DefaultPageSize), sort(SortById)
+        {
+        }
+    };
+
+    // 分页查询的结果
+    // 本页的题目直接指向快照中的索引，不拷贝任何东西，所以需要持有快照
+    struct QuestionPage
+    {
+        QuestionBankPtr bank;
+        const QuestionPtr *questions; // 本页的第一个题目
+        size_t count;                 // 本页的题目数量
+        size_t total;                 // 满足条件的题目总数
+        PageQuery query;              // 修正之后的查询条件
+        int pages;                    // 总页数
+
+        QuestionPage()
+            : questions(nullptr), count(0), total(0), pages(0)
+        {
+        }
     };
 
-    const std::string QuestionList = "./questions/questions.list";
     const std::string QuestionPath = "./questions/";
+    const std::string QuestionListName = "questions.list";
+    // 打包好的题库，存在就优先使用，不存在就从题目目录中加载（开发的时候直接改目录就可以）
+    const std::string QuestionPackName = "questions.pack";
+    // 按需加载的题目内容的缓存容量，按字节计算
+    const size_t QuestionBodyCacheCapacity = 64 * 1024 * 1024;
 
     class Model
     {
     private:
-        std::unordered_map<std::string, Question> questionsContainer;
+        // 当前的题库快照
+        // 读者通过std::atomic_load拿到快照的句柄，重新加载的时候在后台形成新的快照，再用std::atomic_store整体替换
+        // 读者永远不会等待加载，正在使用旧快照的读者也不受影响，最后一个读者放手之后旧快照自动释放
+        QuestionBankPtr _bank;
+
+        // 题目标题和描述的全文索引，每次加载之后在后台增量重建
+        // 要在_watcher之前构造、之后析构，监视线程停下之后才能销毁
+        Searcher _searcher;
+
+        // 同一时间只允许一个重新加载
+        std::mutex _reloadLock;
+        // 题库替换之后需要通知的回调，比如让依赖题目内容的缓存失效
+        std::vector<std::function<void()>> _reloadListeners;
+        // 监视题目目录，有变化就重新加载
+        std::unique_ptr<DirWatcher> _watcher;
+        uint64_t _generation;
+
+        // 从题目目录按需加载的题目内容
+        // 内存占用取决于有多少题目是热的，而不是题库有多大
+        LruCache<QuestionPtr> _bodyCache;
+        // 同一个题目同时未命中，只读一次文件
+        SingleFlight<QuestionPtr> _bodyFlight;
 
     public:
         Model()
+            : _generation(0),
+              _bodyCache(QuestionBodyCacheCapacity, [](const QuestionPtr &question)
+                         { return sizeof(Question) + question->description.size() + question->header.size() + question->tail.size(); })
         {
-            assert(LoadQuestionList(QuestionList));
+            assert(LoadQuestionList(QuestionPath));
         }
         ~Model()
         {
         }
 
     public:
-        // 加载题目列表
+        // 开始监视题目目录，题目有改动时在后台重新加载，不需要再重启服务
+        void StartWatch()
+        {
+            _watcher.reset(new DirWatcher(QuestionPath, [this]()
+                                          { Reload(); }));
+            if (!_watcher->Start())
+                _watcher.reset();
+        }
+
+        // 注册题库替换之后的回调，需要在服务开始之前注册
+        void AddReloadListener(const std::function<void()> &listener)
+        {
+            _reloadListeners.push_back(listener);
+        }
+
+        // 重新加载题库
+        // 加载失败的时候保留旧的快照，服务不受影响
+        bool Reload()
+        {
+            std::unique_lock<std::mutex> guard(_reloadLock);
+            if (!LoadQuestionList(QuestionPath))
+            {
+                Log(Warnning) << "重新加载题库失败，继续使用旧的题库" << '\n';
+                return false;
+            }
+
+            // 旧快照的题目内容不会再被用到了
+            _bodyCache.Clear();
+
+            for (auto &listener : _reloadListeners)
+                listener();
+            return true;
+        }
+
+        // 获取当前的题库快照
+        QuestionBankPtr Snapshot()
+        {
+            return std::atomic_load(&_bank);
+        }
+
+        // 题目内容缓存的统计数据
+        CacheStats BodyCacheStats()
+        {
+            return _bodyCache.Stats();
+        }
+
+        // 加载题库，成功之后替换当前的快照
+        bool LoadQuestionList(const std::string &questionPath)
+        {
+            std::shared_ptr<QuestionBank> bank;
+            bool isPack = FileUtil::IsFileExist(questionPath + QuestionPackName);
+            bool isBuild = isPack ? BuildPackedBank(questionPath + QuestionPackName, &bank)
+                                  : BuildLooseBank(questionPath, &bank, true);
+            if (!isBuild)
+                return false;
+
+            bank->generation = ++_generation;
+            BuildIndexes(bank.get());
+            std::atomic_store(&_bank, QuestionBankPtr(bank));
+            _searcher.Rebuild(bank->generation, bank, SearchDocuments(*bank));
+            Log(Normal) << "加载题库成功！共" << bank->questionList.size() << "道题目"
+                        << (isPack ? "（打包文件）" : "（题目目录）") << '\n';
+            return true;
+        }
+
+        // 从题目目录中形成一个新的快照
         // 题目列表的格式是：
         //  题目ID 题目标题 题目难度 CPU限制  内存限制
         // 我们在加载的时候，采用的方法是一行一行读取，每一行都是一个题目的数据，一直读完整个文件，就是所有题目列表
-        bool LoadQuestionList(const std::string &questionListFileName)
+        // 题库可能在运行中被重新加载，只要有一行数据有问题，就认为这次加载失败，不能让一份残缺的题库替换掉好的题库
+        // lazy为true时只读取题目列表，题目的内容等到第一次被访问的时候再读
+        static bool BuildLooseBank(const std::string &questionPath, std::shared_ptr<QuestionBank> *out, bool lazy = false)
         {
             // 从传入的文件名中读取题目列表
+            std::string questionListFileName = questionPath + QuestionListName;
             std::ifstream questionList(questionListFileName);
             if (!questionList.is_open())
             {
@@ -60,101 +284,432 @@ namespace ns_OJ_model
                 return false;
             }
 
+            std::shared_ptr<QuestionBank> bank = std::make_shared<QuestionBank>();
+            bank->questionPath = questionPath;
+
             // 打开文件成功后，开始读取单个题目的数据，单个题目数据格式为：
             // id 标题 难度 时间限制 空间限制
             std::string buffer;
             while (std::getline(questionList, buffer))
             {
+                if (buffer.empty())
+                    continue;
+
                 std::vector<std::string> data;
                 // 把数据切开 ———— 通过格式我们发现，分隔符为空格
                 StringUtil::SplitString(buffer, &data, " ");
 
                 if (data.size() != 5)
                 {
-                    Log(Error) << "读取题目格式错误，已跳过该题目" << '\n';
-                    continue;
+                    Log(Error) << "读取题目格式错误：" << buffer << '\n';
+                    return false;
                 }
 
                 // 用数据生成结构体
                 std::string questionId = data[0];
                 std::string questionTitle = data[1];
                 std::string questionStar = data[2];
-                int questionCpuLimit = std::stoi(data[3].c_str());
-                int questionMemoryLimit = std::stoi(data[4].c_str());
-
-                // 读取了题目的部分信息后，进入具体题目的文件夹，去读取剩余的信息
-                // 具体的题目文件夹名，与题目的ID相同
-                // 在一个题目的文件夹内，会存在三个文件：
-                // 1.desc.txt
-                // 2.head.cpp
-                // 3.tail.cpp
-                // 这三个文件分别是什么？题目的描述，题目预设，题目尾
-                // 为什么要单独建一个文件夹？如果全部放一个文件内，那么不说可读性差，不好分割等问题
-                // 在以后，假如我们想只去加载一个题目，那么还要把所有文件全部读一遍，代价极
-                std::string questionPath = QuestionPath + questionId + "/";
-
-                std::string questionDescription;
-                FileUtil::ReadFromFile(questionPath + "desc.txt", &questionDescription, true);
-                std::string questionHead;
-                FileUtil::ReadFromFile(questionPath + "header.cpp", &questionHead, true);
-                std::string questionTail;
-                FileUtil::ReadFromFile(questionPath + "tail.cpp", &questionTail, true);
-
-                // 开始填充Question结构体，添加到哈希表中
-                Question question;
-                question.id = questionId;
-                question.title = questionTitle;
-                question.star = questionStar;
-                question.cpuLimit = questionCpuLimit;
-                question.memoryLimit = questionMemoryLimit;
-                question.description = questionDescription;
-                question.header = questionHead;
-                question.tail = questionTail;
-
-                questionsContainer.insert({questionId, question});
+                int questionCpuLimit = 0;
+                int questionMemoryLimit = 0;
+                try
+                {
+                    questionCpuLimit = std::stoi(data[3]);
+                    questionMemoryLimit = std::stoi(data[4]);
+                }
+                catch (const std::exception &e)
+                {
+                    Log(Error) << "题目" << questionId << "的资源限制格式错误" << '\n';
+                    return false;
+                }
+
+                // 开始填充Question结构体，添加到快照中
+                std::shared_ptr<Question> question = std::make_shared<Question>();
+                question->id = questionId;
+                question->title = questionTitle;
+                question->star = questionStar;
+                question->cpuLimit = questionCpuLimit;
+                question->memoryLimit = questionMemoryLimit;
+
+                // 延迟加载的时候不读内容，但三个文件都要在、都能读，否则一份缺文件的题库会在重新加载时替换掉好的题库
+                if (lazy ? !CheckQuestionBody(questionPath, questionId) : !LoadQuestionBody(questionPath, *question, &question))
+                    return false;
+
+                if (!bank->questions.insert({questionId, question}).second)
+                {
+                    Log(Error) << "题目ID" << questionId << "重复" << '\n';
+                    return false;
+                }
+                bank->questionList.push_back(question);
             }
 
             // 结束加载
             questionList.close();
-            Log(Normal) << "加载题库成功！" << '\n';
+            if (bank->questionList.empty())
+            {
+                Log(Error) << "题目列表为空" << '\n';
+                return false;
+            }
+
+            *out = bank;
+            return true;
+        }
+
+        // 检查题目的三个文件是否存在并且可以读取，不读内容
+        static bool CheckQuestionBody(const std::string &questionPath, const std::string &id)
+        {
+            std::string questionDir = questionPath + id + "/";
+            for (const char *name : {"desc.txt", "header.cpp", "tail.cpp"})
+            {
+                struct stat st;
+                std::string fileName = questionDir + name;
+                if (stat(fileName.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || access(fileName.c_str(), R_OK) != 0)
+                {
+                    Log(Error) << "题目" << id << "的文件不完整，缺少" << name << '\n';
+                    return false;
+                }
+            }
             return true;
         }
 
+        // 读取题目的描述、题目头、题目尾，形成一个完整的题目
+        static bool LoadQuestionBody(const std::string &questionPath, const Question &meta, std::shared_ptr<Question> *out)
+        {
+            // 进入具体题目的文件夹，去读取剩余的信息
+            // 具体的题目文件夹名，与题目的ID相同
+            // 在一个题目的文件夹内，会存在三个文件：
+            // 1.desc.txt
+            // 2.head.cpp
+            // 3.tail.cpp
+            // 这三个文件分别是什么？题目的描述，题目预设，题目尾
+            // 为什么要单独建一个文件夹？如果全部放一个文件内，那么不说可读性差，不好分割等问题
+            // 在以后，假如我们想只去加载一个题目，那么还要把所有文件全部读一遍，代价极
+            std::string questionDir = questionPath + meta.id + "/";
+
+            std::string questionDescription;
+            std::string questionHead;
+            std::string questionTail;
+            if (!FileUtil::ReadFromFile(questionDir + "desc.txt", &questionDescription, true) ||
+                !FileUtil::ReadFromFile(questionDir + "header.cpp", &questionHead, true) ||
+                !FileUtil::ReadFromFile(questionDir + "tail.cpp", &questionTail, true))
+            {
+                Log(Error) << "题目" << meta.id << "的文件不完整" << '\n';
+                return false;
+            }
+
+            // 三个文件的内容放在同一块内存里，题目中的string_view指向这块内存
+            std::shared_ptr<std::string> storage = std::make_shared<std::string>();
+            storage->reserve(questionDescription.size() + questionHead.size() + questionTail.size());
+            *storage += questionDescription;
+            *storage += questionHead;
+            *storage += questionTail;
+            const char *text = storage->data();
+
+            std::shared_ptr<Question> question = std::make_shared<Question>(meta);
+            question->description = boost::string_view(text, questionDescription.size());
+            question->header = boost::string_view(text + questionDescription.size(), questionHead.size());
+            question->tail = boost::string_view(text + questionDescription.size() + questionHead.size(), questionTail.size());
+            question->version = QuestionVersion(question->tail, question->cpuLimit, question->memoryLimit);
+            question->hasBody = true;
+            question->storage = storage;
+
+            *out = question;
+            return true;
+        }
+
+        // 从打包文件中形成一个新的快照
+        // 打包文件被整个映射到内存中，题目的描述、题目头、题目尾直接指向映射的内存，不做任何拷贝
+        // 所有题目共同持有这个映射，旧快照上的最后一个题目被释放时，映射才会被解除
+        static bool BuildPackedBank(const std::string &packFileName, std::shared_ptr<QuestionBank> *out)
+        {
+            std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+            if (!file->Open(packFileName))
+            {
+                Log(Error) << "无法映射打包文件" << packFileName << '\n';
+                return false;
+            }
+
+            PackReader reader(file->Data(), file->Size());
+            if (!reader.Parse() || reader.Count() == 0)
+            {
+                Log(Error) << "打包文件格式错误" << packFileName << '\n';
+                return false;
+            }
+
+            std::shared_ptr<QuestionBank> bank = std::make_shared<QuestionBank>();
+            bank->questions.reserve(reader.Count());
+            bank->questionList.reserve(reader.Count());
+            for (uint32_t i = 0; i < reader.Count(); i++)
+            {
+                const PackEntry &entry = reader.Entry(i);
+
+                std::shared_ptr<Question> question = std::make_shared<Question>();
+                question->id = reader.Field(i, FieldId).to_string();
+                question->title = reader.Field(i, FieldTitle).to_string();
+                question->star = reader.Field(i, FieldStar).to_string();
+                question->cpuLimit = entry.cpuLimit;
+                question->memoryLimit = entry.memoryLimit;
+                question->description = reader.Field(i, FieldDescription);
+                question->header = reader.Field(i, FieldHeader);
+                question->tail = reader.Field(i, FieldTail);
+                question->version = entry.version;
+                question->hasBody = true;
+                question->storage = file;
+
+                if (!bank->questions.insert({question->id, question}).second)
+                {
+                    Log(Error) << "打包文件中题目ID" << question->id << "重复" << '\n';
+                    return false;
+                }
+                bank->questionList.push_back(question);
+            }
+
+            *out = bank;
+            return true;
+        }
+
+        // 把题库写成打包文件
+        static bool WritePackedBank(const QuestionBank &bank, const std::string &packFileName)
+        {
+            PackWriter writer;
+            for (const auto &question : bank.questionList)
+            {
+                boost::string_view fields[FieldCount];
+                fields[FieldId] = question->id;
+                fields[FieldTitle] = question->title;
+                fields[FieldStar] = question->star;
+                fields[FieldDescription] = question->description;
+                fields[FieldHeader] = question->header;
+                fields[FieldTail] = question->tail;
+                writer.Add(fields, question->cpuLimit, question->memoryLimit, question->version);
+            }
+            return writer.Write(packFileName);
+        }
+
+        // 难度的排序，简单 < 中等 < 困难，不认识的难度排在最后
+        static int StarRank(const std::string &star)
+        {
+            static const char *ranks[] = {"简单", "中等", "困难"};
+            for (int i = 0; i < 3; i++)
+            {
+                if (star == ranks[i])
+                    return i;
+            }
+            return 3;
+        }
+
+        // 题目编号按数值比较，"2"排在"10"的前面
+        static bool IdLess(const std::string &left, const std::string &right)
+        {
+            if (left.size() != right.size())
+                return left.size() < right.size();
+            return left < right;
+        }
+
+        // 形成快照中的有序索引
+        static void BuildIndexes(QuestionBank *bank)
+        {
+            bank->byId = bank->questionList;
+            std::sort(bank->byId.begin(), bank->byId.end(), [](const QuestionPtr &left, const QuestionPtr &right)
+                      { return IdLess(left->id, right->id); });
+
+            // 其他索引都从按编号排好序的列表出发，用稳定排序，相同的键自然按编号排列
+            bank->byStar = bank->byId;
+            std::stable_sort(bank->byStar.begin(), bank->byStar.end(), [](const QuestionPtr &left, const QuestionPtr &right)
+                             { return StarRank(left->star) < StarRank(right->star); });
+
+            bank->byTitle = bank->byId;
+            std::stable_sort(bank->byTitle.begin(), bank->byTitle.end(), [](const QuestionPtr &left, const QuestionPtr &right)
+                             { return left->title < right->title; });
+
+            for (const auto &question : bank->byId)
+                bank->starIndexes[question->star].byId.push_back(question);
+            for (const auto &question : bank->byTitle)
+                bank->starIndexes[question->star].byTitle.push_back(question);
+
+            for (const auto &question : bank->byStar)
+            {
+                if (bank->stars.empty() || bank->stars.back() != question->star)
+                    bank->stars.push_back(question->star);
+            }
+        }
+
+        // 计算题目的版本
+        // 对于同一份代码，判题结果只取决于tail（测试用例）和资源限制，描述和预设代码的改动不影响结果
+        static uint64_t QuestionVersion(boost::string_view tail, int cpuLimit, int memoryLimit)
+        {
+            uint64_t version = HashUtil::Hash(tail.data(), tail.size());
+            version = HashUtil::Hash(std::to_string(cpuLimit) + ":" + std::to_string(memoryLimit), version);
+            return version;
+        }
+
         // 获取所有题目
-        bool GetAllQuestions(std::vector<Question> *out)
+        // 返回的是快照中题目列表的句柄，和快照共享引用计数，不会拷贝任何题目
+        bool GetAllQuestions(QuestionListPtr *out)
         {
             if (out == nullptr)
                 return false;
 
             // 如果题库容量为空，则表示要么题库没有被正常加载，要么因为网络问题，题库异常丢失
-            if (questionsContainer.size() == 0)
+            QuestionBankPtr bank = Snapshot();
+            if (!bank || bank->questionList.empty())
             {
                 Log(Warnning) << "用户题库获取失败！" << '\n';
                 return false;
             }
 
-            for (const auto &e : questionsContainer)
+            *out = QuestionListPtr(bank, &bank->questionList);
+            return true;
+        }
+
+        // 分页获取题目列表
+        // 只取本页的一段，代价和页的大小有关，和题库的大小无关
+        bool GetQuestionPage(const PageQuery &query, QuestionPage *out)
+        {
+            if (out == nullptr)
+                return false;
+
+            QuestionBankPtr bank = Snapshot();
+            if (!bank || bank->questionList.empty())
+            {
+                Log(Warnning) << "用户题库获取失败！" << '\n';
+                return false;
+            }
+
+            QuestionPage page;
+            page.bank = bank;
+            page.query = query;
+
+            // 选择索引，题库中没有的难度和页码一样修正掉，当作不筛选
+            const std::vector<QuestionPtr> *index = nullptr;
+            auto starIter = bank->starIndexes.find(query.star);
+            if (starIter == bank->starIndexes.end())
+                page.query.star.clear();
+            if (page.query.star.empty())
+            {
+                if (query.sort == SortByStar)
+                    index = &bank->byStar;
+                else if (query.sort == SortByTitle)
+                    index = &bank->byTitle;
+                else
+                    index = &bank->byId;
+            }
+            else
+            {
+                index = query.sort == SortByTitle ? &starIter->second.byTitle : &starIter->second.byId;
+            }
+
+            page.query.size = std::max(1, std::min(query.size, MaxPageSize));
+            page.total = index ? index->size() : 0;
+            page.pages = static_cast<int>((page.total + page.query.size - 1) / page.query.size);
+            page.query.page = std::max(1, std::min(query.page, std::max(page.pages, 1)));
+
+            size_t begin = static_cast<size_t>(page.query.page - 1) * page.query.size;
+            if (index && begin < page.total)
             {
-                out->push_back(e.second);
+                page.questions = index->data() + begin;
+                page.count = std::min(static_cast<size_t>(page.query.size), page.total - begin);
             }
 
+            *out = page;
             return true;
         }
 
         // 获取单个题目
-        bool GetOneQuestion(const std::string &id, Question *out)
+        bool GetOneQuestion(const std::string &id, QuestionPtr *out)
         {
             if (out == nullptr)
                 return false;
 
-            const auto &iter = questionsContainer.find(id);
-            if (iter == questionsContainer.end())
+            QuestionBankPtr bank = Snapshot();
+            if (!bank)
+                return false;
+
+            const auto &iter = bank->questions.find(id);
+            if (iter == bank->questions.end())
             {
                 Log(Warnning) << "没有找到ID为" << "“" + id + "”" << "的题目" << '\n';
                 return false;
             }
 
-            *out = iter->second;
+            if (iter->second->hasBody)
+            {
+                *out = iter->second;
+                return true;
+            }
+
+            return GetQuestionBody(*bank, iter->second, out);
+        }
+
+        // 搜索题目，questions中是本页的题目，和result->hits一一对应
+        // 索引建立在后台进行，刚被删除的题目可能还在索引中，这样的结果直接跳过
+        bool Search(const std::string &query, int page, int size, SearchResult *result, std::vector<QuestionPtr> *questions)
+        {
+            if (result == nullptr || questions == nullptr)
+                return false;
+
+            QuestionBankPtr bank = Snapshot();
+            if (!bank)
+                return false;
+
+            _searcher.Search(query, page, size, result);
+
+            std::vector<SearchHit> hits;
+            questions->clear();
+            for (auto &hit : result->hits)
+            {
+                auto iter = bank->questions.find(hit.id);
+                if (iter == bank->questions.end())
+                    continue;
+                questions->push_back(iter->second);
+                hits.push_back(std::move(hit));
+            }
+            result->hits.swap(hits);
+            return true;
+        }
+
+    private:
+        // 建立全文索引需要的题目数据
+        // 描述还没有加载的题目，让索引自己去读desc.txt
+        static std::vector<SearchDocument> SearchDocuments(const QuestionBank &bank)
+        {
+            std::vector<SearchDocument> documents;
+            documents.reserve(bank.byId.size());
+            for (const auto &question : bank.byId)
+            {
+                SearchDocument document;
+                document.id = question->id;
+                document.title = question->title;
+                if (question->hasBody)
+                    document.description = question->description;
+                else
+                    document.descriptionFile = bank.questionPath + question->id + "/desc.txt";
+                documents.push_back(std::move(document));
+            }
+            return documents;
+        }
+
+        // 按需加载题目内容
+        // 缓存的键带上快照的代数，重新加载之后，旧快照的题目内容不会被新快照用到
+        bool GetQuestionBody(const QuestionBank &bank, const QuestionPtr &meta, QuestionPtr *out)
+        {
+            std::string key = std::to_string(bank.generation) + ':' + meta->id;
+            if (_bodyCache.Get(key, out))
+                return true;
+
+            QuestionPtr question;
+            _bodyFlight.Do(key, [this, &bank, &meta, &key]()
+                           {
+                std::shared_ptr<Question> loaded;
+                if (!LoadQuestionBody(bank.questionPath, *meta, &loaded))
+                    return QuestionPtr();
+
+                _bodyCache.Put(key, loaded);
+                return QuestionPtr(loaded); }, &question);
+
+            if (!question)
+                return false;
+
+            *out = question;
             return true;
         }
     };
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+
+#include <boost/utility/string_view.hpp>
+
+#include "../Comm/Log.hpp"
+
+namespace ns_OJ_pack
+{
+    using namespace ns_Log;
+
+    // 打包题库的文件格式
+    // 题目多了以后，每个题目4个文件一行一行地读，启动时间和页缓存的抖动都会随着题库线性增长
+    // 所以我们提供一个构建步骤，把questions目录打包成一个带索引的二进制文件，OJ_Server启动的时候直接mmap这个文件
+    // 文件的结构为：
+    //  PackHeader      : 魔数、格式版本、题目数量
+    //  PackEntry[count]: 每个题目一项，记录限制、版本，以及各个字符串在文件中的位置
+    //  字符串区        : 所有的字符串首尾相接地放在一起
+    // 所有的偏移量都是相对于文件开头的，读取的时候只需要检查偏移量没有越界，就可以直接用string_view指向映射的内存
+    const char PackMagic[8] = {'O', 'J', 'P', 'A', 'C', 'K', '0', '1'};
+    const uint32_t PackFormatVersion = 1;
+
+    struct PackHeader
+    {
+        char magic[8];
+        uint32_t formatVersion;
+        uint32_t count;
+    };
+
+    struct PackString
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    // 一个题目中的字符串，顺序固定
+    enum PackField
+    {
+        FieldId = 0,
+        FieldTitle,
+        FieldStar,
+        FieldDescription,
+        FieldHeader,
+        FieldTail,
+        FieldCount
+    };
+
+    struct PackEntry
+    {
+        uint64_t version;
+        int32_t cpuLimit;
+        int32_t memoryLimit;
+        PackString fields[FieldCount];
+    };
+
+    // 打包文件的写入
+    class PackWriter
+    {
+    private:
+        std::vector<PackEntry> _entries;
+        std::string _strings;
+
+    public:
+        void Add(const boost::string_view (&fields)[FieldCount], int cpuLimit, int memoryLimit, uint64_t version)
+        {
+            PackEntry entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.version = version;
+            entry.cpuLimit = cpuLimit;
+            entry.memoryLimit = memoryLimit;
+            for (int i = 0; i < FieldCount; i++)
+            {
+                // 此时记录的是在字符串区中的偏移量，写入的时候再加上字符串区的起始位置
+                entry.fields[i].offset = _strings.size();
+                entry.fields[i].size = fields[i].size();
+                _strings.append(fields[i].data(), fields[i].size());
+            }
+            _entries.push_back(entry);
+        }
+
+        // 先写到临时文件，再rename过去
+        // rename是原子的，正在运行的OJ_Server要么看到旧文件，要么看到完整的新文件，不会读到写了一半的文件
+        bool Write(const std::string &fileName)
+        {
+            PackHeader header;
+            memcpy(header.magic, PackMagic, sizeof(PackMagic));
+            header.formatVersion = PackFormatVersion;
+            header.count = _entries.size();
+
+            uint64_t stringsOffset = sizeof(PackHeader) + sizeof(PackEntry) * _entries.size();
+            for (auto &entry : _entries)
+            {
+                for (int i = 0; i < FieldCount; i++)
+                    entry.fields[i].offset += stringsOffset;
+            }
+
+            std::string tempName = fileName + ".tmp";
+            FILE *fp = fopen(tempName.c_str(), "wb");
+            if (fp == nullptr)
+            {
+                Log(Error) << "无法创建打包文件" << tempName << '\n';
+                return false;
+            }
+
+            bool isWrite = fwrite(&header, sizeof(header), 1, fp) == 1;
+            if (isWrite && !_entries.empty())
+                isWrite = fwrite(_entries.data(), sizeof(PackEntry), _entries.size(), fp) == _entries.size();
+            if (isWrite && !_strings.empty())
+                isWrite = fwrite(_strings.data(), 1, _strings.size(), fp) == _strings.size();
+            isWrite = (fclose(fp) == 0) && isWrite;
+
+            if (!isWrite || rename(tempName.c_str(), fileName.c_str()) != 0)
+            {
+                Log(Error) << "写入打包文件失败" << fileName << '\n';
+                unlink(tempName.c_str());
+                return false;
+            }
+            return true;
+        }
+    };
+
+    // 打包文件的读取，只做格式检查，不拷贝任何数据
+    class PackReader
+    {
+    private:
+        const char *_data;
+        size_t _size;
+        const PackEntry *_entries;
+        uint32_t _count;
+
+    public:
+        PackReader(const char *data, size_t size)
+            : _data(data), _size(size), _entries(nullptr), _count(0)
+        {
+        }
+
+    public:
+        bool Parse()
+        {
+            if (_size < sizeof(PackHeader))
+                return false;
+
+            const PackHeader *header = reinterpret_cast<const PackHeader *>(_data);
+            if (memcmp(header->magic, PackMagic, sizeof(PackMagic)) != 0 || header->formatVersion != PackFormatVersion)
+                return false;
+
+            if ((_size - sizeof(PackHeader)) / sizeof(PackEntry) < header->count)
+                return false;
+
+            _entries = reinterpret_cast<const PackEntry *>(_data + sizeof(PackHeader));
+            _count = header->count;
+
+            // 检查所有字符串都在文件范围内
+            for (uint32_t i = 0; i < _count; i++)
+            {
+                for (int j = 0; j < FieldCount; j++)
+                {
+                    const PackString &str = _entries[i].fields[j];
+                    if (str.offset > _size || str.size > _size - str.offset)
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        uint32_t Count() const
+        {
+            return _count;
+        }
+
+        const PackEntry &Entry(uint32_t index) const
+        {
+            return _entries[index];
+        }
+
+        boost::string_view Field(uint32_t index, PackField field) const
+        {
+            const PackString &str = _entries[index].fields[field];
+            return boost::string_view(_data + str.offset, str.size);
+        }
+    };
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+
+#include "../Comm/Log.hpp"
+#include "../Comm/Metrics.hpp"
+
+// 判题的调度
+// 同一时刻交给主机的判题数有上限，超出的在这里排队，空出位置的时候按下面的规则选出下一个：
+//  1. 类别之间按权重平滑轮转，权重大的类别拿到的位置多，但权重小的类别不会饿死
+//  2. 同一类别中，每个用户一个队列，用户之间做deficit round robin，刷提交的用户只占他自己的那一份
+//     这里的“用户”是调用者给的轮转键；请求体里的用户名是客户端自己填的，判题按请求的来源地址轮转
+namespace ns_OJ_scheduler
+{
+    using namespace ns_Log;
+    using namespace ns_Metrics;
+
+    // 判题的类别，越靠前越需要尽快给出结果
+    enum JudgeClass
+    {
+        ClassCheck = 0, // 只检查语法，不链接也不运行，很快就能做完
+        ClassRun,       // 带自定义输入的运行，用户在等着看输出
+        ClassContest,   // 比赛中的提交
+        ClassPractice,  // 平时的提交
+        ClassRejudge,   // 管理员的重判
+        ClassCount
+    };
+
+    const char *const JudgeClassNames[ClassCount] = {"check", "run", "contest", "practice", "rejudge"};
+
+    struct SchedulerOptions
+    {
+        int slots = 8;                              // 同时交给主机的判题数，0表示不限制
+        int weights[ClassCount] = {16, 8, 4, 2, 1}; // 各个类别的权重
+        int quantum = 1;                            // 用户每轮增加的额度，一次判题的花费为题目的CPU时间限制（秒）
+    };
+
+    class JudgeScheduler
+    {
+    private:
+        // 排队中的一次判题，在等待的线程的栈上
+        struct Waiter
+        {
+            int cost;
+            bool isGranted = false;
+            std::condition_variable cond;
+
+            explicit Waiter(int cost_)
+                : cost(cost_)
+            {
+            }
+        };
+
+        struct UserQueue
+        {
+            std::deque<Waiter *> waiters;
+            int64_t deficit = 0;
+        };
+
+        // 一个类别的队列：有判题在排队的用户按轮转的顺序放在active中
+        struct ClassQueue
+        {
+            std::unordered_map<std::string, UserQueue> users;
+            std::deque<std::string> active;
+            size_t waiting = 0;
+            int64_t current = 0; // 平滑加权轮转的当前值
+
+            Counter *dispatched;
+            Histogram *waitLatency;
+        };
+
+        SchedulerOptions _options;
+        std::mutex _lock;
+        int _running;
+        size_t _waiting;
+        ClassQueue _classes[ClassCount];
+
+    public:
+        // 持有期间占着一个位置，析构时让出位置，交给下一个排队的判题
+        class Ticket
+        {
+        private:
+            JudgeScheduler *_scheduler;
+
+        public:
+            explicit Ticket(JudgeScheduler *scheduler)
+                : _scheduler(scheduler)
+            {
+            }
+            ~Ticket()
+            {
+                _scheduler->Release();
+            }
+            Ticket(const Ticket &) = delete;
+            Ticket &operator=(const Ticket &) = delete;
+        };
+
+    public:
+        JudgeScheduler()
+            : _running(0), _waiting(0)
+        {
+            Registry &registry = Registry::Instance();
+            for (int i = 0; i < ClassCount; i++)
+            {
+                std::string label = Label("class", JudgeClassNames[i]);
+                _classes[i].dispatched = registry.GetCounter("oj_scheduler_dispatched_total", "调度出去的判题数", label);
+                _classes[i].waitLatency = registry.GetHistogram("oj_scheduler_wait_seconds", "判题在调度队列中等待的时间", label);
+                registry.SetCallback("oj_scheduler_queue_length", "调度队列中等待的判题数", Registry::GaugeType, label, [this, i]()
+                                     { return static_cast<double>(QueueLength(static_cast<JudgeClass>(i))); });
+                registry.SetCallback("oj_scheduler_queue_users", "调度队列中有判题在等待的用户数", Registry::GaugeType, label, [this, i]()
+                                     { return static_cast<double>(QueueUsers(static_cast<JudgeClass>(i))); });
+            }
+            registry.SetCallback("oj_scheduler_running", "正在主机上执行的判题数", Registry::GaugeType, "", [this]()
+                                 { return static_cast<double>(Running()); });
+        }
+
+        // 需要在开始判题之前设置
+        void Configure(const SchedulerOptions &options)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _options = options;
+            for (int i = 0; i < ClassCount; i++)
+            {
+                if (_options.weights[i] < 1)
+                    _options.weights[i] = 1;
+            }
+            if (_options.quantum < 1)
+                _options.quantum = 1;
+        }
+
+        // 等到轮到这次判题为止，user为轮转键，cost为这次判题的花费
+        // 有空位并且没有人在排队的时候直接返回
+        void Acquire(JudgeClass judgeClass, const std::string &user, int cost, std::unique_ptr<Ticket> *ticket)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            ClassQueue &queue = _classes[judgeClass];
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                if (_waiting == 0 && (_options.slots <= 0 || _running < _options.slots))
+                {
+                    _running++;
+                }
+                else
+                {
+                    Waiter waiter(cost < 1 ? 1 : cost);
+                    UserQueue &userQueue = queue.users[user];
+                    if (userQueue.waiters.empty())
+                        queue.active.push_back(user);
+                    userQueue.waiters.push_back(&waiter);
+                    queue.waiting++;
+                    _waiting++;
+                    waiter.cond.wait(guard, [&waiter]()
+                                     { return waiter.isGranted; });
+                }
+            }
+            queue.dispatched->Inc();
+            queue.waitLatency->Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+            ticket->reset(new Ticket(this));
+        }
+
+        size_t QueueLength(JudgeClass judgeClass)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            return _classes[judgeClass].waiting;
+        }
+
+        size_t QueueUsers(JudgeClass judgeClass)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            return _classes[judgeClass].active.size();
+        }
+
+        int Running()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            return _running;
+        }
+
+    private:
+        void Release()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _running--;
+            while (_waiting > 0 && (_options.slots <= 0 || _running < _options.slots))
+            {
+                Waiter *waiter = Next();
+                waiter->isGranted = true;
+                waiter->cond.notify_one();
+                _running++;
+            }
+        }
+
+        // 先选类别，再在类别中选用户，调用的时候持有锁并且至少有一个判题在排队
+        Waiter *Next()
+        {
+            // 平滑加权轮转：每个有排队的类别加上自己的权重，选当前值最大的，选中的减去总权重
+            int chosen = -1;
+            int64_t total = 0;
+            for (int i = 0; i < ClassCount; i++)
+            {
+                if (_classes[i].waiting == 0)
+                    continue;
+                _classes[i].current += _options.weights[i];
+                total += _options.weights[i];
+                if (chosen < 0 || _classes[i].current > _classes[chosen].current)
+                    chosen = i;
+            }
+            ClassQueue &queue = _classes[chosen];
+            queue.current -= total;
+
+            // deficit round robin：轮到的用户额度不够就加上quantum排到后面去，够了就出队一个判题
+            while (true)
+            {
+                std::string user = queue.active.front();
+                UserQueue &userQueue = queue.users[user];
+                Waiter *waiter = userQueue.waiters.front();
+                if (userQueue.deficit < waiter->cost)
+                {
+                    userQueue.deficit += _options.quantum;
+                    queue.active.pop_front();
+                    queue.active.push_back(user);
+                    continue;
+                }
+
+                userQueue.deficit -= waiter->cost;
+                userQueue.waiters.pop_front();
+                queue.waiting--;
+                _waiting--;
+                // 没有排队的用户不保留额度，不能攒着以后一次用掉
+                if (userQueue.waiters.empty())
+                {
+                    queue.active.pop_front();
+                    queue.users.erase(user);
+                }
+                return waiter;
+            }
+        }
+    };
+}
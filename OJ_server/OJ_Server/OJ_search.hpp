@@ -0,0 +1,607 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+
+#include <boost/utility/string_view.hpp>
+
+#include "../Comm/Utility.hpp"
+#include "../Comm/Log.hpp"
+
+namespace ns_OJ_search
+{
+    using namespace ns_Util;
+    using namespace ns_Log;
+
+    // 分词
+    // 题目的标题和描述大多是中文，中文没有空格来分隔单词，所以对中文采用n-gram的方式：
+    //  英文和数字：连续的字母数字为一个词，统一转换为小写
+    //  中日韩文字：每个字单独作为一个词，相邻的两个字再组成一个词。"求最大值" -> 求 最 大 值 求最 最大 大值
+    //  其他字符（标点、空白等）：作为分隔符
+    // 查询的时候，中文连续两个字以上只用二元词去查，这样"最大值"只会匹配到连续出现"最大""大值"的题目
+    class Tokenizer
+    {
+    public:
+        // forQuery为true时，中文只输出二元词（只有一个字时输出这个字）
+        static void Tokenize(boost::string_view text, std::vector<std::string> *tokens, bool forQuery = false)
+        {
+            std::string word;
+            std::vector<boost::string_view> cjkRun;
+
+            size_t i = 0;
+            while (i < text.size())
+            {
+                size_t charBegin = i;
+                uint32_t codePoint = DecodeUtf8(text, &i);
+
+                if (codePoint < 0x80 && isalnum(static_cast<int>(codePoint)))
+                {
+                    FlushCjk(&cjkRun, tokens, forQuery);
+                    word += static_cast<char>(tolower(static_cast<int>(codePoint)));
+                }
+                else if (IsCjk(codePoint))
+                {
+                    FlushWord(&word, tokens);
+                    cjkRun.push_back(text.substr(charBegin, i - charBegin));
+                }
+                else if (codePoint >= 0x80 && !IsSeparator(codePoint))
+                {
+                    // 其他语言的字母，和英文一样作为单词的一部分
+                    FlushCjk(&cjkRun, tokens, forQuery);
+                    word.append(text.data() + charBegin, i - charBegin);
+                }
+                else
+                {
+                    FlushWord(&word, tokens);
+                    FlushCjk(&cjkRun, tokens, forQuery);
+                }
+            }
+            FlushWord(&word, tokens);
+            FlushCjk(&cjkRun, tokens, forQuery);
+        }
+
+    private:
+        // 解码一个UTF-8字符，非法的字节当作单独的一个字符
+        static uint32_t DecodeUtf8(boost::string_view text, size_t *pos)
+        {
+            unsigned char c = text[*pos];
+            int length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xe ? 3 : (c >> 3) == 0x1e ? 4 : 1;
+            if (*pos + length > text.size())
+                length = 1;
+
+            uint32_t codePoint = length == 1 ? c : length == 2 ? (c & 0x1f) : length == 3 ? (c & 0x0f) : (c & 0x07);
+            for (int k = 1; k < length; k++)
+                codePoint = (codePoint << 6) | (static_cast<unsigned char>(text[*pos + k]) & 0x3f);
+
+            *pos += length;
+            return codePoint;
+        }
+
+        static bool IsCjk(uint32_t c)
+        {
+            return (c >= 0x4e00 && c <= 0x9fff) || (c >= 0x3400 && c <= 0x4dbf) || (c >= 0xf900 && c <= 0xfaff) ||
+                   (c >= 0x3040 && c <= 0x30ff) || (c >= 0xac00 && c <= 0xd7af) || (c >= 0x20000 && c <= 0x2fa1f);
+        }
+
+        // 全角标点、空白等
+        static bool IsSeparator(uint32_t c)
+        {
+            return (c >= 0x2000 && c <= 0x206f) || (c >= 0x3000 && c <= 0x303f) || (c >= 0xff00 && c <= 0xff0f) ||
+                   (c >= 0xff1a && c <= 0xff20) || (c >= 0xff3b && c <= 0xff40) || (c >= 0xff5b && c <= 0xff65) ||
+                   c == 0xa0 || c == 0xfeff;
+        }
+
+        static void FlushWord(std::string *word, std::vector<std::string> *tokens)
+        {
+            if (!word->empty())
+            {
+                tokens->push_back(*word);
+                word->clear();
+            }
+        }
+
+        static void FlushCjk(std::vector<boost::string_view> *run, std::vector<std::string> *tokens, bool forQuery)
+        {
+            if (run->empty())
+                return;
+
+            if (!forQuery || run->size() == 1)
+            {
+                for (const auto &c : *run)
+                    tokens->push_back(c.to_string());
+            }
+            for (size_t k = 0; k + 1 < run->size(); k++)
+                tokens->push_back((*run)[k].to_string() + (*run)[k + 1].to_string());
+
+            run->clear();
+        }
+    };
+
+    // 词典，把词映射为一个整数编号
+    // 倒排索引中只存编号，建立索引的时候用编号直接定位倒排链，不需要再对字符串做哈希
+    // 同一个搜索服务的所有索引共用一个词典，词典只增不减，这样上一次的分词结果这一次可以直接用
+    // 只有建立索引的线程会加入新词，查询只查找，所以用一把锁保护就够了
+    class TermDictionary
+    {
+    private:
+        std::unordered_map<std::string, uint32_t> _ids;
+        mutable std::mutex _lock;
+
+    public:
+        uint32_t Intern(const std::string &term)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            auto iter = _ids.find(term);
+            if (iter != _ids.end())
+                return iter->second;
+
+            uint32_t id = _ids.size();
+            _ids.emplace(term, id);
+            return id;
+        }
+
+        bool Find(const std::string &term, uint32_t *id) const
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            auto iter = _ids.find(term);
+            if (iter == _ids.end())
+                return false;
+            *id = iter->second;
+            return true;
+        }
+
+        size_t Size() const
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            return _ids.size();
+        }
+    };
+
+    // 一个词在一个题目中出现的次数
+    struct DocTerm
+    {
+        uint32_t term;
+        uint16_t titleTf;
+        uint16_t descTf;
+    };
+
+    // 一个题目被分词之后的结果，按词的编号升序排列
+    // 重新建立索引的时候，没有变化的题目直接复用上一次的结果，不需要再读描述、再分词
+    struct DocTerms
+    {
+        uint64_t fingerprint; // 标题和描述的指纹
+        std::vector<DocTerm> terms;
+        uint32_t descLength; // 描述中词的总数
+    };
+    typedef std::shared_ptr<const DocTerms> DocTermsPtr;
+
+    // 建立索引的输入，一个题目一项
+    // 描述已经在内存中时用description，否则从descriptionFile中读取（按需加载的题库）
+    struct SearchDocument
+    {
+        std::string id;
+        std::string title;
+        boost::string_view description;
+        std::string descriptionFile;
+    };
+
+    struct SearchHit
+    {
+        std::string id;
+        double score;
+    };
+
+    // 每页的结果数量限制
+    const int SearchMaxPageSize = 200;
+
+    struct SearchResult
+    {
+        std::vector<SearchHit> hits; // 本页的结果，按得分从高到低排列
+        size_t total;                // 匹配的题目总数
+        int page;
+        int size;
+
+        SearchResult()
+            : total(0), page(1), size(0)
+        {
+        }
+    };
+
+    // 倒排索引
+    // 词 -> 包含这个词的所有题目（按题目在索引中的下标升序排列）
+    // 所有的倒排链首尾相接地放在一个数组里，_offsets[词的编号]是这个词的倒排链的起始位置
+    // 查询的时候所有的词都要出现（与查询），从最短的倒排链开始，其余的倒排链用跳跃查找去确认
+    class SearchIndex
+    {
+    private:
+        // 倒排链中的一项，doc为题目在索引中的下标
+        struct Posting
+        {
+            uint32_t doc;
+            uint16_t titleTf;
+            uint16_t descTf;
+        };
+
+        struct PostingList
+        {
+            const Posting *begin;
+            size_t size;
+        };
+
+        uint64_t _generation; // 建立索引时题库的代数
+        std::shared_ptr<TermDictionary> _dictionary;
+        std::vector<std::string> _docs;
+        std::vector<float> _docNorms; // BM25中和描述长度有关的部分，建立索引的时候算好
+        std::vector<uint32_t> _offsets;
+        std::vector<Posting> _postings;
+        std::unordered_map<std::string, DocTermsPtr> _docTerms; // 题目ID -> 分词结果，供下一次增量建立索引使用
+
+        // BM25的参数，k1 = 1.2，b = 0.75；标题中出现一次相当于描述中出现三次
+        static constexpr double K1 = 1.2;
+        static constexpr double B = 0.75;
+        static constexpr double TitleBoost = 3.0;
+
+    public:
+        SearchIndex()
+            : _generation(0), _dictionary(std::make_shared<TermDictionary>()), _offsets(1, 0)
+        {
+        }
+
+    public:
+        uint64_t Generation() const
+        {
+            return _generation;
+        }
+
+        size_t DocCount() const
+        {
+            return _docs.size();
+        }
+
+        // 建立索引，previous为上一次的索引，用来复用没有变化的题目的分词结果
+        // retokenized输出重新分词的题目数量
+        static std::shared_ptr<SearchIndex> Build(uint64_t generation, const std::vector<SearchDocument> &documents,
+                                                  const SearchIndex *previous, size_t *retokenized = nullptr)
+        {
+            std::shared_ptr<SearchIndex> index = std::make_shared<SearchIndex>();
+            index->_generation = generation;
+            if (previous)
+                index->_dictionary = previous->_dictionary;
+
+            // 第一遍：拿到每个题目的分词结果，没有变化的直接复用
+            std::vector<DocTermsPtr> docTerms;
+            docTerms.reserve(documents.size());
+            index->_docs.reserve(documents.size());
+
+            size_t changed = 0;
+            uint64_t totalLength = 0;
+            for (const SearchDocument &document : documents)
+            {
+                uint64_t fingerprint = Fingerprint(document);
+
+                DocTermsPtr terms;
+                if (previous)
+                {
+                    auto iter = previous->_docTerms.find(document.id);
+                    if (iter != previous->_docTerms.end() && iter->second->fingerprint == fingerprint)
+                        terms = iter->second;
+                }
+                if (!terms)
+                {
+                    terms = Analyze(document, fingerprint, index->_dictionary.get());
+                    changed++;
+                }
+
+                index->_docs.push_back(document.id);
+                index->_docTerms[document.id] = terms;
+                docTerms.push_back(terms);
+                totalLength += terms->descLength;
+            }
+
+            // 第二遍：统计每个词的倒排链长度，算出每条倒排链的起始位置
+            std::vector<uint32_t> &offsets = index->_offsets;
+            offsets.assign(index->_dictionary->Size() + 1, 0);
+            for (const auto &terms : docTerms)
+            {
+                for (const DocTerm &term : terms->terms)
+                    offsets[term.term + 1]++;
+            }
+            for (size_t i = 1; i < offsets.size(); i++)
+                offsets[i] += offsets[i - 1];
+
+            // 第三遍：按题目的顺序填入倒排链，每条倒排链自然是有序的
+            index->_postings.resize(offsets.back());
+            std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+            for (uint32_t doc = 0; doc < docTerms.size(); doc++)
+            {
+                for (const DocTerm &term : docTerms[doc]->terms)
+                {
+                    Posting posting = {doc, term.titleTf, term.descTf};
+                    index->_postings[cursors[term.term]++] = posting;
+                }
+            }
+
+            double averageLength = docTerms.empty() ? 1.0 : std::max(1.0, static_cast<double>(totalLength) / docTerms.size());
+            index->_docNorms.reserve(docTerms.size());
+            for (const auto &terms : docTerms)
+                index->_docNorms.push_back(K1 * (1 - B + B * terms->descLength / averageLength));
+
+            if (retokenized)
+                *retokenized = changed;
+            return index;
+        }
+
+        // 查询，按BM25打分，标题中的词权重更高
+        void Search(const std::string &queryText, int page, int size, SearchResult *result) const
+        {
+            result->page = std::max(1, page);
+            result->size = std::max(1, std::min(size, SearchMaxPageSize));
+            result->total = 0;
+            result->hits.clear();
+
+            std::vector<std::string> tokens;
+            Tokenizer::Tokenize(queryText, &tokens, true);
+            std::sort(tokens.begin(), tokens.end());
+            tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+            if (tokens.empty())
+                return;
+
+            // 找到所有词的倒排链，只要有一个词不存在，结果就为空
+            std::vector<PostingList> lists;
+            for (const auto &token : tokens)
+            {
+                uint32_t term = 0;
+                if (!_dictionary->Find(token, &term) || term + 1 >= _offsets.size() || _offsets[term] == _offsets[term + 1])
+                    return;
+                PostingList list = {_postings.data() + _offsets[term], _offsets[term + 1] - _offsets[term]};
+                lists.push_back(list);
+            }
+            std::sort(lists.begin(), lists.end(), [](const PostingList &left, const PostingList &right)
+                      { return left.size < right.size; });
+
+            std::vector<double> idfs;
+            for (const auto &list : lists)
+            {
+                double n = static_cast<double>(list.size);
+                idfs.push_back(std::log(1.0 + (_docs.size() - n + 0.5) / (n + 0.5)));
+            }
+
+            // 只保留前几页需要的结果：一个大小为need的堆，堆顶是目前留下的结果中最差的
+            size_t begin = static_cast<size_t>(result->page - 1) * result->size;
+            size_t need = begin + result->size;
+            auto better = [](const std::pair<double, uint32_t> &left, const std::pair<double, uint32_t> &right)
+            {
+                if (left.first != right.first)
+                    return left.first > right.first;
+                return left.second < right.second;
+            };
+            std::vector<std::pair<double, uint32_t>> top;
+            top.reserve(std::min(need, lists[0].size));
+
+            // 从最短的倒排链出发，每条倒排链保留一个游标，候选题目是递增的，游标只需要往后走
+            std::vector<size_t> cursors(lists.size(), 0);
+            for (size_t i = 0; i < lists[0].size; i++)
+            {
+                const Posting &candidate = lists[0].begin[i];
+                double score = TermScore(candidate, idfs[0]);
+                bool isMatch = true;
+                for (size_t k = 1; k < lists.size() && isMatch; k++)
+                {
+                    cursors[k] = Advance(lists[k], cursors[k], candidate.doc);
+                    if (cursors[k] == lists[k].size || lists[k].begin[cursors[k]].doc != candidate.doc)
+                        isMatch = false;
+                    else
+                        score += TermScore(lists[k].begin[cursors[k]], idfs[k]);
+                }
+                if (!isMatch)
+                    continue;
+
+                result->total++;
+                std::pair<double, uint32_t> match(score, candidate.doc);
+                if (top.size() < need)
+                {
+                    top.push_back(match);
+                    std::push_heap(top.begin(), top.end(), better);
+                }
+                else if (better(match, top.front()))
+                {
+                    std::pop_heap(top.begin(), top.end(), better);
+                    top.back() = match;
+                    std::push_heap(top.begin(), top.end(), better);
+                }
+            }
+
+            std::sort_heap(top.begin(), top.end(), better);
+            for (size_t k = begin; k < top.size(); k++)
+            {
+                SearchHit hit;
+                hit.id = _docs[top[k].second];
+                hit.score = top[k].first;
+                result->hits.push_back(hit);
+            }
+        }
+
+    private:
+        // 从from开始找到第一个题目下标不小于target的位置
+        // 先按1、2、4、8...的步长往后跳，再在最后一段里二分，要找的位置离游标越近越快
+        static size_t Advance(const PostingList &list, size_t from, uint32_t target)
+        {
+            size_t step = 1, low = from, high = from;
+            while (high < list.size && list.begin[high].doc < target)
+            {
+                low = high + 1;
+                high += step;
+                step <<= 1;
+            }
+            high = std::min(high, list.size);
+
+            const Posting *iter = std::lower_bound(list.begin + low, list.begin + high, target, [](const Posting &posting, uint32_t doc)
+                                                   { return posting.doc < doc; });
+            return iter - list.begin;
+        }
+
+        double TermScore(const Posting &posting, double idf) const
+        {
+            double tf = posting.descTf + TitleBoost * posting.titleTf;
+            return idf * tf * (K1 + 1) / (tf + _docNorms[posting.doc]);
+        }
+
+        // 题目的指纹，标题或描述变了，指纹就会变
+        // 描述已经在内存中时直接哈希描述；按需加载的题目描述还在磁盘上，用desc.txt的修改时间和大小代替，避免把所有描述读一遍
+        static uint64_t Fingerprint(const SearchDocument &document)
+        {
+            uint64_t fingerprint = HashUtil::Hash(document.title);
+            if (document.descriptionFile.empty())
+                return HashUtil::Hash(document.description.data(), document.description.size(), fingerprint);
+
+            struct stat st;
+            if (stat(document.descriptionFile.c_str(), &st) != 0)
+                return fingerprint;
+            std::string meta = std::to_string(st.st_mtim.tv_sec) + '.' + std::to_string(st.st_mtim.tv_nsec) + ':' + std::to_string(st.st_size);
+            return HashUtil::Hash(meta, fingerprint);
+        }
+
+        // 分词并统计每个词出现的次数，返回词的总数
+        static uint32_t CountTerms(boost::string_view text, bool isTitle, TermDictionary *dictionary, std::unordered_map<uint32_t, DocTerm> *counts)
+        {
+            std::vector<std::string> tokens;
+            Tokenizer::Tokenize(text, &tokens);
+            for (const auto &token : tokens)
+            {
+                uint32_t id = dictionary->Intern(token);
+                DocTerm &term = (*counts)[id];
+                term.term = id;
+                uint16_t &tf = isTitle ? term.titleTf : term.descTf;
+                if (tf < 0xffff)
+                    tf++;
+            }
+            return tokens.size();
+        }
+
+        static DocTermsPtr Analyze(const SearchDocument &document, uint64_t fingerprint, TermDictionary *dictionary)
+        {
+            std::shared_ptr<DocTerms> terms = std::make_shared<DocTerms>();
+            terms->fingerprint = fingerprint;
+            terms->descLength = 0;
+
+            std::unordered_map<uint32_t, DocTerm> counts;
+            CountTerms(document.title, true, dictionary, &counts);
+            if (document.descriptionFile.empty())
+            {
+                terms->descLength = CountTerms(document.description, false, dictionary, &counts);
+            }
+            else
+            {
+                std::string description;
+                if (FileUtil::ReadFromFile(document.descriptionFile, &description, true))
+                    terms->descLength = CountTerms(description, false, dictionary, &counts);
+            }
+
+            terms->terms.reserve(counts.size());
+            for (const auto &count : counts)
+                terms->terms.push_back(count.second);
+            std::sort(terms->terms.begin(), terms->terms.end(), [](const DocTerm &left, const DocTerm &right)
+                      { return left.term < right.term; });
+            return terms;
+        }
+    };
+    typedef std::shared_ptr<const SearchIndex> SearchIndexPtr;
+
+    // 搜索服务
+    // 索引在后台线程中建立，建好之后原子地替换，查询永远不会等待建立索引
+    // 题库重新加载之后，只需要提交新的题目，连续多次提交只会按最新的一次建立
+    class Searcher
+    {
+    private:
+        struct BuildTask
+        {
+            uint64_t generation;
+            std::shared_ptr<const void> owner; // description指向的内存的所有者，建立索引期间不能释放
+            std::vector<SearchDocument> documents;
+        };
+
+        SearchIndexPtr _index;
+
+        std::mutex _lock;
+        std::condition_variable _cond;
+        std::unique_ptr<BuildTask> _pending; // 等待建立索引的题目
+        bool _stop;
+        std::thread _builder;
+
+    public:
+        Searcher()
+            : _index(std::make_shared<SearchIndex>()), _stop(false)
+        {
+            _builder = std::thread([this]()
+                                   { BuildRoutine(); });
+        }
+
+        ~Searcher()
+        {
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _stop = true;
+            }
+            _cond.notify_all();
+            _builder.join();
+        }
+
+        Searcher(const Searcher &) = delete;
+        Searcher &operator=(const Searcher &) = delete;
+
+    public:
+        // 提交题库的一个版本，在后台为它建立索引
+        void Rebuild(uint64_t generation, const std::shared_ptr<const void> &owner, std::vector<SearchDocument> documents)
+        {
+            std::unique_ptr<BuildTask> task(new BuildTask());
+            task->generation = generation;
+            task->owner = owner;
+            task->documents.swap(documents);
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                _pending = std::move(task);
+            }
+            _cond.notify_one();
+        }
+
+        void Search(const std::string &query, int page, int size, SearchResult *result)
+        {
+            SearchIndexPtr index = std::atomic_load(&_index);
+            index->Search(query, page, size, result);
+        }
+
+    private:
+        void BuildRoutine()
+        {
+            while (true)
+            {
+                std::unique_ptr<BuildTask> task;
+                {
+                    std::unique_lock<std::mutex> guard(_lock);
+                    _cond.wait(guard, [this]()
+                               { return _stop || _pending; });
+                    if (_stop)
+                        return;
+                    task = std::move(_pending);
+                }
+
+                SearchIndexPtr previous = std::atomic_load(&_index);
+                if (previous->Generation() == task->generation)
+                    continue;
+
+                size_t retokenized = 0;
+                SearchIndexPtr index = SearchIndex::Build(task->generation, task->documents, previous.get(), &retokenized);
+                std::atomic_store(&_index, index);
+                Log(Normal) << "搜索索引建立完成，共" << index->DocCount() << "道题目，其中重新分词" << retokenized << "道" << '\n';
+            }
+        }
+    };
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+#include "../Comm/Log.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/JsonWriter.hpp"
+#include "OJ_store.hpp"
+#include "OJ_cache.hpp"
+
+// 题目的统计和比赛的排行榜
+// 每条提交记录到达的时候增量更新：题目的提交数、通过数、平均判题时间，用户的通过题数和罚时
+// 读的时候不扫描历史，排行榜是一份定期重建的快照，两次重建之间的请求直接返回同一份页面
+// 用户名是提交时客户端自己填的，没有登录来确认，公开的页面只有题目的统计，带用户排名的页面只给管理接口
+namespace ns_OJ_stats
+{
+    using namespace ns_Log;
+    using namespace ns_Metrics;
+    using namespace ns_JsonWriter;
+    using namespace ns_OJ_store;
+    using namespace ns_OJ_cache;
+
+    struct ContestOptions
+    {
+        uint64_t startMs = 0;      // 比赛开始的时间，0表示没有比赛，罚时只算错误的次数
+        uint64_t endMs = 0;        // 比赛结束的时间，0表示不结束；之后的提交只进题目统计，不进排行榜
+        int penaltyMinutes = 20;   // 每次错误的提交罚多少分钟
+        int refreshMs = 1000;      // 排行榜最多多久重建一次
+    };
+
+    // 一道题的统计，计数都是原子的，更新的时候不加锁
+    struct QuestionStats
+    {
+        std::atomic<uint64_t> attempts;
+        std::atomic<uint64_t> accepted;
+        std::atomic<uint64_t> timedAttempts; // 真正编译运行过的提交，缓存命中的不算进判题时间
+        std::atomic<uint64_t> totalDurationUs;
+
+        QuestionStats()
+            : attempts(0), accepted(0), timedAttempts(0), totalDurationUs(0)
+        {
+        }
+    };
+
+    // 一个用户在一道题上的情况
+    struct ProblemCell
+    {
+        uint32_t wrong = 0;       // 通过之前错了几次
+        uint64_t acceptedMs = 0;  // 第一次通过的时间，0表示还没有通过
+    };
+
+    // 排行榜上的一行
+    struct UserRow
+    {
+        std::string user;
+        uint32_t solved = 0;
+        uint64_t penaltySec = 0;
+        uint64_t lastAcceptedMs = 0;   // 罚时相同的时候，先做完的排在前面
+        std::unordered_map<std::string, ProblemCell> problems;
+    };
+
+    class Statistics
+    {
+    private:
+        static const size_t ShardCount = 16;
+
+        // 题目的表只在第一次见到这道题的时候插入，锁只保护表本身，计数在锁外面更新
+        struct QuestionShard
+        {
+            std::mutex lock;
+            std::unordered_map<std::string, std::unique_ptr<QuestionStats>> questions;
+        };
+
+        struct UserShard
+        {
+            std::mutex lock;
+            std::unordered_map<std::string, UserRow> users;
+        };
+
+        ContestOptions _options;
+        QuestionShard _questionShards[ShardCount];
+        UserShard _userShards[ShardCount];
+
+        // 每次更新加一，和上一次重建时的值相同说明排行榜没有变，不需要重建
+        std::atomic<uint64_t> _version;
+
+        std::mutex _buildLock;                 // 同一时刻只有一个线程在重建
+        RenderedPagePtr _page;                 // 只有题目的统计，用atomic_load/atomic_store读写
+        RenderedPagePtr _fullPage;             // 再加上用户的排名，和_page一起重建
+        std::atomic<uint64_t> _builtVersion;
+        std::atomic<int64_t> _builtAtMs;       // steady_clock的毫秒
+
+        Counter *_rebuilds;
+        Histogram *_rebuildLatency;
+
+    public:
+        Statistics()
+            : _version(0), _builtVersion(0), _builtAtMs(0)
+        {
+            Registry &registry = Registry::Instance();
+            _rebuilds = registry.GetCounter("oj_scoreboard_rebuilds_total", "排行榜快照重建的次数");
+            _rebuildLatency = registry.GetHistogram("oj_scoreboard_rebuild_duration_seconds", "重建一次排行榜快照的时间");
+        }
+
+        // 需要在第一条记录到达之前设置
+        void Configure(const ContestOptions &options)
+        {
+            _options = options;
+        }
+
+        // 一条判完的提交，可以在多个线程中同时调用
+        // 编译错误和系统错误不算提交次数，也不罚时
+        void Add(const Submission &submission, Verdict verdict)
+        {
+            if (verdict == VerdictUnknown || verdict == VerdictSystemError || verdict == VerdictCompileError)
+                return;
+            bool isAccepted = verdict == VerdictAccepted;
+
+            QuestionStats *question = FindQuestion(submission.question);
+            question->attempts.fetch_add(1, std::memory_order_relaxed);
+            if (!(submission.flags & FlagCached))
+            {
+                question->timedAttempts.fetch_add(1, std::memory_order_relaxed);
+                question->totalDurationUs.fetch_add(submission.durationUs, std::memory_order_relaxed);
+            }
+            if (isAccepted)
+                question->accepted.fetch_add(1, std::memory_order_relaxed);
+
+            if (!submission.user.empty() && IsInContest(submission.timeMs))
+                AddToUser(submission, isAccepted);
+            _version.fetch_add(1, std::memory_order_release);
+        }
+
+        // 排行榜的快照，距离上次重建超过refreshMs并且有新的提交才重建
+        // 多进程模式下调用之前要先让存储读完journal的末尾，否则看不到其他工作进程的提交
+        // 正在重建的时候其他请求不等待，直接返回旧的快照
+        // withUsers为true时返回带用户排名的页面
+        RenderedPagePtr Scoreboard(bool withUsers)
+        {
+            RenderedPagePtr *slot = withUsers ? &_fullPage : &_page;
+            RenderedPagePtr page = std::atomic_load(slot);
+            if (page && !IsStale())
+                return page;
+
+            std::unique_lock<std::mutex> lock(_buildLock, std::defer_lock);
+            if (!page)
+                lock.lock(); // 还没有快照的时候只能等第一份建好
+            else if (!lock.try_lock())
+                return page;
+
+            page = std::atomic_load(slot);
+            if (page && !IsStale())
+                return page;
+
+            uint64_t version = _version.load(std::memory_order_acquire);
+            ScopedTimer timer(_rebuildLatency);
+            std::string publicJson;
+            std::string fullJson;
+            Build(&publicJson, &fullJson);
+            std::atomic_store(&_page, PageCache::MakePage(std::move(publicJson), true));
+            std::atomic_store(&_fullPage, PageCache::MakePage(std::move(fullJson), true));
+            _builtVersion.store(version, std::memory_order_relaxed);
+            _builtAtMs.store(NowMs(), std::memory_order_relaxed);
+            _rebuilds->Inc();
+            return std::atomic_load(slot);
+        }
+
+    private:
+        static int64_t NowMs()
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static size_t ShardOf(const std::string &key)
+        {
+            return std::hash<std::string>()(key) % ShardCount;
+        }
+
+        bool IsStale() const
+        {
+            return _version.load(std::memory_order_acquire) != _builtVersion.load(std::memory_order_relaxed) &&
+                   NowMs() - _builtAtMs.load(std::memory_order_relaxed) >= _options.refreshMs;
+        }
+
+        bool IsInContest(uint64_t timeMs) const
+        {
+            return timeMs >= _options.startMs && (_options.endMs == 0 || timeMs < _options.endMs);
+        }
+
+        QuestionStats *FindQuestion(const std::string &id)
+        {
+            QuestionShard &shard = _questionShards[ShardOf(id)];
+            std::unique_lock<std::mutex> guard(shard.lock);
+            std::unique_ptr<QuestionStats> &stats = shard.questions[id];
+            if (!stats)
+                stats.reset(new QuestionStats());
+            return stats.get();
+        }
+
+        // ICPC的规则：一道题第一次通过时计入通过数，罚时为通过的时间加上之前每次错误的罚时，通过之后的提交不再计算
+        void AddToUser(const Submission &submission, bool isAccepted)
+        {
+            UserShard &shard = _userShards[ShardOf(submission.user)];
+            std::unique_lock<std::mutex> guard(shard.lock);
+            UserRow &row = shard.users[submission.user];
+            if (row.user.empty())
+                row.user = submission.user;
+
+            ProblemCell &cell = row.problems[submission.question];
+            if (cell.acceptedMs != 0)
+                return;
+            if (!isAccepted)
+            {
+                cell.wrong++;
+                return;
+            }
+
+            cell.acceptedMs = submission.timeMs;
+            row.solved++;
+            row.penaltySec += static_cast<uint64_t>(cell.wrong) * _options.penaltyMinutes * 60;
+            if (_options.startMs != 0)
+                row.penaltySec += (submission.timeMs - _options.startMs) / 1000;
+            row.lastAcceptedMs = std::max(row.lastAcceptedMs, submission.timeMs);
+        }
+
+        // 题目ID都是数字，按数值排序
+        static bool QuestionLess(const std::string &left, const std::string &right)
+        {
+            return left.size() != right.size() ? left.size() < right.size() : left < right;
+        }
+
+        // 两份页面的开头相同：公开的页面在题目统计之后结束，完整的页面接着写用户的排名
+        void Build(std::string *publicJson, std::string *fullJson)
+        {
+            // 每个分片拷贝出来之后就放锁，不会长时间挡住更新
+            std::vector<std::pair<std::string, QuestionStats *>> questions;
+            for (QuestionShard &shard : _questionShards)
+            {
+                std::unique_lock<std::mutex> guard(shard.lock);
+                for (auto &question : shard.questions)
+                    questions.emplace_back(question.first, question.second.get());
+            }
+            std::sort(questions.begin(), questions.end(), [](const std::pair<std::string, QuestionStats *> &left, const std::pair<std::string, QuestionStats *> &right)
+                      { return QuestionLess(left.first, right.first); });
+
+            std::vector<UserRow> rows;
+            for (UserShard &shard : _userShards)
+            {
+                std::unique_lock<std::mutex> guard(shard.lock);
+                for (auto &user : shard.users)
+                    rows.push_back(user.second);
+            }
+            std::sort(rows.begin(), rows.end(), [](const UserRow &left, const UserRow &right)
+                      {
+                if (left.solved != right.solved)
+                    return left.solved > right.solved;
+                if (left.penaltySec != right.penaltySec)
+                    return left.penaltySec < right.penaltySec;
+                if (left.lastAcceptedMs != right.lastAcceptedMs)
+                    return left.lastAcceptedMs < right.lastAcceptedMs;
+                return left.user < right.user; });
+
+            std::string json;
+            JsonWriter writer(&json);
+            writer.BeginObject()
+                .Key("Start").UInt(_options.startMs)
+                .Key("End").UInt(_options.endMs)
+                .Key("Questions").BeginArray();
+            for (const auto &question : questions)
+            {
+                uint64_t attempts = question.second->attempts.load(std::memory_order_relaxed);
+                uint64_t accepted = question.second->accepted.load(std::memory_order_relaxed);
+                uint64_t timed = question.second->timedAttempts.load(std::memory_order_relaxed);
+                uint64_t durationUs = question.second->totalDurationUs.load(std::memory_order_relaxed);
+                writer.BeginObject()
+                    .Key("Id").String(question.first)
+                    .Key("Attempts").UInt(attempts)
+                    .Key("Accepted").UInt(accepted)
+                    .Key("AvgDurationUs").UInt(timed ? durationUs / timed : 0)
+                    .EndObject();
+            }
+            writer.EndArray();
+            *publicJson = json;
+            *publicJson += '}';
+
+            writer.Key("Users").BeginArray();
+
+            // 通过题数和罚时都相同的用户名次相同
+            size_t rank = 0;
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                const UserRow &row = rows[i];
+                if (i == 0 || row.solved != rows[i - 1].solved || row.penaltySec != rows[i - 1].penaltySec)
+                    rank = i + 1;
+
+                std::vector<std::pair<std::string, ProblemCell>> problems(row.problems.begin(), row.problems.end());
+                std::sort(problems.begin(), problems.end(), [](const std::pair<std::string, ProblemCell> &left, const std::pair<std::string, ProblemCell> &right)
+                          { return QuestionLess(left.first, right.first); });
+
+                writer.BeginObject()
+                    .Key("Rank").UInt(rank)
+                    .Key("User").String(row.user)
+                    .Key("Solved").UInt(row.solved)
+                    .Key("PenaltySec").UInt(row.penaltySec)
+                    .Key("Problems").BeginArray();
+                for (const auto &problem : problems)
+                {
+                    writer.BeginObject()
+                        .Key("Question").String(problem.first)
+                        .Key("Wrong").UInt(problem.second.wrong)
+                        .Key("Accepted").Bool(problem.second.acceptedMs != 0);
+                    if (problem.second.acceptedMs != 0)
+                        writer.Key("AcceptedTime").UInt(problem.second.acceptedMs);
+                    writer.EndObject();
+                }
+                writer.EndArray().EndObject();
+            }
+            writer.EndArray().EndObject();
+            fullJson->swap(json);
+        }
+    };
+}
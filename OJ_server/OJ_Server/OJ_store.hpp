@@ -0,0 +1,955 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "../Comm/Log.hpp"
+#include "../Comm/Utility.hpp"
+#include "../Comm/Metrics.hpp"
+#include "../Comm/MappedFile.hpp"
+
+// 提交记录的存储
+// 每次判题的结果追加到日志文件的末尾，内存中按用户、题目、时间建立索引，查询历史不需要重新判题
+// 磁盘上只有三个文件：
+//  journal   追加写的日志，开头是16字节的文件头（魔数、版本、代号），后面一条接一条的记录
+//  snapshot  某一时刻所有记录的快照，以及它包含了journal的哪个代号、到哪个位置为止
+//  lock、users  两个锁文件，协调多个工作进程
+// 重启的时候先读快照，再从快照记下的位置往后读journal，不需要从头读一遍所有的历史
+// 内存中只有索引，代码和判题结果在查看某一条提交的时候才从快照或journal中读出来
+namespace ns_OJ_store
+{
+    using namespace ns_Log;
+    using namespace ns_Util;
+    using namespace ns_Metrics;
+    using namespace ns_MappedFile;
+
+    // 提交的结论，由判题结果的Status和测试用例的输出得出
+    enum Verdict
+    {
+        VerdictUnknown = 0, // 旧版本的记录没有保存结论
+        VerdictAccepted,
+        VerdictWrongAnswer,
+        VerdictCompileError,
+        VerdictRuntimeError,
+        VerdictTimeLimit,
+        VerdictMemoryLimit,
+        VerdictSystemError,
+        VerdictCount
+    };
+
+    const char *const VerdictNames[VerdictCount] = {"Unknown", "Accepted", "WrongAnswer", "CompileError",
+                                                    "RuntimeError", "TimeLimitExceeded", "MemoryLimitExceeded", "SystemError"};
+
+    // 记录中的结论是从文件中读出来的，不认识的值当作Unknown
+    inline const char *VerdictName(uint8_t verdict)
+    {
+        return VerdictNames[verdict < VerdictCount ? verdict : static_cast<uint8_t>(VerdictUnknown)];
+    }
+
+    // 提交的标记
+    enum SubmissionFlag
+    {
+        FlagCached = 1 // 结果来自判题结果缓存，判题时间不是真正编译运行的时间
+    };
+
+    // 一次提交
+    struct Submission
+    {
+        uint64_t id;         // 在存储中的序号，从1开始，由记录在文件中的顺序决定
+        uint64_t timeMs;     // 提交的时间，毫秒时间戳
+        uint32_t durationUs; // 判题用的时间
+        int32_t status;      // 判题结果的Status
+        uint8_t verdict;     // Verdict
+        uint8_t flags;       // SubmissionFlag的组合
+        std::string user;
+        std::string question;
+        std::string code;
+        std::string input;  // 自定义输入，重判的时候原样再用一次
+        std::string result; // 返回给用户的判题结果
+
+        Submission()
+            : id(0), timeMs(0), durationUs(0), status(0), verdict(VerdictUnknown), flags(0)
+        {
+        }
+    };
+
+    typedef std::shared_ptr<const Submission> SubmissionPtr;
+
+    // 查询条件，结果按提交的先后倒序排列，最新的在前面
+    struct SubmissionQuery
+    {
+        std::string user;     // 为空表示所有用户
+        std::string question; // 为空表示所有题目
+        uint64_t sinceMs;     // 提交时间的范围[sinceMs, untilMs]
+        uint64_t untilMs;
+        uint64_t beforeId; // 只要序号小于它的，用于翻页，0表示不限制
+        size_t limit;
+
+        SubmissionQuery()
+            : sinceMs(0), untilMs(UINT64_MAX), beforeId(0), limit(20)
+        {
+        }
+    };
+
+    struct StoreOptions
+    {
+        std::string path;
+        bool sync;            // 每批记录写完之后是否fdatasync
+        int commitIntervalMs; // 攒多久的记录一起写，0表示有记录就写，写的同时到达的记录自然会攒成下一批
+        size_t snapshotBytes; // journal在快照之后又增长了这么多字节，就写一个新的快照
+
+        StoreOptions()
+            : path("./submissions/"), sync(true), commitIntervalMs(0), snapshotBytes(64 << 20)
+        {
+        }
+    };
+
+    // 记录的编码
+    // 一条记录：魔数(4) 长度(4) 校验(4) 内容(长度)，校验为内容的FNV哈希的低32位
+    // 内容：版本(1) 时间(8) 判题时间(4) 状态(4) 结论(1) 标记(1) 用户 题目 代码 输入 结果，字符串为长度(4)加内容
+    // 版本1没有结论这一项，读出来的结论为VerdictUnknown；版本2没有标记这一项，读出来为0；版本3之前没有输入，读出来为空
+    class RecordCodec
+    {
+    public:
+        static const uint32_t Magic = 0x52534a4f; // "OJSR"
+        static const size_t HeaderSize = 12;
+        static const uint32_t MaxPayload = 64 << 20;
+
+        enum DecodeStatus
+        {
+            DecodeOk,
+            DecodeIncomplete, // 数据还不完整，可能是别的进程正在写，等一会儿再读
+            DecodeCorrupt     // 数据完整但是校验不对
+        };
+
+        static void Encode(const Submission &submission, std::string *out)
+        {
+            size_t begin = out->size();
+            out->resize(begin + HeaderSize);
+            out->push_back(4);
+            PutInt(out, submission.timeMs);
+            PutInt(out, submission.durationUs);
+            PutInt(out, static_cast<uint32_t>(submission.status));
+            PutInt(out, submission.verdict);
+            PutInt(out, submission.flags);
+            PutString(out, submission.user);
+            PutString(out, submission.question);
+            PutString(out, submission.code);
+            PutString(out, submission.input);
+            PutString(out, submission.result);
+
+            uint32_t length = out->size() - begin - HeaderSize;
+            uint32_t check = static_cast<uint32_t>(HashUtil::Hash(out->data() + begin + HeaderSize, length));
+            uint32_t magic = Magic;
+            memcpy(&(*out)[begin], &magic, 4);
+            memcpy(&(*out)[begin + 4], &length, 4);
+            memcpy(&(*out)[begin + 8], &check, 4);
+        }
+
+        // 解码data开头的一条记录，consumed为这条记录占用的字节数
+        static DecodeStatus Decode(const char *data, size_t size, size_t *consumed, Submission *submission)
+        {
+            if (size < HeaderSize)
+                return DecodeIncomplete;
+            uint32_t magic, length, check;
+            memcpy(&magic, data, 4);
+            memcpy(&length, data + 4, 4);
+            memcpy(&check, data + 8, 4);
+            if (magic != Magic || length > MaxPayload)
+                return DecodeCorrupt;
+            if (size < HeaderSize + length)
+                return DecodeIncomplete;
+
+            const char *payload = data + HeaderSize;
+            if (static_cast<uint32_t>(HashUtil::Hash(payload, length)) != check)
+                return DecodeCorrupt;
+
+            size_t offset = 1;
+            uint32_t status = 0;
+            submission->verdict = VerdictUnknown;
+            submission->flags = 0;
+            submission->input.clear();
+            if (length < 1 || payload[0] < 1 || payload[0] > 4 ||
+                !GetInt(payload, length, &offset, &submission->timeMs) ||
+                !GetInt(payload, length, &offset, &submission->durationUs) ||
+                !GetInt(payload, length, &offset, &status) ||
+                (payload[0] >= 2 && !GetInt(payload, length, &offset, &submission->verdict)) ||
+                (payload[0] >= 3 && !GetInt(payload, length, &offset, &submission->flags)) ||
+                !GetString(payload, length, &offset, &submission->user) ||
+                !GetString(payload, length, &offset, &submission->question) ||
+                !GetString(payload, length, &offset, &submission->code) ||
+                (payload[0] >= 4 && !GetString(payload, length, &offset, &submission->input)) ||
+                !GetString(payload, length, &offset, &submission->result))
+                return DecodeCorrupt;
+            submission->status = static_cast<int32_t>(status);
+            *consumed = HeaderSize + length;
+            return DecodeOk;
+        }
+
+        // 从from开始找下一条记录的魔数，用于跳过损坏的数据
+        static size_t FindMagic(const std::string &data, size_t from)
+        {
+            const char magic[4] = {'O', 'J', 'S', 'R'};
+            for (size_t i = from; i + 4 <= data.size(); i++)
+            {
+                if (memcmp(data.data() + i, magic, 4) == 0)
+                    return i;
+            }
+            // 没有找到，最后3个字节可能是下一条记录魔数的开头，留着等后面的数据
+            return data.size() >= from + 3 ? data.size() - 3 : from;
+        }
+
+    private:
+        template <class T>
+        static void PutInt(std::string *out, T value)
+        {
+            out->append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        static void PutString(std::string *out, const std::string &value)
+        {
+            PutInt(out, static_cast<uint32_t>(value.size()));
+            out->append(value);
+        }
+
+        template <class T>
+        static bool GetInt(const char *data, size_t size, size_t *offset, T *value)
+        {
+            if (size - *offset < sizeof(T))
+                return false;
+            memcpy(value, data + *offset, sizeof(T));
+            *offset += sizeof(T);
+            return true;
+        }
+
+        static bool GetString(const char *data, size_t size, size_t *offset, std::string *value)
+        {
+            uint32_t length;
+            if (!GetInt(data, size, offset, &length) || size - *offset < length)
+                return false;
+            value->assign(data + *offset, length);
+            *offset += length;
+            return true;
+        }
+    };
+
+    // 记录在磁盘上的位置：快照或者journal中记录开头的偏移
+    struct RecordLocation
+    {
+        bool inSnapshot;
+        uint64_t offset;
+    };
+
+    // 内存中的索引，所有的查询都只查这里
+    // 索引中只有记录的元数据（序号、用户、题目、结论、时间），代码和判题结果留在磁盘上，按位置读出来
+    // 按用户、按题目的索引是序号的数组，记录按序号追加，数组天然有序，翻页用二分查找
+    class SubmissionIndex
+    {
+    private:
+        std::vector<SubmissionPtr> _records; // 第i个为序号i+1的记录，code、input和result为空
+        std::vector<RecordLocation> _locations;
+        std::unordered_map<std::string, std::vector<uint64_t>> _byUser;
+        std::unordered_map<std::string, std::vector<uint64_t>> _byQuestion;
+        // 按提交时间排序的(时间, 序号)，多个进程的记录在文件中的顺序和时间不完全一致，用有序的树，插入在哪里都是O(logN)
+        std::set<std::pair<uint64_t, uint64_t>> _byTime;
+
+    public:
+        // 给submission分配序号，索引中只保存它的元数据
+        SubmissionPtr Add(Submission *submission, const RecordLocation &location)
+        {
+            submission->id = _records.size() + 1;
+            std::shared_ptr<Submission> record = std::make_shared<Submission>();
+            record->id = submission->id;
+            record->timeMs = submission->timeMs;
+            record->durationUs = submission->durationUs;
+            record->status = submission->status;
+            record->verdict = submission->verdict;
+            record->flags = submission->flags;
+            record->user = submission->user;
+            record->question = submission->question;
+            _records.push_back(record);
+            _locations.push_back(location);
+            if (!record->user.empty())
+                _byUser[record->user].push_back(record->id);
+            _byQuestion[record->question].push_back(record->id);
+
+            _byTime.emplace_hint(_byTime.end(), record->timeMs, record->id);
+            return record;
+        }
+
+        size_t Count() const
+        {
+            return _records.size();
+        }
+
+        const std::vector<RecordLocation> &Locations() const
+        {
+            return _locations;
+        }
+
+        // 前count条记录都写进了新的快照，offsets为它们在快照中的位置
+        void MoveToSnapshot(const std::vector<uint64_t> &offsets)
+        {
+            for (size_t i = 0; i < offsets.size() && i < _locations.size(); i++)
+            {
+                _locations[i].inSnapshot = true;
+                _locations[i].offset = offsets[i];
+            }
+        }
+
+        bool Find(uint64_t id, RecordLocation *location) const
+        {
+            if (id == 0 || id > _records.size())
+                return false;
+            *location = _locations[id - 1];
+            return true;
+        }
+
+        void Query(const SubmissionQuery &query, std::vector<SubmissionPtr> *out) const
+        {
+            out->clear();
+            uint64_t before = query.beforeId == 0 ? UINT64_MAX : query.beforeId;
+
+            // 有用户或者题目的时候，沿着更短的那个列表往前找
+            const std::vector<uint64_t> *ids = nullptr;
+            if (!query.user.empty())
+                ids = Find(_byUser, query.user);
+            if (!query.question.empty())
+            {
+                const std::vector<uint64_t> *byQuestion = Find(_byQuestion, query.question);
+                if (ids == nullptr || byQuestion->size() < ids->size())
+                    ids = byQuestion;
+            }
+            if (ids != nullptr)
+            {
+                auto end = std::lower_bound(ids->begin(), ids->end(), before);
+                for (auto iter = end; iter != ids->begin() && out->size() < query.limit;)
+                {
+                    const SubmissionPtr &record = _records[*--iter - 1];
+                    if (Match(query, *record))
+                        out->push_back(record);
+                }
+                return;
+            }
+
+            // 只有时间范围，在时间索引上从范围的末尾往前找，和序号的倒序基本一致
+            if (query.sinceMs > 0 || query.untilMs != UINT64_MAX)
+            {
+                auto begin = _byTime.lower_bound(std::make_pair(query.sinceMs, static_cast<uint64_t>(0)));
+                auto end = _byTime.upper_bound(std::make_pair(query.untilMs, UINT64_MAX));
+                for (auto iter = end; iter != begin && out->size() < query.limit;)
+                {
+                    --iter;
+                    if (iter->second < before)
+                        out->push_back(_records[iter->second - 1]);
+                }
+                return;
+            }
+
+            // 没有条件，最新的若干条
+            uint64_t last = std::min<uint64_t>(before - 1, _records.size());
+            for (uint64_t id = last; id > 0 && out->size() < query.limit; id--)
+                out->push_back(_records[id - 1]);
+        }
+
+    private:
+        static const std::vector<uint64_t> *Find(const std::unordered_map<std::string, std::vector<uint64_t>> &index, const std::string &key)
+        {
+            static const std::vector<uint64_t> empty;
+            auto iter = index.find(key);
+            return iter == index.end() ? &empty : &iter->second;
+        }
+
+        static bool Match(const SubmissionQuery &query, const Submission &record)
+        {
+            return (query.user.empty() || record.user == query.user) &&
+                   (query.question.empty() || record.question == query.question) &&
+                   record.timeMs >= query.sinceMs && record.timeMs <= query.untilMs;
+        }
+    };
+
+    // 提交记录的存储
+    // 写：Append把记录编码之后放进待写的缓冲区就返回，后台线程把攒下的记录一次write追加到journal，一批记录只fdatasync一次
+    //     判题的线程不会等磁盘，比赛中每秒几百个提交也只是每秒几十次fdatasync
+    //     代价是进程崩溃或者断电的时候，最后几毫秒还没有写下去的记录会丢失
+    // 读：索引只从journal中读出来的记录建立，自己写的和其他工作进程写的走同一条路，所有进程看到的序号都一样
+    //     查询之前先看一下journal有没有变长，有的话把新的记录读进索引
+    //     索引只记下每条记录在快照或journal中的位置，Get的时候pread出完整的记录
+    // 多进程：每个进程都以O_APPEND打开同一个journal，一次write的内容不会和其他进程的交错
+    //     每个打开存储的进程都持有users的共享锁；启动的时候持有lock的独占锁，拿到users独占锁说明没有其他进程在用，
+    //     这时候可以把journal压缩进快照，换一个新的journal；其他进程还在用的时候journal只追加，不替换
+    class SubmissionStore
+    {
+    private:
+        static const uint32_t JournalMagic = 0x4a534a4f; // "OJSJ"
+        static const uint32_t SnapshotMagic = 0x53534a4f; // "OJSS"
+        static const size_t JournalHeaderSize = 16;
+        static const size_t SnapshotHeaderSize = 40;
+
+        StoreOptions _options;
+        int _journalFd;
+        int _snapshotFd; // 最近一次读到或写出的快照，其他进程换了新的快照，这个文件依然可读
+        int _lockFd;
+        int _usersFd;
+        uint64_t _generation; // journal的代号，每次压缩换一个新的journal，代号加一
+
+        // 索引和读journal的位置
+        std::mutex _lock;
+        SubmissionIndex _index;
+        uint64_t _readOffset;   // journal中下一条还没有读进索引的记录的位置
+        std::string _readBuffer; // 从_readOffset开始已经读出来、但是还不完整的数据
+        uint64_t _snapshotOffset; // 最近一次快照包含了journal到哪里为止
+        uint64_t _skippedBytes;   // 因为损坏而跳过的字节数
+
+        // 待写的记录
+        std::mutex _pendingLock;
+        std::condition_variable _pendingCond;
+        std::string _pending;
+        bool _isWriting; // 后台线程正在写一批记录
+        bool _stop;
+        std::thread _writer;
+
+        // 每条读进索引的记录都交给它，用于在记录之上维护统计
+        std::function<void(const Submission &)> _listener;
+
+        Counter *_appends;
+        Counter *_commits;
+        Histogram *_commitLatency;
+        Histogram *_snapshotLatency;
+
+    public:
+        SubmissionStore()
+            : _journalFd(-1), _snapshotFd(-1), _lockFd(-1), _usersFd(-1), _generation(0), _readOffset(0), _snapshotOffset(0), _skippedBytes(0), _isWriting(false), _stop(false)
+        {
+            Registry &registry = Registry::Instance();
+            _appends = registry.GetCounter("oj_store_appends_total", "写入提交记录的条数");
+            _commits = registry.GetCounter("oj_store_commits_total", "提交记录写入journal的批数，每批一次write和一次fdatasync");
+            _commitLatency = registry.GetHistogram("oj_store_commit_duration_seconds", "一批提交记录写入journal的时间");
+            _snapshotLatency = registry.GetHistogram("oj_store_snapshot_duration_seconds", "写一次快照的时间");
+        }
+
+        ~SubmissionStore()
+        {
+            if (_writer.joinable())
+            {
+                {
+                    std::unique_lock<std::mutex> guard(_pendingLock);
+                    _stop = true;
+                }
+                _pendingCond.notify_all();
+                _writer.join();
+            }
+            if (_journalFd >= 0)
+                close(_journalFd);
+            if (_snapshotFd >= 0)
+                close(_snapshotFd);
+            if (_usersFd >= 0)
+                close(_usersFd);
+            if (_lockFd >= 0)
+                close(_lockFd);
+        }
+
+        SubmissionStore(const SubmissionStore &) = delete;
+        SubmissionStore &operator=(const SubmissionStore &) = delete;
+
+    public:
+        // 需要在Open之前设置，恢复出来的记录也会交给它
+        // 在存储的锁里调用，所有的记录按序号依次到达，同一时刻只有一个线程在调用
+        void SetListener(const std::function<void(const Submission &)> &listener)
+        {
+            _listener = listener;
+        }
+
+        // 打开存储，读快照和journal恢复索引
+        bool Open(const StoreOptions &options)
+        {
+            _options = options;
+            if (_options.path.empty() || _options.path.back() != '/')
+                _options.path += '/';
+            mkdir(_options.path.c_str(), 0755);
+
+            _lockFd = open((_options.path + "lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            _usersFd = open((_options.path + "users").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (_lockFd < 0 || _usersFd < 0)
+            {
+                Log(Error) << "打开提交记录的锁文件失败：" << _options.path << '\n';
+                return false;
+            }
+
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            flock(_lockFd, LOCK_EX);
+            bool isAlone = flock(_usersFd, LOCK_EX | LOCK_NB) == 0;
+            bool isOpen = Recover(isAlone);
+            flock(_usersFd, LOCK_SH);
+            flock(_lockFd, LOCK_UN);
+            if (!isOpen)
+                return false;
+
+            RegisterMetrics();
+            _writer = std::thread([this]()
+                                  { WriteRoutine(); });
+            Log(Normal) << "加载提交记录成功！共" << Count() << "条，用时"
+                        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count() << "毫秒" << '\n';
+            return true;
+        }
+
+        bool IsOpen() const
+        {
+            return _journalFd >= 0;
+        }
+
+        // 追加一条记录，不等待写入磁盘；记录的序号在写入之后才确定
+        void Append(const Submission &submission)
+        {
+            std::string frame;
+            RecordCodec::Encode(submission, &frame);
+            {
+                std::unique_lock<std::mutex> guard(_pendingLock);
+                _pending += frame;
+            }
+            _appends->Inc();
+            _pendingCond.notify_one();
+        }
+
+        void Query(const SubmissionQuery &query, std::vector<SubmissionPtr> *out)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            CatchUp();
+            _index.Query(query, out);
+        }
+
+        // 完整的一条记录，包括代码和判题结果，从磁盘上读出来
+        bool Get(uint64_t id, SubmissionPtr *out)
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            CatchUp();
+            RecordLocation location;
+            std::shared_ptr<Submission> submission = std::make_shared<Submission>();
+            if (!_index.Find(id, &location) || !ReadRecord(location, submission.get()))
+                return false;
+            submission->id = id;
+            *out = submission;
+            return true;
+        }
+
+        // 把其他工作进程新写入的记录读进索引，只是一次fstat，journal没有变长的时候什么也不做
+        void Refresh()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            CatchUp();
+        }
+
+        size_t Count()
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            CatchUp();
+            return _index.Count();
+        }
+
+        // 等待缓冲区中的记录都写入journal，用于退出之前和压测
+        void Flush()
+        {
+            std::unique_lock<std::mutex> guard(_pendingLock);
+            _pendingCond.wait(guard, [this]()
+                              { return (_pending.empty() && !_isWriting) || _stop; });
+        }
+
+    private:
+        bool Recover(bool isAlone)
+        {
+            uint64_t snapshotGeneration = 0;
+            if (!LoadSnapshot(&snapshotGeneration))
+                return false;
+
+            std::string journalPath = _options.path + "journal";
+            _journalFd = open(journalPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (_journalFd < 0)
+            {
+                Log(Error) << "打开提交记录的journal失败：" << journalPath << '\n';
+                return false;
+            }
+
+            // 新建的journal：代号接着快照往后排，快照中的记录都不在这个journal里
+            struct stat st;
+            fstat(_journalFd, &st);
+            if (st.st_size < static_cast<off_t>(JournalHeaderSize))
+            {
+                if (st.st_size > 0 && ftruncate(_journalFd, 0) != 0)
+                    return false;
+                if (!WriteJournalHeader(_journalFd, snapshotGeneration + 1))
+                    return false;
+            }
+            if (!ReadJournalHeader(_journalFd, &_generation))
+            {
+                Log(Error) << "提交记录的journal文件头不正确：" << journalPath << '\n';
+                return false;
+            }
+
+            // 快照包含了这个journal的一部分，从快照记下的位置往后读；否则快照只包含之前的journal，这个journal要从头读
+            _readOffset = _generation == snapshotGeneration ? _snapshotOffset : JournalHeaderSize;
+            if (_generation != snapshotGeneration)
+                _snapshotOffset = JournalHeaderSize;
+            if (_generation < snapshotGeneration)
+                Log(Warnning) << "提交记录的journal比快照旧，快照之后的记录可能已经丢失" << '\n';
+            CatchUp();
+
+            // 没有其他进程在用，journal中的记录都压缩进快照，换一个空的journal
+            if (isAlone && (_readOffset > JournalHeaderSize || !_readBuffer.empty()))
+                return Compact();
+            return true;
+        }
+
+        bool Compact()
+        {
+            if (!WriteSnapshot())
+                return false;
+
+            std::string journalPath = _options.path + "journal";
+            std::string tempPath = journalPath + ".tmp";
+            int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+            if (fd < 0 || !WriteJournalHeader(fd, _generation + 1) || fdatasync(fd) != 0 || rename(tempPath.c_str(), journalPath.c_str()) != 0)
+            {
+                Log(Error) << "更换提交记录的journal失败" << '\n';
+                if (fd >= 0)
+                    close(fd);
+                return false;
+            }
+            SyncDirectory();
+
+            close(_journalFd);
+            _journalFd = fd;
+            _generation++;
+            _readOffset = JournalHeaderSize;
+            _snapshotOffset = JournalHeaderSize;
+            _readBuffer.clear();
+            Log(Normal) << "提交记录已压缩进快照，新的journal代号为" << _generation << '\n';
+            return true;
+        }
+
+        // 把journal中新追加的记录读进索引，在_lock中调用
+        void CatchUp()
+        {
+            if (_journalFd < 0)
+                return;
+            struct stat st;
+            if (fstat(_journalFd, &st) != 0)
+                return;
+            uint64_t end = _readOffset + _readBuffer.size();
+            if (static_cast<uint64_t>(st.st_size) <= end)
+                return;
+
+            size_t oldSize = _readBuffer.size();
+            _readBuffer.resize(oldSize + (st.st_size - end));
+            ssize_t n = pread(_journalFd, &_readBuffer[oldSize], st.st_size - end, end);
+            _readBuffer.resize(oldSize + (n > 0 ? n : 0));
+
+            size_t offset = 0;
+            while (offset < _readBuffer.size())
+            {
+                Submission submission;
+                size_t consumed = 0;
+                RecordCodec::DecodeStatus status = RecordCodec::Decode(_readBuffer.data() + offset, _readBuffer.size() - offset, &consumed, &submission);
+                if (status == RecordCodec::DecodeIncomplete)
+                    break;
+                if (status == RecordCodec::DecodeCorrupt)
+                {
+                    // 上次崩溃时写了一半的记录，后面又接着追加了新的记录，跳到下一条记录的开头
+                    size_t next = RecordCodec::FindMagic(_readBuffer, offset + 1);
+                    Log(Warnning) << "提交记录的journal在" << _readOffset + offset << "处损坏，跳过" << next - offset << "字节" << '\n';
+                    _skippedBytes += next - offset;
+                    offset = next;
+                    continue;
+                }
+                _index.Add(&submission, RecordLocation{false, _readOffset + offset});
+                if (_listener)
+                    _listener(submission);
+                offset += consumed;
+            }
+            _readBuffer.erase(0, offset);
+            _readOffset += offset;
+        }
+
+        void WriteRoutine()
+        {
+            while (true)
+            {
+                std::string batch;
+                {
+                    std::unique_lock<std::mutex> guard(_pendingLock);
+                    _pendingCond.wait(guard, [this]()
+                                      { return _stop || !_pending.empty(); });
+                    if (_pending.empty())
+                        return;
+                    if (_options.commitIntervalMs > 0 && !_stop)
+                        _pendingCond.wait_for(guard, std::chrono::milliseconds(_options.commitIntervalMs), [this]()
+                                              { return _stop; });
+                    batch.swap(_pending);
+                    _isWriting = true;
+                }
+
+                {
+                    ScopedTimer timer(_commitLatency);
+                    size_t written = 0;
+                    while (written < batch.size())
+                    {
+                        ssize_t n = write(_journalFd, batch.data() + written, batch.size() - written);
+                        if (n <= 0)
+                        {
+                            Log(Error) << "写入提交记录失败，丢弃" << batch.size() - written << "字节" << '\n';
+                            break;
+                        }
+                        written += n;
+                    }
+                    if (_options.sync)
+                        fdatasync(_journalFd);
+                }
+                _commits->Inc();
+                {
+                    std::unique_lock<std::mutex> guard(_pendingLock);
+                    _isWriting = false;
+                }
+                // 通知等待Flush的线程
+                _pendingCond.notify_all();
+
+                bool isSnapshotDue = false;
+                {
+                    std::unique_lock<std::mutex> guard(_lock);
+                    CatchUp();
+                    isSnapshotDue = _readOffset - _snapshotOffset >= _options.snapshotBytes;
+                }
+                // 同一时刻只有一个进程写快照，拿不到锁说明别的进程正在写或者正在启动，下次再说
+                if (isSnapshotDue && flock(_lockFd, LOCK_EX | LOCK_NB) == 0)
+                {
+                    WriteSnapshot();
+                    flock(_lockFd, LOCK_UN);
+                }
+            }
+        }
+
+        // 写快照：先写临时文件，fdatasync之后改名，任何时候崩溃，磁盘上都是一个完整的快照
+        // 记录从它们现在的位置一条条读出来再写进去，写完之后索引中的位置都指向新的快照
+        // 只有写快照的线程会替换_snapshotFd，读旧的位置不需要拿着_lock
+        bool WriteSnapshot()
+        {
+            ScopedTimer timer(_snapshotLatency);
+            std::vector<RecordLocation> locations;
+            uint64_t generation, offset;
+            {
+                std::unique_lock<std::mutex> guard(_lock);
+                locations = _index.Locations();
+                generation = _generation;
+                offset = _readOffset;
+            }
+
+            std::string snapshotPath = _options.path + "snapshot";
+            std::string tempPath = snapshotPath + ".tmp";
+            int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (fd < 0)
+            {
+                Log(Error) << "创建提交记录的快照失败：" << tempPath << '\n';
+                return false;
+            }
+
+            std::string buffer;
+            buffer.resize(SnapshotHeaderSize);
+            uint64_t count = locations.size();
+            uint32_t magic = SnapshotMagic;
+            uint32_t version = 1;
+            memcpy(&buffer[0], &magic, 4);
+            memcpy(&buffer[4], &version, 4);
+            memcpy(&buffer[8], &generation, 8);
+            memcpy(&buffer[16], &offset, 8);
+            memcpy(&buffer[24], &count, 8);
+            uint64_t check = HashUtil::Hash(buffer.data(), 32);
+            memcpy(&buffer[32], &check, 8);
+
+            std::vector<uint64_t> offsets;
+            offsets.reserve(locations.size());
+            uint64_t flushed = 0; // buffer之前已经写进文件的字节数
+            bool isWritten = true;
+            for (size_t i = 0; i <= locations.size() && isWritten; i++)
+            {
+                if (i < locations.size())
+                {
+                    Submission submission;
+                    if (!ReadRecord(locations[i], &submission))
+                    {
+                        Log(Error) << "读取第" << i + 1 << "条提交记录失败，放弃这次快照" << '\n';
+                        isWritten = false;
+                        break;
+                    }
+                    offsets.push_back(flushed + buffer.size());
+                    RecordCodec::Encode(submission, &buffer);
+                }
+                if (buffer.size() >= (1 << 20) || i == locations.size())
+                {
+                    isWritten = WriteAll(fd, buffer);
+                    flushed += buffer.size();
+                    buffer.clear();
+                }
+            }
+            isWritten = isWritten && fdatasync(fd) == 0;
+            if (!isWritten || rename(tempPath.c_str(), snapshotPath.c_str()) != 0)
+            {
+                Log(Error) << "写入提交记录的快照失败" << '\n';
+                close(fd);
+                unlink(tempPath.c_str());
+                return false;
+            }
+            SyncDirectory();
+
+            std::unique_lock<std::mutex> guard(_lock);
+            if (generation == _generation)
+                _snapshotOffset = offset;
+            _index.MoveToSnapshot(offsets);
+            if (_snapshotFd >= 0)
+                close(_snapshotFd);
+            _snapshotFd = fd;
+            return true;
+        }
+
+        // 按位置读出一条完整的记录
+        bool ReadRecord(const RecordLocation &location, Submission *submission) const
+        {
+            int fd = location.inSnapshot ? _snapshotFd : _journalFd;
+            char header[RecordCodec::HeaderSize];
+            if (fd < 0 || pread(fd, header, sizeof(header), location.offset) != static_cast<ssize_t>(sizeof(header)))
+                return false;
+            uint32_t length;
+            memcpy(&length, header + 4, 4);
+            if (length > RecordCodec::MaxPayload)
+                return false;
+
+            std::string frame(RecordCodec::HeaderSize + length, '\0');
+            if (pread(fd, &frame[0], frame.size(), location.offset) != static_cast<ssize_t>(frame.size()))
+                return false;
+            size_t consumed = 0;
+            return RecordCodec::Decode(frame.data(), frame.size(), &consumed, submission) == RecordCodec::DecodeOk;
+        }
+
+        bool LoadSnapshot(uint64_t *generation)
+        {
+            std::string snapshotPath = _options.path + "snapshot";
+            if (!FileUtil::IsFileExist(snapshotPath))
+                return true;
+            // 快照可能有几百MB，映射之后直接在文件的内存上解码，不再拷贝一份
+            // 另外打开一个描述符，之后查看记录的时候从这里读；拿着lock的独占锁，这期间快照不会被替换
+            _snapshotFd = open(snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+            MappedFile content;
+            if (_snapshotFd < 0 || !content.Open(snapshotPath) || content.Size() < SnapshotHeaderSize)
+            {
+                Log(Error) << "读取提交记录的快照失败：" << snapshotPath << '\n';
+                return false;
+            }
+
+            uint32_t magic, version;
+            uint64_t offset, count, check;
+            const char *data = content.Data();
+            memcpy(&magic, data, 4);
+            memcpy(&version, data + 4, 4);
+            memcpy(generation, data + 8, 8);
+            memcpy(&offset, data + 16, 8);
+            memcpy(&count, data + 24, 8);
+            memcpy(&check, data + 32, 8);
+            if (magic != SnapshotMagic || version != 1 || check != HashUtil::Hash(data, 32))
+            {
+                Log(Error) << "提交记录的快照文件头不正确：" << snapshotPath << '\n';
+                return false;
+            }
+
+            size_t position = SnapshotHeaderSize;
+            for (uint64_t i = 0; i < count; i++)
+            {
+                Submission submission;
+                size_t consumed = 0;
+                if (RecordCodec::Decode(data + position, content.Size() - position, &consumed, &submission) != RecordCodec::DecodeOk)
+                {
+                    Log(Error) << "提交记录的快照在第" << i + 1 << "条记录处损坏" << '\n';
+                    return false;
+                }
+                _index.Add(&submission, RecordLocation{true, position});
+                if (_listener)
+                    _listener(submission);
+                position += consumed;
+            }
+            _snapshotOffset = offset;
+            return true;
+        }
+
+        static bool WriteJournalHeader(int fd, uint64_t generation)
+        {
+            std::string header(JournalHeaderSize, '\0');
+            uint32_t magic = JournalMagic;
+            uint32_t version = 1;
+            memcpy(&header[0], &magic, 4);
+            memcpy(&header[4], &version, 4);
+            memcpy(&header[8], &generation, 8);
+            return WriteAll(fd, header);
+        }
+
+        static bool ReadJournalHeader(int fd, uint64_t *generation)
+        {
+            char header[JournalHeaderSize];
+            if (pread(fd, header, JournalHeaderSize, 0) != static_cast<ssize_t>(JournalHeaderSize))
+                return false;
+            uint32_t magic, version;
+            memcpy(&magic, header, 4);
+            memcpy(&version, header + 4, 4);
+            memcpy(generation, header + 8, 8);
+            return magic == JournalMagic && version == 1;
+        }
+
+        static bool WriteAll(int fd, const std::string &data)
+        {
+            size_t written = 0;
+            while (written < data.size())
+            {
+                ssize_t n = write(fd, data.data() + written, data.size() - written);
+                if (n <= 0)
+                    return false;
+                written += n;
+            }
+            return true;
+        }
+
+        // 改名之后同步目录，保证断电之后改名的结果还在
+        void SyncDirectory()
+        {
+            int fd = open(_options.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            fsync(fd);
+            close(fd);
+        }
+
+        void RegisterMetrics()
+        {
+            Registry &registry = Registry::Instance();
+            registry.SetCallback("oj_store_records", "提交记录的条数", Registry::GaugeType, "", [this]()
+                                 { return static_cast<double>(Count()); });
+            registry.SetCallback("oj_store_journal_bytes", "journal读到的位置，快照之后的部分重启时需要重新读", Registry::GaugeType, "", [this]()
+                                 {
+                std::unique_lock<std::mutex> guard(_lock);
+                return static_cast<double>(_readOffset - _snapshotOffset); });
+            registry.SetCallback("oj_store_skipped_bytes", "journal中因为损坏而跳过的字节数", Registry::CounterType, "", [this]()
+                                 {
+                std::unique_lock<std::mutex> guard(_lock);
+                return static_cast<double>(_skippedBytes); });
+        }
+    };
+}
@@ -11,6 +11,7 @@
 namespace ns_OJ_view
 {
     using namespace ns_OJ_model;
+    using namespace ns_Util;
 
     const std::string TemplatePath = "./template_html/";
 
@@ -20,20 +21,62 @@ namespace ns_OJ_view
         View(){}
         ~View(){}
     public:
-        void AllExpandHtml(const std::vector<struct Question> &questions, std::string *html)
+        void AllExpandHtml(const QuestionPage &page, std::string *html)
         {
             // 题目的编号 题目的标题 题目的难度
             // 推荐使用表格显示
             // 1. 形成路径
             std::string src_html = TemplatePath + "AllQuestions.html";
-            // 2. 形成数字典
+            // 2. 形成数字典，只放本页的题目
             ctemplate::TemplateDictionary root("AllQuestions");
-            for (const auto& q : questions)
+            for (size_t i = 0; i < page.count; i++)
             {
+                const QuestionPtr &q = page.questions[i];
                 ctemplate::TemplateDictionary *sub = root.AddSectionDictionary("QuestionList");
-                sub->SetValue("id", q.id);
-                sub->SetValue("title", q.title);
-                sub->SetValue("star", q.star);
+                sub->SetValue("id", q->id);
+                sub->SetValue("title", q->title);
+                sub->SetValue("star", q->star);
+            }
+
+            // 2.1. 分页信息
+            const PageQuery &query = page.query;
+            root.SetIntValue("page", query.page);
+            root.SetIntValue("pages", page.pages);
+            root.SetIntValue("total", page.total);
+            if (query.page > 1)
+            {
+                PageQuery prev = query;
+                prev.page--;
+                root.AddSectionDictionary("PrevPage")->SetValue("url", PageUrl(prev));
+            }
+            if (query.page < page.pages)
+            {
+                PageQuery next = query;
+                next.page++;
+                root.AddSectionDictionary("NextPage")->SetValue("url", PageUrl(next));
+            }
+
+            // 2.2. 排序和难度筛选的链接，切换的时候回到第一页
+            PageQuery first = query;
+            first.page = 1;
+            const QuestionSort sorts[] = {SortById, SortByStar, SortByTitle};
+            for (QuestionSort sort : sorts)
+            {
+                PageQuery sorted = first;
+                sorted.sort = sort;
+                root.SetValue(std::string("sort_") + SortName(sort) + "_url", PageUrl(sorted));
+            }
+
+            PageQuery all = first;
+            all.star.clear();
+            root.SetValue("all_url", PageUrl(all));
+            for (const auto &star : page.bank->stars)
+            {
+                PageQuery filtered = first;
+                filtered.star = star;
+                ctemplate::TemplateDictionary *sub = root.AddSectionDictionary("StarFilter");
+                sub->SetValue("star_name", star);
+                sub->SetValue("star_url", PageUrl(filtered));
             }
 
             //3. 获取被渲染的html
@@ -42,6 +85,17 @@ namespace ns_OJ_view
             //4. 开始完成渲染功能
             tpl->Expand(html, &root);
         }
+        // 形成分页查询的链接
+        static std::string PageUrl(const PageQuery &query)
+        {
+            std::string url = "/AllQuestions?page=" + std::to_string(query.page) +
+                              "&size=" + std::to_string(query.size) +
+                              "&sort=" + SortName(query.sort);
+            if (!query.star.empty())
+                url += "&star=" + StringUtil::UrlEncode(query.star);
+            return url;
+        }
+
         void OneExpandHtml(const struct Question &q, std::string *html)
         {
             // 1. 形成路径
@@ -52,8 +106,9 @@ namespace ns_OJ_view
             root.SetValue("id", q.id);
             root.SetValue("title", q.title);
             root.SetValue("star", q.star);
-            root.SetValue("description", q.description);
-            root.SetValue("pre_code", q.header);
+            // 描述和预设代码是指向题库内存的string_view，直接交给ctemplate，不再拷贝一份
+            root.SetValue("description", ctemplate::TemplateString(q.description.data(), q.description.size()));
+            root.SetValue("pre_code", ctemplate::TemplateString(q.header.data(), q.header.size()));
 
             //3. 获取被渲染的html
             ctemplate::Template *tpl = ctemplate::Template::GetTemplate(src_html, ctemplate::DO_NOT_STRIP);
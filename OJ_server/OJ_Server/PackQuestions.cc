@@ -0,0 +1,41 @@
+#include <iostream>
+#include "OJ_model.hpp"
+
+using namespace ns_OJ_model;
+
+void Usage(const std::string proc)
+{
+    std::cerr<<"Usage:"<<"\n\t"<<proc<<" [题目目录，默认为"<<QuestionPath<<"]"<<std::endl;
+}
+
+// 把题目目录打包成一个二进制文件，放在题目目录下
+// ./PackQuestions ./questions/
+int main(int argc,char*argv[])
+{
+    if(argc>2)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    std::string questionPath = argc==2?argv[1]:QuestionPath;
+    if(questionPath.back()!='/')
+        questionPath+='/';
+
+    // 打包的数据来源永远是题目目录，而不是旧的打包文件
+    std::shared_ptr<QuestionBank> bank;
+    if(!Model::BuildLooseBank(questionPath,&bank))
+    {
+        std::cerr<<"读取题目目录失败"<<std::endl;
+        return 2;
+    }
+
+    if(!Model::WritePackedBank(*bank,questionPath+QuestionPackName))
+    {
+        std::cerr<<"写入打包文件失败"<<std::endl;
+        return 3;
+    }
+
+    std::cout<<"打包完成，共"<<bank->questionList.size()<<"道题目： "<<questionPath+QuestionPackName<<std::endl;
+    return 0;
+}